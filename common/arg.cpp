@@ -1552,7 +1552,7 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
             params.in_files.push_back(value);
         }
-    ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_BATCH_INFER}));
     add_opt(common_arg(
         {"-bf", "--binary-file"}, "FNAME",
         "binary file containing the prompt (default: none)",
@@ -2655,7 +2655,7 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) {
             params.out_file = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_CVECTOR_GENERATOR, LLAMA_EXAMPLE_EXPORT_LORA, LLAMA_EXAMPLE_TTS}));
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX, LLAMA_EXAMPLE_CVECTOR_GENERATOR, LLAMA_EXAMPLE_EXPORT_LORA, LLAMA_EXAMPLE_TTS, LLAMA_EXAMPLE_BATCH_INFER}));
     add_opt(common_arg(
         {"-ofreq", "--output-frequency"}, "N",
         string_format("output the imatrix every N iterations (default: %d)", params.n_out_freq),
@@ -2903,6 +2903,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.endpoint_metrics = true;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_ENDPOINT_METRICS"));
+    add_opt(common_arg(
+        {"--trace-file"}, "FNAME",
+        "write a Chrome trace (chrome://tracing, Perfetto) of the phases of the server main loop to FNAME (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.trace_file = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_TRACE_FILE"));
     add_opt(common_arg(
         {"--slots"},
         string_format("enable slots monitoring endpoint (default: %s)", params.endpoint_slots ? "enabled" : "disabled"),
@@ -2935,6 +2942,28 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--models-dir"}, "PATH",
+        "directory of additional models, each .gguf file is loaded on demand when a request uses its name (without extension) as \"model\" (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.models_dir = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_MODELS_DIR"));
+    add_opt(common_arg(
+        {"--models-budget"}, "N",
+        string_format("max size in MiB of the models loaded from --models-dir, weights and estimated KV cache, the least recently used idle models are unloaded above it (default: %d, 0 = unlimited)", params.models_budget),
+        [](common_params & params, int value) {
+            params.models_budget = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_MODELS_BUDGET"));
+    add_opt(common_arg(
+        {"--max-queued-tokens"}, "N",
+        string_format("max projected KV tokens (prompt + n_predict) of the tasks waiting for a slot, a new task is rejected with 503 above it; "
+                      "only the tasks with the same or a higher priority are counted (default: %d, 0 = unlimited)", params.n_queued_tokens_max),
+        [](common_params & params, int value) {
+            params.n_queued_tokens_max = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_MAX_QUEUED_TOKENS"));
     add_opt(common_arg(
         {"--jinja"},
         "use jinja template for chat (default: disabled)",
@@ -3346,6 +3375,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.vocoder.speaker_file = value;
         }
     ).set_examples({LLAMA_EXAMPLE_TTS}));
+    add_opt(common_arg(
+        {"--tts-stream-chunk"}, "N",
+        string_format("stream audio: run the vocoder every N generated codes and append the audio to the output file (default: %d, 0 = disabled)", params.vocoder.stream_chunk),
+        [](common_params & params, int value) {
+            params.vocoder.stream_chunk = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_TTS}));
 
     // model-specific
     add_opt(common_arg(
@@ -3532,6 +3568,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) { params.diffusion.add_gumbel_noise = std::stof(value); }
     ).set_examples({ LLAMA_EXAMPLE_DIFFUSION }));
 
+    add_opt(common_arg(
+        {"--sort-window"}, "N",
+        string_format("number of requests read and sorted by length together, the results are written in input order (default: %d)", params.n_sort_window),
+        [](common_params & params, int value) {
+            params.n_sort_window = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_BATCH_INFER}));
+
 
     return ctx_arg;
 }
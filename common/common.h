@@ -82,6 +82,7 @@ enum llama_example {
     LLAMA_EXAMPLE_PARALLEL,
     LLAMA_EXAMPLE_TTS,
     LLAMA_EXAMPLE_DIFFUSION,
+    LLAMA_EXAMPLE_BATCH_INFER,
 
     LLAMA_EXAMPLE_COUNT,
 };
@@ -218,6 +219,8 @@ struct common_params_vocoder {
     std::string speaker_file = ""; // speaker file path                                      // NOLINT
 
     bool use_guide_tokens = false; // enable guide tokens to improve TTS accuracy            // NOLINT
+
+    int32_t stream_chunk = 0; // number of codes per vocoder window when streaming audio (0 = disabled)
 };
 
 struct common_params_diffusion {
@@ -416,6 +419,12 @@ struct common_params {
     bool log_json = false;
 
     std::string slot_save_path;
+    std::string trace_file; // Chrome trace of the main loop of the server
+
+    std::string models_dir;          // additional models, loaded on demand by name
+    int32_t     models_budget  = 0;  // max size of the loaded additional models in MiB (0 = unlimited)
+
+    int32_t n_queued_tokens_max = 0; // max projected KV tokens of the queued tasks, the new tasks are rejected above it (0 = unlimited)
 
     float slot_prompt_similarity = 0.5f;
 
@@ -460,6 +469,9 @@ struct common_params {
     // batched-bench params
     bool batched_bench_output_jsonl = false;
 
+    // batch-infer params
+    int32_t n_sort_window = 4096; // number of requests read and sorted by length together
+
     // common params
     std::string out_file; // output filename for all example programs
     // optional callback for model loading progress and cancellation:
@@ -588,6 +600,9 @@ struct ggml_threadpool_params ggml_threadpool_params_from_cpu_params(const cpu_p
 // clear LoRA adapters from context, then apply new list of adapters
 void common_set_adapter_lora(struct llama_context * ctx, std::vector<common_adapter_lora_info> & lora);
 
+// same, for the tokens of the sequence seq_id only
+void common_set_adapter_lora_seq(struct llama_context * ctx, llama_seq_id seq_id, std::vector<common_adapter_lora_info> & lora);
+
 std::string                   get_model_endpoint();
 
 //
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// iterative mixed-radix complex FFT of a fixed size, used by the audio frontends (log-mel of mtmd, ISTFT of tts)
+//
+// the plan is built once per size: the input is loaded in digit-reversed order, then each stage combines p
+// sub-transforms of length l into one of length l*p in place. the twiddles of each stage are precomputed and the
+// data is kept as split re/im arrays, so that the butterflies are contiguous loops that the compiler can vectorize
+
+// scratch buffers of the FFT, one set per thread
+struct fft_work {
+    std::vector<float> re;
+    std::vector<float> im;
+    std::vector<float> tmp; // used by the generic radix butterfly
+};
+
+struct fft_plan {
+    int n;
+    int max_radix = 1;
+
+    std::vector<int> radices; // in execution order
+    std::vector<int> perm;    // perm[i] = input index loaded at position i
+
+    // per stage: tw[(q - 1)*l + j] = exp(-2*pi*i * j*q / (l*p)), for q in [1, p)
+    std::vector<std::vector<float>> tw_re;
+    std::vector<std::vector<float>> tw_im;
+
+    // per stage: exp(-2*pi*i * k / p), for the generic radix
+    std::vector<std::vector<float>> w_re;
+    std::vector<std::vector<float>> w_im;
+
+    explicit fft_plan(int n) : n(n) {
+        const double pi = 3.14159265358979323846;
+
+        // radix 4 first, it has the cheapest butterfly
+        int m = n;
+        while (m % 4 == 0) { radices.push_back(4); m /= 4; }
+        while (m % 2 == 0) { radices.push_back(2); m /= 2; }
+        for (int p = 3; m > 1; p += 2) {
+            while (m % p == 0) { radices.push_back(p); m /= p; }
+        }
+
+        perm.resize(n);
+        build_perm(perm.data(), n, 0, 1, (int) radices.size());
+
+        int l = 1;
+        for (int p : radices) {
+            max_radix = std::max(max_radix, p);
+
+            std::vector<float> twr((p - 1)*l);
+            std::vector<float> twi((p - 1)*l);
+            for (int q = 1; q < p; q++) {
+                for (int j = 0; j < l; j++) {
+                    const double theta = -2.0*pi*j*q/(l*p);
+                    twr[(q - 1)*l + j] = cos(theta);
+                    twi[(q - 1)*l + j] = sin(theta);
+                }
+            }
+            tw_re.push_back(std::move(twr));
+            tw_im.push_back(std::move(twi));
+
+            std::vector<float> wr(p);
+            std::vector<float> wi(p);
+            for (int k = 0; k < p; k++) {
+                wr[k] = cos(-2.0*pi*k/p);
+                wi[k] = sin(-2.0*pi*k/p);
+            }
+            w_re.push_back(std::move(wr));
+            w_im.push_back(std::move(wi));
+
+            l *= p;
+        }
+    }
+
+    // the last stage combines sub-transforms of the inputs x[offset + stride*(q + p*i)], stored one after another
+    void build_perm(int * out, int len, int offset, int stride, int n_stages) {
+        if (n_stages == 0) {
+            out[0] = offset;
+            return;
+        }
+        const int p = radices[n_stages - 1];
+        const int m = len / p;
+        for (int q = 0; q < p; q++) {
+            build_perm(out + q*m, m, offset + q*stride, stride*p, n_stages - 1);
+        }
+    }
+
+    // transform the complex input (in_re[k*stride], in_im[k*stride]), the result is left in work.re/work.im
+    void run(const float * in_re, const float * in_im, int stride, fft_work & work) const {
+        work.re.resize(n);
+        work.im.resize(n);
+        work.tmp.resize(2*max_radix);
+
+        float * xr = work.re.data();
+        float * xi = work.im.data();
+        for (int i = 0; i < n; i++) {
+            xr[i] = in_re[perm[i]*stride];
+            xi[i] = in_im[perm[i]*stride];
+        }
+
+        int l = 1;
+        for (size_t s = 0; s < radices.size(); s++) {
+            const int p = radices[s];
+            const float * twr = tw_re[s].data();
+            const float * twi = tw_im[s].data();
+            for (int b = 0; b < n; b += l*p) {
+                switch (p) {
+                    case 2:  butterfly_2(xr + b, xi + b, twr, twi, l); break;
+                    case 4:  butterfly_4(xr + b, xi + b, twr, twi, l); break;
+                    default: butterfly_generic(xr + b, xi + b, twr, twi, l, p, w_re[s].data(), w_im[s].data(), work.tmp.data()); break;
+                }
+            }
+            l *= p;
+        }
+    }
+
+    // radix-2 butterflies of p = 2 sub-transforms of length l, x points to the start of the block
+    static void butterfly_2(float * xr, float * xi, const float * twr, const float * twi, int l) {
+        for (int j = 0; j < l; j++) {
+            const float br = xr[j + l]*twr[j] - xi[j + l]*twi[j];
+            const float bi = xr[j + l]*twi[j] + xi[j + l]*twr[j];
+
+            const float ar = xr[j];
+            const float ai = xi[j];
+
+            xr[j]     = ar + br;
+            xi[j]     = ai + bi;
+            xr[j + l] = ar - br;
+            xi[j + l] = ai - bi;
+        }
+    }
+
+    static void butterfly_4(float * xr, float * xi, const float * twr, const float * twi, int l) {
+        for (int j = 0; j < l; j++) {
+            const float a0r = xr[j];
+            const float a0i = xi[j];
+            const float a1r = xr[j + 1*l]*twr[j + 0*l] - xi[j + 1*l]*twi[j + 0*l];
+            const float a1i = xr[j + 1*l]*twi[j + 0*l] + xi[j + 1*l]*twr[j + 0*l];
+            const float a2r = xr[j + 2*l]*twr[j + 1*l] - xi[j + 2*l]*twi[j + 1*l];
+            const float a2i = xr[j + 2*l]*twi[j + 1*l] + xi[j + 2*l]*twr[j + 1*l];
+            const float a3r = xr[j + 3*l]*twr[j + 2*l] - xi[j + 3*l]*twi[j + 2*l];
+            const float a3i = xr[j + 3*l]*twi[j + 2*l] + xi[j + 3*l]*twr[j + 2*l];
+
+            const float t0r = a0r + a2r;
+            const float t0i = a0i + a2i;
+            const float t1r = a0r - a2r;
+            const float t1i = a0i - a2i;
+            const float t2r = a1r + a3r;
+            const float t2i = a1i + a3i;
+            const float t3r = a1r - a3r;
+            const float t3i = a1i - a3i;
+
+            xr[j]       = t0r + t2r;
+            xi[j]       = t0i + t2i;
+            xr[j + 1*l] = t1r + t3i; // t1 - i*t3
+            xi[j + 1*l] = t1i - t3r;
+            xr[j + 2*l] = t0r - t2r;
+            xi[j + 2*l] = t0i - t2i;
+            xr[j + 3*l] = t1r - t3i; // t1 + i*t3
+            xi[j + 3*l] = t1i + t3r;
+        }
+    }
+
+    // any other radix, as a naive DFT of the p twiddled inputs
+    static void butterfly_generic(float * xr, float * xi, const float * twr, const float * twi, int l, int p,
+                                  const float * wr, const float * wi, float * tmp) {
+        float * ar = tmp;
+        float * ai = tmp + p;
+        for (int j = 0; j < l; j++) {
+            ar[0] = xr[j];
+            ai[0] = xi[j];
+            for (int q = 1; q < p; q++) {
+                const float w_r = twr[(q - 1)*l + j];
+                const float w_i = twi[(q - 1)*l + j];
+                ar[q] = xr[j + q*l]*w_r - xi[j + q*l]*w_i;
+                ai[q] = xr[j + q*l]*w_i + xi[j + q*l]*w_r;
+            }
+            for (int t = 0; t < p; t++) {
+                float yr = 0.0f;
+                float yi = 0.0f;
+                for (int q = 0; q < p; q++) {
+                    const int k = (t*q) % p;
+                    yr += ar[q]*wr[k] - ai[q]*wi[k];
+                    yi += ar[q]*wi[k] + ai[q]*wr[k];
+                }
+                xr[j + t*l] = yr;
+                xi[j + t*l] = yi;
+            }
+        }
+    }
+};
@@ -70,6 +70,15 @@ extern "C" {
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_BACKEND_API enum ggml_status  ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
 
+    // mul_mat autotuning
+    // benchmarks the chunking and tiling candidates for the MUL_MAT shapes of the graph that were not tuned yet,
+    // and caches the fastest configuration per shape, to be used by the following ggml_graph_compute() calls
+    // the graph is not modified, and the graphs computed by other threads meanwhile use the configurations tuned before they started
+    // the CPU backend does this automatically when GGML_CPU_MUL_MAT_TUNE is set to the path of a cache file
+    GGML_BACKEND_API void ggml_cpu_mul_mat_tune_graph(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool /* = NULL */);
+    GGML_BACKEND_API bool ggml_cpu_mul_mat_tune_load (const char * fname);
+    GGML_BACKEND_API bool ggml_cpu_mul_mat_tune_save (const char * fname);
+
     //
     // system info
     //
@@ -88,6 +97,7 @@ extern "C" {
     GGML_BACKEND_API int ggml_cpu_has_avx512_vnni(void);
     GGML_BACKEND_API int ggml_cpu_has_avx512_bf16(void);
     GGML_BACKEND_API int ggml_cpu_has_amx_int8   (void);
+    GGML_BACKEND_API int ggml_cpu_has_amx_bf16   (void);
     // ARM
     GGML_BACKEND_API int ggml_cpu_has_neon       (void);
     GGML_BACKEND_API int ggml_cpu_has_arm_fma    (void);
@@ -134,6 +144,16 @@ extern "C" {
 
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
+    // Weights stored in the layout the CPU backend repacks them into, functions obtained with ggml_backend_reg_get_proc_address
+    // Layout of a weight: (type << 16) | (interleaved rows << 8) | interleaved block length, 0 if it is not repacked
+    typedef uint32_t                   (*ggml_backend_cpu_repack_layout_t)(const struct ggml_tensor * tensor);
+    // Convert the data of a weight into its repacked layout
+    typedef bool                       (*ggml_backend_cpu_repack_tensor_t)(const struct ggml_tensor * tensor, void * dst, const void * src, size_t size);
+    // Buffer type for weights whose data is already in the repacked layout, it is used as is
+    typedef ggml_backend_buffer_type_t (*ggml_backend_cpu_prepacked_buffer_type_t)(void);
+    // Buffer of that type over existing memory, e.g. a memory-mapped model file
+    typedef ggml_backend_buffer_t      (*ggml_backend_cpu_prepacked_buffer_from_ptr_t)(void * ptr, size_t size);
+
     GGML_BACKEND_API void ggml_cpu_fp32_to_fp32(const float *,       float *, int64_t);
     GGML_BACKEND_API void ggml_cpu_fp32_to_fp16(const float *, ggml_fp16_t *, int64_t);
     GGML_BACKEND_API void ggml_cpu_fp16_to_fp32(const ggml_fp16_t *, float *, int64_t);
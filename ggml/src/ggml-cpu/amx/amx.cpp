@@ -21,8 +21,8 @@
 // AMX type_trais
 namespace ggml::cpu::amx {
 class tensor_traits : public ggml::cpu::tensor_traits {
-    bool work_size(int /* n_threads */, const struct ggml_tensor * op, size_t & size) override {
-        size = ggml_backend_amx_desired_wsize(op);
+    bool work_size(int n_threads, const struct ggml_tensor * op, size_t & size) override {
+        size = ggml_backend_amx_desired_wsize(n_threads, op);
         return true;
     }
 
@@ -150,7 +150,8 @@ class extra_buffer_type : ggml::cpu::extra_buffer_type {
             is_contiguous_2d(op->src[1]) &&                               // src1 must be contiguous
             op->src[0]->buffer && op->src[0]->buffer->buft == ggml_backend_amx_buffer_type() &&
             op->ne[0] % (TILE_N * 2) == 0 &&                              // out_features is 32x
-            (qtype_has_amx_kernels(op->src[0]->type) || (op->src[0]->type == GGML_TYPE_F16))) {
+            (qtype_has_amx_kernels(op->src[0]->type) || ftype_has_amx_kernels(op->src[0]->type)) &&
+            (op->src[0]->type != GGML_TYPE_BF16 || op->src[0]->ne[0] % 32 == 0)) { // bf16 kernels handle 32 k at a time
             // src1 must be host buffer
             if (op->src[1]->buffer && !ggml_backend_buft_is_host(op->src[1]->buffer->buft)) {
                 return false;
@@ -78,6 +78,15 @@ inline void parallel_for_ggml(const ggml_compute_params * params, int n, const f
     f(tbegin, tend);
 }
 
+// floating point types that have AMX support, f16 falls back to avx512 without AMX-BF16
+inline bool ftype_has_amx_kernels(const enum ggml_type type) {
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+    return (type == GGML_TYPE_F16) || (type == GGML_TYPE_BF16);
+#else
+    return (type == GGML_TYPE_F16);
+#endif
+}
+
 // quantized types that have AMX support
 inline bool qtype_has_amx_kernels(const enum ggml_type type) {
     // TODO: fix padding for vnni format
@@ -202,35 +202,36 @@ struct tile_config_t{
 //    advanced-matrix-extensions-intrinsics-functions.html
 //
 
+// kernels with different tile shapes share the tile registers of a thread,
+// so the config is reloaded whenever the kernel that runs next needs another one
+enum tile_config_id {
+    TILE_CONFIG_NONE,
+    TILE_CONFIG_INT8,
+    TILE_CONFIG_BF16,
+};
+
+static thread_local tile_config_id tile_config_loaded = TILE_CONFIG_NONE;
+
 #define TC_CONFIG_TILE(i, r, cb) tc.rows[i] = r; tc.colsb[i] = cb
 void ggml_tile_config_init(void) {
-    static thread_local bool is_first_time = true;
-
-    if (!is_first_time) {
+    if (tile_config_loaded == TILE_CONFIG_INT8) {
         return;
     }
 
-    static thread_local tile_config_t tc;
-    tile_config_t current_tc;
-    _tile_storeconfig(&current_tc);
-
-    // load only when config changes
-    if (tc.palette_id == 0 || (memcmp(&current_tc.colsb, &tc.colsb, sizeof(uint16_t) * 8) != 0 &&
-                               memcmp(&current_tc.rows, &tc.rows, sizeof(uint8_t) * 8) != 0)) {
-        tc.palette_id = 1;
-        tc.start_row = 0;
-        TC_CONFIG_TILE(TMM0, 8, 64);
-        TC_CONFIG_TILE(TMM1, 8, 64);
-        TC_CONFIG_TILE(TMM2, 16, 32);
-        TC_CONFIG_TILE(TMM3, 16, 32);
-        TC_CONFIG_TILE(TMM4, 16, 64);
-        TC_CONFIG_TILE(TMM5, 16, 64);
-        TC_CONFIG_TILE(TMM6, 16, 64);
-        TC_CONFIG_TILE(TMM7, 16, 64);
-        _tile_loadconfig(&tc);
-    }
-
-    is_first_time = false;
+    tile_config_t tc;
+    tc.palette_id = 1;
+    tc.start_row = 0;
+    TC_CONFIG_TILE(TMM0, 8, 64);
+    TC_CONFIG_TILE(TMM1, 8, 64);
+    TC_CONFIG_TILE(TMM2, 16, 32);
+    TC_CONFIG_TILE(TMM3, 16, 32);
+    TC_CONFIG_TILE(TMM4, 16, 64);
+    TC_CONFIG_TILE(TMM5, 16, 64);
+    TC_CONFIG_TILE(TMM6, 16, 64);
+    TC_CONFIG_TILE(TMM7, 16, 64);
+    _tile_loadconfig(&tc);
+
+    tile_config_loaded = TILE_CONFIG_INT8;
 }
 
 // we need an extra 16 * 4B (TILE_N * int32_t) for each NB/KB block for compensation.
@@ -1368,9 +1369,53 @@ struct tinygemm_kernel_avx<float, ggml_fp16_t, float, BLOCK_M, BLOCK_N, BLOCK_K>
     }
 };
 
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+template <int BLOCK_M, int BLOCK_N, int BLOCK_K>
+struct tinygemm_kernel_avx<ggml_bf16_t, ggml_bf16_t, float, BLOCK_M, BLOCK_N, BLOCK_K> {
+    static void apply(int K, const ggml_bf16_t * RESTRICT A, const ggml_bf16_t * RESTRICT B, float * RESTRICT C, int ldc) {
+        constexpr int ROWS = BLOCK_M;
+        constexpr int COLS = BLOCK_N;
+        assert(BLOCK_K == 32);
+
+        __m512bh va;
+        __m512bh vb[COLS];
+        __m512 vc[ROWS * COLS];
+
+        auto loadc = [&](auto idx) {
+            vc[idx] = _mm512_setzero_ps();
+        };
+        Unroll<ROWS * COLS>{}(loadc);
+
+        auto compute = [&](auto idx, auto k) {
+            constexpr int row = idx / COLS;
+            constexpr int col = idx % COLS;
+
+            if constexpr (col == 0) {
+                va = (__m512bh) _mm512_loadu_si512(A + row * K + k);
+            }
+            if constexpr (row == 0) {
+                vb[col] = (__m512bh) _mm512_loadu_si512(B + col * K + k);
+            }
+            vc[idx] = _mm512_dpbf16_ps(vc[idx], va, vb[col]);
+        };
+
+        for (int k = 0; k < K; k += 32) {
+            Unroll<ROWS * COLS>{}(compute, k);
+        }
+
+        auto storec = [&](auto idx) {
+            constexpr int row = idx / COLS;
+            constexpr int col = idx % COLS;
+            C[row * ldc + col] = _mm512_reduce_add_ps(vc[idx]);
+        };
+        Unroll<ROWS * COLS>{}(storec);
+    }
+};
+#endif
+
 #define LAUNCH_TINYGEMM_KERNEL_AVX(MB_SIZE, NB_SIZE)                                \
-    tinygemm_kernel_avx<float, type, float, MB_SIZE, NB_SIZE, blck_size>::apply(    \
-        K, (const float *)src1->data + mb_start * K,                                \
+    tinygemm_kernel_avx<act_type, type, float, MB_SIZE, NB_SIZE, blck_size>::apply( \
+        K, A + mb_start * K,                                                        \
         (const type *)src0->data + nb_start * K,                                    \
         (float *)dst->data + mb_start * ldc + nb_start, ldc);
 
@@ -2297,6 +2342,207 @@ void tinygemm_kernel_amx(int M, int N, int KB, const void * RESTRICT _A, const v
     return;
 }
 
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+
+// Notes: floating point gemm with AMX-BF16
+//
+// TMUL calculates A {16, 32} and B {32, 16} containing BF16 values and accumulates the result
+// to C {16, 16} containing FP32 values, B in vnni format {16, 16, 2}:
+//             A    B    C
+//    rows    16   16   16
+//    colsb   64   64   64
+//
+// The weights are kept in their original layout. Each thread packs a strip of 2 * TILE_N
+// output features over the whole K to vnni format, and multiplies it with all the rows of A
+// using the same 2-2-4 tile pattern as the int8 kernels, so each strip is packed only once.
+//
+// F16 values are split in two BF16 values, x = hi + lo, which is exact for F16 weights.
+// A is split the same way and hi * hi + hi * lo + lo * hi is accumulated, which is at least
+// as precise as the F16 vec_dot path, where A is rounded to F16. Since this takes 3 times
+// the tile products, F16 only goes through AMX once a block of 2 * TILE_M rows is filled.
+//
+// A is converted once to tile format, so the tile loads are contiguous for any K.
+//
+
+#define TILE_K_BF16 32
+
+// bytes of a packed B tile
+#define TILE_SIZE_BF16 (TILE_K_BF16 * TILE_N * sizeof(ggml_bf16_t))
+
+void ggml_tile_config_init_bf16(void) {
+    if (tile_config_loaded == TILE_CONFIG_BF16) {
+        return;
+    }
+
+    tile_config_t tc;
+    tc.palette_id = 1;
+    tc.start_row = 0;
+    for (int i = TMM0; i <= TMM7; ++i) {
+        TC_CONFIG_TILE(i, 16, 64);
+    }
+    _tile_loadconfig(&tc);
+
+    tile_config_loaded = TILE_CONFIG_BF16;
+}
+
+inline __m512i bf16_to_fp32_bits(__m256i x) {
+    return _mm512_slli_epi32(_mm512_cvtepu16_epi32(x), 16);
+}
+
+// split 32 floats in hi + lo bf16 values
+inline void split_bf16(__m512 x0, __m512 x1, __m512i & hi, __m512i & lo) {
+    hi = (__m512i) _mm512_cvtne2ps_pbh(x1, x0);
+
+    const __m512 h0 = _mm512_castsi512_ps(bf16_to_fp32_bits(_mm512_castsi512_si256(hi)));
+    const __m512 h1 = _mm512_castsi512_ps(bf16_to_fp32_bits(_mm512_extracti64x4_epi64(hi, 1)));
+
+    lo = (__m512i) _mm512_cvtne2ps_pbh(_mm512_sub_ps(x1, h1), _mm512_sub_ps(x0, h0));
+}
+
+// convert row m of A to bf16 in tile format {M / TILE_M, KB, TILE_M, TILE_K_BF16},
+// so the tiles are loaded from contiguous memory. lo is only used for f16 weights
+inline void convert_A_bf16(ggml_bf16_t * RESTRICT hi, ggml_bf16_t * RESTRICT lo, const float * RESTRICT x, int m, int K) {
+    const int KB = K / TILE_K_BF16;
+    const size_t offset = ((size_t) (m / TILE_M) * KB * TILE_M + m % TILE_M) * TILE_K_BF16;
+
+    for (int kb = 0; kb < KB; ++kb) {
+        const size_t idx = offset + (size_t) kb * TILE_M * TILE_K_BF16;
+        if (x == nullptr) {
+            // padding rows
+            _mm512_storeu_si512(hi + idx, _mm512_setzero_si512());
+            if (lo) {
+                _mm512_storeu_si512(lo + idx, _mm512_setzero_si512());
+            }
+            continue;
+        }
+        const __m512 x0 = _mm512_loadu_ps(x + kb * TILE_K_BF16);
+        const __m512 x1 = _mm512_loadu_ps(x + kb * TILE_K_BF16 + 16);
+        if (lo) {
+            __m512i vhi, vlo;
+            split_bf16(x0, x1, vhi, vlo);
+            _mm512_storeu_si512(hi + idx, vhi);
+            _mm512_storeu_si512(lo + idx, vlo);
+        } else {
+            _mm512_storeu_si512(hi + idx, (__m512i) _mm512_cvtne2ps_pbh(x1, x0));
+        }
+    }
+}
+
+// pack the 32 x K block of B starting at row n0 to vnni format: {KB, 2, TILE_K_BF16 / 2, TILE_N, 2}
+template <typename TB>
+void pack_B_strip_bf16(ggml_bf16_t * RESTRICT hi, ggml_bf16_t * RESTRICT lo, const TB * RESTRICT B, int n0, int K) {
+    const int KB = K / TILE_K_BF16;
+
+    for (int kb = 0; kb < KB; ++kb) {
+        for (int t = 0; t < 2; ++t) {
+            __m512i vhi[TILE_N];
+            __m512i vlo[TILE_N];
+
+            // each row of B is 16 pairs of k values, the transpose gives the 16 columns of a vnni row
+            for (int n = 0; n < TILE_N; ++n) {
+                const TB * b = B + (int64_t) (n0 + t * TILE_N + n) * K + kb * TILE_K_BF16;
+                if constexpr (std::is_same<TB, ggml_bf16_t>::value) {
+                    vhi[n] = _mm512_loadu_si512(b);
+                } else {
+                    const __m512 x0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) b));
+                    const __m512 x1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (b + 16)));
+                    split_bf16(x0, x1, vhi[n], vlo[n]);
+                }
+            }
+
+            const size_t offset = (kb * 2 + t) * TILE_SIZE_BF16 / sizeof(ggml_bf16_t);
+
+            transpose_16x16_32bit(vhi);
+            for (int r = 0; r < TILE_K_BF16 / 2; ++r) {
+                _mm512_storeu_si512(hi + offset + r * TILE_N * 2, vhi[r]);
+            }
+            if constexpr (!std::is_same<TB, ggml_bf16_t>::value) {
+                transpose_16x16_32bit(vlo);
+                for (int r = 0; r < TILE_K_BF16 / 2; ++r) {
+                    _mm512_storeu_si512(lo + offset + r * TILE_N * 2, vlo[r]);
+                }
+            }
+        }
+    }
+}
+
+// C {M, 2 * TILE_N} = A {M, K} * packed B strip, M <= 2 * TILE_M
+// A points to the first of 2 row tiles (padded with zeros), B_lo and A_lo are used for f16 weights
+void tinygemm_kernel_amx_bf16(int M, int K,
+        const ggml_bf16_t * RESTRICT A_hi, const ggml_bf16_t * RESTRICT A_lo,
+        const ggml_bf16_t * RESTRICT B_hi, const ggml_bf16_t * RESTRICT B_lo,
+        float * RESTRICT C, int ldc) {
+    const int KB = K / TILE_K_BF16;
+    const int m0 = std::min(M, TILE_M);
+    const int m1 = std::max(M - TILE_M, 0);
+
+    constexpr int TILE_ELEMS = TILE_SIZE_BF16 / sizeof(ggml_bf16_t);
+    constexpr int STRIDE = TILE_K_BF16 * sizeof(ggml_bf16_t);
+
+    _tile_zero(TMM0);
+    _tile_zero(TMM1);
+    _tile_zero(TMM2);
+    _tile_zero(TMM3);
+
+    auto load_A = [&](const ggml_bf16_t * A, int kb) {
+        _tile_loadd(TMM4, A + (size_t) kb * TILE_ELEMS, STRIDE);
+        if (m1 > 0) {
+            _tile_loadd(TMM5, A + (size_t) (KB + kb) * TILE_ELEMS, STRIDE);
+        }
+    };
+
+    auto load_B = [&](const ggml_bf16_t * B, int kb) {
+        _tile_loadd(TMM6, B + (size_t) (kb * 2 + 0) * TILE_ELEMS, STRIDE);
+        _tile_loadd(TMM7, B + (size_t) (kb * 2 + 1) * TILE_ELEMS, STRIDE);
+    };
+
+    auto dp = [&]() {
+        _tile_dpbf16ps(TMM0, TMM4, TMM6);
+        _tile_dpbf16ps(TMM1, TMM4, TMM7);
+        if (m1 > 0) {
+            _tile_dpbf16ps(TMM2, TMM5, TMM6);
+            _tile_dpbf16ps(TMM3, TMM5, TMM7);
+        }
+    };
+
+    for (int kb = 0; kb < KB; ++kb) {
+        load_A(A_hi, kb);
+        load_B(B_hi, kb);
+        dp();
+        if (B_lo) {
+            load_B(B_lo, kb);
+            dp();
+            load_A(A_lo, kb);
+            load_B(B_hi, kb);
+            dp();
+        }
+    }
+
+    // partial tiles go through a temporary buffer
+    alignas(64) float Tile[TILE_M * TILE_N];
+
+#define STORE_TILE_BF16(TMM, c, nr)                                         \
+    if ((nr) == TILE_M) {                                                   \
+        _tile_stored(TMM, c, ldc * sizeof(float));                          \
+    } else {                                                                \
+        _tile_stored(TMM, Tile, TILE_N * sizeof(float));                    \
+        for (int m = 0; m < (nr); ++m) {                                    \
+            memcpy((c) + m * ldc, Tile + m * TILE_N, TILE_N * sizeof(float)); \
+        }                                                                   \
+    }
+
+    STORE_TILE_BF16(TMM0, C,          m0);
+    STORE_TILE_BF16(TMM1, C + TILE_N, m0);
+    if (m1 > 0) {
+        STORE_TILE_BF16(TMM2, C + TILE_M * ldc,          m1);
+        STORE_TILE_BF16(TMM3, C + TILE_M * ldc + TILE_N, m1);
+    }
+
+#undef STORE_TILE_BF16
+}
+
+#endif // defined(__AMX_BF16__) && defined(__AVX512BF16__)
+
 } // anonymous namespace
 
 // get the packed tensor size for quantized weights
@@ -2336,19 +2582,37 @@ void ggml_backend_amx_convert_weight(struct ggml_tensor * tensor, const void * d
     });
 }
 
-size_t ggml_backend_amx_desired_wsize(const struct ggml_tensor * dst) {
+// floating point weights use AMX-BF16 when there are enough rows to fill the tiles,
+// smaller batches use the avx512 kernels
+static bool use_amx_bf16(const struct ggml_tensor * dst) {
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+    const int min_m = dst->src[0]->type == GGML_TYPE_F16 ? 2 * TILE_M : TILE_M;
+    return dst->ne[1] >= min_m && dst->src[0]->ne[0] % TILE_K_BF16 == 0;
+#else
+    GGML_UNUSED(dst);
+    return false;
+#endif
+}
+
+size_t ggml_backend_amx_desired_wsize(int n_threads, const struct ggml_tensor * dst) {
     struct ggml_tensor * src0 = dst->src[0];
 
     const enum ggml_type TYPE = src0->type;
 
-    const bool is_floating_type = TYPE == GGML_TYPE_F16;
-    if (is_floating_type) {
-        return 0;
-    }
-
     const int M = dst->ne[1];
     const int K = src0->ne[0];
 
+    const bool is_floating_type = TYPE == GGML_TYPE_F16 || TYPE == GGML_TYPE_BF16;
+    if (is_floating_type) {
+        if (use_amx_bf16(dst)) {
+            // A converted to bf16, padded to full tiles, and a packed strip of B for each thread
+            const size_t n_planes = TYPE == GGML_TYPE_F16 ? 2 : 1;
+            return n_planes * K * sizeof(ggml_bf16_t) * (GGML_PAD(M, 2 * TILE_M) + 2 * TILE_N * n_threads);
+        }
+        // A converted to bf16 for the avx512-bf16 kernels
+        return TYPE == GGML_TYPE_BF16 ? (size_t) M * K * sizeof(ggml_bf16_t) : 0;
+    }
+
     size_t desired_wsize = 0;
 
     GGML_DISPATCH_QTYPES(TYPE, [&] {
@@ -2373,9 +2637,7 @@ void ggml_backend_amx_mul_mat(const ggml_compute_params * params, struct ggml_te
 
     const enum ggml_type TYPE = src0->type;
 
-    // f16 only has avx512 kernels for now,
-    // amx kernels will be added once 6th gen xeon is released.
-    const bool is_floating_type = TYPE == GGML_TYPE_F16;
+    const bool is_floating_type = TYPE == GGML_TYPE_F16 || TYPE == GGML_TYPE_BF16;
 
     const int M = dst->ne[1];
     const int N = dst->ne[0];
@@ -2383,6 +2645,65 @@ void ggml_backend_amx_mul_mat(const ggml_compute_params * params, struct ggml_te
     const int ldc = dst->nb[1] / dst->nb[0];
 
     if (is_floating_type) {
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+        if (use_amx_bf16(dst)) {
+            const int ith = params->ith;
+            const int nth = params->nth;
+
+            const int M_pad = GGML_PAD(M, 2 * TILE_M);
+            const int n_planes = TYPE == GGML_TYPE_F16 ? 2 : 1;
+
+            ggml_bf16_t * A_hi = (ggml_bf16_t *) params->wdata;
+            ggml_bf16_t * A_lo = n_planes == 2 ? A_hi + (size_t) M_pad * K : nullptr;
+            ggml_bf16_t * B_hi = A_hi + (size_t) n_planes * M_pad * K + (size_t) ith * n_planes * 2 * TILE_N * K;
+            ggml_bf16_t * B_lo = n_planes == 2 ? B_hi + (size_t) 2 * TILE_N * K : nullptr;
+
+            const float * A_data = (const float *) src1->data;
+            for (int m = ith; m < M_pad; m += nth) {
+                convert_A_bf16(A_hi, A_lo, m < M ? A_data + (size_t) m * K : nullptr, m, K);
+            }
+
+            ggml_barrier(params->threadpool);
+
+            // one strip of 2 tiles of B for each work item, multiplied by all of A
+            constexpr int BLOCK_M = TILE_M * 2;
+            constexpr int BLOCK_N = TILE_N * 2;
+            const int NB = N / BLOCK_N;
+
+            parallel_for_ggml(params, NB, [&](int begin, int end) {
+                ggml_tile_config_init_bf16();
+
+                for (int nb = begin; nb < end; ++nb) {
+                    if (TYPE == GGML_TYPE_F16) {
+                        pack_B_strip_bf16(B_hi, B_lo, (const ggml_fp16_t *) src0->data, nb * BLOCK_N, K);
+                    } else {
+                        pack_B_strip_bf16(B_hi, B_lo, (const ggml_bf16_t *) src0->data, nb * BLOCK_N, K);
+                    }
+
+                    for (int mb_start = 0; mb_start < M; mb_start += BLOCK_M) {
+                        tinygemm_kernel_amx_bf16(std::min(BLOCK_M, M - mb_start), K,
+                            A_hi + (size_t) mb_start * K, A_lo ? A_lo + (size_t) mb_start * K : nullptr,
+                            B_hi, B_lo,
+                            (float *) dst->data + mb_start * ldc + nb * BLOCK_N, ldc);
+                    }
+                }
+            });
+            return;
+        }
+
+        if (TYPE == GGML_TYPE_BF16) {
+            ggml_bf16_t * A = (ggml_bf16_t *) params->wdata;
+            for (int m = params->ith; m < M; m += params->nth) {
+                const float * x = (const float *) src1->data + (size_t) m * K;
+                for (int k = 0; k < K; k += 32) {
+                    _mm512_storeu_si512(A + (size_t) m * K + k, (__m512i) _mm512_cvtne2ps_pbh(_mm512_loadu_ps(x + k + 16), _mm512_loadu_ps(x + k)));
+                }
+            }
+
+            ggml_barrier(params->threadpool);
+        }
+#endif
+
         constexpr int BLOCK_M = 4;
         constexpr int BLOCK_N = 6;
         const int MB = div_up(M, BLOCK_M);
@@ -2390,6 +2711,10 @@ void ggml_backend_amx_mul_mat(const ggml_compute_params * params, struct ggml_te
 
         parallel_for_ggml(params, MB * NB, [&](int begin, int end) {
             GGML_DISPATCH_FLOATING_TYPES(TYPE, [&] {
+                // bf16 weights are multiplied with A converted to bf16, f16 weights with A in f32
+                using act_type = typename std::conditional<std::is_same<type, ggml_bf16_t>::value, ggml_bf16_t, float>::type;
+                const act_type * A = std::is_same<type, ggml_bf16_t>::value ? (const act_type *) params->wdata : (const act_type *) src1->data;
+
                 for (int i = begin; i < end; ++i) {
                     int mb = i / NB;
                     int nb = i % NB;
@@ -318,6 +318,10 @@ static int ggml_backend_cpu_x86_score() {
     if (!is.AMX_INT8()) { return 0; }
     score += 1<<11;
 #endif
+#ifdef GGML_AMX_BF16
+    if (!is.AMX_BF16()) { return 0; }
+    score += 1<<12;
+#endif
 
     return score;
 }
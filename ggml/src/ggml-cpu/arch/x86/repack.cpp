@@ -6246,3 +6246,784 @@ void ggml_gemm_q2_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
 
 #endif
 }
+
+#if defined(__AVX2__)
+// broadcast 8 consecutive int8 activations over a 256 bit vector
+static inline __m256i repack_bcast_i8x8(const int8_t * x) {
+    int64_t v;
+    memcpy(&v, x, sizeof(v));
+    return _mm256_set1_epi64x(v);
+}
+
+// spread one int16 value per interleaved row over the int16 products of that row in the rows 0-3 / 4-7 vectors
+// (a 256 bit load of an 8x8 interleaved chunk holds 8 bytes of rows 0, 1 | 2, 3 or 4, 5 | 6, 7)
+static inline void repack_spread_i16x8(__m128i v, __m256i & v_0123, __m256i & v_4567) {
+    const __m256i vv = _mm256_broadcastsi128_si256(v);
+    v_0123 = _mm256_shuffle_epi8(vv, _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3, 4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7));
+    v_4567 = _mm256_shuffle_epi8(vv, _mm256_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 10, 11, 10, 11, 10, 11, 10, 11, 12, 13, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15, 14, 15));
+}
+
+// reduce the two int32 partial sums per row of the rows 0-3 / 4-7 vectors to one int32 per row, in row order
+static inline __m256i repack_hsum_i32x8(__m256i acc_0123, __m256i acc_4567) {
+    return _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(acc_0123, acc_4567), _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+// sum over pairs of sub-blocks of the per row int16 values v[2 * p + 0/1][0..7] times the int16 activation sums
+// bsums[2 * p + 0/1], one int32 per row, in row order
+static inline __m256i repack_madd_pair_i16x8(__m256i acc, __m128i v0, __m128i v1, const int16_t * bsums) {
+    int32_t b01;
+    memcpy(&b01, bsums, sizeof(b01));
+    const __m256i v01 = _mm256_set_m128i(_mm_unpackhi_epi16(v0, v1), _mm_unpacklo_epi16(v0, v1));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(v01, _mm256_set1_epi32(b01)));
+}
+
+// unpack the scales and mins of a block_q4_Kx8 / block_q5_Kx8: 8 scales followed by 8 mins per sub-block
+static inline void repack_unpack_scales_mins_k4x8(const uint8_t * scales, uint32_t * utmp) {
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    for (int sb = 0; sb < 8; sb++) {
+        memcpy(utmp + sb * 4, scales + sb * 12, 12);
+        utmp[sb * 4 + 3] = ((utmp[sb * 4 + 2] >> 4) & kmask2) | (((utmp[sb * 4 + 1] >> 6) & kmask3) << 4);
+        const uint32_t uaux_0 = utmp[sb * 4 + 1] & kmask1;
+        utmp[sb * 4 + 1] = (utmp[sb * 4 + 2] & kmask2) | (((utmp[sb * 4 + 0] >> 6) & kmask3) << 4);
+        utmp[sb * 4 + 2] = uaux_0;
+        utmp[sb * 4 + 0] &= kmask1;
+    }
+}
+
+// prefetch n cache lines of the weights that are read a few blocks ahead; the gemv kernels go through the strips
+// faster than the hardware prefetcher brings them in from the last level cache
+#define REPACK_PREFETCH_DIST 4096
+
+static inline void repack_prefetch_lines(const void * p, int n) {
+    for (int i = 0; i < n; i++) {
+        _mm_prefetch((const char *) p + REPACK_PREFETCH_DIST + i * 64, _MM_HINT_T0);
+    }
+}
+
+// signed IQ4_XS scales of sub-block sb, one int16 per row
+static inline __m128i repack_iq4_xs_scales(const block_iq4_xsx8 * b, int sb) {
+    __m128i ls = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(b->scales_l + (sb / 2) * 8)));
+    ls = _mm_and_si128(sb % 2 ? _mm_srli_epi16(ls, 4) : ls, _mm_set1_epi16(0xF));
+    const __m128i hs = _mm_and_si128(_mm_srl_epi16(_mm_loadu_si128((const __m128i *) b->scales_h), _mm_cvtsi32_si128(2 * sb)), _mm_set1_epi16(3));
+    return _mm_sub_epi16(_mm_or_si128(ls, _mm_slli_epi16(hs, 4)), _mm_set1_epi16(32));
+}
+#endif
+
+void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const block_q8_0x8 * b_ptr_start = (const block_q8_0x8 *) vx;
+    const block_q8_0   * a_ptr       = (const block_q8_0 *) vy;
+
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q8_0x8 * b_ptr = b_ptr_start + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+
+        for (int64_t b = 0; b < nb; b++) {
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+
+            // chunk k holds quants 8k..8k+7 of the 8 rows: rows 0-3 in the first 32 bytes, rows 4-7 in the next ones
+            repack_prefetch_lines(b_ptr + b, 5);
+
+            for (int k = 0; k < QK8_0 / 8; k++) {
+                const __m256i lhs = repack_bcast_i8x8(a_ptr[b].qs + k * 8);
+
+                iacc_0123 = mul_sum_i8_pairs_acc_int32x8(iacc_0123, _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64)),      lhs);
+                iacc_4567 = mul_sum_i8_pairs_acc_int32x8(iacc_4567, _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + 32)), lhs);
+            }
+
+            const __m256 scale = _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].d), _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d)));
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123, iacc_4567)), scale, acc_row);
+        }
+
+        _mm256_storeu_ps(s + x * 8, acc_row);
+    }
+    return;
+#endif
+    ggml_gemv_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemv_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i m1 = _mm256_set1_epi8(0x01);
+
+    const block_q5_Kx8 * b_ptr_start = (const block_q5_Kx8 *) vx;
+    const block_q8_K   * a_ptr       = (const block_q8_K *) vy;
+
+    uint32_t utmp[32];
+
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q5_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+
+        for (int64_t b = 0; b < nb; b++) {
+            repack_unpack_scales_mins_k4x8(b_ptr[b].scales, utmp);
+            const uint8_t * sm = (const uint8_t *) utmp;
+
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+            __m256i iacc_min  = _mm256_setzero_si256();
+
+            // sub-block sb: chunks 4sb..4sb+3, low bits in qs[2sb] and qs[2sb + 1], high bits 4(sb % 2).. of qh[sb / 2]
+            for (int sb = 0; sb < QK_K / 32; sb++) {
+                repack_prefetch_lines((const uint8_t *)(b_ptr + b) + sb * 192, 3);
+
+                __m256i sc_0123, sc_4567;
+                repack_spread_i16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16))), sc_0123, sc_4567);
+
+                __m256i qh_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64));
+                __m256i qh_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64 + 32));
+                if (sb % 2) {
+                    qh_0123 = _mm256_srli_epi16(qh_0123, 4);
+                    qh_4567 = _mm256_srli_epi16(qh_4567, 4);
+                }
+
+                const __m256i ql_0123_0 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb) * 64));
+                const __m256i ql_4567_0 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb) * 64 + 32));
+                const __m256i ql_0123_1 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + 1) * 64));
+                const __m256i ql_4567_1 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + 1) * 64 + 32));
+
+                const __m256i v_0123_0 = _mm256_or_si256(_mm256_and_si256(ql_0123_0, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_0123, m1), 4));
+                const __m256i v_0123_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123_0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 1), m1), 4));
+                const __m256i v_0123_2 = _mm256_or_si256(_mm256_and_si256(ql_0123_1, m4),                         _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m1), 4));
+                const __m256i v_0123_3 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123_1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 3), m1), 4));
+                const __m256i v_4567_0 = _mm256_or_si256(_mm256_and_si256(ql_4567_0, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_4567, m1), 4));
+                const __m256i v_4567_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567_0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 1), m1), 4));
+                const __m256i v_4567_2 = _mm256_or_si256(_mm256_and_si256(ql_4567_1, m4),                         _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m1), 4));
+                const __m256i v_4567_3 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567_1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 3), m1), 4));
+
+                const __m256i lhs_0 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 0) * 8);
+                const __m256i lhs_1 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 1) * 8);
+                const __m256i lhs_2 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 2) * 8);
+                const __m256i lhs_3 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 3) * 8);
+
+                // 4 x 31 x 127 x 2 fits the int16 products
+                const __m256i p_0123 = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(v_0123_0, lhs_0), _mm256_maddubs_epi16(v_0123_1, lhs_1)),
+                                                        _mm256_add_epi16(_mm256_maddubs_epi16(v_0123_2, lhs_2), _mm256_maddubs_epi16(v_0123_3, lhs_3)));
+                const __m256i p_4567 = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(v_4567_0, lhs_0), _mm256_maddubs_epi16(v_4567_1, lhs_1)),
+                                                        _mm256_add_epi16(_mm256_maddubs_epi16(v_4567_2, lhs_2), _mm256_maddubs_epi16(v_4567_3, lhs_3)));
+
+                iacc_0123 = _mm256_add_epi32(iacc_0123, _mm256_madd_epi16(p_0123, sc_0123));
+                iacc_4567 = _mm256_add_epi32(iacc_4567, _mm256_madd_epi16(p_4567, sc_4567));
+            }
+
+            // mins times the activation sums of the 32 element sub-blocks
+            for (int sb = 0; sb < QK_K / 32; sb += 2) {
+                const int16_t bsums[2] = {
+                    (int16_t) (a_ptr[b].bsums[2 * sb + 0] + a_ptr[b].bsums[2 * sb + 1]),
+                    (int16_t) (a_ptr[b].bsums[2 * sb + 2] + a_ptr[b].bsums[2 * sb + 3]),
+                };
+                iacc_min = repack_madd_pair_i16x8(iacc_min,
+                        _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16 + 8))),
+                        _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16 + 24))), bsums);
+            }
+
+            const __m256 row_scale = _mm256_set1_ps(a_ptr[b].d);
+            acc_row = _mm256_fmadd_ps (_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].d),    row_scale), acc_row);
+            acc_row = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(iacc_min),                                 _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].dmin), row_scale), acc_row);
+        }
+
+        _mm256_storeu_ps(s + x * 8, acc_row);
+    }
+    return;
+#endif
+    ggml_gemv_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemv_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i m3 = _mm256_set1_epi8(0x03);
+
+    const block_q6_Kx8 * b_ptr_start = (const block_q6_Kx8 *) vx;
+    const block_q8_K   * a_ptr       = (const block_q8_K *) vy;
+
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q6_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+
+        for (int64_t b = 0; b < nb; b++) {
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+            __m256i iacc_off  = _mm256_setzero_si256();
+
+            // sub-block sb: chunks 2sb and 2sb + 1, low bits in ql[sb], high bits 4(sb % 2).. of qh[sb / 2]
+            for (int sb = 0; sb < QK_K / 16; sb++) {
+                repack_prefetch_lines((const uint8_t *)(b_ptr + b) + sb * 128, 2);
+
+                __m256i sc_0123, sc_4567;
+                repack_spread_i16x8(_mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8))), sc_0123, sc_4567);
+
+                __m256i qh_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64));
+                __m256i qh_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64 + 32));
+                if (sb % 2) {
+                    qh_0123 = _mm256_srli_epi16(qh_0123, 4);
+                    qh_4567 = _mm256_srli_epi16(qh_4567, 4);
+                }
+
+                const __m256i ql_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + sb * 64));
+                const __m256i ql_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + sb * 64 + 32));
+
+                const __m256i v_0123_0 = _mm256_or_si256(_mm256_and_si256(ql_0123, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_0123, m3), 4));
+                const __m256i v_0123_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m3), 4));
+                const __m256i v_4567_0 = _mm256_or_si256(_mm256_and_si256(ql_4567, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_4567, m3), 4));
+                const __m256i v_4567_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m3), 4));
+
+                const __m256i lhs_0 = repack_bcast_i8x8(a_ptr[b].qs + (2 * sb + 0) * 8);
+                const __m256i lhs_1 = repack_bcast_i8x8(a_ptr[b].qs + (2 * sb + 1) * 8);
+
+                // the quants are used unsigned (0..63), the offset of 32 is applied through the activation sums
+                const __m256i p_0123 = _mm256_add_epi16(_mm256_maddubs_epi16(v_0123_0, lhs_0), _mm256_maddubs_epi16(v_0123_1, lhs_1));
+                const __m256i p_4567 = _mm256_add_epi16(_mm256_maddubs_epi16(v_4567_0, lhs_0), _mm256_maddubs_epi16(v_4567_1, lhs_1));
+
+                iacc_0123 = _mm256_add_epi32(iacc_0123, _mm256_madd_epi16(p_0123, sc_0123));
+                iacc_4567 = _mm256_add_epi32(iacc_4567, _mm256_madd_epi16(p_4567, sc_4567));
+            }
+
+            for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                iacc_off = repack_madd_pair_i16x8(iacc_off,
+                        _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8))),
+                        _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8 + 8))), a_ptr[b].bsums + sb);
+            }
+
+            const __m256i isum = _mm256_sub_epi32(repack_hsum_i32x8(iacc_0123, iacc_4567), _mm256_slli_epi32(iacc_off, 5));
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(isum), _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].d), _mm256_set1_ps(a_ptr[b].d)), acc_row);
+        }
+
+        _mm256_storeu_ps(s + x * 8, acc_row);
+    }
+    return;
+#endif
+    ggml_gemv_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemv_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4     = _mm256_set1_epi8(0x0F);
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+
+    const block_iq4_xsx8 * b_ptr_start = (const block_iq4_xsx8 *) vx;
+    const block_q8_K     * a_ptr       = (const block_q8_K *) vy;
+
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_iq4_xsx8 * b_ptr = b_ptr_start + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+
+        for (int64_t b = 0; b < nb; b++) {
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+
+            // sub-block sb: chunks 4sb..4sb+3, in the low and high nibbles of qs[2sb] and qs[2sb + 1]
+            for (int sb = 0; sb < QK_K / 32; sb++) {
+                repack_prefetch_lines((const uint8_t *)(b_ptr + b) + sb * 192, 3);
+
+                __m256i sc_0123, sc_4567;
+                repack_spread_i16x8(repack_iq4_xs_scales(b_ptr + b, sb), sc_0123, sc_4567);
+
+                for (int h = 0; h < 2; h++) {
+                    const __m256i q_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + h) * 64));
+                    const __m256i q_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + h) * 64 + 32));
+
+                    const __m256i v_0123_0 = _mm256_shuffle_epi8(values, _mm256_and_si256(q_0123, m4));
+                    const __m256i v_0123_1 = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(q_0123, 4), m4));
+                    const __m256i v_4567_0 = _mm256_shuffle_epi8(values, _mm256_and_si256(q_4567, m4));
+                    const __m256i v_4567_1 = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(q_4567, 4), m4));
+
+                    const __m256i lhs_0 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 2 * h + 0) * 8);
+                    const __m256i lhs_1 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 2 * h + 1) * 8);
+
+                    // signed x signed: |v| x sign(lhs, v), up to 2 x 127 x 127 per int16 product
+                    iacc_0123 = _mm256_add_epi32(iacc_0123, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(v_0123_0, v_0123_0), _mm256_sign_epi8(lhs_0, v_0123_0)), sc_0123));
+                    iacc_0123 = _mm256_add_epi32(iacc_0123, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(v_0123_1, v_0123_1), _mm256_sign_epi8(lhs_1, v_0123_1)), sc_0123));
+                    iacc_4567 = _mm256_add_epi32(iacc_4567, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(v_4567_0, v_4567_0), _mm256_sign_epi8(lhs_0, v_4567_0)), sc_4567));
+                    iacc_4567 = _mm256_add_epi32(iacc_4567, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(v_4567_1, v_4567_1), _mm256_sign_epi8(lhs_1, v_4567_1)), sc_4567));
+                }
+            }
+
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].d), _mm256_set1_ps(a_ptr[b].d)), acc_row);
+        }
+
+        _mm256_storeu_ps(s + x * 8, acc_row);
+    }
+    return;
+#endif
+    ggml_gemv_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const block_q8_0x8 * b_ptr_start = (const block_q8_0x8 *) vx;
+    const block_q8_0x4 * a_ptr_start = (const block_q8_0x4 *) vy;
+
+    // one strip of 8 columns at a time, so that it stays in cache while the rows of src1 go through it
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q8_0x8 * b_ptr = b_ptr_start + (x * nb);
+
+        for (int64_t y = 0; y < nr / 4; y++) {
+            const block_q8_0x4 * a_ptr = a_ptr_start + (y * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc_0123[4];
+                __m256i iacc_4567[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                }
+
+                for (int k = 0; k < QK8_0 / 8; k++) {
+                    const __m256i w_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64));
+                    const __m256i w_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + 32));
+                    const __m256i ax_0123 = _mm256_sign_epi8(w_0123, w_0123);
+                    const __m256i ax_4567 = _mm256_sign_epi8(w_4567, w_4567);
+
+                    // the activations of row m for chunk k are at qs[32k + 8m]
+                    for (int m = 0; m < 4; m++) {
+                        const __m256i lhs = repack_bcast_i8x8(a_ptr[b].qs + k * 32 + m * 8);
+                        iacc_0123[m] = mul_sum_us8_pairs_acc_int32x8(iacc_0123[m], ax_0123, _mm256_sign_epi8(lhs, w_0123));
+                        iacc_4567[m] = mul_sum_us8_pairs_acc_int32x8(iacc_4567[m], ax_4567, _mm256_sign_epi8(lhs, w_4567));
+                    }
+                }
+
+                const __m256 col_scale = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    const __m256 scale = _mm256_mul_ps(col_scale, _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d[m])));
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123[m], iacc_4567[m])), scale, acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * 8, acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i m1 = _mm256_set1_epi8(0x01);
+
+    const block_q5_Kx8 * b_ptr_start = (const block_q5_Kx8 *) vx;
+    const block_q8_Kx4 * a_ptr_start = (const block_q8_Kx4 *) vy;
+
+    uint32_t utmp[32];
+
+    // one strip of 8 columns at a time, so that it stays in cache while the rows of src1 go through it
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q5_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+        for (int64_t y = 0; y < nr / 4; y++) {
+            const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                repack_unpack_scales_mins_k4x8(b_ptr[b].scales, utmp);
+                const uint8_t * sm = (const uint8_t *) utmp;
+
+                __m256i iacc_0123[4];
+                __m256i iacc_4567[4];
+                __m256i iacc_min[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                    iacc_min[m]  = _mm256_setzero_si256();
+                }
+
+                for (int sb = 0; sb < QK_K / 32; sb++) {
+                    __m256i sc_0123, sc_4567;
+                    repack_spread_i16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16))), sc_0123, sc_4567);
+
+                    __m256i qh_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64));
+                    __m256i qh_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64 + 32));
+                    if (sb % 2) {
+                        qh_0123 = _mm256_srli_epi16(qh_0123, 4);
+                        qh_4567 = _mm256_srli_epi16(qh_4567, 4);
+                    }
+
+                    const __m256i ql_0123_0 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb) * 64));
+                    const __m256i ql_4567_0 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb) * 64 + 32));
+                    const __m256i ql_0123_1 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + 1) * 64));
+                    const __m256i ql_4567_1 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + 1) * 64 + 32));
+
+                    const __m256i v_0123_0 = _mm256_or_si256(_mm256_and_si256(ql_0123_0, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_0123, m1), 4));
+                    const __m256i v_0123_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123_0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 1), m1), 4));
+                    const __m256i v_0123_2 = _mm256_or_si256(_mm256_and_si256(ql_0123_1, m4),                         _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m1), 4));
+                    const __m256i v_0123_3 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123_1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 3), m1), 4));
+                    const __m256i v_4567_0 = _mm256_or_si256(_mm256_and_si256(ql_4567_0, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_4567, m1), 4));
+                    const __m256i v_4567_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567_0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 1), m1), 4));
+                    const __m256i v_4567_2 = _mm256_or_si256(_mm256_and_si256(ql_4567_1, m4),                         _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m1), 4));
+                    const __m256i v_4567_3 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567_1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 3), m1), 4));
+
+                    for (int m = 0; m < 4; m++) {
+                        const __m256i lhs_0 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 0) * 32 + m * 8);
+                        const __m256i lhs_1 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 1) * 32 + m * 8);
+                        const __m256i lhs_2 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 2) * 32 + m * 8);
+                        const __m256i lhs_3 = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + 3) * 32 + m * 8);
+
+                        const __m256i p_0123 = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(v_0123_0, lhs_0), _mm256_maddubs_epi16(v_0123_1, lhs_1)),
+                                                                _mm256_add_epi16(_mm256_maddubs_epi16(v_0123_2, lhs_2), _mm256_maddubs_epi16(v_0123_3, lhs_3)));
+                        const __m256i p_4567 = _mm256_add_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(v_4567_0, lhs_0), _mm256_maddubs_epi16(v_4567_1, lhs_1)),
+                                                                _mm256_add_epi16(_mm256_maddubs_epi16(v_4567_2, lhs_2), _mm256_maddubs_epi16(v_4567_3, lhs_3)));
+
+                        iacc_0123[m] = _mm256_add_epi32(iacc_0123[m], _mm256_madd_epi16(p_0123, sc_0123));
+                        iacc_4567[m] = _mm256_add_epi32(iacc_4567[m], _mm256_madd_epi16(p_4567, sc_4567));
+                    }
+                }
+
+                for (int sb = 0; sb < QK_K / 32; sb += 2) {
+                    const __m128i mins_0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16 + 8)));
+                    const __m128i mins_1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(sm + sb * 16 + 24)));
+
+                    // the sums of the 16 element groups of sub-block sb of row m start at bsums[8sb + 4m - 6(sb % 2)]
+                    for (int m = 0; m < 4; m++) {
+                        const int16_t * bs0 = a_ptr[b].bsums + sb * 8 + m * 4;
+                        const int16_t * bs1 = a_ptr[b].bsums + (sb + 1) * 8 + m * 4 - 6;
+                        const int16_t bsums[2] = { (int16_t) (bs0[0] + bs0[1]), (int16_t) (bs1[0] + bs1[1]) };
+                        iacc_min[m] = repack_madd_pair_i16x8(iacc_min[m], mins_0, mins_1, bsums);
+                    }
+                }
+
+                const __m256 col_scale = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                const __m256 col_dmin  = GGML_F32Cx8_LOAD(b_ptr[b].dmin);
+                for (int m = 0; m < 4; m++) {
+                    const __m256 row_scale = _mm256_set1_ps(a_ptr[b].d[m]);
+                    acc_rows[m] = _mm256_fmadd_ps (_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123[m], iacc_4567[m])), _mm256_mul_ps(col_scale, row_scale), acc_rows[m]);
+                    acc_rows[m] = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(iacc_min[m]),                                    _mm256_mul_ps(col_dmin,  row_scale), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * 8, acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i m3 = _mm256_set1_epi8(0x03);
+
+    const block_q6_Kx8 * b_ptr_start = (const block_q6_Kx8 *) vx;
+    const block_q8_Kx4 * a_ptr_start = (const block_q8_Kx4 *) vy;
+
+    // one strip of 8 columns at a time, so that it stays in cache while the rows of src1 go through it
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_q6_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+        for (int64_t y = 0; y < nr / 4; y++) {
+            const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc_0123[4];
+                __m256i iacc_4567[4];
+                __m256i iacc_off[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                    iacc_off[m]  = _mm256_setzero_si256();
+                }
+
+                for (int sb = 0; sb < QK_K / 16; sb++) {
+                    __m256i sc_0123, sc_4567;
+                    repack_spread_i16x8(_mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8))), sc_0123, sc_4567);
+
+                    __m256i qh_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64));
+                    __m256i qh_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (sb / 2) * 64 + 32));
+                    if (sb % 2) {
+                        qh_0123 = _mm256_srli_epi16(qh_0123, 4);
+                        qh_4567 = _mm256_srli_epi16(qh_4567, 4);
+                    }
+
+                    const __m256i ql_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + sb * 64));
+                    const __m256i ql_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + sb * 64 + 32));
+
+                    const __m256i v_0123_0 = _mm256_or_si256(_mm256_and_si256(ql_0123, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_0123, m3), 4));
+                    const __m256i v_0123_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0123, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m3), 4));
+                    const __m256i v_4567_0 = _mm256_or_si256(_mm256_and_si256(ql_4567, m4),                         _mm256_slli_epi16(_mm256_and_si256(qh_4567, m3), 4));
+                    const __m256i v_4567_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_4567, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m3), 4));
+
+                    for (int m = 0; m < 4; m++) {
+                        const __m256i lhs_0 = repack_bcast_i8x8(a_ptr[b].qs + (2 * sb + 0) * 32 + m * 8);
+                        const __m256i lhs_1 = repack_bcast_i8x8(a_ptr[b].qs + (2 * sb + 1) * 32 + m * 8);
+
+                        const __m256i p_0123 = _mm256_add_epi16(_mm256_maddubs_epi16(v_0123_0, lhs_0), _mm256_maddubs_epi16(v_0123_1, lhs_1));
+                        const __m256i p_4567 = _mm256_add_epi16(_mm256_maddubs_epi16(v_4567_0, lhs_0), _mm256_maddubs_epi16(v_4567_1, lhs_1));
+
+                        iacc_0123[m] = _mm256_add_epi32(iacc_0123[m], _mm256_madd_epi16(p_0123, sc_0123));
+                        iacc_4567[m] = _mm256_add_epi32(iacc_4567[m], _mm256_madd_epi16(p_4567, sc_4567));
+                    }
+                }
+
+                for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                    const __m128i sc_0 = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8)));
+                    const __m128i sc_1 = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8 + 8)));
+
+                    // the sum of 16 element group sb of row m is at bsums[16(sb / 4) + 4m + sb % 4]
+                    for (int m = 0; m < 4; m++) {
+                        iacc_off[m] = repack_madd_pair_i16x8(iacc_off[m], sc_0, sc_1, a_ptr[b].bsums + (sb / 4) * 16 + m * 4 + sb % 4);
+                    }
+                }
+
+                const __m256 col_scale = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    const __m256i isum = _mm256_sub_epi32(repack_hsum_i32x8(iacc_0123[m], iacc_4567[m]), _mm256_slli_epi32(iacc_off[m], 5));
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(isum), _mm256_mul_ps(col_scale, _mm256_set1_ps(a_ptr[b].d[m])), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * 8, acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4     = _mm256_set1_epi8(0x0F);
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+
+    const block_iq4_xsx8 * b_ptr_start = (const block_iq4_xsx8 *) vx;
+    const block_q8_Kx4   * a_ptr_start = (const block_q8_Kx4 *) vy;
+
+    // one strip of 8 columns at a time, so that it stays in cache while the rows of src1 go through it
+    for (int64_t x = 0; x < nc / 8; x++) {
+        const block_iq4_xsx8 * b_ptr = b_ptr_start + (x * nb);
+
+        for (int64_t y = 0; y < nr / 4; y++) {
+            const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc_0123[4];
+                __m256i iacc_4567[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                }
+
+                for (int sb = 0; sb < QK_K / 32; sb++) {
+                    __m256i sc_0123, sc_4567;
+                    repack_spread_i16x8(repack_iq4_xs_scales(b_ptr + b, sb), sc_0123, sc_4567);
+
+                    // chunk k = 4sb + t is in the low (even t) or high (odd t) nibbles of qs[2sb + t / 2]
+                    for (int t = 0; t < 4; t++) {
+                        __m256i q_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + t / 2) * 64));
+                        __m256i q_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + (2 * sb + t / 2) * 64 + 32));
+                        if (t % 2) {
+                            q_0123 = _mm256_srli_epi16(q_0123, 4);
+                            q_4567 = _mm256_srli_epi16(q_4567, 4);
+                        }
+
+                        const __m256i v_0123  = _mm256_shuffle_epi8(values, _mm256_and_si256(q_0123, m4));
+                        const __m256i v_4567  = _mm256_shuffle_epi8(values, _mm256_and_si256(q_4567, m4));
+                        const __m256i ax_0123 = _mm256_sign_epi8(v_0123, v_0123);
+                        const __m256i ax_4567 = _mm256_sign_epi8(v_4567, v_4567);
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m256i lhs = repack_bcast_i8x8(a_ptr[b].qs + (4 * sb + t) * 32 + m * 8);
+                            iacc_0123[m] = _mm256_add_epi32(iacc_0123[m], _mm256_madd_epi16(_mm256_maddubs_epi16(ax_0123, _mm256_sign_epi8(lhs, v_0123)), sc_0123));
+                            iacc_4567[m] = _mm256_add_epi32(iacc_4567[m], _mm256_madd_epi16(_mm256_maddubs_epi16(ax_4567, _mm256_sign_epi8(lhs, v_4567)), sc_4567));
+                        }
+                    }
+                }
+
+                const __m256 col_scale = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_hsum_i32x8(iacc_0123[m], iacc_4567[m])), _mm256_mul_ps(col_scale, _mm256_set1_ps(a_ptr[b].d[m])), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * 8, acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
@@ -15,6 +15,8 @@
 extern "C" {
 #endif
 
+struct ggml_mul_mat_tune_cfg;
+
 struct ggml_compute_params {
     // ith = thread index, nth = number of threads
     int ith, nth;
@@ -24,6 +26,9 @@ struct ggml_compute_params {
     void * wdata;
 
     struct ggml_threadpool * threadpool;
+
+    // tuned configuration of the current MUL_MAT node, NULL to use the built-in heuristics (see mm-tune.h)
+    const struct ggml_mul_mat_tune_cfg * mm_tune;
 };
 
 
@@ -512,6 +517,12 @@ void ggml_barrier(struct ggml_threadpool * tp);
 void ggml_threadpool_chunk_set(struct ggml_threadpool * tp, int value);
 int  ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value);
 
+// sin/cos table of ROPE in its own region of the work buffer
+// valid is set if it already holds the table of a ROPE with the same positions and parameters as dst
+// otherwise the threads compute the table, and after a barrier one of them calls ggml_rope_table_set
+float * ggml_rope_table_get(const struct ggml_compute_params * params, const struct ggml_tensor * dst, bool * valid);
+void    ggml_rope_table_set(const struct ggml_compute_params * params, const struct ggml_tensor * dst);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,7 @@
 #include "binary-ops.h"
 #include "vec.h"
 #include "ops.h"
+#include "mm-tune.h"
 #include "ggml.h"
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
@@ -36,6 +37,7 @@
 #include <signal.h>
 #if defined(__gnu_linux__)
 #include <syscall.h>
+#include <linux/futex.h>
 #endif
 
 #ifdef GGML_USE_OPENMP
@@ -437,6 +439,26 @@ typedef pthread_mutex_t    ggml_mutex_t;
 
 #endif
 
+// Barrier
+//
+// ggml_barrier is a two level tree. Threads first arrive at the counter of their group, and the last thread of
+// each group arrives at the root counter, so each contended cache line is shared by the threads of one group
+// instead of all of them. A group is one NUMA node when the threads are distributed across the nodes, and
+// GGML_BARRIER_GROUP_SIZE consecutive threads otherwise.
+//
+// Waiting threads spin on n_barrier_passed and then go to sleep. The number of spins adapts per thread: it grows
+// while the barrier is passed during the spin, and shrinks when the thread has to sleep, so threads that share
+// CPUs stop wasting their time slices.
+
+#define GGML_BARRIER_GROUP_SIZE 8
+#define GGML_BARRIER_MAX_GROUPS (GGML_MAX_N_THREADS / GGML_BARRIER_GROUP_SIZE)
+#define GGML_BARRIER_MIN_SPIN   (1 << 6)
+#define GGML_BARRIER_MAX_SPIN   (1 << 16)
+
+struct ggml_barrier_group {
+    atomic_int GGML_CACHE_ALIGN n_arrived;
+};
+
 // Threadpool def
 struct ggml_threadpool {
     ggml_mutex_t mutex;       // mutex for cond.var
@@ -447,10 +469,25 @@ struct ggml_threadpool {
 
     // synchronization primitives
     atomic_int n_graph;       // incremented when there is work to be done (i.e each graph)
-    atomic_int GGML_CACHE_ALIGN n_barrier;
+    atomic_int GGML_CACHE_ALIGN n_barrier;          // number of groups that arrived at the root of the barrier
     atomic_int GGML_CACHE_ALIGN n_barrier_passed;
+    atomic_int GGML_CACHE_ALIGN n_barrier_sleepers; // number of threads sleeping in the barrier
     atomic_int GGML_CACHE_ALIGN current_chunk; // currently processing chunk during Mat_Mul, shared between all the threads.
 
+    // src1 of the last MUL_MAT converted to vec_dot_type in the src1 region of the work buffer
+    const struct ggml_tensor * mm_src1;
+    enum ggml_type             mm_src1_type;
+    size_t                     work_size_src1; // size of the src1 region, see ggml_graph_work_size_src1
+
+    // last ROPE whose sin/cos table is in the rope region of the work buffer
+    const struct ggml_tensor * rope_node;
+    size_t                     work_size_rope; // size of the rope region, see ggml_graph_work_size_rope
+
+    // tuned mul_mat configuration of each node of the graph, looked up before the graph is computed
+    struct ggml_mul_mat_tune_cfg * mm_tune;
+    int                            mm_tune_size;  // capacity in nodes
+    bool                           mm_tune_valid; // false if no node was tuned
+
     // these are atomic as an annotation for thread-sanitizer
     atomic_bool stop;         // Used for stopping the threadpool altogether
     atomic_bool pause;        // Used for pausing the threadpool or individual threads
@@ -464,6 +501,8 @@ struct ggml_threadpool {
     uint32_t     poll;        // Polling level (0 - no polling)
 
     enum ggml_status ec;
+
+    struct ggml_barrier_group barrier_groups[GGML_BARRIER_MAX_GROUPS];
 };
 
 // Per-thread state
@@ -473,6 +512,7 @@ struct ggml_compute_state {
     bool cpumask[GGML_MAX_N_THREADS];
     int  last_graph;
     bool pending;
+    int  barrier_spin; // number of spins in ggml_barrier before sleeping
 #endif
     struct ggml_threadpool * threadpool;
     int ith;
@@ -526,6 +566,73 @@ struct ggml_state {
 
 static struct ggml_state g_state = {0};
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GGML_THREAD_LOCAL __declspec(thread)
+#else
+#define GGML_THREAD_LOCAL _Thread_local
+#endif
+
+// state of the current thread in the graph being computed, used by ggml_barrier
+static GGML_THREAD_LOCAL struct ggml_compute_state * ggml_cur_state = NULL;
+
+#ifndef GGML_USE_OPENMP
+
+// group of thread ith in the barrier tree
+static inline int ggml_barrier_group(int n_threads, int ith, int * n_members, int * n_groups) {
+    if (g_state.numa.numa_strategy == GGML_NUMA_STRATEGY_DISTRIBUTE && g_state.numa.n_nodes > 1) {
+        // threads are distributed round-robin across the nodes, see set_numa_thread_affinity
+        const int n_nodes = MIN((int) g_state.numa.n_nodes, n_threads);
+        const int group   = ith % n_nodes;
+
+        *n_members = (n_threads - group + n_nodes - 1) / n_nodes;
+        *n_groups  = n_nodes;
+        return group;
+    }
+
+    const int group = ith / GGML_BARRIER_GROUP_SIZE;
+
+    *n_members = MIN(GGML_BARRIER_GROUP_SIZE, n_threads - group * GGML_BARRIER_GROUP_SIZE);
+    *n_groups  = (n_threads + GGML_BARRIER_GROUP_SIZE - 1) / GGML_BARRIER_GROUP_SIZE;
+    return group;
+}
+
+static void ggml_barrier_wait(struct ggml_threadpool * tp, struct ggml_compute_state * state, int n_passed) {
+    for (int i = 0; i < state->barrier_spin; i++) {
+        if (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) != n_passed) {
+            state->barrier_spin = MIN(state->barrier_spin * 2, GGML_BARRIER_MAX_SPIN);
+            return;
+        }
+        ggml_thread_cpu_relax();
+    }
+
+    state->barrier_spin = MAX(state->barrier_spin / 2, GGML_BARRIER_MIN_SPIN);
+
+#if defined(__gnu_linux__)
+    // n_barrier_sleepers is checked by the last thread after updating n_barrier_passed, see ggml_barrier_wake
+    atomic_fetch_add_explicit(&tp->n_barrier_sleepers, 1, memory_order_seq_cst);
+    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_seq_cst) == n_passed) {
+        syscall(SYS_futex, &tp->n_barrier_passed, FUTEX_WAIT_PRIVATE, n_passed, NULL, NULL, 0);
+    }
+    atomic_fetch_add_explicit(&tp->n_barrier_sleepers, -1, memory_order_relaxed);
+#else
+    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
+        sched_yield();
+    }
+#endif
+}
+
+static void ggml_barrier_wake(struct ggml_threadpool * tp) {
+#if defined(__gnu_linux__)
+    if (atomic_load_explicit(&tp->n_barrier_sleepers, memory_order_seq_cst) > 0) {
+        syscall(SYS_futex, &tp->n_barrier_passed, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+#else
+    UNUSED(tp);
+#endif
+}
+
+#endif // GGML_USE_OPENMP
+
 void ggml_barrier(struct ggml_threadpool * tp) {
     int n_threads = atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed);
     if (n_threads == 1) {
@@ -535,24 +642,40 @@ void ggml_barrier(struct ggml_threadpool * tp) {
 #ifdef GGML_USE_OPENMP
     #pragma omp barrier
 #else
+    struct ggml_compute_state * state = ggml_cur_state;
+    assert(state != NULL && state->threadpool == tp);
+
     int n_passed = atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed);
 
+    int n_members;
+    int n_groups;
+    const int group = ggml_barrier_group(n_threads, state->ith, &n_members, &n_groups);
+
+    struct ggml_barrier_group * bg = &tp->barrier_groups[group];
+
     // enter barrier (full seq-cst fence)
-    int n_barrier = atomic_fetch_add_explicit(&tp->n_barrier, 1, memory_order_seq_cst);
+    int n_arrived = atomic_fetch_add_explicit(&bg->n_arrived, 1, memory_order_seq_cst);
 
-    if (n_barrier == (n_threads - 1)) {
-        // last thread
-        atomic_store_explicit(&tp->n_barrier, 0, memory_order_relaxed);
+    if (n_arrived == n_members - 1) {
+        // last thread of the group
+        atomic_store_explicit(&bg->n_arrived, 0, memory_order_relaxed);
 
-        // exit barrier (fill seq-cst fence)
-        atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
-        return;
+        int n_barrier = n_groups == 1 ? 0 : atomic_fetch_add_explicit(&tp->n_barrier, 1, memory_order_seq_cst);
+
+        if (n_barrier == n_groups - 1) {
+            // last thread
+            atomic_store_explicit(&tp->n_barrier, 0, memory_order_relaxed);
+
+            // exit barrier (full seq-cst fence)
+            atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
+
+            ggml_barrier_wake(tp);
+            return;
+        }
     }
 
     // wait for other threads
-    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
-        ggml_thread_cpu_relax();
-    }
+    ggml_barrier_wait(tp, state, n_passed);
 
     // exit barrier (full seq-cst fence)
     // TSAN doesn't support standalone fence yet, we use a dummy read-modify-write instead
@@ -572,6 +695,27 @@ int ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value) {
     return atomic_fetch_add_explicit(&tp->current_chunk, value, memory_order_relaxed);
 }
 
+// the table is stored after the src1 region of the work buffer (see ggml_graph_plan)
+// it only depends on the positions, the freq factors and the op params, so the ROPEs of Q and K of all the layers share it
+float * ggml_rope_table_get(const struct ggml_compute_params * params, const struct ggml_tensor * dst, bool * valid) {
+    const struct ggml_threadpool * tp   = params->threadpool;
+    const struct ggml_tensor     * prev = tp->rope_node;
+
+    *valid = prev != NULL && prev->op == dst->op &&
+             prev->src[1] == dst->src[1] && prev->src[2] == dst->src[2] &&
+             prev->ne[0]  == dst->ne[0]  && prev->ne[2]  == dst->ne[2]  &&
+             memcmp(prev->op_params, dst->op_params, sizeof(dst->op_params)) == 0;
+
+    assert(tp->work_size_rope >= 2*sizeof(float)*dst->ne[0]*dst->ne[2]);
+
+    return (float *) ((char *) params->wdata + params->wsize + tp->work_size_src1);
+}
+
+void ggml_rope_table_set(const struct ggml_compute_params * params, const struct ggml_tensor * dst) {
+    // all threads have checked rope_node before the barrier
+    params->threadpool->rope_node = dst;
+}
+
 #if defined(__gnu_linux__)
 static cpu_set_t ggml_get_numa_affinity(void) {
     cpu_set_t cpuset;
@@ -1109,6 +1253,13 @@ void ggml_set_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
 
 // ggml_compute_forward_mul_mat
 
+// src1 converted to vec_dot_type is stored after the work buffer of the other ops (see ggml_graph_plan)
+// it stays valid until the next conversion, so MUL_MATs that share the same src1 (Q, K and V, gate and up)
+// convert it only once
+static inline void * ggml_mul_mat_src1_wdata(const struct ggml_compute_params * params) {
+    return (char *) params->wdata + params->wsize;
+}
+
 static void ggml_compute_forward_mul_mat_one_chunk(
     const struct ggml_compute_params * params,
     struct ggml_tensor * dst,
@@ -1140,7 +1291,7 @@ static void ggml_compute_forward_mul_mat_one_chunk(
         return;
     }
 
-    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : ggml_mul_mat_src1_wdata(params);
     const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
     assert(ne12 % ne02 == 0);
@@ -1234,6 +1385,9 @@ void ggml_compute_forward_mul_mat(
     //   compute by src0 rows
 
     // TODO: extract to "extra_op"
+    // zero unless the shape was tuned by the autotuner
+    const struct ggml_mul_mat_tune_cfg tune = params->mm_tune ? *params->mm_tune : (struct ggml_mul_mat_tune_cfg) { 0, 0, 0 };
+
 #if GGML_USE_LLAMAFILE
     // broadcast factors
     const int64_t r2 = ne12 / ne02;
@@ -1254,22 +1408,27 @@ void ggml_compute_forward_mul_mat(
                                      nb1/ggml_type_size(dst->type),
                                      src0->type,
                                      src1->type,
-                                     dst->type))
+                                     dst->type,
+                                     &tune))
                     goto UseGgmlGemm1;
         return;
     }
 UseGgmlGemm1:;
 #endif
 
-    if (src1->type != vec_dot_type) {
-        char * wdata = params->wdata;
+    struct ggml_threadpool * tp = params->threadpool;
+
+    const bool src1_converted = tp->mm_src1 == src1 && tp->mm_src1_type == vec_dot_type;
+
+    if (src1->type != vec_dot_type && !src1_converted) {
+        char * wdata = ggml_mul_mat_src1_wdata(params);
 
         const size_t nbw0 = ggml_type_size(vec_dot_type);
         const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
         const size_t nbw2 = nbw1*ne11;
         const size_t nbw3 = nbw2*ne12;
 
-        assert(params->wsize >= ne13*nbw3);
+        assert(tp->work_size_src1 >= ne13*nbw3);
         GGML_ASSERT(src1->type == GGML_TYPE_F32);
 
     #if 0
@@ -1305,9 +1464,15 @@ UseGgmlGemm1:;
 
     ggml_barrier(params->threadpool);
 
+    if (ith == 0 && src1->type != vec_dot_type) {
+        // all threads have checked mm_src1 before the barrier
+        tp->mm_src1      = src1;
+        tp->mm_src1_type = vec_dot_type;
+    }
+
 #if GGML_USE_LLAMAFILE
     if (src1->type != vec_dot_type) {
-        const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+        const void* wdata = ggml_mul_mat_src1_wdata(params);
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
         for (int64_t i13 = 0; i13 < ne13; i13++)
@@ -1322,7 +1487,8 @@ UseGgmlGemm1:;
                                      nb1/ggml_type_size(dst->type),
                                      src0->type,
                                      vec_dot_type,
-                                     dst->type))
+                                     dst->type,
+                                     &tune))
                     goto UseGgmlGemm2;
         return;
     }
@@ -1343,6 +1509,10 @@ UseGgmlGemm2:;
         chunk_size = 64;
     }
 
+    if (tune.chunk_size > 0) {
+        chunk_size = tune.chunk_size;
+    }
+
     // distribute the work across the inner or outer loop based on which one is larger
     // The number of chunks in the 0/1 dim.
     // CEIL(nr0/chunk_size)
@@ -1352,7 +1522,7 @@ UseGgmlGemm2:;
     // If the chunking is poor for the number of threads on this setup, scrap the whole plan.  Re-chunk it by thread.
     //   Also, chunking by thread was measured to have perform better on NUMA systems.  See https://github.com/ggml-org/llama.cpp/pull/6915
     //   In theory, chunking should be just as useful on NUMA and non NUMA systems, but testing disagreed with that.
-    if (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa()) {
+    if (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa() || tune.chunk_size < 0) {
         // distribute the thread work across the inner or outer loop based on which one is larger
         nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
         nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
@@ -1653,6 +1823,590 @@ static void ggml_compute_forward_mul_mat_id(
     }
 }
 
+// fused MoE FFN: MUL_MAT_ID (gate) + MUL_MAT_ID (up) + GLU + MUL_MAT_ID (down)
+//
+// the rows of all tokens are sorted by expert once and src1 is quantized once for both the gate and the up projections
+// the activation is applied to the gate and up results of a tile while they are still hot, and the result is quantized
+// in sorted order for the down projection, so each expert reads its inputs contiguously
+// the work is split in (expert, rows) items whose size depends on the number of tokens routed to the expert
+
+#define GGML_MOE_TILE      16
+#define GGML_MOE_ROW_BLOCK 64
+
+// set from GGML_CPU_DISABLE_FUSION in ggml_cpu_init
+static bool ggml_cpu_disable_fusion = false;
+
+// ggml-alloc expects the nodes to be computed one after the other, so the output of a later node of a fused chain can be
+// allocated in the memory of an input of an earlier node that has no other uses
+static bool ggml_cpu_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// the fused elementwise kernels compute all the nodes of a row at once and in parallel, so dst must either not overlap
+// src or be exactly in-place over it
+static bool ggml_cpu_fused_can_write(const struct ggml_tensor * dst, const struct ggml_tensor * src) {
+    if (!ggml_cpu_tensors_overlap(dst, src)) {
+        return true;
+    }
+
+    return dst->data == src->data && ggml_are_same_shape(dst, src) && ggml_are_same_stride(dst, src);
+}
+
+static bool ggml_moe_weight_supported(const struct ggml_tensor * w) {
+    // weights in extra buffer types (repack, AMX, ...) are stored in their own layout and use their own kernels
+    return w->extra == NULL &&
+        w->ne[3] == 1 &&
+        w->nb[0] == ggml_type_size(w->type) &&
+        type_traits_cpu[w->type].vec_dot != NULL;
+}
+
+static bool ggml_cpu_can_fuse_moe(const struct ggml_cgraph * cgraph, int node_idx) {
+    if (node_idx + 4 > cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * mm0  = cgraph->nodes[node_idx + 0];
+    const struct ggml_tensor * mm1  = cgraph->nodes[node_idx + 1];
+    const struct ggml_tensor * glu  = cgraph->nodes[node_idx + 2];
+    const struct ggml_tensor * down = cgraph->nodes[node_idx + 3];
+
+    if (mm0->op != GGML_OP_MUL_MAT_ID || mm1->op != GGML_OP_MUL_MAT_ID || glu->op != GGML_OP_GLU || down->op != GGML_OP_MUL_MAT_ID) {
+        return false;
+    }
+
+    if (!(glu->src[0] == mm0 && glu->src[1] == mm1) && !(glu->src[0] == mm1 && glu->src[1] == mm0)) {
+        return false;
+    }
+
+    switch (ggml_get_glu_op(glu)) {
+        case GGML_GLU_OP_REGLU:
+        case GGML_GLU_OP_GEGLU:
+        case GGML_GLU_OP_SWIGLU:
+        case GGML_GLU_OP_GEGLU_ERF:
+        case GGML_GLU_OP_GEGLU_QUICK:
+            break;
+        default:
+            return false;
+    }
+
+    const struct ggml_tensor * gate = glu->src[0];
+    const struct ggml_tensor * up   = glu->src[1];
+    const struct ggml_tensor * x    = gate->src[1];
+    const struct ggml_tensor * ids  = gate->src[2];
+
+    if (up->src[1] != x || up->src[2] != ids || down->src[1] != glu || down->src[2] != ids) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        if (!ggml_node_has_n_uses(cgraph, node_idx + i, 1)) {
+            return false;
+        }
+    }
+
+    const struct ggml_tensor * w_gate = gate->src[0];
+    const struct ggml_tensor * w_up   = up->src[0];
+    const struct ggml_tensor * w_down = down->src[0];
+
+    if (!ggml_moe_weight_supported(w_gate) || !ggml_moe_weight_supported(w_up) || !ggml_moe_weight_supported(w_down)) {
+        return false;
+    }
+
+    if (w_gate->type != w_up->type || !ggml_are_same_shape(w_gate, w_up) || w_down->ne[0] != w_gate->ne[1] || w_down->ne[2] != w_gate->ne[2]) {
+        return false;
+    }
+
+    if (x->type != GGML_TYPE_F32 || x->nb[0] != sizeof(float) || x->ne[3] != 1 || ids->type != GGML_TYPE_I32) {
+        return false;
+    }
+
+    if (gate->type != GGML_TYPE_F32 || up->type != GGML_TYPE_F32 || glu->type != GGML_TYPE_F32 || down->type != GGML_TYPE_F32 ||
+        !ggml_is_contiguous(gate) || !ggml_is_contiguous(up) || !ggml_is_contiguous(glu) || !ggml_is_contiguous(down)) {
+        return false;
+    }
+
+    // the GLU rows are written while x and the gate/up weights are still read by other threads, and the down rows
+    // while ids is still read, so they may not share memory with any of them, not even in-place
+    const struct ggml_tensor * inputs[] = { x, ids, w_gate, w_up };
+    for (size_t i = 0; i < sizeof(inputs)/sizeof(inputs[0]); ++i) {
+        if (ggml_cpu_tensors_overlap(glu, inputs[i]) || ggml_cpu_tensors_overlap(down, inputs[i])) {
+            return false;
+        }
+    }
+
+    const enum ggml_type vdt_gu   = type_traits_cpu[w_gate->type].vec_dot_type;
+    const enum ggml_type vdt_down = type_traits_cpu[w_down->type].vec_dot_type;
+
+    return x->ne[0] % ggml_blck_size(vdt_gu) == 0 && w_down->ne[0] % ggml_blck_size(vdt_down) == 0;
+}
+
+static size_t ggml_cpu_moe_work_size(const struct ggml_tensor * glu, const struct ggml_tensor * down) {
+    const struct ggml_tensor * gate   = glu->src[0];
+    const struct ggml_tensor * x      = gate->src[1];
+    const struct ggml_tensor * ids    = gate->src[2];
+    const struct ggml_tensor * w_gate = gate->src[0];
+    const struct ggml_tensor * w_down = down->src[0];
+
+    const enum ggml_type vdt_gu   = type_traits_cpu[w_gate->type].vec_dot_type;
+    const enum ggml_type vdt_down = type_traits_cpu[w_down->type].vec_dot_type;
+
+    const int64_t n_as   = w_gate->ne[2];
+    const int64_t n_rows = ids->ne[0]*ids->ne[1];
+
+    size_t cur = 0;
+    // quantized src1
+    if (x->type != vdt_gu) {
+        cur += ggml_row_size(vdt_gu, x->ne[0])*x->ne[1]*x->ne[2] + sizeof(int64_t);
+    }
+    // offsets, items and rows per item of each expert
+    cur += (n_as + 1)*sizeof(int64_t) + sizeof(int64_t);
+    cur += 2*(n_as + 1)*sizeof(int64_t) + sizeof(int64_t);
+    cur += 2*n_as*sizeof(int64_t) + sizeof(int64_t);
+    // sorted rows
+    cur += n_rows*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
+    // quantized activations
+    if (vdt_down != GGML_TYPE_F32) {
+        cur += ggml_row_size(vdt_down, w_down->ne[0])*n_rows + sizeof(int64_t);
+    }
+    // chunk counters of the two phases
+    cur += 2*CACHE_LINE_SIZE + CACHE_LINE_SIZE;
+
+    return cur;
+}
+
+static void ggml_moe_glu_f32(enum ggml_glu_op op, const int n, float * y, const float * x, const float * g) {
+    switch (op) {
+        case GGML_GLU_OP_REGLU:       ggml_vec_reglu_f32      (n, y, x, g); break;
+        case GGML_GLU_OP_GEGLU:       ggml_vec_geglu_f32      (n, y, x, g); break;
+        case GGML_GLU_OP_SWIGLU:      ggml_vec_swiglu_f32     (n, y, x, g); break;
+        case GGML_GLU_OP_GEGLU_ERF:   ggml_vec_geglu_erf_f32  (n, y, x, g); break;
+        case GGML_GLU_OP_GEGLU_QUICK: ggml_vec_geglu_quick_f32(n, y, x, g); break;
+        default: GGML_ABORT("fatal error");
+    }
+}
+
+// split the nr rows of each expert in items of about the same cost (rows x tokens), aiming at a few items per thread
+static void ggml_moe_split_items(const int64_t * offs, int64_t n_as, int64_t nr, int64_t align, int nth, int64_t * items, int64_t * rows) {
+    const int64_t n_rows = offs[n_as];
+    const int64_t cost   = MAX((nr*n_rows + 4*nth - 1)/(4*nth), 1);
+
+    items[0] = 0;
+    for (int64_t e = 0; e < n_as; ++e) {
+        const int64_t cnt = offs[e + 1] - offs[e];
+
+        int64_t r = 0;
+        int64_t n = 0;
+        if (cnt > 0) {
+            r = (cost + cnt - 1)/cnt;
+            r = MIN(((r + align - 1)/align)*align, nr);
+            n = (nr + r - 1)/r;
+        }
+
+        rows[e]      = r;
+        items[e + 1] = items[e] + n;
+    }
+}
+
+// expert of an item
+static int64_t ggml_moe_item_expert(const int64_t * items, int64_t n_as, int64_t item) {
+    int64_t lo = 0;
+    int64_t hi = n_as - 1;
+    while (lo < hi) {
+        const int64_t mid = (lo + hi + 1)/2;
+        if (items[mid] <= item) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static void ggml_compute_forward_moe_ffn(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * glu,
+              struct ggml_tensor * down) {
+
+    const struct ggml_tensor * gate   = glu->src[0];
+    const struct ggml_tensor * up     = glu->src[1];
+    const struct ggml_tensor * x      = gate->src[1];
+    const struct ggml_tensor * ids    = gate->src[2];
+    const struct ggml_tensor * w_gate = gate->src[0];
+    const struct ggml_tensor * w_up   = up->src[0];
+    const struct ggml_tensor * w_down = down->src[0];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const enum ggml_glu_op op = ggml_get_glu_op(glu);
+
+    const enum ggml_type   vdt_gu       = type_traits_cpu[w_gate->type].vec_dot_type;
+    const enum ggml_type   vdt_down     = type_traits_cpu[w_down->type].vec_dot_type;
+    ggml_vec_dot_t   const vec_dot_gu   = type_traits_cpu[w_gate->type].vec_dot;
+    ggml_vec_dot_t   const vec_dot_down = type_traits_cpu[w_down->type].vec_dot;
+
+    const int64_t n_embd   = x->ne[0];
+    const int64_t ne11     = x->ne[1];
+    const int64_t n_tokens = x->ne[2];
+    const int64_t n_ff     = w_gate->ne[1];
+    const int64_t n_as     = w_gate->ne[2];
+    const int64_t n_out    = w_down->ne[1];
+    const int     n_ids    = ids->ne[0];
+    const int64_t n_rows   = (int64_t) n_ids*n_tokens;
+
+    GGML_ASSERT(ids->ne[1] == n_tokens);
+
+    const size_t row_size_gu   = ggml_row_size(vdt_gu,   n_embd);
+    const size_t row_size_down = ggml_row_size(vdt_down, n_ff);
+
+    void * wdata_cur = params->wdata;
+
+    char * qx = NULL; // [n_tokens][ne11] rows of src1 in vdt_gu
+    if (x->type != vdt_gu) {
+        qx = incr_ptr_aligned(&wdata_cur, row_size_gu*ne11*n_tokens, sizeof(int64_t));
+    }
+
+    int64_t * offs  = incr_ptr_aligned(&wdata_cur, (n_as + 1)*sizeof(int64_t), sizeof(int64_t)); // [n_as + 1]
+    int64_t * items = incr_ptr_aligned(&wdata_cur, 2*(n_as + 1)*sizeof(int64_t), sizeof(int64_t)); // [2][n_as + 1]
+    int64_t * rows  = incr_ptr_aligned(&wdata_cur, 2*n_as*sizeof(int64_t), sizeof(int64_t)); // [2][n_as]
+
+    struct mmid_row_mapping * sorted = // [n_rows], grouped by expert
+        incr_ptr_aligned(&wdata_cur, n_rows*sizeof(struct mmid_row_mapping), sizeof(int64_t));
+
+    char * qh = NULL; // [n_rows] activations in vdt_down, in sorted order
+    if (vdt_down != GGML_TYPE_F32) {
+        qh = incr_ptr_aligned(&wdata_cur, row_size_down*n_rows, sizeof(int64_t));
+    }
+
+    char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [2]
+        incr_ptr_aligned(&wdata_cur, 2*CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+
+    GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
+
+    // quantize src1 once for the gate and up projections
+    if (qx) {
+        ggml_from_float_t const from_float = type_traits_cpu[vdt_gu].from_float;
+
+        const int64_t nr = ne11*n_tokens;
+        if (nr >= nth) {
+            for (int64_t ir = ith; ir < nr; ir += nth) {
+                from_float((const float *) ((const char *) x->data + (ir % ne11)*x->nb[1] + (ir / ne11)*x->nb[2]),
+                           qx + ir*row_size_gu, n_embd);
+            }
+        } else {
+            // few rows: split each row by blocks
+            const int64_t bs = ggml_blck_size(vdt_gu);
+            const int64_t b0 = (ith*(n_embd/bs))/nth;
+            const int64_t b1 = ((ith + 1)*(n_embd/bs))/nth;
+            for (int64_t ir = 0; ir < nr; ++ir) {
+                from_float((const float *) ((const char *) x->data + (ir % ne11)*x->nb[1] + (ir / ne11)*x->nb[2]) + b0*bs,
+                           qx + ir*row_size_gu + b0*ggml_type_size(vdt_gu), (b1 - b0)*bs);
+            }
+        }
+    }
+
+    if (ith == 0) {
+        // sort the rows by expert
+        memset(offs, 0, (n_as + 1)*sizeof(int64_t));
+        for (int64_t it = 0; it < n_tokens; ++it) {
+            for (int id = 0; id < n_ids; ++id) {
+                const int32_t e = *(const int32_t *) ((const char *) ids->data + it*ids->nb[1] + id*ids->nb[0]);
+                assert(e >= 0 && e < n_as);
+                offs[e + 1]++;
+            }
+        }
+        for (int64_t e = 0; e < n_as; ++e) {
+            offs[e + 1] += offs[e];
+        }
+
+        int64_t * pos = rows; // temporary fill position of each expert, overwritten below
+        memcpy(pos, offs, n_as*sizeof(int64_t));
+        for (int64_t it = 0; it < n_tokens; ++it) {
+            for (int id = 0; id < n_ids; ++id) {
+                const int32_t e = *(const int32_t *) ((const char *) ids->data + it*ids->nb[1] + id*ids->nb[0]);
+                sorted[pos[e]++] = (struct mmid_row_mapping) {id, (int32_t) it};
+            }
+        }
+
+        // gate/up items cover whole quantization blocks of the activations
+        const int64_t align_ff = qh ? MAX(ggml_blck_size(vdt_down), GGML_MOE_TILE) : GGML_MOE_TILE;
+
+        ggml_moe_split_items(offs, n_as, n_ff,  align_ff,       nth, items,            rows);
+        ggml_moe_split_items(offs, n_as, n_out, GGML_MOE_TILE,  nth, items + n_as + 1, rows + n_as);
+
+        for (int p = 0; p < 2; ++p) {
+            atomic_store_explicit((atomic_int *) atomic_current_chunk[p], nth, memory_order_relaxed);
+        }
+    }
+
+    ggml_barrier(params->threadpool);
+
+    // gate + up + activation
+    {
+        ggml_from_float_t const from_float = type_traits_cpu[vdt_down].from_float;
+
+        const int64_t n_items = items[n_as];
+
+        int item = ith;
+        while (item < n_items) {
+            const int64_t e   = ggml_moe_item_expert(items, n_as, item);
+            const int64_t ir0 = (item - items[e])*rows[e];
+            const int64_t ir1 = MIN(ir0 + rows[e], n_ff);
+
+            const char * w_gate_e = (const char *) w_gate->data + e*w_gate->nb[2];
+            const char * w_up_e   = (const char *) w_up->data   + e*w_up->nb[2];
+
+            float g[GGML_MOE_TILE];
+            float u[GGML_MOE_TILE];
+
+            // keep a block of rows of both matrices in cache while all the tokens of the expert go through it
+            for (int64_t irb = ir0; irb < ir1; irb += GGML_MOE_ROW_BLOCK) {
+                const int64_t irb1 = MIN(irb + GGML_MOE_ROW_BLOCK, ir1);
+                for (int64_t it0 = offs[e]; it0 < offs[e + 1]; it0 += GGML_MOE_TILE) {
+                    const int64_t it1 = MIN(it0 + GGML_MOE_TILE, offs[e + 1]);
+                    for (int64_t ir = irb; ir < irb1; ir += GGML_MOE_TILE) {
+                        const int64_t nr = MIN(GGML_MOE_TILE, irb1 - ir);
+                        for (int64_t it = it0; it < it1; ++it) {
+                            const struct mmid_row_mapping m = sorted[it];
+
+                            const char * src1_row = qx
+                                ? qx + (m.i1 % ne11 + m.i2*ne11)*row_size_gu
+                                : (const char *) x->data + (m.i1 % ne11)*x->nb[1] + m.i2*x->nb[2];
+
+                            for (int64_t r = 0; r < nr; ++r) {
+                                vec_dot_gu(n_embd, &g[r], 0, w_gate_e + (ir + r)*w_gate->nb[1], 0, src1_row, 0, 1);
+                                vec_dot_gu(n_embd, &u[r], 0, w_up_e   + (ir + r)*w_up->nb[1],   0, src1_row, 0, 1);
+                            }
+
+                            float * dst_row = (float *) ((char *) glu->data + m.i1*glu->nb[1] + m.i2*glu->nb[2]);
+                            ggml_moe_glu_f32(op, nr, dst_row + ir, g, u);
+                        }
+                    }
+                }
+            }
+
+            // quantize this slice of the activations for the down projection
+            if (qh) {
+                const size_t offs_q = (ir0/ggml_blck_size(vdt_down))*ggml_type_size(vdt_down);
+                for (int64_t it = offs[e]; it < offs[e + 1]; ++it) {
+                    const struct mmid_row_mapping m = sorted[it];
+                    const float * src_row = (const float *) ((const char *) glu->data + m.i1*glu->nb[1] + m.i2*glu->nb[2]);
+                    from_float(src_row + ir0, qh + it*row_size_down + offs_q, ir1 - ir0);
+                }
+            }
+
+            item = atomic_fetch_add_explicit((atomic_int *) atomic_current_chunk[0], 1, memory_order_relaxed);
+        }
+    }
+
+    ggml_barrier(params->threadpool);
+
+    // down
+    {
+        const int64_t * items_down = items + n_as + 1;
+        const int64_t * rows_down  = rows  + n_as;
+
+        const int64_t n_items = items_down[n_as];
+
+        float tmp[GGML_MOE_TILE];
+
+        int item = ith;
+        while (item < n_items) {
+            const int64_t e   = ggml_moe_item_expert(items_down, n_as, item);
+            const int64_t ir0 = (item - items_down[e])*rows_down[e];
+            const int64_t ir1 = MIN(ir0 + rows_down[e], n_out);
+
+            const char * w_down_e = (const char *) w_down->data + e*w_down->nb[2];
+
+            for (int64_t irb = ir0; irb < ir1; irb += GGML_MOE_ROW_BLOCK) {
+                const int64_t irb1 = MIN(irb + GGML_MOE_ROW_BLOCK, ir1);
+                for (int64_t it0 = offs[e]; it0 < offs[e + 1]; it0 += GGML_MOE_TILE) {
+                    const int64_t it1 = MIN(it0 + GGML_MOE_TILE, offs[e + 1]);
+                    for (int64_t ir = irb; ir < irb1; ir += GGML_MOE_TILE) {
+                        const int64_t nr = MIN(GGML_MOE_TILE, irb1 - ir);
+                        for (int64_t it = it0; it < it1; ++it) {
+                            const struct mmid_row_mapping m = sorted[it];
+
+                            const char * src1_row = qh
+                                ? qh + it*row_size_down
+                                : (const char *) glu->data + m.i1*glu->nb[1] + m.i2*glu->nb[2];
+
+                            for (int64_t r = 0; r < nr; ++r) {
+                                vec_dot_down(n_ff, &tmp[r], 0, w_down_e + (ir + r)*w_down->nb[1], 0, src1_row, 0, 1);
+                            }
+
+                            float * dst_row = (float *) ((char *) down->data + m.i1*down->nb[1] + m.i2*down->nb[2]);
+                            memcpy(dst_row + ir, tmp, nr*sizeof(float));
+                        }
+                    }
+                }
+            }
+
+            item = atomic_fetch_add_explicit((atomic_int *) atomic_current_chunk[1], 1, memory_order_relaxed);
+        }
+    }
+}
+
+// elementwise chains: [ADD ->] RMS_NORM -> MUL and UNARY(SILU) -> MUL
+// these ops are memory bound, fusing them avoids writing and reading back the intermediate tensors
+
+static bool ggml_cpu_is_f32_rows(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->nb[0] == sizeof(float) && t->extra == NULL;
+}
+
+// the operand of a binary op that is not src
+static const struct ggml_tensor * ggml_cpu_other_src(const struct ggml_tensor * node, const struct ggml_tensor * src) {
+    return node->src[0] == src ? node->src[1] : node->src[0];
+}
+
+static bool ggml_cpu_can_fuse_rms_norm_mul(const struct ggml_cgraph * cgraph, int node_idx) {
+    if (node_idx + 2 > cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * norm = cgraph->nodes[node_idx + 0];
+    const struct ggml_tensor * mul  = cgraph->nodes[node_idx + 1];
+
+    if (norm->op != GGML_OP_RMS_NORM || mul->op != GGML_OP_MUL) {
+        return false;
+    }
+
+    if ((mul->src[0] != norm && mul->src[1] != norm) || !ggml_node_has_n_uses(cgraph, node_idx, 1)) {
+        return false;
+    }
+
+    // the norm weight, broadcast over the rows
+    const struct ggml_tensor * w = ggml_cpu_other_src(mul, norm);
+
+    return w != norm &&
+        ggml_cpu_is_f32_rows(norm->src[0]) && ggml_cpu_is_f32_rows(norm) && ggml_cpu_is_f32_rows(mul) && ggml_cpu_is_f32_rows(w) &&
+        ggml_are_same_shape(norm, mul) &&
+        w->ne[0] == norm->ne[0] && ggml_can_repeat(w, norm) &&
+        ggml_cpu_fused_can_write(mul, norm->src[0]) && ggml_cpu_fused_can_write(mul, w);
+}
+
+static bool ggml_cpu_can_fuse_add_rms_norm_mul(const struct ggml_cgraph * cgraph, int node_idx) {
+    if (node_idx + 3 > cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * add  = cgraph->nodes[node_idx + 0];
+    const struct ggml_tensor * norm = cgraph->nodes[node_idx + 1];
+    const struct ggml_tensor * mul  = cgraph->nodes[node_idx + 2];
+
+    if (add->op != GGML_OP_ADD || norm->src[0] != add || !ggml_cpu_can_fuse_rms_norm_mul(cgraph, node_idx + 1)) {
+        return false;
+    }
+
+    // the result of the add is stored as well, so it may have other uses
+    return ggml_cpu_is_f32_rows(add->src[0]) && ggml_cpu_is_f32_rows(add->src[1]) &&
+        ggml_are_same_shape(add, add->src[0]) && ggml_are_same_shape(add, add->src[1]) &&
+        ggml_cpu_fused_can_write(add, add->src[0]) && ggml_cpu_fused_can_write(add, add->src[1]) &&
+        ggml_cpu_fused_can_write(mul, add->src[0]) && ggml_cpu_fused_can_write(mul, add->src[1]);
+}
+
+static bool ggml_cpu_can_fuse_silu_mul(const struct ggml_cgraph * cgraph, int node_idx) {
+    if (node_idx + 2 > cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * silu = cgraph->nodes[node_idx + 0];
+    const struct ggml_tensor * mul  = cgraph->nodes[node_idx + 1];
+
+    if (silu->op != GGML_OP_UNARY || ggml_get_unary_op(silu) != GGML_UNARY_OP_SILU || mul->op != GGML_OP_MUL) {
+        return false;
+    }
+
+    if ((mul->src[0] != silu && mul->src[1] != silu) || !ggml_node_has_n_uses(cgraph, node_idx, 1)) {
+        return false;
+    }
+
+    const struct ggml_tensor * g = ggml_cpu_other_src(mul, silu);
+
+    return g != silu &&
+        ggml_cpu_is_f32_rows(silu->src[0]) && ggml_cpu_is_f32_rows(g) && ggml_cpu_is_f32_rows(mul) &&
+        ggml_are_same_shape(silu->src[0], mul) && ggml_are_same_shape(g, mul) &&
+        ggml_cpu_fused_can_write(mul, silu->src[0]) && ggml_cpu_fused_can_write(mul, g);
+}
+
+// sequences of nodes computed by a single fused kernel
+// returns the number of nodes starting at node_idx that are fused, or 0
+static int ggml_cpu_fused_n_nodes(const struct ggml_cgraph * cgraph, int node_idx) {
+    if (ggml_cpu_disable_fusion) {
+        return 0;
+    }
+
+    switch (cgraph->nodes[node_idx]->op) {
+        case GGML_OP_MUL_MAT_ID:
+            if (ggml_cpu_can_fuse_moe(cgraph, node_idx)) {
+                return 4;
+            }
+            break;
+        case GGML_OP_ADD:
+            if (ggml_cpu_can_fuse_add_rms_norm_mul(cgraph, node_idx)) {
+                return 3;
+            }
+            break;
+        case GGML_OP_RMS_NORM:
+            if (ggml_cpu_can_fuse_rms_norm_mul(cgraph, node_idx)) {
+                return 2;
+            }
+            break;
+        case GGML_OP_UNARY:
+            if (ggml_cpu_can_fuse_silu_mul(cgraph, node_idx)) {
+                return 2;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static void ggml_compute_forward_fused(struct ggml_compute_params * params, const struct ggml_cgraph * cgraph, int node_idx) {
+    struct ggml_tensor * node = cgraph->nodes[node_idx];
+
+    switch (node->op) {
+        case GGML_OP_MUL_MAT_ID:
+            {
+                ggml_compute_forward_moe_ffn(params, cgraph->nodes[node_idx + 2], cgraph->nodes[node_idx + 3]);
+            } break;
+        case GGML_OP_ADD:
+            {
+                ggml_compute_forward_rms_norm_mul_fused(params, node, cgraph->nodes[node_idx + 1], cgraph->nodes[node_idx + 2]);
+            } break;
+        case GGML_OP_RMS_NORM:
+            {
+                ggml_compute_forward_rms_norm_mul_fused(params, NULL, node, cgraph->nodes[node_idx + 1]);
+            } break;
+        case GGML_OP_UNARY:
+            {
+                ggml_compute_forward_silu_mul_fused(params, node, cgraph->nodes[node_idx + 1]);
+            } break;
+        default:
+            GGML_ABORT("fatal error");
+    }
+}
+
+static size_t ggml_cpu_fused_work_size(const struct ggml_cgraph * cgraph, int node_idx) {
+    struct ggml_tensor * node = cgraph->nodes[node_idx];
+
+    switch (node->op) {
+        case GGML_OP_MUL_MAT_ID:
+            return ggml_cpu_moe_work_size(cgraph->nodes[node_idx + 2], cgraph->nodes[node_idx + 3]);
+        case GGML_OP_ADD:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_UNARY:
+            return 0;
+        default:
+            GGML_ABORT("fatal error");
+    }
+}
+
 /////////////////////////////////
 
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
@@ -2601,6 +3355,7 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
 
     const size_t workers_size = sizeof(struct ggml_compute_state) * n_threads;
     ggml_aligned_free(threadpool->workers, workers_size);
+    free(threadpool->mm_tune);
     ggml_aligned_free(threadpool, sizeof(struct ggml_threadpool));
 }
 
@@ -2643,6 +3398,50 @@ void ggml_threadpool_resume(struct ggml_threadpool * threadpool) {
 #endif
 }
 
+// size of the region after the buffer of the ops that holds the src1 of MUL_MAT converted to vec_dot_type, so that it is
+// not overwritten by the ops in between and the following MUL_MATs with the same src1 can reuse it
+// it is computed again by ggml_graph_compute rather than stored in the public ggml_cplan
+static size_t ggml_graph_work_size_src1(const struct ggml_cgraph * cgraph, int n_threads) {
+    size_t size = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        size_t cur = 0;
+        if (node->op != GGML_OP_MUL_MAT || ggml_cpu_fused_n_nodes(cgraph, i) > 0 || ggml_cpu_extra_work_size(n_threads, node, &cur)) {
+            continue;
+        }
+
+        const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
+
+        if (node->src[1]->type != vec_dot_type) {
+            size = MAX(size, ggml_row_size(vec_dot_type, ggml_nelements(node->src[1])));
+        }
+    }
+
+    return GGML_PAD(size, CACHE_LINE_SIZE);
+}
+
+// size of the region at the end of the work buffer that holds the cos and sin of every position, kept for the following
+// ROPEs. like the src1 region, it is not stored in ggml_cplan
+static size_t ggml_graph_work_size_rope(const struct ggml_cgraph * cgraph, int n_threads) {
+    size_t size = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        size_t cur = 0;
+        if ((node->op != GGML_OP_ROPE && node->op != GGML_OP_ROPE_BACK) ||
+                ggml_cpu_fused_n_nodes(cgraph, i) > 0 || ggml_cpu_extra_work_size(n_threads, node, &cur)) {
+            continue;
+        }
+
+        size = MAX(size, 2 * ggml_type_size(GGML_TYPE_F32) * node->ne[0] * node->ne[2]);
+    }
+
+    return size;
+}
+
 struct ggml_cplan ggml_graph_plan(
           const struct ggml_cgraph * cgraph,
                                int   n_threads,
@@ -2656,6 +3455,8 @@ struct ggml_cplan ggml_graph_plan(
     }
 
     size_t work_size = 0;
+    size_t work_size_src1 = ggml_graph_work_size_src1(cgraph, n_threads);
+    size_t work_size_rope = ggml_graph_work_size_rope(cgraph, n_threads);
 
     struct ggml_cplan cplan;
     memset(&cplan, 0, sizeof(struct ggml_cplan));
@@ -2672,7 +3473,9 @@ struct ggml_cplan ggml_graph_plan(
 
         size_t cur = 0;
 
-        if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
+        if (ggml_cpu_fused_n_nodes(cgraph, i) > 0) {
+            cur = ggml_cpu_fused_work_size(cgraph, i);
+        } else if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
             switch (node->op) {
                 case GGML_OP_CPY:
                 case GGML_OP_DUP:
@@ -2702,14 +3505,6 @@ struct ggml_cplan ggml_graph_plan(
                     {
                         cur = ggml_type_size(node->type)*n_tasks;
                     } break;
-                case GGML_OP_MUL_MAT:
-                    {
-                        const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
-
-                        if (node->src[1]->type != vec_dot_type) {
-                            cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
-                        }
-                    } break;
                 case GGML_OP_MUL_MAT_ID:
                     {
                         cur = 0;
@@ -2736,6 +3531,9 @@ struct ggml_cplan ggml_graph_plan(
                         }
                     } break;
                 case GGML_OP_SOFT_MAX:
+                    {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                    } break;
                 case GGML_OP_ROPE:
                 case GGML_OP_ROPE_BACK:
                     {
@@ -2789,7 +3587,12 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        // per thread: the state of a work unit (queries, accumulators, KQ tile) and one V row,
+                        // followed by the partial results of two units for the split-KV path
+                        const int64_t n_state = GGML_FA_TILE_Q*(ne10 + ne20 + 2 + GGML_FA_TILE_KV) + ne20 + CACHE_LINE_SIZE_F32;
+                        const int64_t n_parts = 2*GGML_FA_TILE_Q*(ne20 + 2);
+
+                        cur = sizeof(float)*(n_state + n_parts)*n_tasks;
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2828,10 +3631,14 @@ struct ggml_cplan ggml_graph_plan(
         work_size += CACHE_LINE_SIZE*(n_threads);
     }
 
-    cplan.threadpool = threadpool;
-    cplan.n_threads  = MIN(max_tasks, n_threads);
-    cplan.work_size  = work_size;
-    cplan.work_data  = NULL;
+    if (work_size_src1 > 0 || work_size_rope > 0) {
+        work_size = GGML_PAD(work_size, CACHE_LINE_SIZE) + work_size_src1 + work_size_rope;
+    }
+
+    cplan.threadpool     = threadpool;
+    cplan.n_threads      = MIN(max_tasks, n_threads);
+    cplan.work_size      = work_size;
+    cplan.work_data      = NULL;
 
     return cplan;
 }
@@ -2845,18 +3652,29 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     set_numa_thread_affinity(state->ith);
 
+    ggml_cur_state = state;
+
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
         /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
-        /*.wsize     =*/ cplan->work_size,
+        /*.wsize     =*/ cplan->work_size - tp->work_size_src1 - tp->work_size_rope,
         /*.wdata     =*/ cplan->work_data,
         /*.threadpool=*/ tp,
+        /*.mm_tune   =*/ NULL,
     };
 
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        params.mm_tune = tp->mm_tune_valid && node->op == GGML_OP_MUL_MAT ? &tp->mm_tune[node_n] : NULL;
+
+        const int n_fused = ggml_cpu_fused_n_nodes(cgraph, node_n);
+        if (n_fused > 0) {
+            ggml_compute_forward_fused(&params, cgraph, node_n);
+            node_n += n_fused - 1;
+        } else {
+            ggml_compute_forward(&params, node);
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
@@ -3029,21 +3847,30 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
     struct ggml_threadpool * threadpool =
         ggml_aligned_malloc(sizeof(struct ggml_threadpool));
     {
-        threadpool->cgraph           = cgraph;
-        threadpool->cplan            = cplan;
-        threadpool->n_graph          = 0;
-        threadpool->n_barrier        = 0;
-        threadpool->n_barrier_passed = 0;
-        threadpool->current_chunk    = 0;
-        threadpool->stop             = false;
-        threadpool->pause            = tpp->paused;
-        threadpool->abort            = -1;
-        threadpool->workers          = NULL;
-        threadpool->n_threads_max    = tpp->n_threads;
-        threadpool->n_threads_cur    = tpp->n_threads;
-        threadpool->poll             = tpp->poll;
-        threadpool->prio             = tpp->prio;
-        threadpool->ec               = GGML_STATUS_SUCCESS;
+        threadpool->cgraph             = cgraph;
+        threadpool->cplan              = cplan;
+        threadpool->n_graph            = 0;
+        threadpool->n_barrier          = 0;
+        threadpool->n_barrier_passed   = 0;
+        threadpool->n_barrier_sleepers = 0;
+        threadpool->current_chunk      = 0;
+        threadpool->mm_src1            = NULL;
+        threadpool->mm_src1_type       = GGML_TYPE_COUNT;
+        threadpool->work_size_src1     = 0;
+        threadpool->rope_node          = NULL;
+        threadpool->work_size_rope     = 0;
+        threadpool->mm_tune            = NULL;
+        threadpool->mm_tune_size       = 0;
+        threadpool->mm_tune_valid      = false;
+        threadpool->stop               = false;
+        threadpool->pause              = tpp->paused;
+        threadpool->abort              = -1;
+        threadpool->workers            = NULL;
+        threadpool->n_threads_max      = tpp->n_threads;
+        threadpool->n_threads_cur      = tpp->n_threads;
+        threadpool->poll               = tpp->poll;
+        threadpool->prio               = tpp->prio;
+        threadpool->ec                 = GGML_STATUS_SUCCESS;
     }
 
     // Allocate and init workers state
@@ -3054,6 +3881,13 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
     for (int j = 0; j < tpp->n_threads; j++) {
         workers[j].threadpool = threadpool;
         workers[j].ith        = j;
+#ifndef GGML_USE_OPENMP
+        workers[j].barrier_spin = GGML_BARRIER_MAX_SPIN;
+#endif
+    }
+
+    for (int j = 0; j < GGML_BARRIER_MAX_GROUPS; j++) {
+        threadpool->barrier_groups[j].n_arrived = 0;
     }
 
     threadpool->workers = workers;
@@ -3092,7 +3926,8 @@ struct ggml_threadpool * ggml_threadpool_new(struct ggml_threadpool_params * tpp
     return ggml_threadpool_new_impl(tpp, NULL, NULL);
 }
 
-enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+// tune: configuration of all the MUL_MAT nodes, NULL to use the tuned ones
+static enum ggml_status ggml_graph_compute_impl(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan, const struct ggml_mul_mat_tune_cfg * tune) {
     ggml_cpu_init();
 
     GGML_ASSERT(cplan);
@@ -3102,6 +3937,10 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     int n_threads                               = cplan->n_threads;
     struct ggml_threadpool * threadpool = cplan->threadpool;
 
+    const size_t work_size_src1 = ggml_graph_work_size_src1(cgraph, n_threads);
+    const size_t work_size_rope = ggml_graph_work_size_rope(cgraph, n_threads);
+    GGML_ASSERT(cplan->work_size >= work_size_src1 + work_size_rope);
+
     bool disposable_threadpool = false;
 
     if (threadpool == NULL) {
@@ -3116,10 +3955,36 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->cgraph           = cgraph;
         threadpool->cplan            = cplan;
         threadpool->current_chunk    = 0;
+        threadpool->mm_src1          = NULL;
+        threadpool->mm_src1_type     = GGML_TYPE_COUNT;
+        threadpool->rope_node        = NULL;
         threadpool->abort            = -1;
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    // no worker thread runs the graph before the kickoff
+    threadpool->work_size_src1 = work_size_src1;
+    threadpool->work_size_rope = work_size_rope;
+
+    // the tuned mul_mat configurations are looked up once per graph, with the number of threads of the plan
+    threadpool->mm_tune_valid = false;
+    if (tune != NULL || ggml_mul_mat_tune_active()) {
+        if (threadpool->mm_tune_size < cgraph->n_nodes) {
+            free(threadpool->mm_tune);
+            threadpool->mm_tune      = malloc(sizeof(struct ggml_mul_mat_tune_cfg) * cgraph->n_nodes);
+            threadpool->mm_tune_size = cgraph->n_nodes;
+            GGML_ASSERT(threadpool->mm_tune != NULL);
+        }
+        if (tune != NULL) {
+            for (int i = 0; i < cgraph->n_nodes; i++) {
+                threadpool->mm_tune[i] = *tune;
+            }
+            threadpool->mm_tune_valid = true;
+        } else {
+            threadpool->mm_tune_valid = ggml_mul_mat_tune_resolve(cgraph, n_threads, threadpool->mm_tune);
+        }
+    }
+
 #ifdef GGML_USE_OPENMP
     if (n_threads > 1) {
         #pragma omp parallel num_threads(n_threads)
@@ -3162,6 +4027,14 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     return ret;
 }
 
+enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+    return ggml_graph_compute_impl(cgraph, cplan, NULL);
+}
+
+enum ggml_status ggml_graph_compute_mul_mat_tune(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan, const struct ggml_mul_mat_tune_cfg * cfg) {
+    return ggml_graph_compute_impl(cgraph, cplan, cfg);
+}
+
 enum ggml_status ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads) {
     struct ggml_cplan cplan = ggml_graph_plan(cgraph, n_threads, NULL);
 
@@ -3357,6 +4230,14 @@ int ggml_cpu_has_amx_int8(void) {
 #endif
 }
 
+int ggml_cpu_has_amx_bf16(void) {
+#if defined(__AMX_BF16__)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 int ggml_cpu_has_bmi2(void) {
 #if defined(__BMI2__)
     return 1;
@@ -3559,6 +4440,10 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        ggml_cpu_disable_fusion = getenv("GGML_CPU_DISABLE_FUSION") != NULL;
+
+        ggml_mul_mat_tune_init();
+
         is_first_call = false;
     }
 
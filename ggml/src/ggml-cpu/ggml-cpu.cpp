@@ -5,6 +5,7 @@
 #include "traits.h"
 #include "ggml-impl.h"
 #include "amx/amx.h"
+#include "mm-tune.h"
 
 #include <cctype>
 #include <string>
@@ -81,6 +82,12 @@ static bool ggml_backend_cpu_is_extra_buffer_type(ggml_backend_buffer_type_t buf
             return true;
         }
     }
+#ifdef GGML_USE_CPU_REPACK
+    // not offered for weight placement, only used for weights that are stored repacked
+    if (buft == ggml_backend_cpu_prepacked_buffer_type()) {
+        return true;
+    }
+#endif
     return false;
 }
 
@@ -120,6 +127,10 @@ static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend
 
     struct ggml_backend_plan_cpu * cpu_plan = new ggml_backend_plan_cpu;
 
+    if (ggml_mul_mat_tune_enabled()) {
+        ggml_mul_mat_tune_auto(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+    }
+
     cpu_plan->cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
     cpu_plan->cgraph = *cgraph; // FIXME: deep copy
 
@@ -157,6 +168,10 @@ static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backe
 static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
 
+    if (ggml_mul_mat_tune_enabled()) {
+        ggml_mul_mat_tune_auto(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+    }
+
     struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
 
     if (cpu_ctx->work_size < cplan.work_size) {
@@ -542,6 +557,9 @@ static ggml_backend_feature * ggml_backend_cpu_get_features(ggml_backend_reg_t r
         if (ggml_cpu_has_amx_int8()) {
             features.push_back({ "AMX_INT8", "1" });
         }
+        if (ggml_cpu_has_amx_bf16()) {
+            features.push_back({ "AMX_BF16", "1" });
+        }
         if (ggml_cpu_has_neon()) {
             features.push_back({ "NEON", "1" });
         }
@@ -644,6 +662,26 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
         return (void *)ggml_backend_cpu_set_threadpool;
     }
 
+#ifdef GGML_USE_CPU_REPACK
+    // weights stored repacked
+    if (strcmp(name, "ggml_backend_cpu_repack_layout") == 0) {
+        ggml_backend_cpu_repack_layout_t fct = ggml_backend_cpu_repack_layout;
+        return (void *)fct;
+    }
+    if (strcmp(name, "ggml_backend_cpu_repack_tensor") == 0) {
+        ggml_backend_cpu_repack_tensor_t fct = ggml_backend_cpu_repack_tensor;
+        return (void *)fct;
+    }
+    if (strcmp(name, "ggml_backend_cpu_prepacked_buffer_type") == 0) {
+        ggml_backend_cpu_prepacked_buffer_type_t fct = ggml_backend_cpu_prepacked_buffer_type;
+        return (void *)fct;
+    }
+    if (strcmp(name, "ggml_backend_cpu_prepacked_buffer_from_ptr") == 0) {
+        ggml_backend_cpu_prepacked_buffer_from_ptr_t fct = ggml_backend_cpu_prepacked_buffer_from_ptr;
+        return (void *)fct;
+    }
+#endif
+
     return NULL;
 
     GGML_UNUSED(reg);
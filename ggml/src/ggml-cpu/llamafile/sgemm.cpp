@@ -53,6 +53,7 @@
 #include "ggml-cpu-impl.h"
 #include "ggml-quants.h"
 #include "simd-mappings.h"
+#include "mm-tune.h"
 
 #include <array>
 #include <type_traits>
@@ -335,44 +336,47 @@ class tinyBLAS {
     tinyBLAS(const ggml_compute_params * params, int64_t k,
              const TA *A, int64_t lda,
              const TB *B, int64_t ldb,
-             TC *C, int64_t ldc)
-        : params(params), A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc) {
+             TC *C, int64_t ldc,
+             const ggml_mul_mat_tune_cfg * tune = nullptr)
+        : params(params), A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc),
+          BM(tune ? tune->sgemm_bm : 0), BN(tune ? tune->sgemm_bn : 0) {
     }
 
     bool matmul(int64_t m, int64_t n) {
         if (k % KN != 0)
             return false;
         // compute RM for only need tile with size RM&RM-1
+        // BM and BN come from the autotuner, 0 keeps the heuristics
 #if VECTOR_REGISTERS == 32
-        if (m % 16 == 0 && (m/16 >= params->nth)) {
+        if (m % 16 == 0 && (BM == 4 || (BM == 0 && m/16 >= params->nth))) {
             const int64_t SIZE_N = BLOCK_SIZE<6>(n);
-            mnpack<4, 6, 4>(m, n, SIZE_N, 12);
+            mnpack<4, 6, 4>(m, n, SIZE_N, BN > 0 ? BN : 12);
             return true;
         }
-        if (m % 8 == 0 ) {
+        if (m % 8 == 0 && BM != 1) {
             const int64_t SIZE_N = BLOCK_SIZE<6>(n);
-            mnpack<4, 6, 2>(m, n, SIZE_N, 12);
+            mnpack<4, 6, 2>(m, n, SIZE_N, BN > 0 ? BN : 12);
             return true;
         }
         if (m % 4 == 0) {
             const int64_t SIZE_N = BLOCK_SIZE<6>(n);
-            mnpack<4, 6, 1>(m, n, SIZE_N, 12);
+            mnpack<4, 6, 1>(m, n, SIZE_N, BN > 0 ? BN : 12);
             return true;
         }
 #else  // VECTOR_REGISTERS == 16
-        if (m % 16 == 0 && (m/16 >= params->nth)) {
+        if (m % 16 == 0 && (BM == 4 || (BM == 0 && m/16 >= params->nth))) {
             const int64_t SIZE_N = BLOCK_SIZE<3>(n);
-            mnpack<4, 3, 4>(m, n, SIZE_N, 24);
+            mnpack<4, 3, 4>(m, n, SIZE_N, BN > 0 ? BN : 24);
             return true;
         }
-        if (m % 8 == 0 ) {
+        if (m % 8 == 0 && BM != 1) {
             const int64_t SIZE_N = BLOCK_SIZE<3>(n);
-            mnpack<4, 3, 2>(m, n, SIZE_N, 24);
+            mnpack<4, 3, 2>(m, n, SIZE_N, BN > 0 ? BN : 24);
             return true;
         }
         if (m % 4 == 0) {
             const int64_t SIZE_N = BLOCK_SIZE<3>(n);
-            mnpack<4, 3, 1>(m, n, SIZE_N, 24);
+            mnpack<4, 3, 1>(m, n, SIZE_N, BN > 0 ? BN : 24);
             return true;
         }
 #endif
@@ -487,6 +491,8 @@ class tinyBLAS {
     const int64_t lda;
     const int64_t ldb;
     const int64_t ldc;
+    const int BM;
+    const int BN;
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -2555,11 +2561,13 @@ class tinyBLAS_PPC {
  * @param Atype is GGML data type of `A`
  * @param Btype is GGML data type of `B`
  * @param Ctype is GGML data type of `C`
+ * @param tune is the configuration picked by the mul_mat autotuner, or NULL
  * @return true if this function was able to service the matmul request
  */
 bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64_t n, int64_t k,
                      const void *A, int64_t lda, const void *B, int64_t ldb, void *C,
-                     int64_t ldc, int Atype, int Btype, int Ctype) {
+                     int64_t ldc, int Atype, int Btype, int Ctype,
+                     const struct ggml_mul_mat_tune_cfg * tune) {
 
     assert(m >= 0);
     assert(n >= 0);
@@ -2588,13 +2596,13 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
         tinyBLAS<16, __m512, __m512, float, float, float> tb{ params,
             k, (const float *)A, lda,
             (const float *)B, ldb,
-            (float *)C, ldc};
+            (float *)C, ldc, tune};
         return tb.matmul(m, n);
 #elif defined(__AVX__) || defined(__AVX2__)
         tinyBLAS<8, __m256, __m256, float, float, float> tb{ params,
             k, (const float *)A, lda,
             (const float *)B, ldb,
-            (float *)C, ldc};
+            (float *)C, ldc, tune};
         return tb.matmul(m, n);
 #elif defined(__ARM_NEON)
         if (n < 4)
@@ -2602,7 +2610,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
         tinyBLAS<4, float32x4_t, float32x4_t, float, float, float> tb{ params,
             k, (const float *)A, lda,
             (const float *)B, ldb,
-            (float *)C, ldc};
+            (float *)C, ldc, tune};
         return tb.matmul(m, n);
 #elif defined(__VXE__) || defined(__VXE2__)
         if (n < 4)
@@ -2610,7 +2618,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
         tinyBLAS<4, float32x4_t, float32x4_t, float, float, float> tb{ params,
             k, (const float *)A, lda,
             (const float *)B, ldb,
-            (float *)C, ldc};
+            (float *)C, ldc, tune};
         return tb.matmul(m, n);
 #elif defined(__MMA__)
         if (k % 8)
@@ -2633,7 +2641,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<32, __m512, __m512bh, ggml_bf16_t, ggml_bf16_t, float> tb{ params, k,
                 (const ggml_bf16_t *)A, lda,
                 (const ggml_bf16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__AVX512F__)
@@ -2641,7 +2649,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<16, __m512, __m512, ggml_bf16_t, ggml_bf16_t, float> tb{ params, k,
                 (const ggml_bf16_t *)A, lda,
                 (const ggml_bf16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__AVX2__)
@@ -2649,7 +2657,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<8, __m256, __m256, ggml_bf16_t, ggml_bf16_t, float> tb{ params, k,
                 (const ggml_bf16_t *)A, lda,
                 (const ggml_bf16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__MMA__)
@@ -2674,7 +2682,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<16, __m512, __m512, ggml_fp16_t, ggml_fp16_t, float> tb{ params, k,
                 (const ggml_fp16_t *)A, lda,
                 (const ggml_fp16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif (defined(__AVX__) || defined(__AVX2__)) && defined(__F16C__)
@@ -2682,7 +2690,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<8, __m256, __m256, ggml_fp16_t, ggml_fp16_t, float> tb{ params, k,
                 (const ggml_fp16_t *)A, lda,
                 (const ggml_fp16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC) && !defined(_MSC_VER)
@@ -2692,7 +2700,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<8, float16x8_t, float16x8_t, ggml_fp16_t, ggml_fp16_t, float> tb{ params,
                 k, (const ggml_fp16_t *)A, lda,
                 (const ggml_fp16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__ARM_NEON) && !defined(_MSC_VER)
@@ -2700,7 +2708,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<4, float32x4_t, float32x4_t, ggml_fp16_t, float, float> tb{ params,
                 k, (const ggml_fp16_t *)A, lda,
                 (const float *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #elif defined(__VXE__) || defined(__VXE2__)
@@ -2710,7 +2718,7 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             tinyBLAS<4, float32x4_t, float32x4_t, ggml_fp16_t, ggml_fp16_t, float> tb{ params,
                 k, (const ggml_fp16_t *)A, lda,
                 (const ggml_fp16_t *)B, ldb,
-                (float *)C, ldc};
+                (float *)C, ldc, tune};
             return tb.matmul(m, n);
         }
 #endif
@@ -2840,4 +2848,5 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
     (void)Atype;
     (void)Btype;
     (void)Ctype;
+    (void)tune;
 }
@@ -10,9 +10,11 @@
 extern "C" {
 #endif
 
+struct ggml_mul_mat_tune_cfg;
+
 bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t, int64_t, int64_t,
                      const void *, int64_t, const void *, int64_t, void *, int64_t,
-                     int, int, int);
+                     int, int, int, const struct ggml_mul_mat_tune_cfg *);
 
 #ifdef __cplusplus
 }
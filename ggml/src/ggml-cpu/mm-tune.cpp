@@ -0,0 +1,339 @@
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "ggml-impl.h"
+
+#include "mm-tune.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Notes: mul_mat autotuning
+//
+// The generic mul_mat splits the output in chunks of 16 rows/columns, and the llamafile tinyBLAS kernels group
+// their tiles in jobs of BM x BN tiles. Both are fixed heuristics, while the best choice depends on the shape,
+// the number of threads and the CPU. The autotuner benchmarks a few candidates on the weights of each MUL_MAT
+// node the first time its shape is seen, and keeps the fastest one in a cache keyed by (type, K, N, M rounded up
+// to a power of 2, n_threads). The graph is not modified: ggml_graph_compute looks up the configuration of each
+// MUL_MAT node once, under the shared lock, keyed on the number of threads of the plan, and the threads read it
+// from the threadpool without locking. The candidates are timed with ggml_graph_compute_mul_mat_tune, which passes
+// them the same way without touching the cache.
+//
+// With GGML_CPU_MUL_MAT_TUNE=<file> the CPU backend loads the file at init, tunes the new shapes before
+// computing a graph and writes them back, so the cost is paid once per machine and model. The file is plain
+// text and can be shipped with a deployment for each CPU type.
+//
+
+namespace {
+
+// type, K, N, M bucket, n_threads
+using tune_key = std::tuple<int, int64_t, int64_t, int64_t, int>;
+
+struct tune_state {
+    std::shared_mutex mutex;
+    std::map<tune_key, ggml_mul_mat_tune_cfg> cache;
+
+    std::string fname;
+    bool dirty = false;
+
+    // set once the cache is not empty
+    std::atomic<bool> active { false };
+};
+
+tune_state & get_state() {
+    static tune_state state;
+    return state;
+}
+
+// a new bucket for every power of 2, so the number of tuned shapes stays small with variable batch sizes
+int64_t m_bucket(int64_t m) {
+    int64_t b = 1;
+    while (b < m && b < 4096) {
+        b *= 2;
+    }
+    return b;
+}
+
+bool can_tune(const ggml_tensor * node) {
+    if (node->op != GGML_OP_MUL_MAT) {
+        return false;
+    }
+
+    const ggml_tensor * src0 = node->src[0];
+    const ggml_tensor * src1 = node->src[1];
+
+    // weights in extra buffer types (repack, AMX, ...) use their own kernels
+    return src0->extra == nullptr && src0->data != nullptr &&
+           src1->type == GGML_TYPE_F32 &&
+           ggml_is_contiguous(src0) && ggml_is_contiguous(src1) &&
+           ggml_nrows(src0) == src0->ne[1] && ggml_nrows(src1) == src1->ne[1];
+}
+
+tune_key get_key(const ggml_tensor * node, int n_threads) {
+    const ggml_tensor * src0 = node->src[0];
+    return { src0->type, src0->ne[0], src0->ne[1], m_bucket(node->src[1]->ne[1]), n_threads };
+}
+
+std::vector<ggml_mul_mat_tune_cfg> get_candidates(enum ggml_type type) {
+    // the defaults go first
+    std::vector<ggml_mul_mat_tune_cfg> res = { { 0, 0, 0 } };
+
+    for (int chunk_size : { -1, 8, 32, 64, 128 }) {
+        res.push_back({ chunk_size, 0, 0 });
+    }
+
+#if GGML_USE_LLAMAFILE
+    if (type == GGML_TYPE_F32 || type == GGML_TYPE_F16 || type == GGML_TYPE_BF16) {
+        for (int bm : { 1, 2, 4 }) {
+            for (int bn : { 6, 12, 24, 48 }) {
+                res.push_back({ 0, bm, bn });
+            }
+        }
+    }
+#else
+    GGML_UNUSED(type);
+#endif
+
+    return res;
+}
+
+// benchmark the candidates on the weights of node, with random activations, and cache the fastest one
+void tune_shape(const ggml_tensor * node, int n_threads, ggml_threadpool * threadpool) {
+    const ggml_tensor * src0 = node->src[0];
+
+    const int64_t K = src0->ne[0];
+    const int64_t N = src0->ne[1];
+    const int64_t M = node->src[1]->ne[1];
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ 3*ggml_tensor_overhead() + ggml_graph_overhead_custom(4, false),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    ggml_tensor * a = ggml_new_tensor_2d(ctx, src0->type,     K, N);
+    ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,  K, M);
+    ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx, 4, false);
+    ggml_build_forward_expand(gf, c);
+
+    std::vector<float> b_data(K*M);
+    std::vector<float> c_data(N*M);
+
+    uint32_t seed = 42;
+    for (auto & x : b_data) {
+        seed = seed*1664525u + 1013904223u;
+        x = (float) (seed >> 8) / (float) (1u << 23) - 1.0f;
+    }
+
+    // the weights are only read
+    a->data = src0->data;
+    b->data = b_data.data();
+    c->data = c_data.data();
+
+    ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+    std::vector<uint8_t> work(cplan.work_size);
+    cplan.work_data = work.data();
+
+    auto run = [&](const ggml_mul_mat_tune_cfg & cfg) {
+        const int64_t t_start = ggml_time_us();
+        ggml_graph_compute_mul_mat_tune(gf, &cplan, &cfg);
+        return ggml_time_us() - t_start;
+    };
+
+    const auto candidates = get_candidates(src0->type);
+
+    // warmup
+    run(candidates[0]);
+
+    std::vector<int64_t> t_best(candidates.size(), INT64_MAX);
+    for (int rep = 0; rep < 2; ++rep) {
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            t_best[i] = std::min(t_best[i], run(candidates[i]));
+        }
+    }
+
+    // keep the defaults unless the difference is above the noise
+    size_t best = 0;
+    for (size_t i = 1; i < candidates.size(); ++i) {
+        if (t_best[i] < t_best[best] && t_best[i] < t_best[0]*0.97) {
+            best = i;
+        }
+    }
+
+    GGML_LOG_INFO("%s: %s K = %" PRId64 ", N = %" PRId64 ", M = %" PRId64 ", n_threads = %d: chunk_size = %d, sgemm_bm = %d, sgemm_bn = %d (%.3f ms, default %.3f ms)\n",
+            __func__, ggml_type_name(src0->type), K, N, M, n_threads,
+            candidates[best].chunk_size, candidates[best].sgemm_bm, candidates[best].sgemm_bn,
+            t_best[best]/1000.0, t_best[0]/1000.0);
+
+    ggml_free(ctx);
+
+    // the caller holds the exclusive lock
+    auto & state = get_state();
+    state.cache[get_key(node, n_threads)] = candidates[best];
+    state.active = true;
+}
+
+} // namespace
+
+void ggml_cpu_mul_mat_tune_graph(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool) {
+    auto & state = get_state();
+    std::unique_lock<std::shared_mutex> lock(state.mutex);
+
+    // the timings must not include the creation of the threads
+    ggml_threadpool * tp = threadpool;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const ggml_tensor * node = cgraph->nodes[i];
+        if (!can_tune(node) || state.cache.count(get_key(node, n_threads)) > 0) {
+            continue;
+        }
+
+        if (tp == nullptr) {
+            ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+            tp = ggml_threadpool_new(&tpp);
+        }
+        tune_shape(node, n_threads, tp);
+        state.dirty = true;
+    }
+
+    if (tp != threadpool) {
+        ggml_threadpool_free(tp);
+    }
+}
+
+bool ggml_cpu_mul_mat_tune_load(const char * fname) {
+    FILE * f = fopen(fname, "r");
+    if (!f) {
+        return false;
+    }
+
+    auto & state = get_state();
+    std::unique_lock<std::shared_mutex> lock(state.mutex);
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            continue;
+        }
+
+        char type_name[64];
+        int64_t k, n, m;
+        int n_threads;
+        ggml_mul_mat_tune_cfg cfg;
+        if (sscanf(line, "%63s %" SCNd64 " %" SCNd64 " %" SCNd64 " %d %d %d %d", type_name, &k, &n, &m, &n_threads,
+                   &cfg.chunk_size, &cfg.sgemm_bm, &cfg.sgemm_bn) != 8) {
+            GGML_LOG_WARN("%s: %s: invalid line: %s", __func__, fname, line);
+            continue;
+        }
+
+        int type = 0;
+        while (type < GGML_TYPE_COUNT && (ggml_type_name((ggml_type) type) == nullptr || strcmp(ggml_type_name((ggml_type) type), type_name) != 0)) {
+            type++;
+        }
+        if (type == GGML_TYPE_COUNT) {
+            GGML_LOG_WARN("%s: %s: unknown type %s\n", __func__, fname, type_name);
+            continue;
+        }
+
+        state.cache[{ type, k, n, m_bucket(m), n_threads }] = cfg;
+        state.active = true;
+    }
+
+    fclose(f);
+
+    return true;
+}
+
+bool ggml_cpu_mul_mat_tune_save(const char * fname) {
+    FILE * f = fopen(fname, "w");
+    if (!f) {
+        return false;
+    }
+
+    auto & state = get_state();
+    std::unique_lock<std::shared_mutex> lock(state.mutex);
+
+    fprintf(f, "# ggml-cpu mul_mat tune: type K N M n_threads chunk_size sgemm_bm sgemm_bn\n");
+    for (const auto & [key, cfg] : state.cache) {
+        const auto & [type, k, n, m, n_threads] = key;
+        fprintf(f, "%s %" PRId64 " %" PRId64 " %" PRId64 " %d %d %d %d\n", ggml_type_name((ggml_type) type), k, n, m, n_threads,
+                cfg.chunk_size, cfg.sgemm_bm, cfg.sgemm_bn);
+    }
+    state.dirty = false;
+
+    fclose(f);
+
+    return true;
+}
+
+void ggml_mul_mat_tune_init(void) {
+    const char * fname = getenv("GGML_CPU_MUL_MAT_TUNE");
+    if (fname == nullptr || fname[0] == '\0') {
+        return;
+    }
+
+    get_state().fname = fname;
+
+    if (ggml_cpu_mul_mat_tune_load(fname)) {
+        GGML_LOG_INFO("%s: loaded %zu mul_mat configurations from %s\n", __func__, get_state().cache.size(), fname);
+    }
+}
+
+bool ggml_mul_mat_tune_enabled(void) {
+    return !get_state().fname.empty();
+}
+
+void ggml_mul_mat_tune_auto(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool) {
+    auto & state = get_state();
+
+    ggml_cpu_mul_mat_tune_graph(cgraph, n_threads, threadpool);
+
+    bool dirty;
+    {
+        std::shared_lock<std::shared_mutex> lock(state.mutex);
+        dirty = state.dirty;
+    }
+
+    if (dirty && !ggml_cpu_mul_mat_tune_save(state.fname.c_str())) {
+        GGML_LOG_ERROR("%s: failed to write %s\n", __func__, state.fname.c_str());
+    }
+}
+
+bool ggml_mul_mat_tune_active(void) {
+    return get_state().active;
+}
+
+bool ggml_mul_mat_tune_resolve(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_mul_mat_tune_cfg * cfgs) {
+    auto & state = get_state();
+    std::shared_lock<std::shared_mutex> lock(state.mutex);
+
+    bool any = false;
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const ggml_tensor * node = cgraph->nodes[i];
+
+        cfgs[i] = { 0, 0, 0 };
+        if (!can_tune(node)) {
+            continue;
+        }
+
+        auto it = state.cache.find(get_key(node, n_threads));
+        if (it != state.cache.end()) {
+            cfgs[i] = it->second;
+            any     = true;
+        }
+    }
+
+    return any;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ggml-cpu.h"
+
+#include <stdint.h>
+
+// GGML CPU internal header
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// mul_mat configuration picked by the autotuner for a shape
+// zero fields keep the built-in heuristics
+struct ggml_mul_mat_tune_cfg {
+    int32_t chunk_size; // rows and columns per chunk of the generic path, -1 to chunk by thread
+    int32_t sgemm_bm;   // llamafile tinyBLAS row blocks per job (1, 2 or 4)
+    int32_t sgemm_bn;   // llamafile tinyBLAS column tiles per job
+};
+
+// reads GGML_CPU_MUL_MAT_TUNE, called once from ggml_cpu_init
+void ggml_mul_mat_tune_init(void);
+
+// true if GGML_CPU_MUL_MAT_TUNE is set
+bool ggml_mul_mat_tune_enabled(void);
+
+// tune the new shapes of the graph and update the GGML_CPU_MUL_MAT_TUNE file
+void ggml_mul_mat_tune_auto(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_threadpool * threadpool);
+
+// true once a configuration was tuned or loaded, until then the graphs are computed without looking them up
+bool ggml_mul_mat_tune_active(void);
+
+// sets cfgs[i] to the configuration of node i, all zero if it is not a MUL_MAT or its shape was not tuned
+// n_threads is the number of threads of the plan, the one the shapes are tuned with
+// takes the shared lock, returns false if no node was tuned
+bool ggml_mul_mat_tune_resolve(const struct ggml_cgraph * cgraph, int n_threads, struct ggml_mul_mat_tune_cfg * cfgs);
+
+// same as ggml_graph_compute, with the configuration cfg for all the MUL_MAT nodes, used to time the candidates
+enum ggml_status ggml_graph_compute_mul_mat_tune(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan, const struct ggml_mul_mat_tune_cfg * cfg);
+
+#ifdef __cplusplus
+}
+#endif
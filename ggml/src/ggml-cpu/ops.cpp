@@ -4155,16 +4155,12 @@ static void ggml_compute_forward_rms_norm_f32(
 
     GGML_ASSERT(eps >= 0.0f);
 
-    // TODO: optimize
     for (int64_t i03 = 0; i03 < ne03; i03++) {
         for (int64_t i02 = 0; i02 < ne02; i02++) {
             for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
                 const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-                ggml_float sum = 0.0;
-                for (int64_t i00 = 0; i00 < ne00; i00++) {
-                    sum += (ggml_float)(x[i00] * x[i00]);
-                }
+                const ggml_float sum = ggml_vec_sumsq_f32(ne00, x);
 
                 const float mean = sum/ne00;
 
@@ -4204,6 +4200,72 @@ void ggml_compute_forward_rms_norm(
     }
 }
 
+// ggml_compute_forward_rms_norm_mul_fused
+
+// computes [ADD ->] RMS_NORM -> MUL in a single pass over each row
+// the result of the ADD is still stored, it is usually used again by the residual connection
+// the operations are done in the same order as the unfused ops, so the results are identical
+void ggml_compute_forward_rms_norm_mul_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * add,
+        ggml_tensor * norm,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = norm->src[0];
+    const ggml_tensor * w    = mul->src[0] == norm ? mul->src[1] : mul->src[0];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && w->type == GGML_TYPE_F32 && mul->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_are_same_shape(src0, norm) && ggml_are_same_shape(norm, mul));
+    GGML_ASSERT(w->ne[0] == norm->ne[0] && ggml_can_repeat(w, norm));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_LOCALS(int64_t, ne0, src0, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb0, src0, nb)
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    const ggml_tensor * a = add ? add->src[0] : NULL;
+    const ggml_tensor * b = add ? add->src[1] : NULL;
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+                if (add) {
+                    ggml_vec_add_f32(ne00, x,
+                            (const float *) ((const char *) a->data + i01*a->nb[1] + i02*a->nb[2] + i03*a->nb[3]),
+                            (const float *) ((const char *) b->data + i01*b->nb[1] + i02*b->nb[2] + i03*b->nb[3]));
+                }
+
+                const ggml_float sum = ggml_vec_sumsq_f32(ne00, x);
+
+                const float mean  = sum/ne00;
+                const float scale = 1.0f/sqrtf(mean + eps);
+
+                // if you hit this, likely you got an inf somewhere earlier
+                assert(scale > 0.0f);
+
+                const int64_t i11 = i01 % w->ne[1];
+                const int64_t i12 = i02 % w->ne[2];
+                const int64_t i13 = i03 % w->ne[3];
+
+                const float * wr = (const float *) ((const char *) w->data + i11*w->nb[1] + i12*w->nb[2] + i13*w->nb[3]);
+                float       * y  = (float *) ((char *) mul->data + i01*mul->nb[1] + i02*mul->nb[2] + i03*mul->nb[3]);
+
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    y[i00] = (x[i00]*scale)*wr[i00];
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -5744,20 +5806,20 @@ static void ggml_compute_forward_soft_max_f32(
                 ggml_fp16_t * mp_f16 = src1 ? (ggml_fp16_t *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
                 float       * mp_f32 = src1 ? (float       *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
 
-                ggml_vec_cpy_f32  (ne00, wp, sp);
-                ggml_vec_scale_f32(ne00, wp, scale);
-                if (mp_f32) {
-                    if (use_f16) {
-                        for (int i = 0; i < ne00; ++i) {
-                            wp[i] += slope*GGML_CPU_FP16_TO_FP32(mp_f16[i]);
-                        }
-                    } else {
-                        for (int i = 0; i < ne00; ++i) {
-                            wp[i] += slope*mp_f32[i];
-                        }
+                const float * xp = sp;
+                if (mp_f32 && use_f16) {
+                    // dp is not written yet, use it for the converted mask
+                    if (dp == sp) {
+                        ggml_vec_cpy_f32(ne00, wp, sp);
+                        xp = wp;
                     }
+                    ggml_cpu_fp16_to_fp32(mp_f16, dp, ne00);
+                    mp_f32 = dp;
                 }
 
+                // scale, mask and max in a single pass
+                float max = ggml_vec_scale_add_max_f32(ne00, wp, xp, scale, mp_f32, slope);
+
 #ifndef NDEBUG
                 for (int i = 0; i < ne00; ++i) {
                     //printf("p[%d] = %f\n", i, p[i]);
@@ -5765,9 +5827,6 @@ static void ggml_compute_forward_soft_max_f32(
                 }
 #endif
 
-                float max = -INFINITY;
-                ggml_vec_max_f32(ne00, &max, wp);
-
                 // if we have sinks, make a correction as if they were included in the softmax
                 if (sk) {
                     max = MAX(max, sk[i02]);
@@ -6144,57 +6203,48 @@ static void ggml_mrope_cache_init(
     }
 }
 
-static void ggml_compute_forward_rope_f32(
+// sin/cos table of all the positions of a ROPE, computed once and shared with the following ROPEs that have the
+// same positions and parameters (Q and K of all the layers), see ggml_rope_table_get
+// for each position, ne0 cos values followed by ne0 sin values in the layout of the rotation:
+//   normal: c = [c0, c0, c1, c1, ...], s = [-s0, s0, -s1, s1, ...]
+//   neox, mrope and vision: c = [c0, c1, ...], s = [s0, s1, ...]
+static const float * ggml_rope_table(
         const ggml_compute_params * params,
-        ggml_tensor * dst,
+        const ggml_tensor * dst,
         const bool forward) {
 
-    const ggml_tensor * src0 = dst->src[0];
     const ggml_tensor * src1 = dst->src[1];
     const ggml_tensor * src2 = dst->src[2];
 
+    bool valid;
+    float * table = ggml_rope_table_get(params, dst, &valid);
+    if (valid) {
+        return table;
+    }
+
     float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
     int sections[4];
 
-    //const int n_past     = ((int32_t *) dst->op_params)[0];
-    const int n_dims     = ((int32_t *) dst->op_params)[1];
-    const int mode       = ((int32_t *) dst->op_params)[2];
-    //const int n_ctx      = ((int32_t *) dst->op_params)[3];
-    const int n_ctx_orig = ((int32_t *) dst->op_params)[4];
-
-    memcpy(&freq_base,   (int32_t *) dst->op_params +  5, sizeof(float));
-    memcpy(&freq_scale,  (int32_t *) dst->op_params +  6, sizeof(float));
-    memcpy(&ext_factor,  (int32_t *) dst->op_params +  7, sizeof(float));
-    memcpy(&attn_factor, (int32_t *) dst->op_params +  8, sizeof(float));
-    memcpy(&beta_fast,   (int32_t *) dst->op_params +  9, sizeof(float));
-    memcpy(&beta_slow,   (int32_t *) dst->op_params + 10, sizeof(float));
-    memcpy(&sections,    (int32_t *) dst->op_params + 11, sizeof(int)*4);
-
-    GGML_TENSOR_UNARY_OP_LOCALS
+    //const int n_past     = ((const int32_t *) dst->op_params)[0];
+    const int n_dims     = ((const int32_t *) dst->op_params)[1];
+    const int mode       = ((const int32_t *) dst->op_params)[2];
+    //const int n_ctx      = ((const int32_t *) dst->op_params)[3];
+    const int n_ctx_orig = ((const int32_t *) dst->op_params)[4];
 
-    //printf("ne0: %d, ne1: %d, ne2: %d, ne3: %d\n", ne0, ne1, ne2, ne3);
-    //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
+    memcpy(&freq_base,   (const int32_t *) dst->op_params +  5, sizeof(float));
+    memcpy(&freq_scale,  (const int32_t *) dst->op_params +  6, sizeof(float));
+    memcpy(&ext_factor,  (const int32_t *) dst->op_params +  7, sizeof(float));
+    memcpy(&attn_factor, (const int32_t *) dst->op_params +  8, sizeof(float));
+    memcpy(&beta_fast,   (const int32_t *) dst->op_params +  9, sizeof(float));
+    memcpy(&beta_slow,   (const int32_t *) dst->op_params + 10, sizeof(float));
+    memcpy(&sections,    (const int32_t *) dst->op_params + 11, sizeof(int)*4);
 
-    GGML_ASSERT(nb00 == sizeof(float));
+    const int64_t ne0 = dst->ne[0];
+    const int64_t ne2 = dst->ne[2];
 
     const int ith = params->ith;
     const int nth = params->nth;
 
-    const int nr = ggml_nrows(dst);
-
-    GGML_ASSERT(n_dims <= ne0);
-    GGML_ASSERT(n_dims % 2 == 0);
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
-
-    // row index used to determine which thread to use
-    int ir = 0;
-
     const float theta_scale = powf(freq_base, -2.0f/n_dims);
 
     float corr_dims[2];
@@ -6204,14 +6254,6 @@ static void ggml_compute_forward_rope_f32(
     const bool is_mrope = mode & GGML_ROPE_TYPE_MROPE;  // ggml_rope_multi, multimodal rotary position embedding
     const bool is_vision = mode == GGML_ROPE_TYPE_VISION;
 
-    if (is_mrope) {
-        GGML_ASSERT(sections[0] > 0 || sections[1] > 0 || sections[2] > 0);
-    }
-
-    if (is_vision) {
-        GGML_ASSERT(n_dims == ne0/2);
-    }
-
     const float * freq_factors = NULL;
     if (src2 != NULL) {
         GGML_ASSERT(src2->type == GGML_TYPE_F32);
@@ -6226,142 +6268,73 @@ static void ggml_compute_forward_rope_f32(
 
     const int32_t * pos = (const int32_t *) src1->data;
 
-    for (int64_t i3 = 0; i3 < ne3; i3++) { // batch
-        for (int64_t i2 = 0; i2 < ne2; i2++) { // seq-len
-
-            float * cache = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
-            if (!is_mrope) {
-                const int64_t p = pos[i2];
-                ggml_rope_cache_init(p, freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
-            }
-            else {
-                const int64_t p_t = pos[i2];
-                const int64_t p_h = pos[i2 + ne2];
-                const int64_t p_w = pos[i2 + ne2 * 2];
-                const int64_t p_e = pos[i2 + ne2 * 3];
-                ggml_mrope_cache_init(
-                    p_t, p_h, p_w, p_e, sections, is_vision,
-                    freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
-            }
-
-            for (int64_t i1 = 0; i1 < ne1; i1++) { // attn-heads
-                if (ir++ < ir0) continue;
-                if (ir   > ir1) break;
-
-                if (is_neox || is_mrope) {
-                    if (is_vision){
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
+    float * cache = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
 
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
-
-                            const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = src[0];
-                            const float x1 = src[n_dims];
-
-                            dst_data[0]      = x0*cos_theta - x1*sin_theta;
-                            dst_data[n_dims] = x0*sin_theta + x1*cos_theta;
-                        }
-                    } else {
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
-
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
-
-                            const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = src[0];
-                            const float x1 = src[n_dims/2];
-
-                            dst_data[0]        = x0*cos_theta - x1*sin_theta;
-                            dst_data[n_dims/2] = x0*sin_theta + x1*cos_theta;
-                        }
-                    }
-                } else {
-                    for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = src[0];
-                        const float x1 = src[1];
-
-                        dst_data[0] = x0*cos_theta - x1*sin_theta;
-                        dst_data[1] = x0*sin_theta + x1*cos_theta;
-                    }
-                }
-
-                if (is_vision) {
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const int64_t ic = i0/2;
-
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                        float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                        const float x0 = src[0];
-                        const float x1 = src[n_dims];
+    for (int64_t i2 = ith; i2 < ne2; i2 += nth) { // seq-len
+        if (!is_mrope) {
+            const int64_t p = pos[i2];
+            ggml_rope_cache_init(p, freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
+        }
+        else {
+            const int64_t p_t = pos[i2];
+            const int64_t p_h = pos[i2 + ne2];
+            const int64_t p_w = pos[i2 + ne2 * 2];
+            const int64_t p_e = pos[i2 + ne2 * 3];
+            ggml_mrope_cache_init(
+                p_t, p_h, p_w, p_e, sections, is_vision,
+                freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
+        }
 
-                        dst_data[0]      = x0*cos_theta - x1*sin_theta;
-                        dst_data[n_dims] = x0*sin_theta + x1*cos_theta;
-                    }
-                } else {
-                    // fill the remain channels with data from src tensor
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                        float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
+        float * c = table + 2*ne0*i2;
+        float * s = c + ne0;
 
-                        dst_data[0] = src[0];
-                        dst_data[1] = src[1];
-                    }
-                }
+        // only whole pairs: with an odd ne0 the last channel is never rotated (n_dims is even) and a pair starting
+        // there would spill into s, and past the table for the last position
+        if (is_neox || is_mrope) {
+            for (int64_t i0 = 0; i0 + 1 < ne0; i0 += 2) {
+                c[i0/2] = cache[i0 + 0];
+                s[i0/2] = cache[i0 + 1];
+            }
+        } else {
+            for (int64_t i0 = 0; i0 + 1 < ne0; i0 += 2) {
+                c[i0 + 0] =  cache[i0 + 0];
+                c[i0 + 1] =  cache[i0 + 0];
+                s[i0 + 0] = -cache[i0 + 1];
+                s[i0 + 1] =  cache[i0 + 1];
             }
         }
     }
+
+    ggml_barrier(params->threadpool);
+
+    if (ith == 0) {
+        ggml_rope_table_set(params, dst);
+    }
+
+    return table;
 }
 
-// TODO: deduplicate f16/f32 code
-static void ggml_compute_forward_rope_f16(
+static void ggml_compute_forward_rope_flt(
         const ggml_compute_params * params,
         ggml_tensor * dst,
         const bool forward) {
 
     const ggml_tensor * src0 = dst->src[0];
-    const ggml_tensor * src1 = dst->src[1];
-    const ggml_tensor * src2 = dst->src[2];
 
-    float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
     int sections[4];
 
-    //const int n_past     = ((int32_t *) dst->op_params)[0];
     const int n_dims     = ((int32_t *) dst->op_params)[1];
     const int mode       = ((int32_t *) dst->op_params)[2];
-    //const int n_ctx      = ((int32_t *) dst->op_params)[3];
-    const int n_ctx_orig = ((int32_t *) dst->op_params)[4];
-    memcpy(&freq_base,   (int32_t *) dst->op_params +  5, sizeof(float));
-    memcpy(&freq_scale,  (int32_t *) dst->op_params +  6, sizeof(float));
-    memcpy(&ext_factor,  (int32_t *) dst->op_params +  7, sizeof(float));
-    memcpy(&attn_factor, (int32_t *) dst->op_params +  8, sizeof(float));
-    memcpy(&beta_fast,   (int32_t *) dst->op_params +  9, sizeof(float));
-    memcpy(&beta_slow,   (int32_t *) dst->op_params + 10, sizeof(float));
-    memcpy(&sections,    (int32_t *) dst->op_params + 11, sizeof(int)*4);
 
+    memcpy(&sections,    (int32_t *) dst->op_params + 11, sizeof(int)*4);
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
     //printf("ne0: %d, ne1: %d, ne2: %d, ne3: %d\n", ne0, ne1, ne2, ne3);
-    //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
 
-    GGML_ASSERT(nb0 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(src0->type == dst->type);
+    GGML_ASSERT(nb00 == ggml_type_size(src0->type));
+    GGML_ASSERT(nb0  == ggml_type_size(dst->type));
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -6381,13 +6354,8 @@ static void ggml_compute_forward_rope_f16(
     // row index used to determine which thread to use
     int ir = 0;
 
-    const float theta_scale = powf(freq_base, -2.0f/n_dims);
-
-    float corr_dims[2];
-    ggml_rope_yarn_corr_dims(n_dims, n_ctx_orig, freq_base, beta_fast, beta_slow, corr_dims);
-
     const bool is_neox = mode & GGML_ROPE_TYPE_NEOX;
-    const bool is_mrope = mode & GGML_ROPE_TYPE_MROPE;
+    const bool is_mrope = mode & GGML_ROPE_TYPE_MROPE;  // ggml_rope_multi, multimodal rotary position embedding
     const bool is_vision = mode == GGML_ROPE_TYPE_VISION;
 
     if (is_mrope) {
@@ -6398,116 +6366,50 @@ static void ggml_compute_forward_rope_f16(
         GGML_ASSERT(n_dims == ne0/2);
     }
 
-    const float * freq_factors = NULL;
-    if (src2 != NULL) {
-        GGML_ASSERT(src2->type == GGML_TYPE_F32);
-        GGML_ASSERT(src2->ne[0] >= n_dims / 2);
-        freq_factors = (const float *) src2->data;
-    }
+    const float * table = ggml_rope_table(params, dst, forward);
 
-    // backward process uses inverse rotation by cos and sin.
-    // cos and sin build a rotation matrix, where the inverse is the transpose.
-    // this essentially just switches the sign of sin.
-    const float sin_sign = forward ? 1.0f : -1.0f;
-
-    const int32_t * pos = (const int32_t *) src1->data;
-
-    for (int64_t i3 = 0; i3 < ne3; i3++) {
-        for (int64_t i2 = 0; i2 < ne2; i2++) {
+    // f16 rows are rotated in f32, the scratch of the table is free now
+    float * wrow = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
 
-            float * cache = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
-            if (!is_mrope) {
-                const int64_t p = pos[i2];
-                ggml_rope_cache_init(p, freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
-            }
-            else {
-                const int64_t p_t = pos[i2];
-                const int64_t p_h = pos[i2 + ne2];
-                const int64_t p_w = pos[i2 + ne2 * 2];
-                const int64_t p_e = pos[i2 + ne2 * 3];
-                ggml_mrope_cache_init(
-                    p_t, p_h, p_w, p_e, sections, is_vision,
-                    freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
-            }
+    for (int64_t i3 = 0; i3 < ne3; i3++) { // batch
+        for (int64_t i2 = 0; i2 < ne2; i2++) { // seq-len
+            const float * c = table + 2*ne0*i2;
+            const float * s = c + ne0;
 
-            for (int64_t i1 = 0; i1 < ne1; i1++) {
+            for (int64_t i1 = 0; i1 < ne1; i1++) { // attn-heads
                 if (ir++ < ir0) continue;
                 if (ir   > ir1) break;
 
-                if (is_neox || is_mrope) {
-                    if (is_vision) {
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
+                const char * src_row = (const char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01;
+                      char * dst_row = (char *)        dst->data + i3*nb3  + i2*nb2  + i1*nb1;
 
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
+                const float * x;
+                      float * y;
 
-                            const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = GGML_CPU_FP16_TO_FP32(src[0]);
-                            const float x1 = GGML_CPU_FP16_TO_FP32(src[n_dims]);
-
-                            dst_data[0]      = GGML_CPU_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                            dst_data[n_dims] = GGML_CPU_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                        }
-                    } else {
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
-
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
-
-                            const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = GGML_CPU_FP16_TO_FP32(src[0]);
-                            const float x1 = GGML_CPU_FP16_TO_FP32(src[n_dims/2]);
-
-                            dst_data[0]        = GGML_CPU_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                            dst_data[n_dims/2] = GGML_CPU_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                        }
-                    }
+                if (src0->type == GGML_TYPE_F16) {
+                    ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) src_row, wrow, ne0);
+                    x = wrow;
+                    y = wrow;
                 } else {
-                    for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = GGML_CPU_FP16_TO_FP32(src[0]);
-                        const float x1 = GGML_CPU_FP16_TO_FP32(src[1]);
-
-                        dst_data[0] = GGML_CPU_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                        dst_data[1] = GGML_CPU_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                    }
+                    x = (const float *) src_row;
+                    y = (float *) dst_row;
                 }
 
                 if (is_vision) {
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const int64_t ic = i0/2;
-
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                        ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                        const float x0 = GGML_CPU_FP16_TO_FP32(src[0]);
-                        const float x1 = GGML_CPU_FP16_TO_FP32(src[n_dims]);
-
-                        dst_data[0]      = GGML_CPU_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                        dst_data[n_dims] = GGML_CPU_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                    }
+                    ggml_vec_rope_neox_f32(ne0/2, y, y + n_dims, x, x + n_dims, c, s);
+                } else if (is_neox || is_mrope) {
+                    ggml_vec_rope_neox_f32(n_dims/2, y, y + n_dims/2, x, x + n_dims/2, c, s);
                 } else {
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                        ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
+                    ggml_vec_rope_norm_f32(n_dims, y, x, c, s);
+                }
 
-                        dst_data[0] = src[0];
-                        dst_data[1] = src[1];
-                    }
+                // fill the remain channels with data from src tensor
+                if (!is_vision && y != x) {
+                    memcpy(y + n_dims, x + n_dims, (ne0 - n_dims)*sizeof(float));
+                }
+
+                if (src0->type == GGML_TYPE_F16) {
+                    ggml_cpu_fp32_to_fp16(wrow, (ggml_fp16_t *) dst_row, ne0);
                 }
             }
         }
@@ -6522,12 +6424,9 @@ void ggml_compute_forward_rope(
 
     switch (src0->type) {
         case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_rope_f16(params, dst, true);
-            } break;
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_rope_f32(params, dst, true);
+                ggml_compute_forward_rope_flt(params, dst, true);
             } break;
         default:
             {
@@ -6546,12 +6445,9 @@ void ggml_compute_forward_rope_back(
 
     switch (src0->type) {
         case GGML_TYPE_F16:
-            {
-                ggml_compute_forward_rope_f16(params, dst, false);
-            } break;
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_rope_f32(params, dst, false);
+                ggml_compute_forward_rope_flt(params, dst, false);
             } break;
         default:
             {
@@ -8166,6 +8062,268 @@ void ggml_compute_forward_argsort(
 
 // ggml_compute_forward_flash_attn_ext
 
+// query heads that share a K/V head are processed together: a work unit holds up to GGML_FA_TILE_Q query
+// vectors (query rows x heads of one K/V head) and streams K and V through them GGML_FA_TILE_KV rows at a
+// time, so every K/V row is loaded once per unit instead of once per query head
+struct fattn_unit {
+    int64_t iq1; // first query row
+    int64_t nr;  // number of query rows
+    int64_t iq2; // first query head
+    int64_t nh;  // number of query heads
+    int64_t iq3;
+
+    int64_t nq() const { return nr*nh; }
+};
+
+// enumeration of the work units, rows are the fastest varying so that consecutive units share a K/V head
+struct fattn_layout {
+    int64_t N;         // query rows
+    int64_t n_group;   // query heads per K/V head
+    int64_t n_kv_head;
+    int64_t nr_unit;   // query rows per unit
+    int64_t nh_unit;   // query heads per unit
+    int64_t n_rblk;
+    int64_t n_hblk;
+
+    fattn_unit get(int64_t iu) const {
+        const int64_t rb = iu%n_rblk; iu /= n_rblk;
+        const int64_t hb = iu%n_hblk; iu /= n_hblk;
+        const int64_t g  = iu%n_kv_head;
+
+        fattn_unit u;
+        u.iq1 = rb*nr_unit;
+        u.nr  = MIN(nr_unit, N - u.iq1);
+        u.iq2 = g*n_group + hb*nh_unit;
+        u.nh  = MIN(nh_unit, n_group - hb*nh_unit);
+        u.iq3 = iu/n_kv_head;
+        return u;
+    }
+};
+
+struct fattn_params {
+    const ggml_tensor * q;
+    const ggml_tensor * k;
+    const ggml_tensor * v;
+    const ggml_tensor * mask;
+    const ggml_tensor * sinks;
+
+    float    scale;
+    float    max_bias;
+    float    logit_softcap;
+    float    m0;
+    float    m1;
+    uint32_t n_head_log2;
+
+    int64_t rk2, rk3;
+    int64_t rv2, rv3;
+
+    size_t            q_row_size; // bytes per query converted to the K vec_dot type
+    ggml_from_float_t q_to_vec_dot;
+    ggml_vec_dot_t    kq_vec_dot;
+    ggml_to_float_t   v_to_float;
+};
+
+// accumulators of the unit being processed, vector iq of the unit is query row iq/nh, head iq%nh
+struct fattn_state {
+    char  * Q_q; // [GGML_FA_TILE_Q][q_row_size] queries converted to the K vec_dot type
+    float * VKQ; // [GGML_FA_TILE_Q][DV]         unnormalized output
+    float * M;   // [GGML_FA_TILE_Q]             maximum KQ value
+    float * S;   // [GGML_FA_TILE_Q]             sum of exp(KQ - M)
+    float * KQ;  // [GGML_FA_TILE_Q][GGML_FA_TILE_KV] KQ values of the current tile, then their softmax numerators
+    float * V32; // [DV]                         V row converted to F32
+};
+
+static void fattn_unit_init(const fattn_params & p, const fattn_unit & u, const fattn_state & st) {
+    const ggml_tensor * q = p.q;
+    const int64_t DV = p.v->ne[0];
+
+    for (int64_t iq = 0; iq < u.nq(); ++iq) {
+        const int64_t iq1 = u.iq1 + iq/u.nh;
+        const int64_t iq2 = u.iq2 + iq%u.nh;
+
+        const float * pq = (const float *) ((const char *) q->data + (iq1*q->nb[1] + iq2*q->nb[2] + u.iq3*q->nb[3]));
+        p.q_to_vec_dot(pq, st.Q_q + iq*p.q_row_size, q->ne[0]);
+
+        memset(st.VKQ + iq*DV, 0, DV*sizeof(float));
+        st.M[iq] = -INFINITY;
+        st.S[iq] = 0.0f;
+    }
+}
+
+// the K and V tiles are consumed in separate passes, which on their own leave the hardware prefetchers a single
+// stream: fetch the V rows of the tile while computing KQ, and the K rows of the next tile while accumulating V
+static inline void fattn_prefetch_row(const char * row, size_t size) {
+#if defined(__GNUC__)
+    for (size_t i = 0; i < size; i += 64) {
+        __builtin_prefetch(row + i);
+    }
+#else
+    GGML_UNUSED(row);
+    GGML_UNUSED(size);
+#endif
+}
+
+// online softmax over the K/V rows [ic0, ic1)
+// ref: https://arxiv.org/pdf/2112.05682.pdf
+static void fattn_unit_accumulate(const fattn_params & p, const fattn_unit & u, const fattn_state & st, int64_t ic0, int64_t ic1) {
+    const ggml_tensor * k    = p.k;
+    const ggml_tensor * v    = p.v;
+    const ggml_tensor * mask = p.mask;
+
+    const int64_t DK = k->ne[0];
+    const int64_t DV = v->ne[0];
+    const int64_t nq = u.nq();
+
+    // all query heads of a unit share the same K/V head
+    const int64_t ik2 = u.iq2/p.rk2;
+    const int64_t ik3 = u.iq3/p.rk3;
+    const int64_t iv2 = u.iq2/p.rv2;
+    const int64_t iv3 = u.iq3/p.rv3;
+
+    const ggml_fp16_t * mp[GGML_FA_TILE_Q];
+    float slope[GGML_FA_TILE_Q];
+
+    for (int64_t iq = 0; iq < nq; ++iq) {
+        const int64_t  iq1 = u.iq1 + iq/u.nh;
+        const uint32_t h   = u.iq2 + iq%u.nh; // head index
+
+        mp[iq] = mask ? (const ggml_fp16_t *) ((const char *) mask->data + iq1*mask->nb[1] + (h%mask->ne[2])*mask->nb[2] + (u.iq3%mask->ne[3])*mask->nb[3]) : NULL;
+        slope[iq] = (p.max_bias > 0.0f) ? h < p.n_head_log2 ? powf(p.m0, h + 1) : powf(p.m1, 2*(h - p.n_head_log2) + 1) : 1.0f;
+    }
+
+    for (int64_t ic = ic0; ic < ic1; ic += GGML_FA_TILE_KV) {
+        const int64_t nc = MIN(GGML_FA_TILE_KV, ic1 - ic);
+
+        // KQ values of the tile, every K row is used by all the queries of the unit while it is hot
+        for (int64_t j = 0; j < nc; ++j) {
+            const char * k_data = (const char *) k->data + ((ic + j)*k->nb[1] + ik2*k->nb[2] + ik3*k->nb[3]);
+            fattn_prefetch_row((const char *) v->data + ((ic + j)*v->nb[1] + iv2*v->nb[2] + iv3*v->nb[3]), v->nb[1]);
+
+            for (int64_t iq = 0; iq < nq; ++iq) {
+                const float mv = mp[iq] ? slope[iq]*GGML_CPU_FP16_TO_FP32(mp[iq][ic + j]) : 0.0f;
+                if (mv == -INFINITY) {
+                    st.KQ[iq*GGML_FA_TILE_KV + j] = -INFINITY;
+                    continue;
+                }
+
+                float s; // KQ value
+                p.kq_vec_dot(DK, &s, 0, k_data, 0, st.Q_q + iq*p.q_row_size, 0, 1);
+
+                s = s*p.scale; // scale KQ value
+
+                if (p.logit_softcap != 0.0f) {
+                    s = p.logit_softcap*tanhf(s);
+                }
+
+                st.KQ[iq*GGML_FA_TILE_KV + j] = s + mv; // apply mask
+            }
+        }
+
+        // one max update per tile: rescale VKQ and S once, then KQ = expf(KQ - M)
+        for (int64_t iq = 0; iq < nq; ++iq) {
+            float * kq = st.KQ + iq*GGML_FA_TILE_KV;
+
+            float M = st.M[iq];
+            for (int64_t j = 0; j < nc; ++j) {
+                M = MAX(M, kq[j]);
+            }
+
+            if (M == -INFINITY) {
+                // everything masked so far
+                memset(kq, 0, nc*sizeof(float));
+                continue;
+            }
+
+            if (M > st.M[iq]) {
+                const float ms = expf(st.M[iq] - M);
+                ggml_vec_scale_f32(DV, st.VKQ + iq*DV, ms);
+                st.S[iq] *= ms;
+                st.M[iq]  = M;
+            }
+
+            st.S[iq] += (float) ggml_vec_soft_max_f32(nc, kq, kq, M);
+        }
+
+        // VKQ += expf(KQ - M)*V, every V row is converted once and used by all the queries of the unit
+        for (int64_t j = 0; j < nc; ++j) {
+            const char  * v_data = (const char *) v->data + ((ic + j)*v->nb[1] + iv2*v->nb[2] + iv3*v->nb[3]);
+            const float * v32    = NULL;
+            if (ic + GGML_FA_TILE_KV + j < ic1) {
+                fattn_prefetch_row((const char *) k->data + ((ic + GGML_FA_TILE_KV + j)*k->nb[1] + ik2*k->nb[2] + ik3*k->nb[3]), k->nb[1]);
+            }
+
+            for (int64_t iq = 0; iq < nq; ++iq) {
+                const float vs = st.KQ[iq*GGML_FA_TILE_KV + j];
+                if (vs == 0.0f) {
+                    continue;
+                }
+
+                if (v32 == NULL) {
+                    if (v->type == GGML_TYPE_F32) {
+                        v32 = (const float *) v_data;
+                    } else {
+                        if (v->type == GGML_TYPE_F16) {
+                            ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) v_data, st.V32, DV);
+                        } else {
+                            p.v_to_float(v_data, st.V32, DV);
+                        }
+                        v32 = st.V32;
+                    }
+                }
+
+                ggml_vec_mad_f32(DV, st.VKQ + iq*DV, v32, vs);
+            }
+        }
+    }
+}
+
+// apply the sinks, normalize and write the unit to dst
+static void fattn_unit_store(const fattn_params & p, const fattn_unit & u, const fattn_state & st, ggml_tensor * dst) {
+    const int64_t DV = p.v->ne[0];
+
+    for (int64_t iq = 0; iq < u.nq(); ++iq) {
+        const int64_t iq1 = u.iq1 + iq/u.nh;
+        const int64_t iq2 = u.iq2 + iq%u.nh;
+
+        float * VKQ32 = st.VKQ + iq*DV;
+
+        float S = st.S[iq];
+
+        // sinks
+        if (p.sinks) {
+            const float M = st.M[iq];
+            const float s = ((const float *) p.sinks->data)[iq2];
+
+            float ms = 1.0f;
+            float vs = 1.0f;
+
+            if (s > M) {
+                ms = expf(M - s);
+                ggml_vec_scale_f32(DV, VKQ32, ms);
+            } else {
+                vs = expf(s - M);
+            }
+
+            S = S*ms + vs;
+        }
+
+        // V /= S
+        const float S_inv = 1.0f/S;
+        ggml_vec_scale_f32(DV, VKQ32, S_inv);
+
+        // dst indices
+        const int64_t i1 = iq1;
+        const int64_t i2 = iq2;
+        const int64_t i3 = u.iq3;
+
+        // original
+        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+
+        // permute(0, 2, 1, 3)
+        memcpy((char *) dst->data + (i3*dst->ne[2]*dst->ne[1] + i2 + i1*dst->ne[1])*dst->nb[1], VKQ32, dst->nb[1]);
+    }
+}
+
 static void ggml_compute_forward_flash_attn_ext_f16(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -8212,195 +8370,162 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_ASSERT(nb1 <= nb2);
     GGML_ASSERT(nb2 <= nb3);
 
-    // broadcast factors
-    const int64_t rk2 = neq2/nek2;
-    const int64_t rk3 = neq3/nek3;
-
-    const int64_t rv2 = neq2/nev2;
-    const int64_t rv3 = neq3/nev3;
-
-    // parallelize by q rows using ggml_vec_dot_f32
+    fattn_params p;
 
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
+    p.q     = q;
+    p.k     = k;
+    p.v     = v;
+    p.mask  = mask;
+    p.sinks = sinks;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    // broadcast factors
+    p.rk2 = neq2/nek2;
+    p.rk3 = neq3/nek3;
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    p.rv2 = neq2/nev2;
+    p.rv3 = neq3/nev3;
 
-    float scale         = 1.0f;
-    float max_bias      = 0.0f;
-    float logit_softcap = 0.0f;
+    p.scale         = 1.0f;
+    p.max_bias      = 0.0f;
+    p.logit_softcap = 0.0f;
 
-    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
-    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
-    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+    memcpy(&p.scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&p.max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&p.logit_softcap, (float *) dst->op_params + 2, sizeof(float));
 
-    if (logit_softcap != 0) {
-        scale /= logit_softcap;
+    if (p.logit_softcap != 0) {
+        p.scale /= p.logit_softcap;
     }
 
-    const uint32_t n_head      = neq2;
-    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+    const uint32_t n_head = neq2;
+    p.n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
 
-    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
-    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+    p.m0 = powf(2.0f, -(p.max_bias       ) / p.n_head_log2);
+    p.m1 = powf(2.0f, -(p.max_bias / 2.0f) / p.n_head_log2);
 
-    ggml_type         const k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
-    ggml_from_float_t const q_to_vec_dot   = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
-    ggml_vec_dot_t    const kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
-    ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
+    ggml_type const k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
 
-    GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
-    GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
+    p.q_to_vec_dot = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
+    p.kq_vec_dot   = ggml_get_type_traits_cpu(k->type)->vec_dot;
+    p.v_to_float   = ggml_get_type_traits(v->type)->to_float;
+    p.q_row_size   = GGML_PAD(ggml_row_size(k_vec_dot_type, DK), sizeof(float));
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    GGML_ASSERT((                              p.q_to_vec_dot) && "fattn: unsupported K-type");
+    GGML_ASSERT((v->type == GGML_TYPE_F32 || p.v_to_float  ) && "fattn: unsupported V-type");
 
-        const uint32_t h = iq2; // head index
-        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+    // work units: blocks of query rows x query heads sharing a K/V head
+    fattn_layout layout;
+    layout.N         = N;
+    layout.n_group   = p.rk2 == p.rv2 ? p.rk2 : 1;
+    layout.n_kv_head = neq2/layout.n_group;
+    layout.nh_unit   = MIN(layout.n_group, GGML_FA_TILE_Q);
+    layout.nr_unit   = MAX(1, GGML_FA_TILE_Q/layout.nh_unit);
+    layout.n_rblk    = (N + layout.nr_unit - 1)/layout.nr_unit;
+    layout.n_hblk    = (layout.n_group + layout.nh_unit - 1)/layout.nh_unit;
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
+    const int64_t n_units = layout.n_rblk*layout.n_hblk*layout.n_kv_head*neq3;
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+    // per-thread state, see GGML_OP_FLASH_ATTN_EXT in ggml_graph_plan
+    const size_t thread_size = GGML_FA_TILE_Q*(DK + DV + 2 + GGML_FA_TILE_KV) + DV + CACHE_LINE_SIZE_F32;
 
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, DV*sizeof(float));
-        }
-
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+    float * wdata = (float *) params->wdata + ith*thread_size;
 
-        // k indices
-        const int ik3 = iq3 / rk3;
-        const int ik2 = iq2 / rk2;
+    fattn_state st;
+    st.VKQ = wdata;
+    st.M   = st.VKQ + GGML_FA_TILE_Q*DV;
+    st.S   = st.M   + GGML_FA_TILE_Q;
+    st.KQ  = st.S   + GGML_FA_TILE_Q;
+    st.V32 = st.KQ  + GGML_FA_TILE_Q*GGML_FA_TILE_KV;
+    st.Q_q = (char *) (st.V32 + DV);
 
-        // v indices
-        const int iv3 = iq3 / rv3;
-        const int iv2 = iq2 / rv2;
+    // with fewer units than threads (e.g. single token decode), the threads share the K/V rows of the units
+    // instead (flash-decoding): each thread processes a contiguous range of the n_units*nek1 (unit, K/V row)
+    // pairs, which spans at most two units, and the partial results are merged with their log-sum-exp
+    const int64_t n_work = n_units*nek1;
+    const bool split_kv  = nth > 1 && n_units < nth && n_work >= (int64_t) nth*4*GGML_FA_TILE_KV;
 
-        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
-        q_to_vec_dot(pq, Q_q, DK);
-
-        // online softmax / attention
-        // loop over n_kv and n_head_kv
-        // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
-                continue;
-            }
+    if (!split_kv) {
+        for (int64_t iu = ith; iu < n_units; iu += nth) {
+            const fattn_unit u = layout.get(iu);
 
-            float s; // KQ value
-
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
-
-            s = s*scale; // scale KQ value
+            fattn_unit_init(p, u, st);
+            fattn_unit_accumulate(p, u, st, 0, nek1);
+            fattn_unit_store(p, u, st, dst);
+        }
+        return;
+    }
 
-            if (logit_softcap != 0.0f) {
-                s = logit_softcap*tanhf(s);
-            }
+    // partial results: [nth][2 units][M, S, VKQ] after the per-thread states
+    const size_t part_size = GGML_FA_TILE_Q*(DV + 2);
+    float * parts = (float *) params->wdata + nth*thread_size;
 
-            s += mv; // apply mask
+    const int64_t w0 = n_work*ith/nth;
+    const int64_t w1 = n_work*(ith + 1)/nth;
 
-            const float Mold = M;
+    for (int64_t w = w0, slot = 0; w < w1; ++slot) {
+        const int64_t iu  = w/nek1;
+        const int64_t ic0 = w%nek1;
+        const int64_t ic1 = MIN(nek1, ic0 + (w1 - w));
 
-            float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
-            float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+        const fattn_unit u = layout.get(iu);
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+        fattn_unit_init(p, u, st);
+        fattn_unit_accumulate(p, u, st, ic0, ic1);
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+        float * part = parts + (2*ith + slot)*part_size;
+        memcpy(part,                    st.M,   u.nq()*sizeof(float));
+        memcpy(part +   GGML_FA_TILE_Q, st.S,   u.nq()*sizeof(float));
+        memcpy(part + 2*GGML_FA_TILE_Q, st.VKQ, u.nq()*DV*sizeof(float));
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(DV, VKQ16, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
-                }
+        w += ic1 - ic0;
+    }
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
-            } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+    ggml_barrier(params->threadpool);
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(DV, VKQ32, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
-                }
+    for (int64_t iu = ith; iu < n_units; iu += nth) {
+        const fattn_unit u  = layout.get(iu);
+        const int64_t    nq = u.nq();
 
-                // V += v*expf(s - M)
-                if (v_to_float) {
-                    v_to_float(v_data, V32, DV);
-                    ggml_vec_mad_f32(DV, VKQ32, V32, vs);
-                } else {
-                    // V is F32
-                    ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
-                }
-            }
+        const int64_t u0 = iu*nek1;
+        const int64_t u1 = u0 + nek1;
 
-            S = S*ms + vs; // scale and increment sum with partial sum
+        for (int64_t iq = 0; iq < nq; ++iq) {
+            st.M[iq] = -INFINITY;
         }
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < DV; ++d) {
-                VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
+        // the maximum over all the parts, then the rescaled sums
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                for (int64_t iq = 0; iq < nq; ++iq) {
+                    st.S[iq] = 0.0f;
+                }
+                memset(st.VKQ, 0, nq*DV*sizeof(float));
             }
-        }
 
-        // sinks
-        if (sinks) {
-            const float s = ((float *)((char *) sinks->data))[h];
+            for (int t = 0; t < nth; ++t) {
+                const int64_t t0 = n_work*t/nth;
+                const int64_t t1 = n_work*(t + 1)/nth;
+                if (t1 <= u0 || t0 >= u1 || t0 == t1) {
+                    continue;
+                }
 
-            float ms = 1.0f;
-            float vs = 1.0f;
+                const int64_t slot = t0/nek1 == iu ? 0 : 1;
+                const float * part = parts + (2*t + slot)*part_size;
 
-            if (s > M) {
-                ms = expf(M - s);
-                ggml_vec_scale_f32(DV, VKQ32, ms);
-            } else {
-                vs = expf(s - M);
+                for (int64_t iq = 0; iq < nq; ++iq) {
+                    const float M = part[iq];
+                    if (pass == 0) {
+                        st.M[iq] = MAX(st.M[iq], M);
+                    } else if (M != -INFINITY) {
+                        const float ms = expf(M - st.M[iq]);
+                        st.S[iq] += part[GGML_FA_TILE_Q + iq]*ms;
+                        ggml_vec_mad_f32(DV, st.VKQ + iq*DV, part + 2*GGML_FA_TILE_Q + iq*DV, ms);
+                    }
+                }
             }
-
-            S = S*ms + vs;
         }
 
-        // V /= S
-        const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(DV, VKQ32, S_inv);
-
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
-
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
-
-        // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+        fattn_unit_store(p, u, st, dst);
     }
 }
 
@@ -9293,6 +9418,46 @@ void ggml_compute_forward_glu(
     }
 }
 
+// ggml_compute_forward_silu_mul_fused
+
+// computes UNARY(SILU) -> MUL as a single swiglu, without storing the result of the silu
+void ggml_compute_forward_silu_mul_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * silu,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = silu->src[0];
+    const ggml_tensor * g    = mul->src[0] == silu ? mul->src[1] : mul->src[0];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && g->type == GGML_TYPE_F32 && mul->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_are_same_shape(src0, mul) && ggml_are_same_shape(g, mul));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && g->nb[0] == sizeof(float) && mul->nb[0] == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = mul->ne[0];
+    const int nr = ggml_nrows(mul);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int ir = ir0; ir < ir1; ir++) {
+        const int64_t i3 = ir/(mul->ne[2]*mul->ne[1]);
+        const int64_t i2 = (ir - i3*mul->ne[2]*mul->ne[1])/mul->ne[1];
+        const int64_t i1 = ir - i3*mul->ne[2]*mul->ne[1] - i2*mul->ne[1];
+
+        ggml_vec_swiglu_f32(nc,
+                (float *) ((char *) mul->data + i1*mul->nb[1] + i2*mul->nb[2] + i3*mul->nb[3]),
+                (const float *) ((const char *) src0->data + i1*src0->nb[1] + i2*src0->nb[2] + i3*src0->nb[3]),
+                (const float *) ((const char *) g->data + i1*g->nb[1] + i2*g->nb[2] + i3*g->nb[3]));
+    }
+}
+
 // ggml_compute_forward_get_rel_pos
 
 static void ggml_compute_forward_get_rel_pos_f16(
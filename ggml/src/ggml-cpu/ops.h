@@ -23,6 +23,10 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Flash attention tiles: query vectors (query rows x heads sharing a K/V head) and K/V rows processed together
+#define GGML_FA_TILE_Q  32
+#define GGML_FA_TILE_KV 32
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,6 +112,10 @@ void ggml_compute_forward_cross_entropy_loss_back(const struct ggml_compute_para
 void ggml_compute_forward_opt_step_adamw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 
+// fused sequences of ops, see ggml_cpu_fused_n_nodes
+void ggml_compute_forward_rms_norm_mul_fused(const struct ggml_compute_params * params, struct ggml_tensor * add, struct ggml_tensor * norm, struct ggml_tensor * mul);
+void ggml_compute_forward_silu_mul_fused(const struct ggml_compute_params * params, struct ggml_tensor * silu, struct ggml_tensor * mul);
+
 #ifdef __cplusplus
 }
 #endif
@@ -285,23 +285,31 @@ ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float
     int i = 0;
     ggml_float sum = 0;
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
+    // accumulate in double lanes, a horizontal sum per vector is slower than the exp
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
     for (; i + 15 < n; i += 16) {
         __m512 val = ggml_v_expf(_mm512_sub_ps(_mm512_loadu_ps(x + i),
                                                _mm512_set1_ps(max)));
         _mm512_storeu_ps(y + i, val);
-        sum += (ggml_float)_mm512_reduce_add_ps(val);
+        acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(val)));
+        acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(_mm512_extractf32x8_ps(val, 1)));
     }
+    sum += (ggml_float)_mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
 #elif defined(__AVX2__) && defined(__FMA__)
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
     for (; i + 7 < n; i += 8) {
         __m256 val = ggml_v_expf(_mm256_sub_ps(_mm256_loadu_ps(x + i),
                                                _mm256_set1_ps(max)));
         _mm256_storeu_ps(y + i, val);
-        __m128 val2 = _mm_add_ps(_mm256_extractf128_ps(val, 1),
-                                 _mm256_castps256_ps128(val));
-        val2 = _mm_add_ps(val2, _mm_movehl_ps(val2, val2));
-        val2 = _mm_add_ss(val2, _mm_movehdup_ps(val2));
-        sum += (ggml_float)_mm_cvtss_f32(val2);
+        acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(val)));
+        acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(val, 1)));
     }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d acc = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    acc = _mm_add_sd(acc, _mm_unpackhi_pd(acc, acc));
+    sum += (ggml_float)_mm_cvtsd_f64(acc);
 #elif defined(__SSE2__)
     for (; i + 3 < n; i += 4) {
         __m128 val = ggml_v_expf(_mm_sub_ps(_mm_loadu_ps(x + i),
@@ -334,6 +342,201 @@ ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float
     return sum;
 }
 
+float ggml_vec_scale_add_max_f32(const int n, float * y, const float * x, const float s, const float * b, const float v) {
+    int i = 0;
+    float max = -INFINITY;
+#if defined(__AVX512F__)
+    __m512 vmax = _mm512_set1_ps(-INFINITY);
+    for (; i + 15 < n; i += 16) {
+        __m512 val = _mm512_mul_ps(_mm512_loadu_ps(x + i), _mm512_set1_ps(s));
+        if (b) {
+            val = _mm512_add_ps(val, _mm512_mul_ps(_mm512_loadu_ps(b + i), _mm512_set1_ps(v)));
+        }
+        _mm512_storeu_ps(y + i, val);
+        vmax = _mm512_max_ps(vmax, val);
+    }
+    max = _mm512_reduce_max_ps(vmax);
+#elif defined(__AVX__)
+    __m256 vmax = _mm256_set1_ps(-INFINITY);
+    for (; i + 7 < n; i += 8) {
+        __m256 val = _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_set1_ps(s));
+        if (b) {
+            val = _mm256_add_ps(val, _mm256_mul_ps(_mm256_loadu_ps(b + i), _mm256_set1_ps(v)));
+        }
+        _mm256_storeu_ps(y + i, val);
+        vmax = _mm256_max_ps(vmax, val);
+    }
+    __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+    max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+    max4 = _mm_max_ss(max4, _mm_movehdup_ps(max4));
+    max = _mm_cvtss_f32(max4);
+#elif defined(__SSE2__)
+    __m128 vmax = _mm_set1_ps(-INFINITY);
+    for (; i + 3 < n; i += 4) {
+        __m128 val = _mm_mul_ps(_mm_loadu_ps(x + i), _mm_set1_ps(s));
+        if (b) {
+            val = _mm_add_ps(val, _mm_mul_ps(_mm_loadu_ps(b + i), _mm_set1_ps(v)));
+        }
+        _mm_storeu_ps(y + i, val);
+        vmax = _mm_max_ps(vmax, val);
+    }
+    vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+    vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 1, 1, 1)));
+    max = _mm_cvtss_f32(vmax);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t vmax = vdupq_n_f32(-INFINITY);
+    for (; i + 3 < n; i += 4) {
+        float32x4_t val = vmulq_n_f32(vld1q_f32(x + i), s);
+        if (b) {
+            val = vaddq_f32(val, vmulq_n_f32(vld1q_f32(b + i), v));
+        }
+        vst1q_f32(y + i, val);
+        vmax = vmaxq_f32(vmax, val);
+    }
+    max = vmaxvq_f32(vmax);
+#endif
+    for (; i < n; ++i) {
+        float val = x[i]*s;
+        if (b) {
+            val += b[i]*v;
+        }
+        y[i] = val;
+        max = MAX(max, val);
+    }
+    return max;
+}
+
+ggml_float ggml_vec_sumsq_f32(const int n, const float * x) {
+    int i = 0;
+    ggml_float sum = 0;
+#if defined(__AVX512F__)
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    for (; i + 15 < n; i += 16) {
+        __m512 val = _mm512_loadu_ps(x + i);
+        val = _mm512_mul_ps(val, val);
+        acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(val)));
+        acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(val), 1))));
+    }
+    sum += (ggml_float)_mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+#elif defined(__AVX__)
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (; i + 7 < n; i += 8) {
+        __m256 val = _mm256_loadu_ps(x + i);
+        val = _mm256_mul_ps(val, val);
+        acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(val)));
+        acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(val, 1)));
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d acc = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    acc = _mm_add_sd(acc, _mm_unpackhi_pd(acc, acc));
+    sum += (ggml_float)_mm_cvtsd_f64(acc);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    for (; i + 3 < n; i += 4) {
+        float32x4_t val = vld1q_f32(x + i);
+        val = vmulq_f32(val, val);
+        acc0 = vaddq_f64(acc0, vcvt_f64_f32(vget_low_f32(val)));
+        acc1 = vaddq_f64(acc1, vcvt_high_f64_f32(val));
+    }
+    sum += (ggml_float)vaddvq_f64(vaddq_f64(acc0, acc1));
+#endif
+    for (; i < n; ++i) {
+        sum += (ggml_float)(x[i]*x[i]);
+    }
+    return sum;
+}
+
+void ggml_vec_rope_norm_f32(const int n, float * y, const float * x, const float * c, const float * s) {
+    int i = 0;
+#if defined(__AVX512F__)
+    for (; i + 15 < n; i += 16) {
+        const __m512 vx = _mm512_loadu_ps(x + i);
+        const __m512 vr = _mm512_permute_ps(vx, 0xB1); // swap the values of each pair
+        _mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_mul_ps(vx, _mm512_loadu_ps(c + i)),
+                                              _mm512_mul_ps(vr, _mm512_loadu_ps(s + i))));
+    }
+#elif defined(__AVX__)
+    for (; i + 7 < n; i += 8) {
+        const __m256 vx = _mm256_loadu_ps(x + i);
+        const __m256 vr = _mm256_permute_ps(vx, 0xB1);
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_mul_ps(vx, _mm256_loadu_ps(c + i)),
+                                              _mm256_mul_ps(vr, _mm256_loadu_ps(s + i))));
+    }
+#elif defined(__SSE2__)
+    for (; i + 3 < n; i += 4) {
+        const __m128 vx = _mm_loadu_ps(x + i);
+        const __m128 vr = _mm_shuffle_ps(vx, vx, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(c + i)),
+                                        _mm_mul_ps(vr, _mm_loadu_ps(s + i))));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 3 < n; i += 4) {
+        const float32x4_t vx = vld1q_f32(x + i);
+        const float32x4_t vr = vrev64q_f32(vx);
+        vst1q_f32(y + i, vaddq_f32(vmulq_f32(vx, vld1q_f32(c + i)),
+                                   vmulq_f32(vr, vld1q_f32(s + i))));
+    }
+#endif
+    for (; i < n; i += 2) {
+        const float x0 = x[i + 0];
+        const float x1 = x[i + 1];
+
+        y[i + 0] = x0*c[i + 0] + x1*s[i + 0];
+        y[i + 1] = x1*c[i + 1] + x0*s[i + 1];
+    }
+}
+
+void ggml_vec_rope_neox_f32(const int n, float * y0, float * y1, const float * x0, const float * x1, const float * c, const float * s) {
+    int i = 0;
+#if defined(__AVX512F__)
+    for (; i + 15 < n; i += 16) {
+        const __m512 v0 = _mm512_loadu_ps(x0 + i);
+        const __m512 v1 = _mm512_loadu_ps(x1 + i);
+        const __m512 vc = _mm512_loadu_ps(c + i);
+        const __m512 vs = _mm512_loadu_ps(s + i);
+        _mm512_storeu_ps(y0 + i, _mm512_sub_ps(_mm512_mul_ps(v0, vc), _mm512_mul_ps(v1, vs)));
+        _mm512_storeu_ps(y1 + i, _mm512_add_ps(_mm512_mul_ps(v0, vs), _mm512_mul_ps(v1, vc)));
+    }
+#elif defined(__AVX__)
+    for (; i + 7 < n; i += 8) {
+        const __m256 v0 = _mm256_loadu_ps(x0 + i);
+        const __m256 v1 = _mm256_loadu_ps(x1 + i);
+        const __m256 vc = _mm256_loadu_ps(c + i);
+        const __m256 vs = _mm256_loadu_ps(s + i);
+        _mm256_storeu_ps(y0 + i, _mm256_sub_ps(_mm256_mul_ps(v0, vc), _mm256_mul_ps(v1, vs)));
+        _mm256_storeu_ps(y1 + i, _mm256_add_ps(_mm256_mul_ps(v0, vs), _mm256_mul_ps(v1, vc)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 3 < n; i += 4) {
+        const __m128 v0 = _mm_loadu_ps(x0 + i);
+        const __m128 v1 = _mm_loadu_ps(x1 + i);
+        const __m128 vc = _mm_loadu_ps(c + i);
+        const __m128 vs = _mm_loadu_ps(s + i);
+        _mm_storeu_ps(y0 + i, _mm_sub_ps(_mm_mul_ps(v0, vc), _mm_mul_ps(v1, vs)));
+        _mm_storeu_ps(y1 + i, _mm_add_ps(_mm_mul_ps(v0, vs), _mm_mul_ps(v1, vc)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 3 < n; i += 4) {
+        const float32x4_t v0 = vld1q_f32(x0 + i);
+        const float32x4_t v1 = vld1q_f32(x1 + i);
+        const float32x4_t vc = vld1q_f32(c + i);
+        const float32x4_t vs = vld1q_f32(s + i);
+        vst1q_f32(y0 + i, vsubq_f32(vmulq_f32(v0, vc), vmulq_f32(v1, vs)));
+        vst1q_f32(y1 + i, vaddq_f32(vmulq_f32(v0, vs), vmulq_f32(v1, vc)));
+    }
+#endif
+    for (; i < n; ++i) {
+        const float v0 = x0[i];
+        const float v1 = x1[i];
+
+        y0[i] = v0*c[i] - v1*s[i];
+        y1[i] = v0*s[i] + v1*c[i];
+    }
+}
+
 ggml_float ggml_vec_log_soft_max_f32(const int n, float * y, const float * x, float max) {
     // log(soft_max) = log(soft_max_i / soft_max_sum) = log(soft_max_i) - log(soft_max_sum) = (logit_i - max) - log(soft_max_i)
 
@@ -47,6 +47,19 @@ void ggml_vec_silu_f32(const int n, float * y, const float * x);
 ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float max);
 ggml_float ggml_vec_log_soft_max_f32(const int n, float * y, const float * x, float max);
 
+// y = s*x + v*b (no b if NULL), returns max(y)
+float ggml_vec_scale_add_max_f32(const int n, float * y, const float * x, const float s, const float * b, const float v);
+
+// sum(x*x) with a ggml_float accumulator
+ggml_float ggml_vec_sumsq_f32(const int n, const float * x);
+
+// rotate the pairs (x[2i], x[2i + 1]) of n values
+// c = [c0, c0, c1, c1, ...], s = [-s0, s0, -s1, s1, ...]
+void ggml_vec_rope_norm_f32(const int n, float * y, const float * x, const float * c, const float * s);
+
+// rotate the pairs (x0[i], x1[i]) of n values, y0/y1 may alias x0/x1
+void ggml_vec_rope_neox_f32(const int n, float * y0, float * y1, const float * x0, const float * x1, const float * c, const float * s);
+
 inline static void ggml_vec_set_i8(const int n, int8_t * x, const int8_t v) { for (int i = 0; i < n; ++i) x[i] = v; }
 inline static void ggml_vec_set_i16(const int n, int16_t * x, const int16_t v) { for (int i = 0; i < n; ++i) x[i] = v; }
 
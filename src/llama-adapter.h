@@ -74,3 +74,6 @@ struct llama_adapter_lora {
 };
 
 using llama_adapter_loras = std::unordered_map<llama_adapter_lora *, float>;
+
+// adapters applied only to the tokens of a sequence
+using llama_adapter_loras_seq = std::unordered_map<llama_seq_id, llama_adapter_loras>;
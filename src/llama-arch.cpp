@@ -110,6 +110,7 @@ static const std::map<llm_kv, const char *> LLM_KV_NAMES = {
     { LLM_KV_GENERAL_LICENSE,              "general.license"                       },
     { LLM_KV_GENERAL_SOURCE_URL,           "general.source.url"                    },
     { LLM_KV_GENERAL_SOURCE_HF_REPO,       "general.source.huggingface.repository" },
+    { LLM_KV_GENERAL_REPACK_LAYOUTS,       "general.repack.layouts"                },
 
     { LLM_KV_VOCAB_SIZE,                        "%s.vocab_size"                        },
     { LLM_KV_CONTEXT_LENGTH,                    "%s.context_length"                    },
@@ -2298,6 +2299,34 @@ const llm_tensor_info & llm_tensor_info_for(llm_tensor tensor) {
     return LLM_TENSOR_INFOS.at(tensor);
 }
 
+ggml_op llm_tensor_op_for_name(llm_arch arch, const std::string & name) {
+    // "blk.<n>.<tensor>.weight" -> "blk.%d.<tensor>"
+    static const std::string suffix = ".weight";
+    if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return GGML_OP_NONE;
+    }
+    std::string base = name.substr(0, name.size() - suffix.size());
+
+    int bid = -1;
+    int n   = 0;
+    if (sscanf(base.c_str(), "blk.%d.%n", &bid, &n) == 1 && n > 0) {
+        base = "blk.%d." + base.substr(n);
+    }
+
+    const auto it_arch = LLM_TENSOR_NAMES.find(arch);
+    if (it_arch == LLM_TENSOR_NAMES.end()) {
+        return GGML_OP_NONE;
+    }
+    for (const auto & it : it_arch->second) {
+        if (base == it.second) {
+            const auto it_info = LLM_TENSOR_INFOS.find(it.first);
+            return it_info == LLM_TENSOR_INFOS.end() ? GGML_OP_NONE : it_info->second.op;
+        }
+    }
+
+    return GGML_OP_NONE;
+}
+
 bool llm_arch_is_recurrent(const llm_arch & arch) {
     switch (arch) {
         case LLM_ARCH_MAMBA:
@@ -114,6 +114,7 @@ enum llm_kv {
     LLM_KV_GENERAL_LICENSE,
     LLM_KV_GENERAL_SOURCE_URL,
     LLM_KV_GENERAL_SOURCE_HF_REPO,
+    LLM_KV_GENERAL_REPACK_LAYOUTS,
 
     LLM_KV_VOCAB_SIZE,
     LLM_KV_CONTEXT_LENGTH,
@@ -493,6 +494,9 @@ llm_arch llm_arch_from_string(const std::string & name);
 
 const llm_tensor_info & llm_tensor_info_for(llm_tensor tensor);
 
+// op a weight of the architecture is used with, from its name in the model file (GGML_OP_NONE if unknown)
+ggml_op llm_tensor_op_for_name(llm_arch arch, const std::string & name);
+
 bool llm_arch_is_recurrent(const llm_arch & arch);
 bool llm_arch_is_hybrid   (const llm_arch & arch);
 bool llm_arch_is_diffusion(const llm_arch & arch);
@@ -679,6 +679,9 @@ void llama_context::set_adapter_lora(
     LLAMA_LOG_DEBUG("%s: adapter = %p, scale = %f\n", __func__, (void *) adapter, scale);
 
     loras[adapter] = scale;
+
+    // the adapters are part of the graph
+    gf_res_prev->reset();
 }
 
 bool llama_context::rm_adapter_lora(
@@ -688,6 +691,7 @@ bool llama_context::rm_adapter_lora(
     auto pos = loras.find(adapter);
     if (pos != loras.end()) {
         loras.erase(pos);
+        gf_res_prev->reset();
         return true;
     }
 
@@ -698,6 +702,37 @@ void llama_context::clear_adapter_lora() {
     LLAMA_LOG_DEBUG("%s: call\n", __func__);
 
     loras.clear();
+    gf_res_prev->reset();
+}
+
+bool llama_context::set_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale) {
+    LLAMA_LOG_DEBUG("%s: adapter = %p, seq_id = %d, scale = %f\n", __func__, (void *) adapter, seq_id, scale);
+
+    if (seq_id < 0 || (uint32_t) seq_id >= cparams.n_seq_max) {
+        LLAMA_LOG_ERROR("%s: invalid seq_id = %d >= %u\n", __func__, seq_id, cparams.n_seq_max);
+        return false;
+    }
+
+    loras_seq[seq_id][adapter] = scale;
+
+    gf_res_prev->reset();
+
+    return true;
+}
+
+void llama_context::clear_adapter_lora_seq(llama_seq_id seq_id) {
+    LLAMA_LOG_DEBUG("%s: seq_id = %d\n", __func__, seq_id);
+
+    if (seq_id < 0) {
+        loras_seq.clear();
+    } else {
+        loras_seq.erase(seq_id);
+    }
+
+    gf_res_prev->reset();
 }
 
 bool llama_context::apply_adapter_cvec(
@@ -1421,6 +1456,7 @@ llm_graph_params llama_context::graph_params(
         /*.backend_cpu =*/ backend_cpu,
         /*.cvec        =*/ &cvec,
         /*.loras       =*/ &loras,
+        /*.loras_seq   =*/ &loras_seq,
         /*.mctx        =*/ mctx,
         /*.cross       =*/ &cross,
         /*.n_outputs   =*/ n_outputs,
@@ -2453,6 +2489,22 @@ void llama_clear_adapter_lora(llama_context * ctx) {
     ctx->clear_adapter_lora();
 }
 
+int32_t llama_set_adapter_lora_seq(
+            llama_context * ctx,
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale) {
+    bool res = ctx->set_adapter_lora_seq(adapter, seq_id, scale);
+
+    return res ? 0 : -1;
+}
+
+void llama_clear_adapter_lora_seq(
+            llama_context * ctx,
+            llama_seq_id seq_id) {
+    ctx->clear_adapter_lora_seq(seq_id);
+}
+
 int32_t llama_apply_adapter_cvec(
         llama_context * ctx,
                  const float * data,
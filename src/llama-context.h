@@ -83,6 +83,13 @@ struct llama_context {
 
     void clear_adapter_lora();
 
+    bool set_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale);
+
+    void clear_adapter_lora_seq(llama_seq_id seq_id);
+
     bool apply_adapter_cvec(
             const float * data,
                  size_t   len,
@@ -225,6 +232,8 @@ private:
     llama_adapter_cvec  cvec;
     llama_adapter_loras loras;
 
+    llama_adapter_loras_seq loras_seq;
+
     llama_cross cross; // TODO: tmp for handling cross-attention - need something better probably
 
     std::unique_ptr<llama_memory_i> memory;
@@ -9,6 +9,7 @@
 #include "llama-memory-hybrid.h"
 #include "llama-memory-recurrent.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -143,6 +144,107 @@ bool llm_graph_input_out_ids::can_reuse(const llm_graph_params & params) {
     return res;
 }
 
+std::vector<llm_graph_input_lora_seq::group> llm_graph_input_lora_seq::get_groups(
+        const llama_ubatch & ubatch,
+        const llama_adapter_loras_seq & loras_seq,
+        uint32_t n_outputs) {
+    std::vector<group> res;
+
+    // the ubatch used to reserve the graph does not have sequences
+    if (loras_seq.empty() || ubatch.seq_id == nullptr) {
+        return res;
+    }
+
+    const int64_t n_tokens = ubatch.n_tokens;
+
+    std::unordered_map<const llama_adapter_lora *, size_t> idx;
+
+    int32_t i_out = 0;
+    for (int64_t i = 0; i < n_tokens; ++i) {
+        // same order as llm_graph_input_out_ids
+        const bool is_out = n_outputs == n_tokens || (ubatch.output && ubatch.output[i]);
+
+        // the tokens shared by several sequences use the adapters of the first one
+        const auto it = ubatch.n_seq_id[i] > 0 ? loras_seq.find(ubatch.seq_id[i][0]) : loras_seq.end();
+        if (it != loras_seq.end()) {
+            for (const auto & [adapter, scale] : it->second) {
+                auto [it_idx, added] = idx.emplace(adapter, res.size());
+                if (added) {
+                    res.push_back({ adapter, {}, {}, {}, {}, 0, 0 });
+                }
+
+                group & g = res[it_idx->second];
+                g.rows.push_back(i);
+                g.scales.push_back(scale);
+                if (is_out) {
+                    g.rows_out.push_back(i_out);
+                    g.scales_out.push_back(scale);
+                }
+            }
+        }
+
+        if (is_out) {
+            i_out++;
+        }
+    }
+
+    int64_t offs = 0;
+    for (auto & g : res) {
+        g.offs     = offs;
+        offs      += g.rows.size();
+        g.offs_out = offs;
+        offs      += g.rows_out.size();
+    }
+
+    return res;
+}
+
+void llm_graph_input_lora_seq::set_input(const llama_ubatch * ubatch) {
+    if (!rows) {
+        return;
+    }
+
+    const auto cur = get_groups(*ubatch, *loras_seq, n_outputs);
+    GGML_ASSERT(cur.size() == groups.size());
+
+    const int64_t n_rows = rows->ne[0];
+
+    std::vector<int32_t> data_rows    (n_rows);
+    std::vector<int64_t> data_rows_i64(n_rows);
+    std::vector<float>   data_scales  (n_rows);
+
+    for (const auto & g : cur) {
+        std::copy(g.rows.begin(),       g.rows.end(),       data_rows.begin()     + g.offs);
+        std::copy(g.rows.begin(),       g.rows.end(),       data_rows_i64.begin() + g.offs);
+        std::copy(g.scales.begin(),     g.scales.end(),     data_scales.begin()   + g.offs);
+        std::copy(g.rows_out.begin(),   g.rows_out.end(),   data_rows.begin()     + g.offs_out);
+        std::copy(g.rows_out.begin(),   g.rows_out.end(),   data_rows_i64.begin() + g.offs_out);
+        std::copy(g.scales_out.begin(), g.scales_out.end(), data_scales.begin()   + g.offs_out);
+    }
+
+    ggml_backend_tensor_set(rows,     data_rows.data(),     0, n_rows*ggml_element_size(rows));
+    ggml_backend_tensor_set(rows_i64, data_rows_i64.data(), 0, n_rows*ggml_element_size(rows_i64));
+    ggml_backend_tensor_set(scales,   data_scales.data(),   0, n_rows*ggml_element_size(scales));
+}
+
+bool llm_graph_input_lora_seq::can_reuse(const llm_graph_params & params) {
+    // the graph depends on the adapters and on the number of tokens that use them
+    const auto cur = get_groups(params.ubatch, *params.loras_seq, params.n_outputs);
+    if (cur.size() != groups.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < cur.size(); ++i) {
+        if (cur[i].adapter         != groups[i].adapter     ||
+            cur[i].rows.size()     != groups[i].rows.size() ||
+            cur[i].rows_out.size() != groups[i].rows_out.size()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void llm_graph_input_mean::set_input(const llama_ubatch * ubatch) {
     if (cparams.embeddings && cparams.pooling_type == LLAMA_POOLING_TYPE_MEAN) {
         const int64_t n_tokens     = ubatch->n_tokens;
@@ -267,6 +369,54 @@ void llm_graph_input_attn_no_cache::set_input(const llama_ubatch * ubatch) {
 
     float * data = (float *) kq_mask->data;
 
+    if (n_pad > 0) {
+        GGML_ASSERT(ggml_backend_buffer_is_host(idx_pad->buffer));
+        GGML_ASSERT(ggml_backend_buffer_is_host(idx_unpad->buffer));
+
+        const int64_t n_seqs = ubatch->n_seqs_unq;
+        const int64_t n_rows = kq_mask->ne[1];
+
+        int32_t * data_pad   = (int32_t *) idx_pad->data;
+        int32_t * data_unpad = (int32_t *) idx_unpad->data;
+
+        std::vector<int32_t> n_seq_tokens(n_seqs, 0);
+
+        for (int i = 0; i < n_tokens; ++i) {
+            const int32_t s = ubatch->seq_idx[ubatch->seq_id[i][0]];
+            const int32_t j = s*n_pad + n_seq_tokens[s]++;
+
+            data_pad[j]   = i;
+            data_unpad[i] = j;
+        }
+
+        for (int64_t s = 0; s < n_seqs; ++s) {
+            // the padding rows repeat the first token of the sequence, so that none of their mask rows is empty
+            for (uint32_t c = n_seq_tokens[s]; c < n_pad; ++c) {
+                data_pad[s*n_pad + c] = data_pad[s*n_pad];
+            }
+
+            for (uint32_t c1 = 0; c1 < n_pad; ++c1) {
+                const llama_pos p1 = ubatch->pos[data_pad[s*n_pad + c1]];
+
+                for (uint32_t c0 = 0; c0 < n_pad; ++c0) {
+                    float f = -INFINITY;
+
+                    if (c0 < (uint32_t) n_seq_tokens[s]) {
+                        const llama_pos p0 = ubatch->pos[data_pad[s*n_pad + c0]];
+
+                        if (!cparams.causal_attn || p0 <= p1) {
+                            f = hparams.use_alibi ? -std::abs(p0 - p1) : 0.0f;
+                        }
+                    }
+
+                    data[s*(n_pad*n_rows) + c1*n_pad + c0] = f;
+                }
+            }
+        }
+
+        return;
+    }
+
     for (int h = 0; h < 1; ++h) {
         for (int i1 = 0; i1 < n_tokens; ++i1) {
             const llama_seq_id s1 = ubatch->seq_id[i1][0];
@@ -519,6 +669,7 @@ llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     backend_cpu      (params.backend_cpu),
     cvec             (params.cvec),
     loras            (params.loras),
+    loras_seq        (params.loras_seq),
     mctx             (params.mctx),
     cross            (params.cross),
     cb_func          (params.cb),
@@ -526,6 +677,28 @@ llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     ctx0             (res->get_ctx()),
     gf               (res->get_gf()) {
         res->set_params(params);
+
+        if (loras_seq && !loras_seq->empty()) {
+            auto inp = std::make_unique<llm_graph_input_lora_seq>(loras_seq, n_outputs);
+
+            inp->groups = llm_graph_input_lora_seq::get_groups(ubatch, *loras_seq, n_outputs);
+
+            int64_t n_rows = 0;
+            for (const auto & g : inp->groups) {
+                n_rows += g.rows.size() + g.rows_out.size();
+            }
+
+            if (n_rows > 0) {
+                inp->rows     = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_rows);
+                inp->rows_i64 = ggml_new_tensor_1d(ctx0, GGML_TYPE_I64, n_rows);
+                inp->scales   = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, n_rows);
+                ggml_set_input(inp->rows);
+                ggml_set_input(inp->rows_i64);
+                ggml_set_input(inp->scales);
+            }
+
+            inp_lora_seq = static_cast<llm_graph_input_lora_seq *>(res->add_input(std::move(inp)));
+        }
     }
 
 void llm_graph_context::cb(ggml_tensor * cur, const char * name, int il) const {
@@ -563,7 +736,7 @@ ggml_tensor * llm_graph_context::build_lora_mm(
         res = ggml_add(ctx0, res, ab_cur);
     }
 
-    return res;
+    return build_lora_seq(w, cur, nullptr, res);
 }
 
 ggml_tensor * llm_graph_context::build_lora_mm_id(
@@ -591,7 +764,96 @@ ggml_tensor * llm_graph_context::build_lora_mm_id(
         res = ggml_add(ctx0, res, ab_cur);
     }
 
-    return res;
+    return build_lora_seq(w, cur, ids, res);
+}
+
+ggml_tensor * llm_graph_context::build_lora_seq(
+          ggml_tensor * w,
+          ggml_tensor * cur,
+          ggml_tensor * ids,
+          ggml_tensor * res) const {
+    if (!inp_lora_seq || !inp_lora_seq->rows) {
+        return res;
+    }
+
+    // cur is either [n_in, n_rows], [n_in, n_used, n_rows] with ids, or the I32 tokens for the input embeddings
+    // the rows are the tokens of the ubatch, or the outputs after ggml_get_rows(inp_out_ids)
+    const bool is_tokens = cur->type == GGML_TYPE_I32;
+
+    const int64_t n_rows = ids ? cur->ne[2] : is_tokens ? cur->ne[0] : ggml_nrows(cur);
+    if (n_rows != n_tokens && n_rows != n_outputs) {
+        // the rows do not correspond to tokens, the adapters of the sequences cannot be applied
+        return res;
+    }
+
+    const bool is_out = n_rows != n_tokens;
+
+    ggml_tensor * cur_2d = nullptr;
+    ggml_tensor * res_2d = nullptr;
+
+    for (const auto & g : inp_lora_seq->groups) {
+        llama_adapter_lora_weight * lw = g.adapter->get_weight(w);
+
+        const int64_t n = is_out ? g.rows_out.size() : g.rows.size();
+        if (lw == nullptr || n == 0) {
+            continue;
+        }
+
+        if (res_2d == nullptr) {
+            cur_2d = ggml_reshape_2d(ctx0, ggml_is_contiguous(cur) ? cur : ggml_cont(ctx0, cur), ggml_nelements(cur)/n_rows, n_rows);
+            res_2d = ggml_reshape_2d(ctx0, res, ggml_nelements(res)/n_rows, n_rows);
+        }
+
+        const int64_t offs = is_out ? g.offs_out : g.offs;
+
+        ggml_tensor * rows     = ggml_view_1d(ctx0, inp_lora_seq->rows,     n, offs*ggml_element_size(inp_lora_seq->rows));
+        ggml_tensor * rows_i64 = ggml_view_1d(ctx0, inp_lora_seq->rows_i64, n, offs*ggml_element_size(inp_lora_seq->rows_i64));
+        ggml_tensor * scales   = ggml_view_2d(ctx0, inp_lora_seq->scales, 1, n,
+                ggml_element_size(inp_lora_seq->scales), offs*ggml_element_size(inp_lora_seq->scales));
+
+        // only the rows of the tokens that use the adapter are multiplied
+        ggml_tensor * x = ggml_get_rows(ctx0, cur_2d, rows);
+
+        ggml_tensor * ab_cur = nullptr;
+        float scale = 1.0f;
+
+        if (is_tokens) {
+            ab_cur = ggml_mul_mat(
+                    ctx0, lw->b, // non-transposed lora_b
+                    ggml_get_rows(ctx0, lw->a, ggml_reshape_1d(ctx0, x, n))
+                    );
+            scale = lw->get_scale(g.adapter->alpha, 1.0f);
+        } else if (ids) {
+            ggml_tensor * ids_rows = ggml_get_rows(ctx0, ids, rows);
+
+            x = ggml_reshape_3d(ctx0, x, cur->ne[0], cur->ne[1], n);
+
+            ab_cur = ggml_mul_mat_id(
+                    ctx0, lw->b,
+                    ggml_mul_mat_id(ctx0, lw->a, x, ids_rows),
+                    ids_rows
+                    );
+            ab_cur = ggml_reshape_2d(ctx0, ab_cur, ab_cur->ne[0]*ab_cur->ne[1], n);
+
+            const float alpha = g.adapter->alpha;
+            const float rank  = (float) lw->b->ne[0];
+            scale = alpha ? alpha / rank : 1.0f;
+        } else {
+            ab_cur = ggml_mul_mat(
+                    ctx0, lw->b,
+                    ggml_mul_mat(ctx0, lw->a, x)
+                    );
+            scale = lw->get_scale(g.adapter->alpha, 1.0f);
+        }
+
+        // the scale of the adapter can be different for each sequence
+        ab_cur = ggml_mul(ctx0, ggml_scale(ctx0, ab_cur, scale), scales);
+        ab_cur = ggml_add(ctx0, ab_cur, ggml_get_rows(ctx0, res_2d, rows));
+
+        res_2d = ggml_set_rows(ctx0, res_2d, ab_cur, rows_i64);
+    }
+
+    return res_2d ? ggml_reshape(ctx0, res_2d, res) : res;
 }
 
 ggml_tensor * llm_graph_context::build_norm(
@@ -1055,6 +1317,8 @@ ggml_tensor * llm_graph_context::build_inp_embd(ggml_tensor * tok_embd) const {
 
             cur = ggml_add(ctx0, cur, inpL_delta);
         }
+
+        cur = build_lora_seq(tok_embd, inp->tokens, nullptr, cur);
     } else {
         inp->embd = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, ubatch.n_tokens);
         ggml_set_input(inp->embd);
@@ -1343,8 +1607,43 @@ ggml_tensor * llm_graph_context::build_attn_mha(
 llm_graph_input_attn_no_cache * llm_graph_context::build_attn_inp_no_cache() const {
     auto inp = std::make_unique<llm_graph_input_attn_no_cache>(hparams, cparams);
 
-    // note: there is no KV cache, so the number of KV values is equal to the number of tokens in the batch
-    inp->kq_mask = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_tokens, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1, 1);
+    // [TAG_NO_CACHE_PAD]
+    // the sequences of the batch do not attend to each other: when they are many, pad each of them to the
+    // longest one and compute the attention per sequence, if this is at least twice cheaper than a full mask
+    // over all the tokens. the relative position bias (T5) is built for the unpadded layout
+    if (ubatch.n_seqs_unq > 1 && hparams.n_rel_attn_bkts == 0) {
+        std::vector<uint32_t> n_seq_tokens(ubatch.n_seqs_unq, 0);
+
+        bool ok = true;
+        for (uint32_t i = 0; i < ubatch.n_tokens && ok; ++i) {
+            ok = ubatch.n_seq_id[i] == 1;
+            if (ok) {
+                n_seq_tokens[ubatch.seq_idx[ubatch.seq_id[i][0]]]++;
+            }
+        }
+
+        const uint64_t n_max = *std::max_element(n_seq_tokens.begin(), n_seq_tokens.end());
+
+        if (ok && 2*n_max*n_max*ubatch.n_seqs_unq <= (uint64_t) n_tokens*n_tokens) {
+            inp->n_pad = n_max;
+        }
+    }
+
+    if (inp->n_pad > 0) {
+        const int64_t n_pad  = inp->n_pad;
+        const int64_t n_seqs = ubatch.n_seqs_unq;
+
+        inp->idx_pad = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_pad*n_seqs);
+        ggml_set_input(inp->idx_pad);
+
+        inp->idx_unpad = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+        ggml_set_input(inp->idx_unpad);
+
+        inp->kq_mask = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_pad, GGML_PAD(n_pad, GGML_KQ_MASK_PAD), 1, n_seqs);
+    } else {
+        // note: there is no KV cache, so the number of KV values is equal to the number of tokens in the batch
+        inp->kq_mask = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_tokens, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1, 1);
+    }
     ggml_set_input(inp->kq_mask);
 
     inp->kq_mask_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->kq_mask, GGML_TYPE_F16) : inp->kq_mask;
@@ -1374,14 +1673,44 @@ ggml_tensor * llm_graph_context::build_attn(
     const auto & kq_mask = inp->get_kq_mask();
 
     // [TAG_NO_CACHE_PAD]
-    // TODO: if ubatch.equal_seqs() == true, we can split the three tensors below into ubatch.n_seqs_unq streams
     assert(!ubatch.equal_seqs());
 
     ggml_tensor * q = q_cur;
     ggml_tensor * k = k_cur;
     ggml_tensor * v = v_cur;
 
+    if (inp->n_pad > 0) {
+        GGML_ASSERT(kq_b == nullptr);
+
+        const int64_t n_pad  = inp->n_pad;
+        const int64_t n_seqs = ubatch.n_seqs_unq;
+
+        // gather the tokens of each sequence into its own stream of n_pad rows
+        auto pad = [&](ggml_tensor * x) {
+            const int64_t ne0 = x->ne[0];
+            const int64_t ne1 = x->ne[1];
+
+            if (!ggml_is_contiguous(x)) {
+                x = ggml_cont(ctx0, x);
+            }
+
+            x = ggml_get_rows(ctx0, ggml_reshape_2d(ctx0, x, ne0*ne1, x->ne[2]), inp->idx_pad);
+
+            return ggml_reshape_4d(ctx0, x, ne0, ne1, n_pad, n_seqs);
+        };
+
+        // build_attn_mha splits q into the streams of k
+        q = pad(q);
+        q = ggml_reshape_3d(ctx0, q, q->ne[0], q->ne[1], n_pad*n_seqs);
+        k = pad(k);
+        v = pad(v);
+    }
+
     ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, v_mla, nullptr, kq_scale);
+
+    if (inp->n_pad > 0) {
+        cur = ggml_get_rows(ctx0, cur, inp->idx_unpad);
+    }
     cb(cur, "kqv_out", il);
 
     if (wo) {
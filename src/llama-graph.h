@@ -184,6 +184,44 @@ public:
     const uint32_t n_outputs;
 };
 
+// the adapters of the sequences (llama_set_adapter_lora_seq)
+// for each adapter used by the ubatch, the rows of its tokens are gathered, multiplied by the adapter and added back
+// to the result, so that the sequences of a batch can use different adapters
+class llm_graph_input_lora_seq : public llm_graph_input_i {
+public:
+    // the tokens of the ubatch that use an adapter, with their scale
+    struct group {
+        llama_adapter_lora * adapter;
+
+        std::vector<int32_t> rows;     // index of the tokens in the ubatch
+        std::vector<int32_t> rows_out; // index of the tokens in the outputs
+        std::vector<float>   scales;
+        std::vector<float>   scales_out;
+
+        int64_t offs     = 0; // offset of the rows in the input tensors
+        int64_t offs_out = 0;
+    };
+
+    llm_graph_input_lora_seq(const llama_adapter_loras_seq * loras_seq, uint32_t n_outputs) : loras_seq(loras_seq), n_outputs(n_outputs) {}
+    virtual ~llm_graph_input_lora_seq() = default;
+
+    void set_input(const llama_ubatch * ubatch) override;
+
+    bool can_reuse(const llm_graph_params & params) override;
+
+    static std::vector<group> get_groups(const llama_ubatch & ubatch, const llama_adapter_loras_seq & loras_seq, uint32_t n_outputs);
+
+    std::vector<group> groups; // only the adapters and the number of rows are used after the graph is built
+
+    ggml_tensor * rows     = nullptr; // I32 [n_rows]
+    ggml_tensor * rows_i64 = nullptr; // I64 [n_rows], for ggml_set_rows
+    ggml_tensor * scales   = nullptr; // F32 [n_rows]
+
+    const llama_adapter_loras_seq * loras_seq;
+
+    const uint32_t n_outputs;
+};
+
 class llm_graph_input_mean : public llm_graph_input_i {
 public:
     llm_graph_input_mean(const llama_cparams & cparams) : cparams(cparams) {}
@@ -250,8 +288,15 @@ public:
 
     ggml_tensor * get_kq_mask() const { return kq_mask_cnv; }
 
-    ggml_tensor * kq_mask     = nullptr; // F32 [n_tokens, n_batch, 1, 1]
-    ggml_tensor * kq_mask_cnv = nullptr; //     [n_tokens, n_batch, 1, 1]
+    ggml_tensor * kq_mask     = nullptr; // F32 [n_tokens, n_batch, 1, 1] or [n_pad, n_pad, 1, n_seqs_unq]
+    ggml_tensor * kq_mask_cnv = nullptr; //     [n_tokens, n_batch, 1, 1] or [n_pad, n_pad, 1, n_seqs_unq]
+
+    // when n_pad > 0, the attention is computed per sequence: the tokens of each sequence are gathered
+    // into a block of n_pad rows and scattered back after the attention
+    uint32_t n_pad = 0;
+
+    ggml_tensor * idx_pad   = nullptr; // I32 [n_pad*n_seqs_unq]
+    ggml_tensor * idx_unpad = nullptr; // I32 [n_tokens]
 
     const llama_hparams hparams;
     const llama_cparams cparams;
@@ -398,10 +443,11 @@ struct llm_graph_params {
     ggml_backend_sched_t sched;
     ggml_backend_t backend_cpu;
 
-    const llama_adapter_cvec     * cvec;
-    const llama_adapter_loras    * loras;
-    const llama_memory_context_i * mctx;
-    const llama_cross            * cross;
+    const llama_adapter_cvec      * cvec;
+    const llama_adapter_loras     * loras;
+    const llama_adapter_loras_seq * loras_seq;
+    const llama_memory_context_i  * mctx;
+    const llama_cross             * cross;
 
     uint32_t n_outputs;
 
@@ -449,6 +495,7 @@ struct llm_graph_params {
             gtype     == other.gtype &&
             cvec      == other.cvec  &&
             loras     == other.loras &&
+            loras_seq == other.loras_seq &&
             cross     == other.cross &&
             n_outputs == other.n_outputs;
     }
@@ -561,10 +608,11 @@ struct llm_graph_context {
 
     ggml_backend_t backend_cpu; // TODO: needed by build_attn_mha, figure out a way to remove?
 
-    const llama_adapter_cvec     * cvec;
-    const llama_adapter_loras    * loras;
-    const llama_memory_context_i * mctx;
-    const llama_cross            * cross;
+    const llama_adapter_cvec      * cvec;
+    const llama_adapter_loras     * loras;
+    const llama_adapter_loras_seq * loras_seq;
+    const llama_memory_context_i  * mctx;
+    const llama_cross             * cross;
 
     const llm_graph_cb & cb_func;
 
@@ -573,6 +621,8 @@ struct llm_graph_context {
     ggml_context * ctx0 = nullptr;
     ggml_cgraph  * gf   = nullptr;
 
+    llm_graph_input_lora_seq * inp_lora_seq = nullptr; // nullptr if no sequence has adapters
+
     llm_graph_context(const llm_graph_params & params);
     virtual ~llm_graph_context() = default;
 
@@ -597,6 +647,13 @@ struct llm_graph_context {
               ggml_tensor * cur, // ggml_tensor * b
               ggml_tensor * ids) const;
 
+    // add the adapters of the sequences to res = w*cur (mat_mul_id if ids is not null)
+    ggml_tensor * build_lora_seq(
+              ggml_tensor * w,
+              ggml_tensor * cur,
+              ggml_tensor * ids,
+              ggml_tensor * res) const;
+
     ggml_tensor * build_norm(
              ggml_tensor * cur,
              ggml_tensor * mw,
@@ -112,6 +112,15 @@ std::string llama_format_tensor_shape(const struct ggml_tensor * t) {
     return buf;
 }
 
+std::string llama_format_repack_layout(uint32_t layout) {
+    if (layout == 0) {
+        return "none";
+    }
+    const uint32_t type = layout >> 16;
+    const char * type_name = type < GGML_TYPE_COUNT ? ggml_type_name((ggml_type) type) : "unknown";
+    return format("%s_%ux%u", type_name, (layout >> 8) & 0xff, layout & 0xff);
+}
+
 static std::string gguf_data_to_str(enum gguf_type type, const void * data, int i) {
     switch (type) {
         case GGUF_TYPE_UINT8:   return std::to_string(((const uint8_t  *)data)[i]);
@@ -58,4 +58,7 @@ std::string format(const char * fmt, ...);
 std::string llama_format_tensor_shape(const std::vector<int64_t> & ne);
 std::string llama_format_tensor_shape(const struct ggml_tensor * t);
 
+// CPU repack layout id as stored in general.repack.layouts, e.g. "q4_0_8x8"
+std::string llama_format_repack_layout(uint32_t layout);
+
 std::string gguf_kv_to_str(const struct gguf_context * ctx_gguf, int i);
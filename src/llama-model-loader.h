@@ -28,6 +28,7 @@ struct llama_model_loader {
     struct llama_tensor_weight {
         uint16_t  idx; // source file index
         size_t   offs; // tensor data offset in the original file
+        uint32_t repack = 0; // CPU repack layout the data is stored in, 0 for the plain layout
 
         ggml_tensor * tensor;
 
@@ -41,6 +42,13 @@ struct llama_model_loader {
             if (offs + ggml_nbytes(tensor) < offs || offs + ggml_nbytes(tensor) > file->size()) {
                 throw std::runtime_error(format("tensor '%s' data is not within the file bounds, model is corrupted or incomplete", ggml_get_name(tensor)));
             }
+
+            // written by llama-quantize --repack, one entry per tensor of this file
+            const int kid = gguf_find_key(gguf_ctx, LLM_KV(LLM_ARCH_UNKNOWN)(LLM_KV_GENERAL_REPACK_LAYOUTS).c_str());
+            if (kid >= 0 && gguf_get_kv_type(gguf_ctx, kid) == GGUF_TYPE_ARRAY && gguf_get_arr_type(gguf_ctx, kid) == GGUF_TYPE_UINT32 &&
+                    (size_t) tensor_idx < gguf_get_arr_n(gguf_ctx, kid)) {
+                repack = ((const uint32_t *) gguf_get_arr_data(gguf_ctx, kid))[tensor_idx];
+            }
         }
     };
 
@@ -302,6 +302,45 @@ static ggml_backend_buffer_type_t select_weight_buft(const llama_hparams & hpara
     return nullptr;
 }
 
+// buffer type for a weight stored in a CPU repacked layout (see llama-quantize --repack)
+// the data can only be used by the CPU backend as is, so other devices and layout mismatches are errors
+static ggml_backend_buffer_type_t select_prepacked_buft(const llama_hparams & hparams, ggml_tensor * tensor, ggml_op op, ggml_backend_buffer_type_t buft, uint32_t layout) {
+    auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (cpu_dev == nullptr) {
+        throw std::runtime_error(format("%s: no CPU backend found", __func__));
+    }
+
+    auto * cpu_reg = ggml_backend_dev_backend_reg(cpu_dev);
+    auto * repack_layout_fn = (ggml_backend_cpu_repack_layout_t)
+        ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_cpu_repack_layout");
+    auto * prepacked_buft_fn = (ggml_backend_cpu_prepacked_buffer_type_t)
+        ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_cpu_prepacked_buffer_type");
+    if (!repack_layout_fn || !prepacked_buft_fn) {
+        throw std::runtime_error(format("tensor %s is stored in repacked layout %s, but the CPU backend does not support repacked weights",
+                tensor->name, llama_format_repack_layout(layout).c_str()));
+    }
+
+    auto * buft_dev = ggml_backend_buft_get_device(buft);
+    if (buft_dev && ggml_backend_dev_type(buft_dev) != GGML_BACKEND_DEVICE_TYPE_CPU && ggml_backend_dev_type(buft_dev) != GGML_BACKEND_DEVICE_TYPE_ACCEL) {
+        throw std::runtime_error(format("tensor %s is stored in repacked layout %s and cannot be offloaded to %s, keep it on the CPU or requantize the model without --repack",
+                tensor->name, llama_format_repack_layout(layout).c_str(), ggml_backend_dev_name(buft_dev)));
+    }
+
+    const uint32_t cpu_layout = repack_layout_fn(tensor);
+    if (cpu_layout != layout) {
+        throw std::runtime_error(format("tensor %s is stored in repacked layout %s, but this CPU uses %s, requantize the model without --repack",
+                tensor->name, llama_format_repack_layout(layout).c_str(), llama_format_repack_layout(cpu_layout).c_str()));
+    }
+
+    ggml_backend_buffer_type_t prepacked_buft = prepacked_buft_fn();
+    if (!weight_buft_supported(hparams, tensor, op, prepacked_buft, cpu_dev)) {
+        throw std::runtime_error(format("tensor %s is stored in repacked layout %s, but its op %s is not supported in that layout",
+                tensor->name, llama_format_repack_layout(layout).c_str(), ggml_op_name(op)));
+    }
+
+    return prepacked_buft;
+}
+
 // CPU: ACCEL -> GPU host -> CPU extra -> CPU
 static buft_list_t make_cpu_buft_list(const std::vector<ggml_backend_dev_t> & devices, bool use_extra_bufts) {
     buft_list_t buft_list;
@@ -2148,6 +2187,11 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                 buft = ggml_backend_dev_buffer_type(cpu_dev);
             }
 
+            // weights stored repacked by llama-quantize are used in place
+            if (const auto * w = ml.get_weight(tn.str().c_str()); w && w->repack) {
+                buft = select_prepacked_buft(hparams, t_meta, op, buft, w->repack);
+            }
+
             if (buft != buft_list->front().second) {
                 n_moved_tensors++;
                 if (!first_moved_tensor) {
@@ -5585,7 +5629,35 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         bool buffer_from_host_ptr_supported = props.caps.buffer_from_host_ptr;
         bool is_default_buft = buft == ggml_backend_dev_buffer_type(dev);
 
-        if (ml.use_mmap && use_mmap_buffer && buffer_from_host_ptr_supported && is_default_buft) {
+        // repacked weights from the file are mapped as they are
+        ggml_backend_cpu_prepacked_buffer_from_ptr_t prepacked_from_ptr_fn = nullptr;
+        if (!is_default_buft && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            auto * reg = ggml_backend_dev_backend_reg(dev);
+            auto * prepacked_buft_fn = (ggml_backend_cpu_prepacked_buffer_type_t)
+                ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_prepacked_buffer_type");
+            if (prepacked_buft_fn && buft == prepacked_buft_fn()) {
+                prepacked_from_ptr_fn = (ggml_backend_cpu_prepacked_buffer_from_ptr_t)
+                    ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_prepacked_buffer_from_ptr");
+            }
+        }
+
+        if (ml.use_mmap && use_mmap_buffer && prepacked_from_ptr_fn) {
+            for (uint32_t idx = 0; idx < ml.files.size(); idx++) {
+                void * addr = nullptr;
+                size_t first, last; // NOLINT
+                ml.get_mapping_range(&first, &last, &addr, idx, ctx);
+                if (first >= last) {
+                    continue;
+                }
+                ggml_backend_buffer_t buf = prepacked_from_ptr_fn((char *) addr + first, last - first);
+                if (buf == nullptr) {
+                    throw std::runtime_error(format("unable to allocate %s buffer", ggml_backend_buft_name(buft)));
+                }
+                pimpl->bufs.emplace_back(buf);
+                buf_map.emplace(idx, buf);
+            }
+        }
+        else if (ml.use_mmap && use_mmap_buffer && buffer_from_host_ptr_supported && is_default_buft) {
             for (uint32_t idx = 0; idx < ml.files.size(); idx++) {
                 // only the mmap region containing the tensors in the model is mapped to the backend buffer
                 // this is important for metal with apple silicon: if the entire model could be mapped to a metal buffer, then we could just use metal for all layers
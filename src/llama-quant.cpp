@@ -607,6 +607,27 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
 
     quantize_state_impl qs(model, params);
 
+    for (const auto & it : ml.weights_map) {
+        if (it.second.repack) {
+            throw std::runtime_error(format("tensor %s is stored in repacked layout %s, quantize from a model without --repack",
+                    it.first.c_str(), llama_format_repack_layout(it.second.repack).c_str()));
+        }
+    }
+
+    ggml_backend_cpu_repack_layout_t repack_layout_fn = nullptr;
+    ggml_backend_cpu_repack_tensor_t repack_tensor_fn = nullptr;
+    if (params->cpu_repack) {
+        auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (cpu_dev) {
+            auto * cpu_reg = ggml_backend_dev_backend_reg(cpu_dev);
+            repack_layout_fn = (ggml_backend_cpu_repack_layout_t) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_cpu_repack_layout");
+            repack_tensor_fn = (ggml_backend_cpu_repack_tensor_t) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_cpu_repack_tensor");
+        }
+        if (!repack_layout_fn || !repack_tensor_fn) {
+            throw std::runtime_error("the CPU backend does not support repacked weights");
+        }
+    }
+
     if (params->only_copy) {
         ftype = ml.ftype;
     }
@@ -645,6 +666,9 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
     gguf_remove_key(ctx_out.get(), ml.llm_kv(LLM_KV_SPLIT_COUNT).c_str());
     gguf_remove_key(ctx_out.get(), ml.llm_kv(LLM_KV_SPLIT_TENSORS_COUNT).c_str());
 
+    // repack layouts are per tensor and per file, they are written again below if requested
+    gguf_remove_key(ctx_out.get(), ml.llm_kv(LLM_KV_GENERAL_REPACK_LAYOUTS).c_str());
+
     if (params->kv_overrides) {
         const std::vector<llama_model_kv_override> & overrides = *(const std::vector<llama_model_kv_override> *)params->kv_overrides;
         for (const auto & o : overrides) {
@@ -741,6 +765,7 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
     std::vector<no_init<uint8_t>> read_data;
     std::vector<no_init<uint8_t>> work;
     std::vector<no_init<float>> f32_conv_buf;
+    std::vector<no_init<uint8_t>> repack_buf;
 
     uint16_t n_split = 1;
 
@@ -772,11 +797,25 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
         }
     }
 
+    // repack layout of each tensor in file order, the array has a fixed size so that the meta data size does not change
+    std::vector<std::vector<uint32_t>> repack_layouts(n_split);
+    if (params->cpu_repack) {
+        for (size_t i = 0; i < ctx_outs.size(); ++i) {
+            repack_layouts[i].resize(gguf_get_n_tensors(ctx_outs[i].get()), 0);
+            gguf_set_arr_data(ctx_outs[i].get(), ml.llm_kv(LLM_KV_GENERAL_REPACK_LAYOUTS).c_str(), GGUF_TYPE_UINT32,
+                    repack_layouts[i].data(), repack_layouts[i].size());
+        }
+    }
+
     int cur_split = -1;
     std::ofstream fout;
     auto close_ofstream = [&]() {
         // Write metadata and close file handler
         if (fout.is_open()) {
+            if (params->cpu_repack) {
+                gguf_set_arr_data(ctx_outs[cur_split].get(), ml.llm_kv(LLM_KV_GENERAL_REPACK_LAYOUTS).c_str(), GGUF_TYPE_UINT32,
+                        repack_layouts[cur_split].data(), repack_layouts[cur_split].size());
+            }
             fout.seekp(0);
             std::vector<uint8_t> data(gguf_get_meta_size(ctx_outs[cur_split].get()));
             gguf_get_meta_data(ctx_outs[cur_split].get(), data.data());
@@ -1026,6 +1065,33 @@ static void llama_model_quantize_impl(const std::string & fname_inp, const std::
         total_size_org += ggml_nbytes(tensor);
         total_size_new += new_size;
 
+        // store the weights used by matrix multiplications in the layout the CPU backend would repack them to at load time
+        const ggml_op op = repack_layout_fn ? llm_tensor_op_for_name(model.arch, name) : GGML_OP_NONE;
+        if ((op == GGML_OP_MUL_MAT && ggml_n_dims(tensor) == 2) || (op == GGML_OP_MUL_MAT_ID && ggml_n_dims(tensor) == 3)) {
+            ggml_tensor t_new = *tensor;
+            t_new.type  = new_type;
+            t_new.nb[0] = ggml_type_size(new_type);
+            t_new.nb[1] = ggml_row_size(new_type, t_new.ne[0]);
+            for (int i = 2; i < GGML_MAX_DIMS; i++) {
+                t_new.nb[i] = t_new.nb[i - 1]*t_new.ne[i - 1];
+            }
+            t_new.data = nullptr;
+
+            const uint32_t layout = repack_layout_fn(&t_new);
+            if (layout) {
+                if (repack_buf.size() < new_size) {
+                    repack_buf.resize(new_size);
+                }
+                if (!repack_tensor_fn(&t_new, repack_buf.data(), new_data, new_size)) {
+                    throw std::runtime_error(format("failed to repack tensor %s to %s", name.c_str(), llama_format_repack_layout(layout).c_str()));
+                }
+                new_data = repack_buf.data();
+
+                repack_layouts[cur_split][gguf_find_tensor(ctx_outs[cur_split].get(), name.c_str())] = layout;
+                LLAMA_LOG_DEBUG("%s: tensor %s repacked to %s\n", __func__, name.c_str(), llama_format_repack_layout(layout).c_str());
+            }
+        }
+
         // update the gguf meta data as we go
         gguf_set_tensor_type(ctx_outs[cur_split].get(), name.c_str(), new_type);
         GGML_ASSERT(gguf_get_tensor_size(ctx_outs[cur_split].get(), gguf_find_tensor(ctx_outs[cur_split].get(), name.c_str())) == new_size);
@@ -1061,6 +1127,7 @@ llama_model_quantize_params llama_model_quantize_default_params() {
         /*.only_copy                   =*/ false,
         /*.pure                        =*/ false,
         /*.keep_split                  =*/ false,
+        /*.cpu_repack                  =*/ false,
         /*.imatrix                     =*/ nullptr,
         /*.kv_overrides                =*/ nullptr,
         /*.tensor_type                 =*/ nullptr,
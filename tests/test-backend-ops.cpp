@@ -2912,6 +2912,101 @@ struct test_rms_norm_mul_add : public test_case {
     }
 };
 
+// GGML_OP_ADD + GGML_OP_RMS_NORM + GGML_OP_MUL
+struct test_add_rms_norm_mul : public test_case {
+    const ggml_type type;
+    const std::array<int64_t, 4> ne;
+    const float eps;
+    const bool inplace; // the add writes into its first operand
+
+    std::string op_desc(ggml_tensor * t) override {
+        GGML_UNUSED(t);
+        return "ADD_RMS_NORM_MUL";
+    }
+
+    bool run_whole_graph() override { return true; }
+
+    std::string vars() override {
+        return VARS_TO_STR4(type, ne, eps, inplace);
+    }
+
+    test_add_rms_norm_mul(ggml_type type = GGML_TYPE_F32,
+            std::array<int64_t, 4> ne = {64, 5, 4, 3},
+            float eps = 1e-6f, bool inplace = false)
+        : type(type), ne(ne), eps(eps), inplace(inplace) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor(ctx, type, 4, ne.data());
+        ggml_set_name(a, "a");
+
+        ggml_tensor * b = ggml_new_tensor(ctx, type, 4, ne.data());
+        ggml_set_name(b, "b");
+
+        ggml_tensor * w = ggml_new_tensor_1d(ctx, type, ne[0]);
+        ggml_set_name(w, "w");
+
+        ggml_tensor * sum = inplace ? ggml_add_inplace(ctx, a, b) : ggml_add(ctx, a, b);
+        ggml_set_name(sum, "sum");
+
+        ggml_tensor * out = ggml_mul(ctx, ggml_rms_norm(ctx, sum, eps), w);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            init_tensor_uniform(t, -10.f, 10.f);
+        }
+    }
+};
+
+// GGML_OP_UNARY(SILU) + GGML_OP_MUL
+struct test_silu_mul : public test_case {
+    const ggml_type type;
+    const std::array<int64_t, 4> ne;
+    const bool inplace; // the mul writes into the gate
+
+    std::string op_desc(ggml_tensor * t) override {
+        GGML_UNUSED(t);
+        return "SILU_MUL";
+    }
+
+    bool run_whole_graph() override { return true; }
+
+    std::string vars() override {
+        return VARS_TO_STR3(type, ne, inplace);
+    }
+
+    test_silu_mul(ggml_type type = GGML_TYPE_F32,
+            std::array<int64_t, 4> ne = {64, 5, 4, 3},
+            bool inplace = false)
+        : type(type), ne(ne), inplace(inplace) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor(ctx, type, 4, ne.data());
+        ggml_set_name(a, "a");
+
+        ggml_tensor * g = ggml_new_tensor(ctx, type, 4, ne.data());
+        ggml_set_name(g, "g");
+
+        ggml_tensor * silu = ggml_silu(ctx, a);
+        ggml_set_name(silu, "silu");
+
+        ggml_tensor * out = inplace ? ggml_mul_inplace(ctx, g, silu) : ggml_mul(ctx, silu, g);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            // test extended range of values to check for NaNs in SILU
+            init_tensor_uniform(t, -150.f, 150.f);
+        }
+    }
+};
+
 // GGML_OP_SSM_CONV
 struct test_ssm_conv : public test_case {
     const ggml_type type;
@@ -3266,6 +3361,102 @@ struct test_mul_mat_id : public test_case {
     }
 };
 
+// GGML_OP_MUL_MAT_ID + GGML_OP_MUL_MAT_ID + GGML_OP_GLU + GGML_OP_MUL_MAT_ID
+struct test_moe_ffn : public test_case {
+    const ggml_type type_a;
+    const ggml_glu_op op;
+    const int n_mats;
+    const int n_used;
+    const int64_t n_embd;
+    const int64_t n_ff;
+    const int64_t n_tokens;
+
+    std::string op_desc(ggml_tensor * t) override {
+        GGML_UNUSED(t);
+        return "MOE_FFN";
+    }
+
+    bool run_whole_graph() override { return true; }
+
+    std::string vars() override {
+        return VARS_TO_STR6(type_a, n_mats, n_used, n_embd, n_ff, n_tokens) + ",glu=" + ggml_glu_op_name(op);
+    }
+
+    double max_nmse_err() override {
+        return 5e-4;
+    }
+
+    uint64_t op_flops(ggml_tensor * t) override {
+        GGML_UNUSED(t);
+        return 2 * 3 * n_embd * n_ff * n_used * n_tokens;
+    }
+
+    test_moe_ffn(ggml_type type_a = GGML_TYPE_F32, ggml_glu_op op = GGML_GLU_OP_SWIGLU,
+            int n_mats = 8, int n_used = 2,
+            int64_t n_embd = 256, int64_t n_ff = 256, int64_t n_tokens = 32)
+        : type_a(type_a), op(op), n_mats(n_mats), n_used(n_used),
+            n_embd(n_embd), n_ff(n_ff), n_tokens(n_tokens) {
+            GGML_ASSERT(n_used <= n_mats);
+        }
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        // same layout as build_moe_ffn: the input is broadcast to the selected experts
+        ggml_tensor * gate_exps = ggml_new_tensor_3d(ctx, type_a, n_embd, n_ff, n_mats);
+        ggml_set_name(gate_exps, "gate_exps");
+
+        ggml_tensor * up_exps = ggml_new_tensor_3d(ctx, type_a, n_embd, n_ff, n_mats);
+        ggml_set_name(up_exps, "up_exps");
+
+        ggml_tensor * down_exps = ggml_new_tensor_3d(ctx, type_a, n_ff, n_embd, n_mats);
+        ggml_set_name(down_exps, "down_exps");
+
+        ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_mats, n_tokens);
+        ggml_set_name(ids, "ids");
+        if (n_used != n_mats) {
+            ids = ggml_view_2d(ctx, ids, n_used, n_tokens, ids->nb[1], 0);
+            ggml_set_name(ids, "view_of_ids");
+        }
+
+        ggml_tensor * cur = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd, 1, n_tokens);
+        ggml_set_name(cur, "cur");
+
+        ggml_tensor * gate = ggml_mul_mat_id(ctx, gate_exps, cur, ids);
+        ggml_set_name(gate, "gate");
+
+        ggml_tensor * up = ggml_mul_mat_id(ctx, up_exps, cur, ids);
+        ggml_set_name(up, "up");
+
+        ggml_tensor * par = ggml_glu_split(ctx, gate, up, op);
+        ggml_set_name(par, "par");
+
+        ggml_tensor * out = ggml_mul_mat_id(ctx, down_exps, par, ids);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            if (t->type == GGML_TYPE_I32) {
+                if (ggml_is_view_op(t->op)) { continue; }
+                std::random_device rd;
+                std::default_random_engine rng(rd());
+                // ids
+                for (int64_t r = 0; r < ggml_nrows(t); r++) {
+                    std::vector<int32_t> data(t->ne[0]);
+                    for (int i = 0; i < t->ne[0]; i++) {
+                        data[i] = i % n_mats;
+                    }
+                    std::shuffle(data.begin(), data.end(), rng);
+                    ggml_backend_tensor_set(t, data.data(), r * t->nb[1], t->ne[0] * sizeof(int32_t));
+                }
+            } else {
+                init_tensor_uniform(t);
+            }
+        }
+    }
+};
+
 // GGML_OP_OUT_PROD
 struct test_out_prod : public test_case {
     const ggml_type type_a;
@@ -5637,6 +5828,14 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         test_cases.emplace_back(new test_rms_norm_mul_add(GGML_TYPE_F32, {64, 5, 4, 3}, eps));
         test_cases.emplace_back(new test_rms_norm_mul_add(GGML_TYPE_F32, {64, 5, 4, 3}, eps, true));
     }
+    for (bool inplace : {false, true}) {
+        for (float eps : {0.0f, 1e-6f, 1e-1f}) {
+            test_cases.emplace_back(new test_add_rms_norm_mul(GGML_TYPE_F32, {64, 5, 4, 3}, eps, inplace));
+        }
+        test_cases.emplace_back(new test_add_rms_norm_mul(GGML_TYPE_F32, {4096, 37, 1, 1}, 1e-6f, inplace));
+        test_cases.emplace_back(new test_silu_mul(GGML_TYPE_F32, {64, 5, 4, 3}, inplace));
+        test_cases.emplace_back(new test_silu_mul(GGML_TYPE_F32, {4096, 37, 1, 1}, inplace));
+    }
 
     test_cases.emplace_back(new test_l2_norm(GGML_TYPE_F32, {64, 5, 4, 3}, 1e-12f));
 
@@ -5816,6 +6015,17 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    for (ggml_type type_a : {GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K}) {
+        for (int n_tokens : {1, 32, 129}) {
+            test_cases.emplace_back(new test_moe_ffn(type_a, GGML_GLU_OP_SWIGLU, 8, 2, 256, 256, n_tokens));
+        }
+    }
+    for (ggml_glu_op op : {GGML_GLU_OP_REGLU, GGML_GLU_OP_GEGLU, GGML_GLU_OP_GEGLU_ERF, GGML_GLU_OP_GEGLU_QUICK}) {
+        test_cases.emplace_back(new test_moe_ffn(GGML_TYPE_F32, op, 8, 2, 256, 256, 32));
+    }
+    test_cases.emplace_back(new test_moe_ffn(GGML_TYPE_Q4_0, GGML_GLU_OP_SWIGLU, 4, 4, 256, 512, 32));
+    test_cases.emplace_back(new test_moe_ffn(GGML_TYPE_F16, GGML_GLU_OP_SWIGLU, 16, 1, 512, 256, 8));
+
     for (ggml_type type_a : base_types) {
         for (ggml_type type_b : {GGML_TYPE_F32, GGML_TYPE_F16}) {
             for (int n : {1, 16}) {
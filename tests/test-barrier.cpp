@@ -4,13 +4,48 @@
 
 #include <chrono>
 #include <iostream>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
+#include <random>
 #include <vector>
 
 #define MAX_NARGS 2
 
+// runs the graph n_rounds times after a warmup, returns the time per round in usec
+static double graph_compute_rounds(struct ggml_cgraph * gf, int n_threads, int n_rounds) {
+    // Create threadpool
+    struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
+    struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
+        exit(1);
+    }
+
+    // Create compute plan
+    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    // Warmup
+    ggml_graph_compute(gf, &cplan);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (int i=0; i < n_rounds; i++) {
+        ggml_graph_compute(gf, &cplan);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    ggml_threadpool_free(threadpool);
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count() / (1000.0 * n_rounds);
+}
+
 int main(int argc, char *argv[]) {
 
     int n_threads = 4;
@@ -32,36 +67,43 @@ int main(int argc, char *argv[]) {
 
     struct ggml_context * ctx = ggml_init(params);
 
+    std::mt19937 rng(42);
+
+    // random weights that keep the magnitude of the activations
+    auto new_weights = [&](int64_t ne0, int64_t ne1) {
+        std::uniform_real_distribution<float> dist(-std::sqrt(3.0f/ne0), std::sqrt(3.0f/ne0));
+        std::vector<float> data(ne0*ne1);
+        for (auto & x : data) {
+            x = dist(rng);
+        }
+
+        struct ggml_tensor * t = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, ne0, ne1);
+        ggml_quantize_chunk(GGML_TYPE_Q4_0, data.data(), t->data, 0, ne1, ne0, nullptr);
+        return t;
+    };
+
     // Create graph
     struct ggml_cgraph * gf = ggml_new_graph(ctx);
 
     // Lots of small, parallel ops where barriers in between will dominate
     struct ggml_tensor * out = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,  64);
+    {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        for (int i = 0; i < 64; i++) {
+            ((float *) out->data)[i] = dist(rng);
+        }
+    }
     for (int i = 0; i < 1000; i++) {
-        struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 64, 128);
+        struct ggml_tensor * a = new_weights(64, 128);
         out = ggml_mul_mat(ctx, a, out);
 
-        struct ggml_tensor * d = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 128, 64);
+        struct ggml_tensor * d = new_weights(128, 64);
         out = ggml_mul_mat(ctx, d, out);
     }
 
     ggml_build_forward_expand(gf, out);
     int n_nodes = ggml_graph_n_nodes(gf);
 
-    // Create threadpool
-    struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
-    struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
-    if (!threadpool) {
-        fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
-        exit(1);
-    }
-
-    // Create compute plan
-    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
-
-    std::vector<uint8_t> work_data(cplan.work_size);
-    cplan.work_data = work_data.data();
-
     std::cerr << "graph-compute with"
               << "\n n_threads: " << n_threads
               << "\n   n_nodes: " << n_nodes
@@ -69,26 +111,25 @@ int main(int argc, char *argv[]) {
               << "\n";
     // ggml_graph_print(gf);
 
-    // Warmup
-    ggml_graph_compute(gf, &cplan);
+    // the result does not depend on the number of threads, any mismatch means that a barrier let a thread through too early
+    const double usec_1 = graph_compute_rounds(gf, 1, n_rounds);
+    std::vector<uint8_t> ref(ggml_nbytes(out));
+    memcpy(ref.data(), out->data, ref.size());
 
-    auto t0 = std::chrono::high_resolution_clock::now();
+    const double usec = graph_compute_rounds(gf, n_threads, n_rounds);
 
-    for (int i=0; i < n_rounds; i++) {
-        ggml_graph_compute(gf, &cplan);
-    }
-
-    auto t1 = std::chrono::high_resolution_clock::now();
-
-    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count();
-    auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count();
-    std::cerr << "graph-compute took " << usec << " usec "
-              << "\n " << (float) usec / n_rounds << " usec per-iter"
-              << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
+    std::cerr << "graph-compute took " << usec * n_rounds << " usec "
+              << "\n " << usec << " usec per-iter"
+              << "\n " << 1000.0 * usec / n_nodes << " nsec per-node"
+              << "\n " << 1000.0 * (usec - usec_1 / n_threads) / n_nodes << " nsec per-node over 1 thread / n_threads (barrier overhead)"
               << "\n";
 
-    ggml_threadpool_free(threadpool);
+    const bool ok = memcmp(ref.data(), out->data, ref.size()) == 0;
+    if (!ok) {
+        std::cerr << "result mismatch with " << n_threads << " threads\n";
+    }
+
     ggml_free(ctx);
 
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,274 @@
+// compares the chains of nodes that the CPU backend computes with a single fused kernel against the same nodes computed
+// one by one. GGML_CPU_DISABLE_FUSION is read once when the backend is initialized, so the unfused reference computes
+// every node in a graph of its own, where there is nothing to fuse - the same kernels that the flag selects
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+struct fused_chain {
+    std::string name;
+
+    std::vector<struct ggml_tensor *> outs;    // results compared against the unfused nodes
+    std::vector<struct ggml_tensor *> skipped; // intermediate results that the fused kernel does not store
+};
+
+static void graph_compute(struct ggml_cgraph * gf, struct ggml_threadpool * threadpool, int n_threads) {
+    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    if (ggml_graph_compute(gf, &cplan) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "graph compute failed\n");
+        exit(1);
+    }
+}
+
+static double nmse(const float * a, const float * b, size_t n) {
+    double mse_a_b = 0.0;
+    double mse_a_0 = 0.0;
+
+    for (size_t i = 0; i < n; i++) {
+        mse_a_b += (a[i] - b[i]) * (a[i] - b[i]);
+        mse_a_0 += a[i] * a[i];
+    }
+
+    return mse_a_b / mse_a_0;
+}
+
+static void fill_uniform(struct ggml_tensor * t, std::mt19937 & rng, float max) {
+    std::uniform_real_distribution<float> dist(-max, max);
+    std::vector<float> data(ggml_nelements(t));
+    for (auto & x : data) {
+        x = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        const int64_t n_per_row = t->ne[0];
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nelements(t)/n_per_row, n_per_row, nullptr);
+    }
+}
+
+// computes the graph of the chain once node by node and once as a whole, returns false on a mismatch or if the chain
+// was not fused at all
+static bool check_chain(struct ggml_context * ctx, const fused_chain & chain, struct ggml_threadpool * threadpool, int n_threads) {
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    for (auto * out : chain.outs) {
+        ggml_build_forward_expand(gf, out);
+    }
+
+    for (int i = 0; i < ggml_graph_n_nodes(gf); i++) {
+        struct ggml_cgraph * gf_node = ggml_new_graph_custom(ctx, 1, false);
+        ggml_graph_add_node(gf_node, ggml_graph_node(gf, i));
+        graph_compute(gf_node, threadpool, n_threads);
+    }
+
+    std::vector<std::vector<float>> ref;
+    for (auto * out : chain.outs) {
+        const float * data = (const float *) out->data;
+        ref.emplace_back(data, data + ggml_nelements(out));
+    }
+
+    for (auto * t : chain.skipped) {
+        float * data = (float *) t->data;
+        std::fill(data, data + ggml_nelements(t), NAN);
+    }
+
+    graph_compute(gf, threadpool, n_threads);
+
+    bool ok = true;
+
+    for (auto * t : chain.skipped) {
+        const float * data = (const float *) t->data;
+        if (!std::isnan(data[0]) || !std::isnan(data[ggml_nelements(t) - 1])) {
+            fprintf(stderr, "%s: %s was computed, the chain was not fused\n", chain.name.c_str(), ggml_get_name(t));
+            ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < chain.outs.size(); i++) {
+        const double err = nmse(ref[i].data(), (const float *) chain.outs[i]->data, ref[i].size());
+        if (!(err <= 1e-6)) {
+            fprintf(stderr, "%s: %s: NMSE = %.9f\n", chain.name.c_str(), ggml_get_name(chain.outs[i]), err);
+            ok = false;
+        }
+    }
+
+    printf("%s: %s\n", chain.name.c_str(), ok ? "OK" : "FAIL");
+
+    return ok;
+}
+
+// mul_mat_id(gate) -> mul_mat_id(up) -> glu -> mul_mat_id(down), same layout as build_moe_ffn
+static fused_chain build_moe_ffn(struct ggml_context * ctx, std::mt19937 & rng, enum ggml_type type, enum ggml_glu_op op,
+        int n_mats, int n_used, int64_t n_embd, int64_t n_ff, int64_t n_tokens) {
+    struct ggml_tensor * gate_exps = ggml_new_tensor_3d(ctx, type, n_embd, n_ff, n_mats);
+    struct ggml_tensor * up_exps   = ggml_new_tensor_3d(ctx, type, n_embd, n_ff, n_mats);
+    struct ggml_tensor * down_exps = ggml_new_tensor_3d(ctx, type, n_ff, n_embd, n_mats);
+    fill_uniform(gate_exps, rng, std::sqrt(3.0f/n_embd));
+    fill_uniform(up_exps,   rng, std::sqrt(3.0f/n_embd));
+    fill_uniform(down_exps, rng, std::sqrt(3.0f/n_ff));
+
+    // distinct experts for each token
+    struct ggml_tensor * ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_used, n_tokens);
+    std::vector<int32_t> experts(n_mats);
+    for (int64_t i = 0; i < n_tokens; i++) {
+        for (int j = 0; j < n_mats; j++) {
+            experts[j] = j;
+        }
+        std::shuffle(experts.begin(), experts.end(), rng);
+        memcpy((int32_t *) ids->data + i*n_used, experts.data(), n_used*sizeof(int32_t));
+    }
+
+    struct ggml_tensor * cur = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd, 1, n_tokens);
+    fill_uniform(cur, rng, 1.0f);
+
+    struct ggml_tensor * gate = ggml_mul_mat_id(ctx, gate_exps, cur, ids);
+    ggml_set_name(gate, "gate");
+
+    struct ggml_tensor * up = ggml_mul_mat_id(ctx, up_exps, cur, ids);
+    ggml_set_name(up, "up");
+
+    struct ggml_tensor * par = ggml_glu_split(ctx, gate, up, op);
+    ggml_set_name(par, "par");
+
+    struct ggml_tensor * out = ggml_mul_mat_id(ctx, down_exps, par, ids);
+    ggml_set_name(out, "out");
+
+    char name[128];
+    snprintf(name, sizeof(name), "MOE_FFN(type=%s,glu=%s,n_mats=%d,n_used=%d,n_embd=%d,n_ff=%d,n_tokens=%d)",
+            ggml_type_name(type), ggml_glu_op_name(op), n_mats, n_used, (int) n_embd, (int) n_ff, (int) n_tokens);
+
+    return { name, { par, out }, { gate, up } };
+}
+
+// [add ->] rms_norm -> mul by the norm weight. the weight is either a single row broadcast over the rows, or a tensor of
+// the same shape, which can then be the first operand of the mul
+static fused_chain build_rms_norm_mul(struct ggml_context * ctx, std::mt19937 & rng, bool with_add, bool w_full, int64_t ne0, int64_t ne1, int64_t ne2) {
+    struct ggml_tensor * a = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+    fill_uniform(a, rng, 1.0f);
+
+    struct ggml_tensor * w = w_full ? ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2) : ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne0);
+    fill_uniform(w, rng, 1.0f);
+
+    std::vector<struct ggml_tensor *> outs;
+
+    struct ggml_tensor * cur = a;
+    if (with_add) {
+        struct ggml_tensor * b = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+        fill_uniform(b, rng, 1.0f);
+
+        cur = ggml_add(ctx, a, b);
+        ggml_set_name(cur, "add");
+        outs.push_back(cur);
+    }
+
+    struct ggml_tensor * norm = ggml_rms_norm(ctx, cur, 1e-6f);
+    ggml_set_name(norm, "norm");
+
+    struct ggml_tensor * out = w_full ? ggml_mul(ctx, w, norm) : ggml_mul(ctx, norm, w);
+    ggml_set_name(out, "out");
+    outs.push_back(out);
+
+    char name[128];
+    snprintf(name, sizeof(name), "%sRMS_NORM_MUL(w=%s,ne=[%d,%d,%d])", with_add ? "ADD_" : "", w_full ? "full" : "row", (int) ne0, (int) ne1, (int) ne2);
+
+    return { name, outs, { norm } };
+}
+
+// silu -> mul by a gate of the same shape, on either side of the mul
+static fused_chain build_silu_mul(struct ggml_context * ctx, std::mt19937 & rng, bool swapped, int64_t ne0, int64_t ne1, int64_t ne2) {
+    struct ggml_tensor * a = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+    struct ggml_tensor * g = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+    fill_uniform(a, rng, 4.0f);
+    fill_uniform(g, rng, 1.0f);
+
+    struct ggml_tensor * silu = ggml_silu(ctx, a);
+    ggml_set_name(silu, "silu");
+
+    struct ggml_tensor * out = swapped ? ggml_mul(ctx, g, silu) : ggml_mul(ctx, silu, g);
+    ggml_set_name(out, "out");
+
+    char name[128];
+    snprintf(name, sizeof(name), "SILU_MUL(swapped=%d,ne=[%d,%d,%d])", swapped, (int) ne0, (int) ne1, (int) ne2);
+
+    return { name, { out }, { silu } };
+}
+
+int main(int argc, char * argv[]) {
+    int n_threads = 4;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
+    struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
+        exit(1);
+    }
+
+    std::mt19937 rng(42);
+
+    int n_fail = 0;
+
+    const enum ggml_type moe_types[] = {
+        GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K, GGML_TYPE_Q6_K,
+    };
+
+    for (enum ggml_type type : moe_types) {
+        for (enum ggml_glu_op op : { GGML_GLU_OP_SWIGLU, GGML_GLU_OP_GEGLU }) {
+            // a single token, a few tokens and more tokens than experts, so that some experts get several of them
+            for (int64_t n_tokens : { 1, 7, 33 }) {
+                struct ggml_context * ctx = ggml_init(params);
+                n_fail += !check_chain(ctx, build_moe_ffn(ctx, rng, type, op, 8, 2, 256, 512, n_tokens), threadpool, n_threads);
+                ggml_free(ctx);
+            }
+        }
+    }
+
+    // odd row sizes leave a tail after the SIMD loops, and more rows than threads or fewer
+    const int64_t shapes[][3] = {
+        { 4097, 5, 3 }, { 67, 33, 1 }, { 1, 7, 1 }, { 4096, 1, 1 },
+    };
+
+    for (const auto & ne : shapes) {
+        struct ggml_context * ctx = ggml_init(params);
+        for (bool with_add : { false, true }) {
+            for (bool w_full : { false, true }) {
+                n_fail += !check_chain(ctx, build_rms_norm_mul(ctx, rng, with_add, w_full, ne[0], ne[1], ne[2]), threadpool, n_threads);
+            }
+        }
+        for (bool swapped : { false, true }) {
+            n_fail += !check_chain(ctx, build_silu_mul(ctx, rng, swapped, ne[0], ne[1], ne[2]), threadpool, n_threads);
+        }
+        ggml_free(ctx);
+    }
+
+    ggml_threadpool_free(threadpool);
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d fused chains do not match the unfused nodes\n", n_fail);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,405 @@
+// compares soft_max, rms_norm and rope of the CPU backend against scalar references computed in double precision, on
+// odd row sizes that leave a tail after the SIMD loops of their vec kernels
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static void graph_compute(struct ggml_cgraph * gf, struct ggml_threadpool * threadpool, int n_threads) {
+    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    if (ggml_graph_compute(gf, &cplan) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "graph compute failed\n");
+        exit(1);
+    }
+}
+
+static double nmse(const std::vector<double> & ref, const std::vector<float> & res) {
+    double mse_a_b = 0.0;
+    double mse_a_0 = 0.0;
+
+    for (size_t i = 0; i < ref.size(); i++) {
+        mse_a_b += (ref[i] - res[i]) * (ref[i] - res[i]);
+        mse_a_0 += ref[i] * ref[i];
+    }
+
+    return mse_a_b / mse_a_0;
+}
+
+static void fill_uniform(struct ggml_tensor * t, std::mt19937 & rng, float min, float max) {
+    std::uniform_real_distribution<float> dist(min, max);
+    for (int64_t i = 0; i < ggml_nelements(t); i++) {
+        if (t->type == GGML_TYPE_F16) {
+            ((ggml_fp16_t *) t->data)[i] = ggml_fp32_to_fp16(dist(rng));
+        } else {
+            ((float *) t->data)[i] = dist(rng);
+        }
+    }
+}
+
+// element i of a contiguous f32 or f16 tensor
+static float get_f(const struct ggml_tensor * t, int64_t i) {
+    return t->type == GGML_TYPE_F16 ? ggml_fp16_to_fp32(((const ggml_fp16_t *) t->data)[i]) : ((const float *) t->data)[i];
+}
+
+static std::vector<float> get_data(const struct ggml_tensor * t) {
+    std::vector<float> res(ggml_nelements(t));
+    for (int64_t i = 0; i < ggml_nelements(t); i++) {
+        res[i] = get_f(t, i);
+    }
+    return res;
+}
+
+static bool check(const std::string & name, const std::vector<double> & ref, const struct ggml_tensor * t, double max_err) {
+    const double err = nmse(ref, get_data(t));
+    const bool   ok  = err <= max_err;
+
+    if (!ok) {
+        fprintf(stderr, "%s: NMSE = %.9f > %.9f\n", name.c_str(), err, max_err);
+    }
+    printf("%s: %s\n", name.c_str(), ok ? "OK" : "FAIL");
+
+    return ok;
+}
+
+// soft_max(x*scale + slope*mask), with the ALiBi slope of each head and optional sinks
+static bool test_soft_max(struct ggml_threadpool * threadpool, int n_threads, std::mt19937 & rng,
+        int64_t ne0, int64_t ne1, int64_t ne2, enum ggml_type mask_type, float max_bias, bool sinks, bool inplace) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    const float scale = 0.125f;
+
+    struct ggml_tensor * x = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+    fill_uniform(x, rng, -8.0f, 8.0f);
+
+    // causal mask with -INF above the diagonal, broadcast over the heads
+    struct ggml_tensor * mask = nullptr;
+    if (mask_type != GGML_TYPE_COUNT) {
+        mask = ggml_new_tensor_2d(ctx, mask_type, ne0, ne1);
+        fill_uniform(mask, rng, -1.0f, 1.0f);
+        for (int64_t i1 = 0; i1 < ne1; i1++) {
+            for (int64_t i0 = ne0 - ne1 + i1 + 1; i0 < ne0; i0++) {
+                if (mask_type == GGML_TYPE_F16) {
+                    ((ggml_fp16_t *) mask->data)[i1*ne0 + i0] = ggml_fp32_to_fp16(-INFINITY);
+                } else {
+                    ((float *) mask->data)[i1*ne0 + i0] = -INFINITY;
+                }
+            }
+        }
+    }
+
+    struct ggml_tensor * sk = nullptr;
+    if (sinks) {
+        sk = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne2);
+        fill_uniform(sk, rng, -4.0f, 4.0f);
+    }
+
+    const std::vector<float> x_data = get_data(x);
+
+    struct ggml_tensor * out = ggml_soft_max_ext(ctx, x, mask, scale, max_bias);
+    if (sk) {
+        ggml_soft_max_add_sinks(out, sk);
+    }
+    if (inplace) {
+        // what ggml-alloc does when x has no other use
+        out->data = x->data;
+    }
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    graph_compute(gf, threadpool, n_threads);
+
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(ne2));
+
+    const double m0 = pow(2.0, -(max_bias       ) / n_head_log2);
+    const double m1 = pow(2.0, -(max_bias / 2.0f) / n_head_log2);
+
+    std::vector<double> ref(ggml_nelements(out));
+    std::vector<double> w(ne0);
+
+    for (int64_t i2 = 0; i2 < ne2; i2++) {
+        const double slope = max_bias > 0.0f ? i2 < n_head_log2 ? pow(m0, i2 + 1) : pow(m1, 2*(i2 - n_head_log2) + 1) : 1.0;
+
+        for (int64_t i1 = 0; i1 < ne1; i1++) {
+            const int64_t ir = i2*ne1 + i1;
+
+            double max = -INFINITY;
+            for (int64_t i0 = 0; i0 < ne0; i0++) {
+                w[i0] = (double) x_data[ir*ne0 + i0]*scale + (mask ? slope*get_f(mask, i1*ne0 + i0) : 0.0);
+                max   = std::max(max, w[i0]);
+            }
+            if (sk) {
+                max = std::max(max, (double) get_f(sk, i2));
+            }
+
+            double sum = sk ? exp(get_f(sk, i2) - max) : 0.0;
+            for (int64_t i0 = 0; i0 < ne0; i0++) {
+                w[i0] = exp(w[i0] - max);
+                sum  += w[i0];
+            }
+            for (int64_t i0 = 0; i0 < ne0; i0++) {
+                ref[ir*ne0 + i0] = w[i0]/sum;
+            }
+        }
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "SOFT_MAX(ne=[%d,%d,%d],mask=%s,max_bias=%.1f,sinks=%d,inplace=%d)", (int) ne0, (int) ne1, (int) ne2,
+            mask ? ggml_type_name(mask_type) : "none", max_bias, sinks, inplace);
+
+    const bool ok = check(name, ref, out, 1e-9);
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+static bool test_rms_norm(struct ggml_threadpool * threadpool, int n_threads, std::mt19937 & rng, int64_t ne0, int64_t ne1, float eps) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    // an offset, so that the sum of squares is not dominated by a few elements
+    struct ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+    fill_uniform(x, rng, 0.5f, 2.0f);
+
+    struct ggml_tensor * out = ggml_rms_norm(ctx, x, eps);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    graph_compute(gf, threadpool, n_threads);
+
+    std::vector<double> ref(ggml_nelements(out));
+    for (int64_t i1 = 0; i1 < ne1; i1++) {
+        const float * xr = (const float *) x->data + i1*ne0;
+
+        double sum = 0.0;
+        for (int64_t i0 = 0; i0 < ne0; i0++) {
+            sum += (double) xr[i0]*xr[i0];
+        }
+
+        const double scale = 1.0/sqrt(sum/ne0 + eps);
+        for (int64_t i0 = 0; i0 < ne0; i0++) {
+            ref[i1*ne0 + i0] = xr[i0]*scale;
+        }
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "RMS_NORM(ne=[%d,%d],eps=%g)", (int) ne0, (int) ne1, eps);
+
+    const bool ok = check(name, ref, out, 1e-10);
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+struct rope_params {
+    int   n_dims;
+    int   mode;
+    float freq_base;
+    float freq_scale;
+    float attn_factor;
+};
+
+// rope without YaRN: rotates the pairs (x[2i], x[2i + 1]), or (x[i], x[i + n_dims/2]) for neox, by
+// p*freq_scale*freq_base^(-2i/n_dims)/ff[i], scales them by attn_factor and copies the channels past n_dims
+static std::vector<double> rope_ref(const struct ggml_tensor * x, const int32_t * pos, const float * ff, const rope_params & rp) {
+    const int64_t ne0 = x->ne[0];
+    const int64_t ne1 = x->ne[1];
+    const int64_t ne2 = x->ne[2];
+    const int64_t ne3 = x->ne[3];
+
+    const bool is_neox = rp.mode & GGML_ROPE_TYPE_NEOX;
+
+    std::vector<double> ref(ggml_nelements(x));
+
+    for (int64_t i3 = 0; i3 < ne3; i3++) {
+        for (int64_t i2 = 0; i2 < ne2; i2++) {
+            for (int64_t i1 = 0; i1 < ne1; i1++) {
+                const int64_t ir = (i3*ne2 + i2)*ne1 + i1;
+
+                for (int64_t i0 = rp.n_dims; i0 < ne0; i0++) {
+                    ref[ir*ne0 + i0] = get_f(x, ir*ne0 + i0);
+                }
+
+                for (int64_t i = 0; i < rp.n_dims/2; i++) {
+                    const double theta = pos[i2]*rp.freq_scale*pow(rp.freq_base, -2.0*i/rp.n_dims)/(ff ? ff[i] : 1.0f);
+
+                    const int64_t j0 = is_neox ? i : 2*i;
+                    const int64_t j1 = is_neox ? i + rp.n_dims/2 : 2*i + 1;
+
+                    const double x0 = get_f(x, ir*ne0 + j0);
+                    const double x1 = get_f(x, ir*ne0 + j1);
+
+                    ref[ir*ne0 + j0] = (x0*cos(theta) - x1*sin(theta))*rp.attn_factor;
+                    ref[ir*ne0 + j1] = (x0*sin(theta) + x1*cos(theta))*rp.attn_factor;
+                }
+            }
+        }
+    }
+
+    return ref;
+}
+
+// several ROPEs in one graph, the way the attention of consecutive layers uses them: the ROPEs with the same positions
+// and parameters share the sin/cos table of the first one, any other one recomputes it
+static bool test_rope(struct ggml_threadpool * threadpool, int n_threads, std::mt19937 & rng, enum ggml_type type, int mode, int64_t ne0, int64_t n_tokens) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    const int n_dims = ne0 % 2 == 0 ? ne0 : ne0 - 1;
+
+    struct ggml_tensor * pos_a = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_tokens);
+    struct ggml_tensor * pos_b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_tokens);
+    for (int64_t i = 0; i < n_tokens; i++) {
+        ((int32_t *) pos_a->data)[i] = 100 + i;
+        ((int32_t *) pos_b->data)[i] = 7 + 3*i;
+    }
+
+    struct ggml_tensor * ff = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_dims/2);
+    fill_uniform(ff, rng, 1.0f, 4.0f);
+
+    struct test_rope_case {
+        rope_params          rp;
+        struct ggml_tensor * pos;
+        struct ggml_tensor * ff;
+        int64_t              n_head;
+        int64_t              n_batch;
+    };
+
+    const rope_params rp_a = { n_dims,     mode, 10000.0f, 1.0f,  1.0f };
+    const rope_params rp_b = { n_dims,     mode, 500000.0f, 0.25f, 0.75f };
+    const rope_params rp_c = { n_dims - 2, mode, 10000.0f, 1.0f,  1.0f };
+
+    const test_rope_case cases[] = {
+        { rp_a, pos_a, nullptr, 7, 1 }, // Q
+        { rp_a, pos_a, nullptr, 3, 1 }, // K, shares the table
+        { rp_a, pos_b, nullptr, 3, 2 }, // other positions
+        { rp_b, pos_b, ff,      5, 1 }, // other parameters, with freq factors
+        { rp_b, pos_b, ff,      1, 1 }, // shares the table
+        { rp_c, pos_b, ff,      2, 1 }, // fewer rotated channels
+        { rp_a, pos_a, nullptr, 7, 1 }, // the first table again, recomputed
+    };
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+
+    std::vector<struct ggml_tensor *> xs;
+    std::vector<struct ggml_tensor *> outs;
+
+    for (const auto & tc : cases) {
+        struct ggml_tensor * x = ggml_new_tensor_4d(ctx, type, ne0, tc.n_head, n_tokens, tc.n_batch);
+        fill_uniform(x, rng, -1.0f, 1.0f);
+
+        struct ggml_tensor * out = ggml_rope_ext(ctx, x, tc.pos, tc.ff, tc.rp.n_dims, tc.rp.mode, 0,
+                tc.rp.freq_base, tc.rp.freq_scale, 0.0f, tc.rp.attn_factor, 0.0f, 0.0f);
+
+        // in order, so that each ROPE sees the table of the previous one
+        ggml_build_forward_expand(gf, out);
+
+        xs.push_back(x);
+        outs.push_back(out);
+    }
+
+    graph_compute(gf, threadpool, n_threads);
+
+    bool ok = true;
+
+    for (size_t i = 0; i < outs.size(); i++) {
+        const auto & tc = cases[i];
+
+        const std::vector<double> ref = rope_ref(xs[i], (const int32_t *) tc.pos->data, tc.ff ? (const float *) tc.ff->data : nullptr, tc.rp);
+
+        char name[256];
+        snprintf(name, sizeof(name), "ROPE(type=%s,mode=%d,ne0=%d,n_dims=%d,n_head=%d,n_tokens=%d,n_batch=%d,case=%d)",
+                ggml_type_name(type), mode, (int) ne0, tc.rp.n_dims, (int) tc.n_head, (int) n_tokens, (int) tc.n_batch, (int) i);
+
+        // f16 rows are rounded when they are stored
+        ok = check(name, ref, outs[i], type == GGML_TYPE_F16 ? 1e-6 : 1e-9) && ok;
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(int argc, char * argv[]) {
+    int n_threads = 4;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
+    struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
+        exit(1);
+    }
+
+    std::mt19937 rng(42);
+
+    int n_fail = 0;
+
+    for (int64_t ne0 : { 1, 3, 17, 33, 67, 4097 }) {
+        for (enum ggml_type mask_type : { GGML_TYPE_COUNT, GGML_TYPE_F32, GGML_TYPE_F16 }) {
+            for (float max_bias : { 0.0f, 8.0f }) {
+                if (max_bias > 0.0f && mask_type == GGML_TYPE_COUNT) {
+                    continue;
+                }
+                const int64_t ne1 = std::min<int64_t>(ne0, 5);
+                n_fail += !test_soft_max(threadpool, n_threads, rng, ne0, ne1, 6, mask_type, max_bias, false, false);
+                n_fail += !test_soft_max(threadpool, n_threads, rng, ne0, ne1, 6, mask_type, max_bias, true,  true);
+            }
+        }
+    }
+
+    for (int64_t ne0 : { 1, 3, 17, 33, 67, 4097 }) {
+        for (float eps : { 1e-6f, 1e-2f }) {
+            n_fail += !test_rms_norm(threadpool, n_threads, rng, ne0, 7, eps);
+        }
+    }
+
+    for (enum ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16 }) {
+        for (int mode : { 0, GGML_ROPE_TYPE_NEOX }) {
+            // odd sizes leave channels past n_dims, and a tail after the SIMD loops
+            for (int64_t ne0 : { 4, 18, 35, 64, 129 }) {
+                for (int64_t n_tokens : { 1, 5 }) {
+                    n_fail += !test_rope(threadpool, n_threads, rng, type, mode, ne0, n_tokens);
+                }
+            }
+        }
+    }
+
+    ggml_threadpool_free(threadpool);
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d ops do not match the scalar reference\n", n_fail);
+        return 1;
+    }
+
+    return 0;
+}
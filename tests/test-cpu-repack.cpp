@@ -0,0 +1,226 @@
+// compares mul_mat and mul_mat_id with the weights in the CPU_REPACK buffer type, computed by the gemv/gemm kernels of
+// the interleaved layouts, against the same weights in a plain CPU buffer, computed by vec_dot
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "ggml-backend.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static double nmse(const float * a, const float * b, size_t n) {
+    double mse_a_b = 0.0;
+    double mse_a_0 = 0.0;
+
+    for (size_t i = 0; i < n; i++) {
+        mse_a_b += (a[i] - b[i]) * (a[i] - b[i]);
+        mse_a_0 += a[i] * a[i];
+    }
+
+    return mse_a_b / mse_a_0;
+}
+
+static std::vector<float> rand_data(std::mt19937 & rng, size_t n, float max) {
+    std::uniform_real_distribution<float> dist(-max, max);
+    std::vector<float> data(n);
+    for (auto & x : data) {
+        x = dist(rng);
+    }
+    return data;
+}
+
+static ggml_backend_buffer_type_t get_repack_buft() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts) {
+        return nullptr;
+    }
+
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        if (strcmp(ggml_backend_buft_name(*buft), "CPU_REPACK") == 0) {
+            return *buft;
+        }
+    }
+
+    return nullptr;
+}
+
+enum test_result {
+    TEST_OK,
+    TEST_FAIL,
+    TEST_SKIPPED,
+};
+
+// ne00 x ne01 weights (n_as experts of them for mul_mat_id), ne11 rows of activations
+static test_result test_repack(ggml_backend_t backend, ggml_backend_buffer_type_t repack_buft, std::mt19937 & rng,
+        enum ggml_type type, int64_t ne00, int64_t ne01, int64_t ne11, int n_as) {
+    const bool is_id  = n_as > 0;
+    const int  n_used = is_id ? 2 : 0;
+
+    char name[128];
+    snprintf(name, sizeof(name), "%s(type=%s,ne00=%d,ne01=%d,ne11=%d%s)", is_id ? "MUL_MAT_ID" : "MUL_MAT",
+            ggml_type_name(type), (int) ne00, (int) ne01, (int) ne11, is_id ? (",n_as=" + std::to_string(n_as)).c_str() : "");
+
+    // the weights, once in each buffer type
+    struct ggml_init_params params_w = {
+        /* .mem_size   = */ 2*ggml_tensor_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+
+    struct ggml_context * ctx_repack = ggml_init(params_w);
+    struct ggml_context * ctx_plain  = ggml_init(params_w);
+
+    struct ggml_tensor * w_repack = is_id ? ggml_new_tensor_3d(ctx_repack, type, ne00, ne01, n_as) : ggml_new_tensor_2d(ctx_repack, type, ne00, ne01);
+    struct ggml_tensor * w_plain  = is_id ? ggml_new_tensor_3d(ctx_plain,  type, ne00, ne01, n_as) : ggml_new_tensor_2d(ctx_plain,  type, ne00, ne01);
+
+    ggml_backend_buffer_t buf_repack = ggml_backend_alloc_ctx_tensors_from_buft(ctx_repack, repack_buft);
+    ggml_backend_buffer_t buf_plain  = ggml_backend_alloc_ctx_tensors_from_buft(ctx_plain,  ggml_backend_cpu_buffer_type());
+
+    test_result result = TEST_OK;
+
+    // layouts that this build does not interleave are kept as they are and computed by vec_dot, nothing to compare
+    if (w_repack->extra == nullptr) {
+        result = TEST_SKIPPED;
+    }
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+    ggml_backend_buffer_t buf = nullptr;
+
+    if (result == TEST_OK) {
+        const std::vector<float> w_data = rand_data(rng, ggml_nelements(w_plain), std::sqrt(3.0f/ne00));
+        std::vector<uint8_t> w_q(ggml_nbytes(w_plain));
+        ggml_quantize_chunk(type, w_data.data(), w_q.data(), 0, ggml_nelements(w_plain)/ne00, ne00, nullptr);
+
+        // the repack buffer converts the blocks to the interleaved layout in set_tensor
+        ggml_backend_tensor_set(w_repack, w_q.data(), 0, w_q.size());
+        ggml_backend_tensor_set(w_plain,  w_q.data(), 0, w_q.size());
+
+        struct ggml_tensor * x;
+        struct ggml_tensor * ids = nullptr;
+        struct ggml_tensor * out_repack;
+        struct ggml_tensor * out_plain;
+
+        if (is_id) {
+            x   = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne00, 1, ne11);
+            ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_used, ne11);
+
+            out_repack = ggml_mul_mat_id(ctx, w_repack, x, ids);
+            out_plain  = ggml_mul_mat_id(ctx, w_plain,  x, ids);
+        } else {
+            x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne00, ne11);
+
+            out_repack = ggml_mul_mat(ctx, w_repack, x);
+            out_plain  = ggml_mul_mat(ctx, w_plain,  x);
+        }
+
+        struct ggml_cgraph * gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, out_repack);
+        ggml_build_forward_expand(gf, out_plain);
+
+        buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+        const std::vector<float> x_data = rand_data(rng, ggml_nelements(x), 1.0f);
+        ggml_backend_tensor_set(x, x_data.data(), 0, ggml_nbytes(x));
+
+        if (ids) {
+            // distinct experts for each row, all of them used when there are enough rows
+            std::vector<int32_t> ids_data(ggml_nelements(ids));
+            for (int64_t i = 0; i < ne11; i++) {
+                const int32_t e0 = rng() % n_as;
+                for (int j = 0; j < n_used; j++) {
+                    ids_data[i*n_used + j] = (e0 + j) % n_as;
+                }
+            }
+            ggml_backend_tensor_set(ids, ids_data.data(), 0, ggml_nbytes(ids));
+        }
+
+        if (ggml_backend_graph_compute(backend, gf) != GGML_STATUS_SUCCESS) {
+            fprintf(stderr, "%s: graph compute failed\n", name);
+            exit(1);
+        }
+
+        std::vector<float> res_repack(ggml_nelements(out_repack));
+        std::vector<float> res_plain(ggml_nelements(out_plain));
+        ggml_backend_tensor_get(out_repack, res_repack.data(), 0, ggml_nbytes(out_repack));
+        ggml_backend_tensor_get(out_plain,  res_plain.data(),  0, ggml_nbytes(out_plain));
+
+        const double err = nmse(res_plain.data(), res_repack.data(), res_plain.size());
+        if (!(err <= 1e-6)) {
+            fprintf(stderr, "%s: NMSE = %.9f\n", name, err);
+            result = TEST_FAIL;
+        }
+    }
+
+    printf("%s: %s\n", name, result == TEST_OK ? "OK" : result == TEST_FAIL ? "FAIL" : "not repacked, skipped");
+
+    ggml_backend_buffer_free(buf);
+    ggml_backend_buffer_free(buf_repack);
+    ggml_backend_buffer_free(buf_plain);
+    ggml_free(ctx);
+    ggml_free(ctx_repack);
+    ggml_free(ctx_plain);
+
+    return result;
+}
+
+int main(int argc, char * argv[]) {
+    int n_threads = 4;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    ggml_backend_buffer_type_t repack_buft = get_repack_buft();
+    if (!repack_buft) {
+        printf("CPU_REPACK buffer type not available, skipping\n");
+        return 0;
+    }
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+    std::mt19937 rng(42);
+
+    int n_fail = 0;
+
+    const enum ggml_type types[] = {
+        GGML_TYPE_Q8_0, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_IQ4_XS,
+    };
+
+    for (enum ggml_type type : types) {
+        // the gemm kernels take 4 rows of activations at a time, the rest goes through gemv. the weights are split
+        // between the threads in groups of 8 rows, so 8 and 24 rows leave some threads without work
+        for (int64_t ne01 : { 8, 24, 136 }) {
+            for (int64_t ne11 : { 1, 3, 4, 5, 7, 13, 33 }) {
+                n_fail += test_repack(backend, repack_buft, rng, type, 512, ne01, ne11, 0) == TEST_FAIL;
+            }
+        }
+
+        // the rows of each expert are gathered from the tokens that use it, so their counts are ragged as well
+        for (int64_t ne11 : { 1, 5, 33 }) {
+            n_fail += test_repack(backend, repack_buft, rng, type, 256, 24, ne11, 4) == TEST_FAIL;
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d repacked mul_mat do not match the plain CPU buffer\n", n_fail);
+        return 1;
+    }
+
+    return 0;
+}
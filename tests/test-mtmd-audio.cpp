@@ -0,0 +1,132 @@
+// checks the audio preprocessing of mtmd: the shared FFT against a naive DFT, and the streaming log-mel against the
+// whole audio pushed at once - the frames are computed by push() as soon as their window is complete, so the output
+// must not depend on how the samples are split between the calls, nor on the number of threads
+#include "mtmd-audio.h"
+#include "common/fft.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace whisper_preprocessor;
+
+static bool test_fft(int n, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    // interleaved (re, im), read with a stride of 2 like the real FFT of the mel does
+    std::vector<float> x(2*n);
+    for (auto & v : x) {
+        v = dist(rng);
+    }
+
+    fft_plan plan(n);
+    fft_work work;
+    plan.run(x.data(), x.data() + 1, 2, work);
+
+    double err = 0.0;
+    double ref = 0.0;
+    for (int k = 0; k < n; k++) {
+        double yr = 0.0;
+        double yi = 0.0;
+        for (int j = 0; j < n; j++) {
+            const double theta = -2.0*3.14159265358979323846*(((int64_t) j*k) % n)/n;
+            yr += x[2*j]*cos(theta) - x[2*j + 1]*sin(theta);
+            yi += x[2*j]*sin(theta) + x[2*j + 1]*cos(theta);
+        }
+        err += (yr - work.re[k])*(yr - work.re[k]) + (yi - work.im[k])*(yi - work.im[k]);
+        ref += yr*yr + yi*yi;
+    }
+
+    const bool ok = err <= 1e-10*ref;
+    printf("FFT(n=%d): %s\n", n, ok ? "OK" : "FAIL");
+    if (!ok) {
+        fprintf(stderr, "FFT(n=%d): NMSE = %.12f\n", n, err/ref);
+    }
+    return ok;
+}
+
+static std::vector<float> mel_stream(const whisper_filters & filters, const std::vector<float> & pcm,
+        const std::vector<size_t> & chunks, int n_threads) {
+    whisper_mel_stream stream(filters, n_threads);
+
+    // the chunk sizes are repeated until all the samples are pushed
+    size_t i = 0;
+    for (size_t c = 0; i < pcm.size(); c++) {
+        const size_t n = std::min(chunks[c % chunks.size()], pcm.size() - i);
+        stream.push(pcm.data() + i, n);
+        i += n;
+    }
+
+    std::vector<whisper_mel> output;
+    stream.finish(output);
+
+    std::vector<float> res;
+    for (const auto & mel : output) {
+        res.insert(res.end(), mel.data.begin(), mel.data.end());
+    }
+    return res;
+}
+
+static std::string chunks_str(const std::vector<size_t> & chunks) {
+    std::string s;
+    for (size_t c : chunks) {
+        s += (s.empty() ? "" : ",") + std::to_string(c);
+    }
+    return s;
+}
+
+int main(void) {
+    std::mt19937 rng(42);
+
+    int n_fail = 0;
+
+    // sizes of the real FFTs of whisper (400) and of the tts vocoder (1280), halved, and the radices on their own
+    for (int n : { 1, 2, 3, 4, 5, 8, 12, 25, 100, 200, 640 }) {
+        n_fail += !test_fft(n, rng);
+    }
+
+    const whisper_filters filters = whisper_precalc_filters::get_128_bins();
+
+    // a few tones over noise; 180 samples are less than the reflective padding at the beginning
+    for (size_t n_samples : { (size_t) 180, (size_t) 3*WHISPER_SAMPLE_RATE + 77 }) {
+        std::normal_distribution<float> noise(0.0f, 0.01f);
+        std::vector<float> pcm(n_samples);
+        for (size_t i = 0; i < n_samples; i++) {
+            const double t = 2.0*3.14159265358979323846*i/WHISPER_SAMPLE_RATE;
+            pcm[i] = 0.3f*sin(440.0*t) + 0.2f*sin(1234.5*t) + noise(rng);
+        }
+
+        const std::vector<float> ref = mel_stream(filters, pcm, { n_samples }, 1);
+
+        // chunks smaller than the padding at the beginning, than a hop and than a window, and ragged ones
+        const std::vector<std::vector<size_t>> chunkings = {
+            { 1 },
+            { 7, 0, 150 },
+            { 199, 2, 160 },
+            { 401, 1000, 3 },
+            { 4000 },
+        };
+
+        for (int n_threads : { 1, 3 }) {
+            for (const auto & chunks : chunkings) {
+                const std::vector<float> res = mel_stream(filters, pcm, chunks, n_threads);
+
+                const bool ok = res.size() == ref.size() && memcmp(res.data(), ref.data(), ref.size()*sizeof(float)) == 0;
+                printf("MEL_STREAM(n_samples=%d,chunks=%s,n_threads=%d): %s\n", (int) n_samples, chunks_str(chunks).c_str(),
+                        n_threads, ok ? "OK" : "FAIL");
+                n_fail += !ok;
+            }
+        }
+    }
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d audio preprocessing tests failed\n", n_fail);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+// checks that the JSON writers of the server that do not go through nlohmann::json
+// give the same output as json::dump()
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "utils.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// returns false if json::dump() rejects str as invalid UTF-8
+static bool dump_string(const std::string & str, std::string & out) {
+    try {
+        out = json(str).dump();
+    } catch (const json::type_error &) {
+        return false;
+    }
+    return true;
+}
+
+static void check_string(const std::string & str) {
+    std::string expected;
+    const bool valid = dump_string(str, expected);
+
+    // the output is appended, the previous content is kept
+    std::string out = "prefix";
+    const bool ok = json_append_string(out, str);
+
+    if (ok != valid) {
+        fprintf(stderr, "%s: json_append_string returned %d, json::dump %s for a string of %zu bytes\n",
+                __func__, ok, valid ? "accepted it" : "rejected it", str.size());
+        assert(false);
+    }
+
+    if (!valid) {
+        // the output is unchanged on error
+        assert(out == "prefix");
+        return;
+    }
+
+    if (out.substr(6) != expected) {
+        fprintf(stderr, "%s: mismatch for a string of %zu bytes:\n  got:      %s\n  expected: %s\n",
+                __func__, str.size(), out.substr(6, 256).c_str(), expected.substr(0, 256).c_str());
+        assert(false);
+    }
+}
+
+static void test_escapes() {
+    check_string("");
+    check_string("hello world");
+    check_string("\"quoted\"");
+    check_string("back\\slash");
+    check_string("/slash/is/not/escaped");
+    check_string("\b\f\n\r\t");
+    check_string("line 1\nline 2\r\n\tindented");
+
+    // all the control characters, and DEL which is not escaped
+    for (int c = 0; c < 0x20; c++) {
+        check_string(std::string(1, (char) c));
+        check_string("a" + std::string(1, (char) c) + "b");
+    }
+    check_string(std::string(1, '\0') + "after nul");
+    check_string("\x7f");
+}
+
+static void test_utf8() {
+    const std::vector<std::string> valid = {
+        "\xc2\x80",         // U+0080
+        "\xdf\xbf",         // U+07FF
+        "\xe0\xa0\x80",     // U+0800
+        "\xed\x9f\xbf",     // U+D7FF
+        "\xee\x80\x80",     // U+E000
+        "\xef\xbf\xbf",     // U+FFFF
+        "\xf0\x90\x80\x80", // U+10000
+        "\xf4\x8f\xbf\xbf", // U+10FFFF
+        "caf\xc3\xa9",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+        "emoji \xf0\x9f\x98\x80 and \"quotes\"\n",
+    };
+
+    const std::vector<std::string> invalid = {
+        "\x80",             // lone continuation byte
+        "\xbf",
+        "\xc0\x80",         // overlong
+        "\xc1\xbf",
+        "\xe0\x80\x80",
+        "\xe0\x9f\xbf",
+        "\xf0\x80\x80\x80",
+        "\xf0\x8f\xbf\xbf",
+        "\xed\xa0\x80",     // surrogates
+        "\xed\xbf\xbf",
+        "\xf4\x90\x80\x80", // above U+10FFFF
+        "\xf5\x80\x80\x80",
+        "\xfe",
+        "\xff",
+        "\xc3",             // truncated sequences
+        "\xe6\x97",
+        "\xf0\x9f\x98",
+        "\xc3" "a",         // continuation byte missing
+        "\xe6\x97" "a",
+        "\xf0\x9f\x98" "a",
+    };
+
+    for (const auto & s : valid) {
+        check_string(s);
+        check_string("a" + s + "b");
+    }
+
+    for (const auto & s : invalid) {
+        check_string(s);
+        check_string("valid text before " + s);
+        check_string(s + " valid text after");
+    }
+}
+
+static void test_random(std::mt19937 & rng) {
+    // mostly ASCII with some control, escaped and non-ASCII bytes, so that both valid and invalid strings come up
+    const std::string alphabet =
+        std::string("abcdefghijklmnopqrstuvwxyz ABC0123456789.,;:!?\"\\/\n\r\t\b\f") + '\0' + "\x01\x1f\x7f";
+
+    std::uniform_int_distribution<int> dist_len(0, 32);
+    std::uniform_int_distribution<int> dist_kind(0, 9);
+    std::uniform_int_distribution<int> dist_byte(0, 255);
+    std::uniform_int_distribution<size_t> dist_alpha(0, alphabet.size() - 1);
+
+    const std::vector<std::string> pieces = {
+        "\xc3\xa9", "\xe6\x97\xa5", "\xf0\x9f\x98\x80", "\xef\xbf\xbd",
+    };
+
+    for (int i = 0; i < 100000; i++) {
+        std::string s;
+        const int len = dist_len(rng);
+        for (int j = 0; j < len; j++) {
+            const int kind = dist_kind(rng);
+            if (kind < 6) {
+                s += alphabet[dist_alpha(rng)];
+            } else if (kind < 9) {
+                s += pieces[dist_byte(rng) % pieces.size()];
+            } else {
+                s += (char) dist_byte(rng);
+            }
+        }
+        check_string(s);
+    }
+}
+
+static void test_large(std::mt19937 & rng) {
+    // long runs without escapes, and long strings with many escapes and multibyte sequences
+    check_string(std::string(1 << 20, 'x'));
+    check_string(std::string(1 << 16, '"'));
+    check_string(std::string(1 << 16, '\n'));
+
+    std::string s;
+    std::uniform_int_distribution<int> dist(0, 3);
+    while (s.size() < (1 << 20)) {
+        switch (dist(rng)) {
+            case 0: s += "plain text "; break;
+            case 1: s += "\"\\\n\t";    break;
+            case 2: s += "\xe6\x97\xa5\xf0\x9f\x98\x80"; break;
+            case 3: s += '\x01';        break;
+        }
+    }
+    check_string(s);
+
+    // an invalid byte at the very end of a large string
+    check_string(s + "\xff");
+}
+
+static void test_int() {
+    for (int64_t v : { INT64_C(0), INT64_C(1), INT64_C(-1), INT64_C(42), INT64_C(-1234567890123), INT64_MAX, INT64_MIN }) {
+        std::string out;
+        json_append_int(out, v);
+        assert(out == json(v).dump());
+    }
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    test_escapes();
+    test_utf8();
+    test_random(rng);
+    test_large(rng);
+    test_int();
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,577 @@
+// Offline batch inference: completes the prompts of JSONL files with as many sequences in flight as the context allows
+//
+// - the input is read in windows of --sort-window requests, sorted by length so that the long requests start first
+// - the common prefix of the prompts of a window is evaluated once in sequence 0 and copied to the other sequences
+// - every llama_decode() call is filled up to n_batch tokens: one token per generating sequence, the rest with chunks
+//   of the prompts of the new requests
+// - the results are written in input order and the output file is the checkpoint: a restarted run skips its lines
+
+#include "arg.h"
+#include "common.h"
+#include "sampling.h"
+#include "log.h"
+#include "llama.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+struct batch_request {
+    int64_t index = 0; // non-empty line of the request in the input
+
+    json id; // copied to the result
+
+    std::vector<llama_token> tokens;
+
+    int32_t n_predict = 0;
+    int32_t n_decoded = 0;
+
+    bool stopped_eos = false;
+    bool done        = false;
+
+    std::string content;
+    std::string error;
+};
+
+struct batch_seq {
+    ~batch_seq() {
+        if (smpl) {
+            common_sampler_free(smpl);
+        }
+    }
+
+    llama_seq_id seq_id = 0;
+
+    batch_request * req = nullptr;
+
+    struct common_sampler * smpl = nullptr;
+
+    int32_t n_past     = 0;  // tokens of the sequence in the KV cache
+    int32_t n_reserved = 0;  // KV cells reserved for the request, the shared prefix excluded
+    int32_t i_batch    = -1;
+
+    bool orphan = false; // started from a prefix that was replaced since then
+
+    llama_token sampled = LLAMA_TOKEN_NULL;
+};
+
+// reads the non-empty lines of the input files one after the other
+struct batch_reader {
+    std::vector<std::string> files;
+
+    size_t        i_file = 0;
+    std::ifstream in;
+
+    bool next(std::string & line) {
+        while (true) {
+            if (!in.is_open()) {
+                if (i_file >= files.size()) {
+                    return false;
+                }
+                in.open(files[i_file++]);
+                if (!in) {
+                    LOG_ERR("%s: failed to open '%s'\n", __func__, files[i_file - 1].c_str());
+                    return false;
+                }
+            }
+            if (!std::getline(in, line)) {
+                in.close();
+                continue;
+            }
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                return true;
+            }
+        }
+    }
+};
+
+// number of complete lines of the output of a previous run, a partial last line is removed
+static int64_t checkpoint_load(const std::string & fname) {
+    std::ifstream in(fname, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+
+    int64_t n_lines = 0;
+    size_t  n_bytes = 0; // up to the last newline
+    size_t  pos     = 0;
+
+    char buf[1 << 16];
+    while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+        for (std::streamsize i = 0; i < in.gcount(); ++i) {
+            if (buf[i] == '\n') {
+                n_lines += 1;
+                n_bytes = pos + i + 1;
+            }
+        }
+        pos += in.gcount();
+    }
+    in.close();
+
+    if (n_bytes != pos) {
+        LOG_WRN("%s: removing the partial last line of '%s'\n", __func__, fname.c_str());
+        std::filesystem::resize_file(fname, n_bytes);
+    }
+
+    return n_lines;
+}
+
+static bool request_parse(batch_request & req, const std::string & line, const common_params & params, const llama_vocab * vocab) {
+    json data;
+    try {
+        data = json::parse(line);
+    } catch (const std::exception & e) {
+        req.error = std::string("invalid JSON: ") + e.what();
+        return false;
+    }
+
+    std::string prompt;
+    if (data.is_string()) {
+        prompt = data.get<std::string>();
+    } else if (data.is_object() && data.contains("prompt") && data.at("prompt").is_string()) {
+        prompt = data.at("prompt").get<std::string>();
+        req.id = data.value("id", json());
+        try {
+            req.n_predict = data.value("n_predict", 0);
+        } catch (const std::exception & e) {
+            req.error = std::string("invalid \"n_predict\": ") + e.what();
+            return false;
+        }
+    } else {
+        req.error = "expected a string or an object with a \"prompt\" string";
+        return false;
+    }
+
+    if (req.n_predict <= 0) {
+        req.n_predict = params.n_predict;
+    }
+
+    req.tokens = common_tokenize(vocab, prompt, true, true);
+    if (req.tokens.empty()) {
+        req.error = "empty prompt";
+        return false;
+    }
+
+    return true;
+}
+
+static json request_result(const batch_request & req) {
+    json res = {
+        {"index", req.index},
+    };
+    if (!req.id.is_null()) {
+        res["id"] = req.id;
+    }
+    if (!req.error.empty()) {
+        res["error"] = req.error;
+        return res;
+    }
+    res["content"]          = req.content;
+    res["tokens_prompt"]    = req.tokens.size();
+    res["tokens_predicted"] = req.n_decoded;
+    res["stop_type"]        = req.stopped_eos ? "eos" : "limit";
+    return res;
+}
+
+static void print_usage(int, char ** argv) {
+    LOG("\nexample usage:\n");
+    LOG("\n    %s -m model.gguf --in-file prompts.jsonl -o results.jsonl -c 16384 -np 32 -n 128\n", argv[0]);
+    LOG("\n");
+}
+
+int main(int argc, char ** argv) {
+    common_params params;
+
+    params.n_parallel = 32;
+    params.n_predict  = 128;
+    params.out_file   = "results.jsonl";
+
+    if (!common_params_parse(argc, argv, params, LLAMA_EXAMPLE_BATCH_INFER, print_usage)) {
+        return 1;
+    }
+
+    common_init();
+
+    if (params.in_files.empty()) {
+        LOG_ERR("%s: no input file, use --in-file\n", __func__);
+        return 1;
+    }
+    if (params.n_predict <= 0) {
+        LOG_ERR("%s: n_predict must be positive\n", __func__);
+        return 1;
+    }
+
+    const int32_t n_seq    = params.n_parallel;
+    const int32_t n_window = std::max(1, params.n_sort_window);
+
+    // sequence 0 holds the shared prefix, the sequences share the whole context
+    params.n_parallel += 1;
+    params.kv_unified  = true;
+
+    // each llama_decode() call has one token for every generating sequence
+    if (params.n_batch < n_seq) {
+        LOG_WRN("%s: n_batch = %d is smaller than n_parallel = %d, increasing it\n", __func__, params.n_batch, n_seq);
+        params.n_batch = n_seq;
+    }
+
+    llama_backend_init();
+    llama_numa_init(params.numa);
+
+    common_init_result llama_init = common_init_from_params(params);
+
+    llama_model   * model = llama_init.model.get();
+    llama_context * ctx   = llama_init.context.get();
+
+    if (model == nullptr || ctx == nullptr) {
+        LOG_ERR("%s: failed to load the model\n", __func__);
+        return 1;
+    }
+
+    auto * mem = llama_get_memory(ctx);
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    const int32_t n_ctx   = llama_n_ctx(ctx);
+    const int32_t n_batch = llama_n_batch(ctx);
+
+    const int64_t n_skip = checkpoint_load(params.out_file);
+
+    FILE * fout = fopen(params.out_file.c_str(), "ab");
+    if (fout == nullptr) {
+        LOG_ERR("%s: failed to open '%s'\n", __func__, params.out_file.c_str());
+        return 1;
+    }
+
+    batch_reader reader;
+    reader.files = params.in_files;
+
+    std::string line;
+
+    int64_t n_read = 0;
+    while (n_read < n_skip && reader.next(line)) {
+        n_read += 1;
+    }
+    if (n_skip > 0) {
+        LOG_INF("%s: resuming after the %" PRId64 " results of '%s'\n", __func__, n_skip, params.out_file.c_str());
+    }
+
+    std::vector<batch_seq> seqs(n_seq);
+    for (int32_t i = 0; i < n_seq; ++i) {
+        seqs[i].seq_id = i + 1;
+    }
+
+    std::deque<batch_request>     reqs;    // read and not written yet, in input order
+    std::vector<batch_request *>  pending; // of the current window and not started yet, the next one at the back
+    std::vector<llama_token>      prefix;       // tokens of sequence 0
+    std::vector<llama_token>      prefix_next;  // shared prefix of the current window
+
+    int32_t n_orphan      = 0; // KV cells of the replaced prefixes that are still used by the orphan sequences
+    int32_t n_seq_orphan  = 0;
+
+    int64_t n_written     = n_skip;
+    int64_t n_prompt_eval = 0;
+    int64_t n_prompt_skip = 0;
+    int64_t n_gen         = 0;
+    int64_t n_decode      = 0;
+
+    llama_batch batch = llama_batch_init(std::max(n_batch, n_seq), 0, 1);
+
+    // reads the next window of requests and finds their common prefix, evaluated later in prefix_next
+    const auto load_window = [&]() {
+        while ((int32_t) pending.size() < n_window && reader.next(line)) {
+            batch_request & req = reqs.emplace_back();
+            req.index = n_read++;
+
+            if (request_parse(req, line, params, vocab)) {
+                pending.push_back(&req);
+            } else {
+                req.done = true;
+            }
+        }
+
+        // the longest requests at the back start first, the short ones fill the gaps at the end of the window
+        std::stable_sort(pending.begin(), pending.end(), [](const batch_request * a, const batch_request * b) {
+            return a->tokens.size() + a->n_predict < b->tokens.size() + b->n_predict;
+        });
+
+        // the last token of a prompt is evaluated in its own sequence for its logits
+        size_t n_prefix = 0;
+        if (pending.size() > 1) {
+            const auto & ref = pending[0]->tokens;
+
+            n_prefix = ref.size() - 1;
+            for (const auto * req : pending) {
+                n_prefix = std::min(n_prefix, req->tokens.size() - 1);
+                n_prefix = std::mismatch(ref.begin(), ref.begin() + n_prefix, req->tokens.begin()).first - ref.begin();
+            }
+        }
+
+        size_t n_keep = 0;
+        while (n_keep < prefix.size() && n_keep < n_prefix && prefix[n_keep] == pending[0]->tokens[n_keep]) {
+            n_keep += 1;
+        }
+
+        if (n_keep < prefix.size()) {
+            // the running sequences keep their copy of the cells of the old prefix
+            for (auto & seq : seqs) {
+                if (seq.req != nullptr && !seq.orphan) {
+                    seq.orphan    = true;
+                    n_seq_orphan += 1;
+                }
+            }
+            if (n_seq_orphan > 0) {
+                n_orphan += prefix.size() - n_keep;
+            }
+
+            llama_memory_seq_rm(mem, 0, n_keep, -1);
+            prefix.resize(n_keep);
+        }
+
+        prefix_next.clear();
+        if (!pending.empty()) {
+            prefix_next.assign(pending[0]->tokens.begin(), pending[0]->tokens.begin() + n_prefix);
+
+            LOG_INF("load_window: %zu requests, shared prefix = %zu tokens\n", pending.size(), prefix_next.size());
+        }
+    };
+
+    // evaluates the tokens of prefix_next that are not in sequence 0 yet
+    const auto eval_prefix = [&]() -> bool {
+        for (size_t i = prefix.size(); i < prefix_next.size(); i += n_batch) {
+            common_batch_clear(batch);
+            for (size_t j = i; j < std::min(prefix_next.size(), i + n_batch); ++j) {
+                common_batch_add(batch, prefix_next[j], j, { 0 }, false);
+            }
+            if (llama_decode(ctx, batch) != 0) {
+                LOG_ERR("eval_prefix: failed to evaluate the shared prefix\n");
+                return false;
+            }
+        }
+        prefix = prefix_next;
+
+        return true;
+    };
+
+    const auto t_main_start = ggml_time_us();
+
+    LOG_INF("%s: n_seq = %d, n_ctx = %d, n_batch = %d, sort window = %d\n", __func__, n_seq, n_ctx, n_batch, n_window);
+
+    while (true) {
+        if (pending.empty()) {
+            load_window();
+        }
+
+        // start the pending requests as long as their KV cells can be reserved
+        int32_t n_used = prefix.size() + n_orphan;
+        for (const auto & seq : seqs) {
+            n_used += seq.n_reserved;
+        }
+
+        bool any_active = false;
+        for (const auto & seq : seqs) {
+            any_active |= seq.req != nullptr;
+        }
+
+        // the cells of the new prefix are reserved too: wait for the running requests to free enough of them
+        if (prefix.size() < prefix_next.size()) {
+            if (!any_active) {
+                prefix_next.resize(std::min<size_t>(prefix_next.size(), n_ctx));
+            }
+
+            const int32_t n_eval = prefix_next.size() - prefix.size();
+            if (n_used + n_eval <= n_ctx) {
+                if (!eval_prefix()) {
+                    return 1;
+                }
+                n_used += n_eval;
+            }
+        }
+
+        for (auto & seq : seqs) {
+            if (seq.req != nullptr || pending.empty() || prefix.size() < prefix_next.size()) {
+                continue;
+            }
+
+            batch_request * req = pending.back();
+
+            const int32_t n_reserve = req->tokens.size() - prefix.size() + req->n_predict;
+            if (n_used + n_reserve > n_ctx) {
+                if (!any_active && prefix.size() + n_reserve > (size_t) n_ctx) {
+                    req->error = "the request does not fit in the context";
+                    req->done  = true;
+                    pending.pop_back();
+                }
+                break;
+            }
+            pending.pop_back();
+
+            n_used    += n_reserve;
+            any_active = true;
+
+            common_params_sampling sparams = params.sampling;
+            if (sparams.seed != LLAMA_DEFAULT_SEED) {
+                // the result of a request does not depend on the scheduling
+                sparams.seed += req->index;
+            }
+
+            seq.req        = req;
+            seq.smpl       = common_sampler_init(model, sparams);
+            seq.n_past     = prefix.size();
+            seq.n_reserved = n_reserve;
+            seq.orphan     = false;
+
+            llama_memory_seq_rm(mem, seq.seq_id, -1, -1);
+            if (!prefix.empty()) {
+                llama_memory_seq_cp(mem, 0, seq.seq_id, -1, -1);
+            }
+
+            n_prompt_skip += prefix.size();
+        }
+
+        common_batch_clear(batch);
+
+        // one token for each generating sequence, then the prompts
+        for (auto & seq : seqs) {
+            seq.i_batch = -1;
+            if (seq.req == nullptr || seq.n_past < (int32_t) seq.req->tokens.size()) {
+                continue;
+            }
+
+            seq.i_batch = batch.n_tokens;
+            common_batch_add(batch, seq.sampled, seq.n_past++, { seq.seq_id }, true);
+        }
+
+        const int32_t n_gen_batch = batch.n_tokens;
+
+        for (auto & seq : seqs) {
+            if (seq.req == nullptr || seq.i_batch >= 0) {
+                continue;
+            }
+
+            const auto & tokens = seq.req->tokens;
+            while (seq.n_past < (int32_t) tokens.size() && batch.n_tokens < n_batch) {
+                const bool last = seq.n_past == (int32_t) tokens.size() - 1;
+                if (last) {
+                    seq.i_batch = batch.n_tokens;
+                }
+                common_batch_add(batch, tokens[seq.n_past], seq.n_past, { seq.seq_id }, last);
+                seq.n_past += 1;
+            }
+        }
+
+        if (batch.n_tokens > 0) {
+            const int ret = llama_decode(ctx, batch);
+            if (ret != 0) {
+                LOG_ERR("%s: failed to decode the batch, n_tokens = %d, ret = %d\n", __func__, batch.n_tokens, ret);
+                return 1;
+            }
+
+            n_decode      += 1;
+            n_prompt_eval += batch.n_tokens - n_gen_batch;
+            n_gen         += n_gen_batch;
+        }
+
+        for (auto & seq : seqs) {
+            if (seq.i_batch < 0) {
+                continue;
+            }
+
+            batch_request & req = *seq.req;
+
+            const llama_token id = common_sampler_sample(seq.smpl, ctx, seq.i_batch);
+
+            common_sampler_accept(seq.smpl, id, true);
+
+            req.n_decoded += 1;
+
+            seq.sampled = id;
+
+            req.stopped_eos = llama_vocab_is_eog(vocab, id);
+            if (!req.stopped_eos) {
+                req.content += common_token_to_piece(ctx, id);
+            }
+
+            if (req.stopped_eos || req.n_decoded >= req.n_predict) {
+                req.done = true;
+
+                llama_memory_seq_rm(mem, seq.seq_id, -1, -1);
+
+                common_sampler_free(seq.smpl);
+                seq.smpl       = nullptr;
+                seq.req        = nullptr;
+                seq.n_reserved = 0;
+
+                if (seq.orphan && --n_seq_orphan == 0) {
+                    n_orphan = 0;
+                }
+                seq.orphan = false;
+            }
+        }
+
+        // write the results in input order
+        const int64_t n_written_prev = n_written;
+        while (!reqs.empty() && reqs.front().done) {
+            const std::string res = request_result(reqs.front()).dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+            if (fwrite(res.data(), 1, res.size(), fout) != res.size()) {
+                // the partial last line is removed when resuming
+                LOG_ERR("%s: failed to write to '%s': %s\n", __func__, params.out_file.c_str(), strerror(errno));
+                fclose(fout);
+                return 1;
+            }
+
+            reqs.pop_front();
+            n_written += 1;
+        }
+        if (n_written != n_written_prev) {
+            if (fflush(fout) != 0) {
+                LOG_ERR("%s: failed to write to '%s': %s\n", __func__, params.out_file.c_str(), strerror(errno));
+                fclose(fout);
+                return 1;
+            }
+
+            if (n_written / 100 != n_written_prev / 100) {
+                const double t = (ggml_time_us() - t_main_start) / 1e6;
+                LOG_INF("%s: %" PRId64 " results, %.2f prompt t/s, %.2f gen t/s\n", __func__, n_written, n_prompt_eval / t, n_gen / t);
+            }
+        }
+
+        // nothing is running and the input is exhausted
+        if (batch.n_tokens == 0 && !any_active && pending.empty()) {
+            break;
+        }
+    }
+
+    const auto t_main_end = ggml_time_us();
+    const double t = (t_main_end - t_main_start) / 1e6;
+
+    if (fclose(fout) != 0) {
+        LOG_ERR("%s: failed to write to '%s': %s\n", __func__, params.out_file.c_str(), strerror(errno));
+        return 1;
+    }
+
+    LOG_INF("\n");
+    LOG_INF("%s: %" PRId64 " results written to '%s' in %.2f s\n", __func__, n_written - n_skip, params.out_file.c_str(), t);
+    LOG_INF("%s: prompt tokens: %" PRId64 " evaluated + %" PRId64 " shared, %.2f t/s\n", __func__, n_prompt_eval, n_prompt_skip, n_prompt_eval / t);
+    LOG_INF("%s: gen tokens:    %" PRId64 ", %.2f t/s\n", __func__, n_gen, n_gen / t);
+    LOG_INF("%s: decode calls:  %" PRId64 ", %.1f tokens per call\n", __func__, n_decode, n_decode > 0 ? (double) (n_prompt_eval + n_gen) / n_decode : 0.0);
+    LOG_INF("\n");
+
+    llama_perf_context_print(ctx);
+
+    llama_batch_free(batch);
+
+    llama_backend_free();
+
+    return 0;
+}
@@ -1,17 +1,24 @@
 #include "ggml.h"
+#include "ggml-cpp.h"
 #include "gguf.h"
 #include "llama.h"
 #include "common.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cinttypes>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <stdexcept>
 #include <cstring>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #if defined(_WIN32)
@@ -20,6 +27,14 @@
         #define PATH_MAX MAX_PATH
     #endif
     #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #if defined(__linux__)
+        #include <sys/syscall.h>
+    #endif
 #endif
 
 enum split_operation : uint8_t {
@@ -41,8 +56,10 @@ struct split_params {
     int n_split_tensors = 128;
     std::string input;
     std::string output;
+    int n_threads = 4;
     bool no_tensor_first_split = false;
     bool dry_run = false;
+    bool use_mmap = true;
 };
 
 static void split_print_usage(const char * executable) {
@@ -61,6 +78,8 @@ static void split_print_usage(const char * executable) {
     printf("  --split-max-size N(M|G) max size per split\n");
     printf("  --no-tensor-first-split do not add tensors to the first split (disabled by default)\n");
     printf("  --dry-run               only print out a split plan and exit, without writing any new files\n");
+    printf("  --threads N             number of splits copied in parallel (default: %d)\n", default_params.n_threads);
+    printf("  --no-mmap               do not memory-map the input files\n");
     printf("\n");
 }
 
@@ -106,6 +125,19 @@ static void split_params_parse_ex(int argc, const char ** argv, split_params & p
         } else if (arg == "--dry-run") {
             arg_found = true;
             params.dry_run = true;
+        } else if (arg == "--no-mmap") {
+            arg_found = true;
+            params.use_mmap = false;
+        } else if (arg == "--threads") {
+            if (++arg_idx >= argc) {
+                invalid_param = true;
+                break;
+            }
+            arg_found = true;
+            params.n_threads = atoi(argv[arg_idx]);
+            if (params.n_threads <= 0) {
+                throw std::invalid_argument("error: --threads must be a positive value");
+            }
         } else if (arg == "--no-tensor-first-split") {
             arg_found = true;
             params.no_tensor_first_split = true;
@@ -184,16 +216,259 @@ static bool split_params_parse(int argc, const char ** argv, split_params & para
     return result;
 }
 
-static void zeros(std::ofstream & file, size_t n) {
-    char zero = 0;
-    for (size_t i = 0; i < n; ++i) {
-        file.write(&zero, 1);
+// positional file I/O: every read and write names its own offset, so several threads can share one file
+struct split_file {
+    const uint8_t * addr = nullptr; // read-only mapping of the whole file, or nullptr
+    size_t size = 0;
+
+#if defined(_WIN32)
+    HANDLE hfile = INVALID_HANDLE_VALUE;
+    HANDLE hmap  = NULL;
+
+    split_file(const char * path, bool write, bool use_mmap = false) {
+        hfile = CreateFileA(path, write ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+                write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(string_format("failed to open %s: error %lu", path, GetLastError()));
+        }
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(hfile, &file_size);
+        size = (size_t) file_size.QuadPart;
+
+        if (!write && use_mmap && size > 0) {
+            hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (hmap != NULL) {
+                addr = (const uint8_t *) MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+                if (addr == nullptr) {
+                    CloseHandle(hmap);
+                    hmap = NULL;
+                }
+            }
+            if (addr == nullptr) {
+                fprintf(stderr, "warning: failed to mmap %s, falling back to buffered reads\n", path);
+            }
+        }
+    }
+
+    ~split_file() {
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+        if (hmap != NULL) {
+            CloseHandle(hmap);
+        }
+        CloseHandle(hfile);
+    }
+
+    void read_at(void * dst, size_t len, size_t offset) const {
+        while (len > 0) {
+            OVERLAPPED ov = {};
+            ov.Offset     = (DWORD) (offset & 0xffffffff);
+            ov.OffsetHigh = (DWORD) (offset >> 32);
+            DWORD n = 0;
+            if (!ReadFile(hfile, dst, (DWORD) std::min(len, (size_t) 1 << 30), &n, &ov) || n == 0) {
+                throw std::runtime_error(string_format("read error: error %lu", GetLastError()));
+            }
+            dst     = (uint8_t *) dst + n;
+            offset += n;
+            len    -= n;
+        }
+    }
+
+    void write_at(const void * src, size_t len, size_t offset) const {
+        while (len > 0) {
+            OVERLAPPED ov = {};
+            ov.Offset     = (DWORD) (offset & 0xffffffff);
+            ov.OffsetHigh = (DWORD) (offset >> 32);
+            DWORD n = 0;
+            if (!WriteFile(hfile, src, (DWORD) std::min(len, (size_t) 1 << 30), &n, &ov) || n == 0) {
+                throw std::runtime_error(string_format("write error: error %lu", GetLastError()));
+            }
+            src     = (const uint8_t *) src + n;
+            offset += n;
+            len    -= n;
+        }
+    }
+#else
+    int fd = -1;
+
+    split_file(const char * path, bool write, bool use_mmap = false) {
+        fd = write ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(string_format("failed to open %s: %s", path, strerror(errno)));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error(string_format("failed to stat %s: %s", path, strerror(errno)));
+        }
+        size = (size_t) st.st_size;
+
+        if (!write && use_mmap && size > 0) {
+            void * p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                fprintf(stderr, "warning: failed to mmap %s: %s, falling back to buffered reads\n", path, strerror(errno));
+            } else {
+                // every byte is read once, front to back
+                posix_madvise(p, size, POSIX_MADV_SEQUENTIAL);
+                addr = (const uint8_t *) p;
+            }
+        }
+    }
+
+    ~split_file() {
+        if (addr) {
+            munmap(const_cast<uint8_t *>(addr), size);
+        }
+        close(fd);
+    }
+
+    void read_at(void * dst, size_t len, size_t offset) const {
+        while (len > 0) {
+            ssize_t n = pread(fd, dst, len, (off_t) offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error(n == 0 ? "unexpected end of file" : string_format("read error: %s", strerror(errno)));
+            }
+            dst     = (uint8_t *) dst + n;
+            offset += n;
+            len    -= n;
+        }
+    }
+
+    void write_at(const void * src, size_t len, size_t offset) const {
+        while (len > 0) {
+            ssize_t n = pwrite(fd, src, len, (off_t) offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error(string_format("write error: %s", strerror(errno)));
+            }
+            src     = (const uint8_t *) src + n;
+            offset += n;
+            len    -= n;
+        }
+    }
+#endif
+
+    split_file(const split_file &) = delete;
+    split_file & operator=(const split_file &) = delete;
+};
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+// cleared on the first error that means copy_file_range cannot be used here (old kernel, cross-device, sandbox, ...)
+static std::atomic<bool> split_copy_range_ok{true};
+#endif
+
+// copy len bytes of in at in_off to out at out_off; buf is only used as a staging buffer when nothing better is available
+static void split_copy(const split_file & in, size_t in_off, const split_file & out, size_t out_off, size_t len, std::vector<uint8_t> & buf) {
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    // let the kernel move the data without a round trip through user space;
+    // filesystems with reflink support (btrfs, XFS, ...) share the extents instead of copying them
+    while (len > 0 && split_copy_range_ok.load(std::memory_order_relaxed)) {
+        loff_t off_in  = in_off;
+        loff_t off_out = out_off;
+        ssize_t n = syscall(__NR_copy_file_range, in.fd, &off_in, out.fd, &off_out, len, 0u);
+        if (n > 0) {
+            in_off  += n;
+            out_off += n;
+            len     -= n;
+            continue;
+        }
+        if (n == 0) {
+            break; // let the fallback below report the short input
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP && errno != EPERM && errno != EBADF) {
+            throw std::runtime_error(string_format("copy_file_range failed: %s", strerror(errno)));
+        }
+        split_copy_range_ok.store(false, std::memory_order_relaxed);
+    }
+#endif
+    if (len == 0) {
+        return;
+    }
+
+    if (in.addr) {
+        // write straight from the mapping, without staging
+        if (in_off + len > in.size) {
+            throw std::runtime_error("unexpected end of file");
+        }
+        out.write_at(in.addr + in_off, len, out_off);
+        return;
+    }
+
+    // bounded staging buffer, large tensors are copied in chunks
+    const size_t chunk = std::min(len, (size_t) 64*1024*1024);
+    if (buf.size() < chunk) {
+        buf.resize(chunk);
+    }
+    while (len > 0) {
+        const size_t n = std::min(len, chunk);
+        in.read_at(buf.data(), n, in_off);
+        out.write_at(buf.data(), n, out_off);
+        in_off  += n;
+        out_off += n;
+        len     -= n;
+    }
+}
+
+// copy one tensor and write the zero padding up to the next aligned offset
+static void split_copy_tensor(const split_file & in, size_t in_off, const split_file & out, size_t out_off, size_t n_bytes, std::vector<uint8_t> & buf) {
+    static const uint8_t zeros[GGUF_DEFAULT_ALIGNMENT] = {0};
+
+    split_copy(in, in_off, out, out_off, n_bytes, buf);
+
+    const size_t n_pad = GGML_PAD(n_bytes, GGUF_DEFAULT_ALIGNMENT) - n_bytes;
+    if (n_pad > 0) {
+        out.write_at(zeros, n_pad, out_off + n_bytes);
+    }
+}
+
+// run fn(i) for every i in [0, n) on up to n_threads threads, the calling thread included
+// the first exception thrown by fn is rethrown on the calling thread once all threads have stopped
+static void split_parallel_for(int n, int n_threads, const std::function<void(int)> & fn) {
+    std::atomic<int> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        for (int i = next++; i < n && !failed; i = next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < std::min(n, n_threads); ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
     }
 }
 
 struct split_strategy {
     const split_params params;
-    std::ifstream & f_input;
+    const split_file & f_input;
     struct gguf_context * ctx_gguf;
     struct ggml_context * ctx_meta = NULL;
     const int n_tensors;
@@ -201,11 +476,8 @@ struct split_strategy {
     // one ctx_out per one output file
     std::vector<struct gguf_context *> ctx_outs;
 
-    // temporary buffer for reading in tensor data
-    std::vector<uint8_t> read_buf;
-
     split_strategy(const split_params & params,
-            std::ifstream & f_input,
+            const split_file & f_input,
             struct gguf_context * ctx_gguf,
             struct ggml_context * ctx_meta) :
         params(params),
@@ -304,82 +576,71 @@ struct split_strategy {
     }
 
     void write() {
-        int i_split = 0;
-        int n_split = ctx_outs.size();
-        for (auto & ctx_out : ctx_outs) {
+        const int n_split = ctx_outs.size();
+        std::mutex log_mutex;
+
+        // the layout of every output file is already known, so the splits are written independently
+        split_parallel_for(n_split, params.n_threads, [&](int i_split) {
+            struct gguf_context * ctx_out = ctx_outs[i_split];
+
             // construct file path
             char split_path[PATH_MAX] = {0};
             llama_split_path(split_path, sizeof(split_path), params.output.c_str(), i_split, n_split);
 
-            // open the output file
-            printf("Writing file %s ... ", split_path);
-            fflush(stdout);
-            std::ofstream fout = std::ofstream(split_path, std::ios::binary);
-            fout.exceptions(std::ofstream::failbit); // fail fast on write errors
+            split_file fout(split_path, true);
 
             // write metadata
             std::vector<uint8_t> data(gguf_get_meta_size(ctx_out));
             gguf_get_meta_data(ctx_out, data.data());
-            fout.write((const char *)data.data(), data.size());
+            fout.write_at(data.data(), data.size(), 0);
 
             // write tensors
+            std::vector<uint8_t> buf;
             for (int i = 0; i < gguf_get_n_tensors(ctx_out); ++i) {
-                // read tensor meta and prepare buffer
                 const char * t_name = gguf_get_tensor_name(ctx_out, i);
                 struct ggml_tensor * t = ggml_get_tensor(ctx_meta, t_name);
                 auto n_bytes = ggml_nbytes(t);
-                read_buf.resize(n_bytes);
 
-                // calculate offset
+                // calculate offsets
                 auto i_tensor_in = gguf_find_tensor(ctx_gguf, t_name); // idx of tensor in the input file
-                auto offset = gguf_get_data_offset(ctx_gguf) + gguf_get_tensor_offset(ctx_gguf, i_tensor_in);
+                auto offset_in  = gguf_get_data_offset(ctx_gguf) + gguf_get_tensor_offset(ctx_gguf, i_tensor_in);
+                auto offset_out = data.size() + gguf_get_tensor_offset(ctx_out, i);
 
                 // copy tensor from input to output file
-                copy_file_to_file(f_input, fout, offset, n_bytes);
-                zeros(fout, GGML_PAD(n_bytes, GGUF_DEFAULT_ALIGNMENT) - n_bytes);
+                split_copy_tensor(f_input, offset_in, fout, offset_out, n_bytes, buf);
             }
 
-            printf("done\n");
-            // close the file
-            fout.close();
-            i_split++;
-        }
-    }
-
-    void copy_file_to_file(std::ifstream & f_in, std::ofstream & f_out, const size_t in_offset, const size_t len) {
-        // TODO: detect OS and use copy_file_range() here for better performance
-        if (read_buf.size() < len) {
-            read_buf.resize(len);
-        }
-        f_in.seekg(in_offset);
-        f_in.read((char *)read_buf.data(), len);
-        f_out.write((const char *)read_buf.data(), len);
+            std::lock_guard<std::mutex> lock(log_mutex);
+            printf("Writing file %s ... done\n", split_path);
+            fflush(stdout);
+        });
     }
 };
 
 static void gguf_split(const split_params & split_params) {
     struct ggml_context * ctx_meta = NULL;
+    int n_split   = 0;
+    int n_tensors = 0;
 
     struct gguf_init_params params = {
         /*.no_alloc = */ true,
         /*.ctx      = */ &ctx_meta,
     };
 
-    std::ifstream f_input(split_params.input.c_str(), std::ios::binary);
-    if (!f_input.is_open()) {
-        fprintf(stderr, "%s:  failed to open input GGUF from %s\n", __func__, split_params.input.c_str());
-        exit(EXIT_FAILURE);
-    }
-
-    auto * ctx_gguf = gguf_init_from_file(split_params.input.c_str(), params);
+    gguf_context_ptr ctx_gguf(gguf_init_from_file(split_params.input.c_str(), params));
     if (!ctx_gguf) {
         fprintf(stderr, "%s:  failed to load input GGUF from %s\n", __func__, split_params.input.c_str());
         exit(EXIT_FAILURE);
     }
+    ggml_context_ptr ctx_meta_ptr(ctx_meta);
+
+    // I/O errors are thrown to main, the contexts are freed on the way
+    split_file f_input(split_params.input.c_str(), false, split_params.use_mmap);
 
     // prepare the strategy
-    split_strategy strategy(split_params, f_input, ctx_gguf, ctx_meta);
-    int n_split = strategy.ctx_outs.size();
+    split_strategy strategy(split_params, f_input, ctx_gguf.get(), ctx_meta);
+    n_split   = strategy.ctx_outs.size();
+    n_tensors = strategy.n_tensors;
     strategy.print_info();
 
     if (!split_params.dry_run) {
@@ -387,12 +648,8 @@ static void gguf_split(const split_params & split_params) {
         strategy.write();
     }
 
-    // done, clean up
-    gguf_free(ctx_gguf);
-    f_input.close();
-
     fprintf(stderr, "%s: %d gguf split written with a total of %d tensors.\n",
-            __func__, n_split, strategy.n_tensors);
+            __func__, n_split, n_tensors);
 }
 
 static void gguf_merge(const split_params & split_params) {
@@ -411,7 +668,6 @@ static void gguf_merge(const split_params & split_params) {
 
     auto * ctx_out = gguf_init_empty();
 
-    std::vector<uint8_t> read_data;
     std::vector<ggml_context *> ctx_metas;
     std::vector<gguf_context *> ctx_ggufs;
 
@@ -495,70 +751,62 @@ static void gguf_merge(const split_params & split_params) {
 
         fprintf(stderr, "\033[3Ddone\n");
     }
-    std::ofstream fout;
     if (!split_params.dry_run) {
-        fout.open(split_params.output.c_str(), std::ios::binary);
-        fout.exceptions(std::ofstream::failbit); // fail fast on write errors
-        // placeholder for the meta data
-        auto meta_size = gguf_get_meta_size(ctx_out);
-        ::zeros(fout, meta_size);
-    }
+        // the offset of every tensor in the output is already known, so the splits are copied independently
+        std::vector<int> i_tensor_first(n_split, 0);
+        for (int i_split = 1; i_split < n_split; i_split++) {
+            i_tensor_first[i_split] = i_tensor_first[i_split - 1] + gguf_get_n_tensors(ctx_ggufs[i_split - 1]);
+        }
 
-    // Write tensors data
-    for (int i_split = 0; i_split < n_split; i_split++) {
-        llama_split_path(split_path, sizeof(split_path), split_prefix, i_split, n_split);
-        std::ifstream f_input(split_path, std::ios::binary);
-        if (!f_input.is_open()) {
-            fprintf(stderr, "%s:  failed to open input GGUF from %s\n", __func__, split_path);
+        try {
+            split_file fout(split_params.output.c_str(), true);
+
+            // write metadata
+            std::vector<uint8_t> data(gguf_get_meta_size(ctx_out));
+            gguf_get_meta_data(ctx_out, data.data());
+            fout.write_at(data.data(), data.size(), 0);
+
+            // write tensors data
+            std::mutex log_mutex;
+            split_parallel_for(n_split, split_params.n_threads, [&](int i_split) {
+                char split_path_in[PATH_MAX] = {0};
+                llama_split_path(split_path_in, sizeof(split_path_in), split_prefix, i_split, n_split);
+                split_file f_input(split_path_in, false, split_params.use_mmap);
+
+                auto * ctx_gguf = ctx_ggufs[i_split];
+                auto * ctx_meta = ctx_metas[i_split];
+
+                std::vector<uint8_t> buf;
+                auto n_tensors = gguf_get_n_tensors(ctx_gguf);
+                for (int i_tensor = 0; i_tensor < n_tensors; i_tensor++) {
+                    const char * t_name = gguf_get_tensor_name(ctx_gguf, i_tensor);
+                    struct ggml_tensor * t = ggml_get_tensor(ctx_meta, t_name);
+
+                    auto n_bytes    = ggml_nbytes(t);
+                    auto offset_in  = gguf_get_data_offset(ctx_gguf) + gguf_get_tensor_offset(ctx_gguf, i_tensor);
+                    auto offset_out = data.size() + gguf_get_tensor_offset(ctx_out, i_tensor_first[i_split] + i_tensor);
+
+                    // write tensor data + padding
+                    split_copy_tensor(f_input, offset_in, fout, offset_out, n_bytes, buf);
+                }
+
+                std::lock_guard<std::mutex> lock(log_mutex);
+                fprintf(stderr, "gguf_merge: writing tensors %s ... done\n", split_path_in);
+            });
+        } catch (const std::exception & e) {
+            fprintf(stderr, "%s: %s\n", __func__, e.what());
             for (uint32_t i = 0; i < ctx_ggufs.size(); i++) {
                 gguf_free(ctx_ggufs[i]);
                 ggml_free(ctx_metas[i]);
             }
             gguf_free(ctx_out);
-            if (!split_params.dry_run) {
-                fout.close();
-            }
             exit(EXIT_FAILURE);
         }
-        fprintf(stderr, "%s: writing tensors %s ...", __func__, split_path);
-
-        auto * ctx_gguf = ctx_ggufs[i_split];
-        auto * ctx_meta = ctx_metas[i_split];
-
-        auto n_tensors = gguf_get_n_tensors(ctx_gguf);
-        for (int i_tensor = 0; i_tensor < n_tensors; i_tensor++) {
-            const char * t_name = gguf_get_tensor_name(ctx_gguf, i_tensor);
-            struct ggml_tensor * t = ggml_get_tensor(ctx_meta, t_name);
-
-            auto n_bytes = ggml_nbytes(t);
-
-            if (read_data.size() < n_bytes) {
-                read_data.resize(n_bytes);
-            }
-
-            auto offset = gguf_get_data_offset(ctx_gguf) + gguf_get_tensor_offset(ctx_gguf, i_tensor);
-            f_input.seekg(offset);
-            f_input.read((char *)read_data.data(), n_bytes);
-            if (!split_params.dry_run) {
-                // write tensor data + padding
-                fout.write((const char *)read_data.data(), n_bytes);
-                zeros(fout, GGML_PAD(n_bytes, GGUF_DEFAULT_ALIGNMENT) - n_bytes);
-            }
-        }
-
-        gguf_free(ctx_gguf);
-        ggml_free(ctx_meta);
-        f_input.close();
-        fprintf(stderr, "\033[3Ddone\n");
     }
 
-    if (!split_params.dry_run) {
-        // go back to beginning of file and write the updated metadata
-        fout.seekp(0);
-        std::vector<uint8_t> data(gguf_get_meta_size(ctx_out));
-        gguf_get_meta_data(ctx_out, data.data());
-        fout.write((const char *)data.data(), data.size());
-        fout.close();
+    for (uint32_t i = 0; i < ctx_ggufs.size(); i++) {
+        gguf_free(ctx_ggufs[i]);
+        ggml_free(ctx_metas[i]);
     }
     gguf_free(ctx_out);
 
@@ -570,13 +818,18 @@ int main(int argc, const char ** argv) {
     split_params params;
     split_params_parse(argc, argv, params);
 
-    switch (params.operation) {
-        case OP_SPLIT: gguf_split(params);
-            break;
-        case OP_MERGE: gguf_merge(params);
-            break;
-        default: split_print_usage(argv[0]);
-            exit(EXIT_FAILURE);
+    try {
+        switch (params.operation) {
+            case OP_SPLIT: gguf_split(params);
+                break;
+            case OP_MERGE: gguf_merge(params);
+                break;
+            default: split_print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    } catch (const std::exception & e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return EXIT_FAILURE;
     }
 
     return 0;
@@ -9,9 +9,12 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <functional>
+#include <fstream>
 #include <iterator>
 #include <map>
 #include <numeric>
+#include <random>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -111,6 +114,17 @@ template <typename T> static T stdev(const std::vector<T> & v) {
     return stdev;
 }
 
+// nearest-rank percentile, p in [0, 100]
+template <typename T> static T percentile(std::vector<T> v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t k = (size_t) std::ceil(p / 100.0 * v.size());
+    k        = std::min(std::max(k, (size_t) 1), v.size()) - 1;
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
 static std::string get_cpu_info() {
     std::vector<std::string> cpu_list;
     for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
@@ -235,12 +249,66 @@ static std::vector<int> parse_int_range(const std::string & s) {
     return result;
 }
 
+// a request of a serving test, lengths are in tokens
+struct serve_request {
+    uint64_t t_arrival_ns; // relative to the start of the test
+    int      n_prompt;     // including the shared prefix
+    int      n_gen;
+    int      n_prefix;     // leading prompt tokens shared by all requests
+};
+
+// recorded trace: one request per line, "<arrival ms> <n_prompt> <n_gen> [<n_prefix>]", '#' starts a comment
+static std::vector<serve_request> load_serve_trace(const std::string & fname) {
+    std::ifstream file(fname);
+    if (!file) {
+        throw std::runtime_error("failed to open trace file: " + fname);
+    }
+
+    std::vector<serve_request> requests;
+    std::string                line;
+    int                        n_line = 0;
+    while (std::getline(file, line)) {
+        n_line++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        std::istringstream ss(line);
+        double             t_ms     = 0.0;
+        int                n_prompt = 0;
+        int                n_gen    = 0;
+        int                n_prefix = 0;
+        if (!(ss >> t_ms >> n_prompt >> n_gen) || t_ms < 0.0 || n_prompt < 1 || n_gen < 1) {
+            throw std::runtime_error(string_format("%s:%d: invalid request", fname.c_str(), n_line));
+        }
+        if (ss >> n_prefix && (n_prefix < 0 || n_prefix >= n_prompt)) {
+            throw std::runtime_error(string_format("%s:%d: the shared prefix must be shorter than the prompt", fname.c_str(), n_line));
+        }
+        requests.push_back({ (uint64_t) (t_ms * 1e6), n_prompt, n_gen, n_prefix });
+    }
+    if (requests.empty()) {
+        throw std::runtime_error("empty trace file: " + fname);
+    }
+
+    std::stable_sort(requests.begin(), requests.end(), [](const serve_request & a, const serve_request & b) {
+        return a.t_arrival_ns < b.t_arrival_ns;
+    });
+    return requests;
+}
+
 struct cmd_params {
     std::vector<std::string>         model;
     std::vector<int>                 n_prompt;
     std::vector<int>                 n_gen;
     std::vector<std::pair<int, int>> n_pg;
     std::vector<int>                 n_depth;
+    std::vector<int>                 n_serve;
+    std::vector<float>               serve_rate;
+    std::vector<std::pair<int, int>> serve_pg;
+    std::vector<int>                 serve_prefix;
+    std::vector<int>                 n_parallel;
+    std::string                      serve_trace;
+    std::vector<serve_request>       serve_requests;
     std::vector<int>                 n_batch;
     std::vector<int>                 n_ubatch;
     std::vector<ggml_type>           type_k;
@@ -278,6 +346,13 @@ static const cmd_params cmd_params_defaults = {
     /* n_gen                */ { 128 },
     /* n_pg                 */ {},
     /* n_depth              */ { 0 },
+    /* n_serve              */ {},
+    /* serve_rate           */ { 0.0f },
+    /* serve_pg             */ { { 512, 128 } },
+    /* serve_prefix         */ { 0 },
+    /* n_parallel           */ { 4 },
+    /* serve_trace          */ "",
+    /* serve_requests       */ {},
     /* n_batch              */ { 2048 },
     /* n_ubatch             */ { 512 },
     /* type_k               */ { GGML_TYPE_F16 },
@@ -338,6 +413,16 @@ static void print_usage(int /* argc */, char ** argv) {
            join(transform_to_str(cmd_params_defaults.n_pg, pair_str), ",").c_str());
     printf("  -d, --n-depth <n>                         (default: %s)\n",
            join(cmd_params_defaults.n_depth, ",").c_str());
+    printf("  -sv, --serve <n>                          (default: %s)\n", join(cmd_params_defaults.n_serve, ",").c_str());
+    printf("  --serve-rate <f>                          (default: %s)\n",
+           join(cmd_params_defaults.serve_rate, ",").c_str());
+    printf("  --serve-pg <pp,tg>                        (default: %s)\n",
+           join(transform_to_str(cmd_params_defaults.serve_pg, pair_str), ",").c_str());
+    printf("  --serve-prefix <n>                        (default: %s)\n",
+           join(cmd_params_defaults.serve_prefix, ",").c_str());
+    printf("  --serve-trace <filename>                  (default: none)\n");
+    printf("  -np, --n-parallel <n>                     (default: %s)\n",
+           join(cmd_params_defaults.n_parallel, ",").c_str());
     printf("  -b, --batch-size <n>                      (default: %s)\n",
            join(cmd_params_defaults.n_batch, ",").c_str());
     printf("  -ub, --ubatch-size <n>                    (default: %s)\n",
@@ -479,6 +564,52 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                 }
                 auto p = parse_int_range(argv[i]);
                 params.n_depth.insert(params.n_depth.end(), p.begin(), p.end());
+            } else if (arg == "-sv" || arg == "--serve") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = parse_int_range(argv[i]);
+                params.n_serve.insert(params.n_serve.end(), p.begin(), p.end());
+            } else if (arg == "--serve-rate") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = string_split<float>(argv[i], split_delim);
+                params.serve_rate.insert(params.serve_rate.end(), p.begin(), p.end());
+            } else if (arg == "--serve-pg") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = string_split<std::string>(argv[i], ',');
+                if (p.size() != 2) {
+                    invalid_param = true;
+                    break;
+                }
+                params.serve_pg.push_back({ std::stoi(p[0]), std::stoi(p[1]) });
+            } else if (arg == "--serve-prefix") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = parse_int_range(argv[i]);
+                params.serve_prefix.insert(params.serve_prefix.end(), p.begin(), p.end());
+            } else if (arg == "--serve-trace") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                params.serve_trace    = argv[i];
+                params.serve_requests = load_serve_trace(params.serve_trace);
+            } else if (arg == "-np" || arg == "--n-parallel") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = parse_int_range(argv[i]);
+                params.n_parallel.insert(params.n_parallel.end(), p.begin(), p.end());
             } else if (arg == "-b" || arg == "--batch-size") {
                 if (++i >= argc) {
                     invalid_param = true;
@@ -837,6 +968,18 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     if (params.n_depth.empty()) {
         params.n_depth = cmd_params_defaults.n_depth;
     }
+    if (params.serve_rate.empty()) {
+        params.serve_rate = cmd_params_defaults.serve_rate;
+    }
+    if (params.serve_pg.empty()) {
+        params.serve_pg = cmd_params_defaults.serve_pg;
+    }
+    if (params.serve_prefix.empty()) {
+        params.serve_prefix = cmd_params_defaults.serve_prefix;
+    }
+    if (params.n_parallel.empty()) {
+        params.n_parallel = cmd_params_defaults.n_parallel;
+    }
     if (params.n_batch.empty()) {
         params.n_batch = cmd_params_defaults.n_batch;
     }
@@ -906,6 +1049,10 @@ struct cmd_params_instance {
     int                n_prompt;
     int                n_gen;
     int                n_depth;
+    int                n_parallel;
+    int                n_serve;
+    float              serve_rate;
+    int                n_prefix;
     int                n_batch;
     int                n_ubatch;
     ggml_type          type_k;
@@ -1014,6 +1161,12 @@ struct cmd_params_instance {
         cparams.op_offload   = !no_op_offload;
         cparams.swa_full     = false;
 
+        if (n_serve > 0) {
+            // one sequence per slot plus one holding the shared prefix, the prefix cells are shared with the slots
+            cparams.n_seq_max  = n_parallel + 1;
+            cparams.kv_unified = true;
+        }
+
         return cparams;
     }
 };
@@ -1021,6 +1174,47 @@ struct cmd_params_instance {
 static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_params & params) {
     std::vector<cmd_params_instance> instances;
 
+    struct serve_spec {
+        int   n_serve;
+        float rate;
+        int   n_prompt;
+        int   n_gen;
+        int   n_prefix;
+    };
+
+    std::vector<serve_spec> serve_specs;
+    if (!params.serve_requests.empty()) {
+        // recorded trace: report the mean request shape and the mean arrival rate
+        const auto & reqs     = params.serve_requests;
+        const int    n_reqs   = reqs.size();
+        double       n_prompt = 0.0;
+        double       n_gen    = 0.0;
+        double       n_prefix = 0.0;
+        for (const auto & r : reqs) {
+            n_prompt += r.n_prompt;
+            n_gen    += r.n_gen;
+            n_prefix += r.n_prefix;
+        }
+        const double t_span = reqs.back().t_arrival_ns / 1e9;
+        serve_specs.push_back({ n_reqs, t_span > 0.0 ? (float) ((n_reqs - 1) / t_span) : 0.0f,
+                                (int) std::lround(n_prompt / n_reqs), (int) std::lround(n_gen / n_reqs),
+                                (int) std::lround(n_prefix / n_reqs) });
+    } else {
+        // clang-format off
+        for (const auto & n_serve : params.n_serve)
+        for (const auto & rate : params.serve_rate)
+        for (const auto & spg : params.serve_pg)
+        for (const auto & prefix : params.serve_prefix) {
+            if (n_serve <= 0 || spg.first <= 0 || spg.second <= 0) {
+                continue;
+            }
+            // the prefix must leave at least one prompt token to process in the shortest prompt
+            const int n_prefix = std::max(0, std::min(prefix, std::max(1, spg.first / 2) - 1));
+            serve_specs.push_back({ n_serve, rate, spg.first, spg.second, n_prefix });
+        }
+        // clang-format on
+    }
+
     // this ordering minimizes the number of times that each model needs to be reloaded
     // clang-format off
     for (const auto & m : params.model)
@@ -1054,6 +1248,10 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .n_prompt     = */ n_prompt,
                 /* .n_gen        = */ 0,
                 /* .n_depth      = */ nd,
+                /* .n_parallel   = */ 1,
+                /* .n_serve      = */ 0,
+                /* .serve_rate   = */ 0.0f,
+                /* .n_prefix     = */ 0,
                 /* .n_batch      = */ nb,
                 /* .n_ubatch     = */ nub,
                 /* .type_k       = */ tk,
@@ -1087,6 +1285,10 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .n_prompt     = */ 0,
                 /* .n_gen        = */ n_gen,
                 /* .n_depth      = */ nd,
+                /* .n_parallel   = */ 1,
+                /* .n_serve      = */ 0,
+                /* .serve_rate   = */ 0.0f,
+                /* .n_prefix     = */ 0,
                 /* .n_batch      = */ nb,
                 /* .n_ubatch     = */ nub,
                 /* .type_k       = */ tk,
@@ -1120,6 +1322,53 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .n_prompt     = */ n_pg.first,
                 /* .n_gen        = */ n_pg.second,
                 /* .n_depth      = */ nd,
+                /* .n_parallel   = */ 1,
+                /* .n_serve      = */ 0,
+                /* .serve_rate   = */ 0.0f,
+                /* .n_prefix     = */ 0,
+                /* .n_batch      = */ nb,
+                /* .n_ubatch     = */ nub,
+                /* .type_k       = */ tk,
+                /* .type_v       = */ tv,
+                /* .defrag_thold = */ defrag_thold,
+                /* .n_threads    = */ nt,
+                /* .cpu_mask     = */ cm,
+                /* .cpu_strict   = */ cs,
+                /* .poll         = */ pl,
+                /* .n_gpu_layers = */ nl,
+                /* .rpc_servers  = */ rpc,
+                /* .split_mode   = */ sm,
+                /* .main_gpu     = */ mg,
+                /* .no_kv_offload= */ nkvo,
+                /* .flash_attn   = */ fa,
+                /* .tensor_split = */ ts,
+                /* .tensor_buft_overrides = */ ot,
+                /* .use_mmap     = */ mmp,
+                /* .embeddings   = */ embd,
+                /* .no_op_offload= */ nopo,
+            };
+            instances.push_back(instance);
+        }
+
+        // serving tests do not use the context depth, add them only once
+        if (nd != params.n_depth.front()) {
+            continue;
+        }
+
+        for (const auto & np : params.n_parallel)
+        for (const auto & spec : serve_specs) {
+            if (np <= 0) {
+                continue;
+            }
+            cmd_params_instance instance = {
+                /* .model        = */ m,
+                /* .n_prompt     = */ spec.n_prompt,
+                /* .n_gen        = */ spec.n_gen,
+                /* .n_depth      = */ 0,
+                /* .n_parallel   = */ np,
+                /* .n_serve      = */ spec.n_serve,
+                /* .serve_rate   = */ spec.rate,
+                /* .n_prefix     = */ spec.n_prefix,
                 /* .n_batch      = */ nb,
                 /* .n_ubatch     = */ nub,
                 /* .type_k       = */ tk,
@@ -1180,8 +1429,15 @@ struct test {
     int                      n_prompt;
     int                      n_gen;
     int                      n_depth;
+    int                      n_parallel;
+    int                      n_serve;
+    float                    serve_rate;
+    int                      n_prefix;
+    int64_t                  n_serve_tokens = 0;
     std::string              test_time;
     std::vector<uint64_t>    samples_ns;
+    std::vector<uint64_t>    ttft_ns; // serving tests: time to first token of every request
+    std::vector<uint64_t>    itl_ns;  // serving tests: time between consecutive tokens of a request
 
     test(const cmd_params_instance & inst, const llama_model * lmodel, const llama_context * ctx) :
         cpu_info(get_cpu_info()),
@@ -1215,6 +1471,10 @@ struct test {
         n_prompt       = inst.n_prompt;
         n_gen          = inst.n_gen;
         n_depth        = inst.n_depth;
+        n_parallel     = inst.n_parallel;
+        n_serve        = inst.n_serve;
+        serve_rate     = inst.serve_rate;
+        n_prefix       = inst.n_prefix;
         // RFC 3339 date-time format
         time_t t       = time(NULL);
         std::strftime(buf, sizeof(buf), "%FT%TZ", gmtime(&t));
@@ -1228,7 +1488,8 @@ struct test {
     uint64_t stdev_ns() const { return ::stdev(samples_ns); }
 
     std::vector<double> get_ts() const {
-        int                 n_tokens = n_prompt + n_gen;
+        // serving tests count every prompt token that was not cached and every generated token
+        int64_t             n_tokens = n_serve > 0 ? n_serve_tokens : n_prompt + n_gen;
         std::vector<double> ts;
         std::transform(samples_ns.begin(), samples_ns.end(), std::back_inserter(ts),
                        [n_tokens](uint64_t t) { return 1e9 * n_tokens / t; });
@@ -1251,7 +1512,7 @@ struct test {
         return backends.empty() ? "CPU" : join(backends, ",");
     }
 
-    static const std::vector<std::string> & get_fields() {
+    static const std::vector<std::string> & get_fields(bool serve) {
         static const std::vector<std::string> fields = {
             "build_commit", "build_number", "cpu_info",       "gpu_info",   "backends",     "model_filename",
             "model_type",   "model_size",   "model_n_params", "n_batch",    "n_ubatch",     "n_threads",
@@ -1261,7 +1522,16 @@ struct test {
             "use_mmap",     "embeddings",   "no_op_offload",   "n_prompt",       "n_gen",      "n_depth",      "test_time",
             "avg_ns",       "stddev_ns",    "avg_ts",         "stddev_ts",
         };
-        return fields;
+        // the serving fields are only added when serving tests are run, after the other fields
+        static const std::vector<std::string> fields_serve = [] {
+            std::vector<std::string> f = fields;
+            f.insert(f.end(), {
+                "n_parallel",   "n_serve",      "serve_rate",     "n_prefix",
+                "ttft_p50_ms",  "ttft_p99_ms",  "itl_p50_ms",     "itl_p99_ms",
+            });
+            return f;
+        }();
+        return serve ? fields_serve : fields;
     }
 
     enum field_type { STRING, BOOL, INT, FLOAT };
@@ -1270,6 +1540,7 @@ struct test {
         if (field == "build_number" || field == "n_batch" || field == "n_ubatch" || field == "n_threads" ||
             field == "poll" || field == "model_size" || field == "model_n_params" || field == "n_gpu_layers" ||
             field == "main_gpu" || field == "n_prompt" || field == "n_gen" || field == "n_depth" ||
+            field == "n_parallel" || field == "n_serve" || field == "n_prefix" ||
             field == "avg_ns" || field == "stddev_ns" || field == "no_op_offload") {
             return INT;
         }
@@ -1277,13 +1548,14 @@ struct test {
             field == "use_mmap" || field == "embeddings") {
             return BOOL;
         }
-        if (field == "avg_ts" || field == "stddev_ts" || field == "defrag_thold") {
+        if (field == "avg_ts" || field == "stddev_ts" || field == "defrag_thold" || field == "serve_rate" ||
+            field == "ttft_p50_ms" || field == "ttft_p99_ms" || field == "itl_p50_ms" || field == "itl_p99_ms") {
             return FLOAT;
         }
         return STRING;
     }
 
-    std::vector<std::string> get_values() const {
+    std::vector<std::string> get_values(bool serve) const {
         std::string tensor_split_str;
         std::string tensor_buft_overrides_str;
         int         max_nonzero = 0;
@@ -1356,13 +1628,23 @@ struct test {
                                             std::to_string(stdev_ns()),
                                             std::to_string(avg_ts()),
                                             std::to_string(stdev_ts()) };
+        if (serve) {
+            values.insert(values.end(), { std::to_string(n_parallel),
+                                          std::to_string(n_serve),
+                                          std::to_string(serve_rate),
+                                          std::to_string(n_prefix),
+                                          std::to_string(percentile(ttft_ns, 50) / 1e6),
+                                          std::to_string(percentile(ttft_ns, 99) / 1e6),
+                                          std::to_string(percentile(itl_ns, 50) / 1e6),
+                                          std::to_string(percentile(itl_ns, 99) / 1e6) });
+        }
         return values;
     }
 
     std::map<std::string, std::string> get_map() const {
         std::map<std::string, std::string> map;
-        auto                               fields = get_fields();
-        auto                               values = get_values();
+        auto                               fields = get_fields(true);
+        auto                               values = get_values(true);
         std::transform(fields.begin(), fields.end(), values.begin(), std::inserter(map, map.end()),
                        std::make_pair<const std::string &, const std::string &>);
         return map;
@@ -1376,6 +1658,7 @@ struct printer {
     virtual ~printer() {}
 
     FILE * fout;
+    bool   serve = false; // print the serving fields
 
     virtual void print_header(const cmd_params & params) { (void) params; }
 
@@ -1398,13 +1681,13 @@ struct csv_printer : public printer {
     }
 
     void print_header(const cmd_params & params) override {
-        std::vector<std::string> fields = test::get_fields();
+        std::vector<std::string> fields = test::get_fields(serve);
         fprintf(fout, "%s\n", join(fields, ",").c_str());
         (void) params;
     }
 
     void print_test(const test & t) override {
-        std::vector<std::string> values = t.get_values();
+        std::vector<std::string> values = t.get_values(serve);
         std::transform(values.begin(), values.end(), values.begin(), escape_csv);
         fprintf(fout, "%s\n", join(values, ",").c_str());
     }
@@ -1462,7 +1745,7 @@ struct json_printer : public printer {
             fprintf(fout, ",\n");
         }
         fprintf(fout, "  {\n");
-        print_fields(test::get_fields(), t.get_values());
+        print_fields(test::get_fields(serve), t.get_values(serve));
         fprintf(fout, "    \"samples_ns\": [ %s ],\n", join(t.samples_ns, ", ").c_str());
         fprintf(fout, "    \"samples_ts\": [ %s ]\n", join(t.get_ts(), ", ").c_str());
         fprintf(fout, "  }");
@@ -1482,7 +1765,7 @@ struct jsonl_printer : public printer {
 
     void print_test(const test & t) override {
         fprintf(fout, "{");
-        print_fields(test::get_fields(), t.get_values());
+        print_fields(test::get_fields(serve), t.get_values(serve));
         fprintf(fout, "\"samples_ns\": [ %s ],", join(t.samples_ns, ", ").c_str());
         fprintf(fout, "\"samples_ts\": [ %s ]", join(t.get_ts(), ", ").c_str());
         fprintf(fout, "}\n");
@@ -1533,6 +1816,9 @@ struct markdown_printer : public printer {
         if (field == "no_op_offload") {
             return 4;
         }
+        if (field == "ttft" || field == "itl") {
+            return 17;
+        }
 
         int width = std::max((int) field.length(), 10);
 
@@ -1573,6 +1859,12 @@ struct markdown_printer : public printer {
         if (field == "tensor_buft_overrides") {
             return "ot";
         }
+        if (field == "ttft") {
+            return "ttft p50/p99 ms";
+        }
+        if (field == "itl") {
+            return "itl p50/p99 ms";
+        }
         return field;
     }
 
@@ -1643,6 +1935,10 @@ struct markdown_printer : public printer {
         }
         fields.emplace_back("test");
         fields.emplace_back("t/s");
+        if (serve) {
+            fields.emplace_back("ttft");
+            fields.emplace_back("itl");
+        }
 
         fprintf(fout, "|");
         for (const auto & field : fields) {
@@ -1683,7 +1979,17 @@ struct markdown_printer : public printer {
             } else if (field == "backend") {
                 value = test::get_backend();
             } else if (field == "test") {
-                if (t.n_prompt > 0 && t.n_gen == 0) {
+                if (t.n_serve > 0) {
+                    snprintf(buf, sizeof(buf), "sv%d np%d", t.n_serve, t.n_parallel);
+                    if (t.serve_rate > 0.0f) {
+                        int len = strlen(buf);
+                        snprintf(buf + len, sizeof(buf) - len, " @ %.3gr/s", t.serve_rate);
+                    }
+                    if (t.n_prefix > 0) {
+                        int len = strlen(buf);
+                        snprintf(buf + len, sizeof(buf) - len, " pfx%d", t.n_prefix);
+                    }
+                } else if (t.n_prompt > 0 && t.n_gen == 0) {
                     snprintf(buf, sizeof(buf), "pp%d", t.n_prompt);
                 } else if (t.n_gen > 0 && t.n_prompt == 0) {
                     snprintf(buf, sizeof(buf), "tg%d", t.n_gen);
@@ -1698,6 +2004,12 @@ struct markdown_printer : public printer {
             } else if (field == "t/s") {
                 snprintf(buf, sizeof(buf), "%.2f ± %.2f", t.avg_ts(), t.stdev_ts());
                 value = buf;
+            } else if (field == "ttft" || field == "itl") {
+                if (t.n_serve > 0) {
+                    const auto & v = field == "ttft" ? t.ttft_ns : t.itl_ns;
+                    snprintf(buf, sizeof(buf), "%.2f / %.2f", percentile(v, 50) / 1e6, percentile(v, 99) / 1e6);
+                    value = buf;
+                }
             } else if (vmap.find(field) != vmap.end()) {
                 value = vmap.at(field);
             } else {
@@ -1737,7 +2049,7 @@ struct sql_printer : public printer {
     }
 
     void print_header(const cmd_params & params) override {
-        std::vector<std::string> fields = test::get_fields();
+        std::vector<std::string> fields = test::get_fields(serve);
         fprintf(fout, "CREATE TABLE IF NOT EXISTS llama_bench (\n");
         for (size_t i = 0; i < fields.size(); i++) {
             fprintf(fout, "  %s %s%s\n", fields.at(i).c_str(), get_sql_field_type(fields.at(i)).c_str(),
@@ -1749,9 +2061,9 @@ struct sql_printer : public printer {
     }
 
     void print_test(const test & t) override {
-        fprintf(fout, "INSERT INTO llama_bench (%s) ", join(test::get_fields(), ", ").c_str());
+        fprintf(fout, "INSERT INTO llama_bench (%s) ", join(test::get_fields(serve), ", ").c_str());
         fprintf(fout, "VALUES (");
-        std::vector<std::string> values = t.get_values();
+        std::vector<std::string> values = t.get_values(serve);
         for (size_t i = 0; i < values.size(); i++) {
             fprintf(fout, "'%s'%s", values.at(i).c_str(), i < values.size() - 1 ? ", " : "");
         }
@@ -1809,6 +2121,199 @@ static bool test_gen(llama_context * ctx, int n_gen, int n_threads) {
     return true;
 }
 
+// synthetic trace: Poisson arrivals at the given rate (all at once if 0), lengths uniform in [x/2, 3x/2]
+static std::vector<serve_request> get_serve_requests(const cmd_params & params, const cmd_params_instance & inst) {
+    if (!params.serve_requests.empty()) {
+        return params.serve_requests;
+    }
+
+    std::mt19937                           rng(42);
+    std::exponential_distribution<double>  dist_gap(inst.serve_rate > 0.0f ? inst.serve_rate : 1.0f);
+    std::uniform_int_distribution<int>     dist_prompt(std::max(1, inst.n_prompt / 2), inst.n_prompt + inst.n_prompt / 2);
+    std::uniform_int_distribution<int>     dist_gen(std::max(1, inst.n_gen / 2), inst.n_gen + inst.n_gen / 2);
+
+    std::vector<serve_request> requests;
+    double                     t_arrival = 0.0;
+    for (int i = 0; i < inst.n_serve; i++) {
+        if (inst.serve_rate > 0.0f && i > 0) {
+            t_arrival += dist_gap(rng);
+        }
+        const int n_prompt = dist_prompt(rng);
+        const int n_gen    = dist_gen(rng);
+        requests.push_back({ (uint64_t) (t_arrival * 1e9), n_prompt, n_gen, inst.n_prefix });
+    }
+    return requests;
+}
+
+// KV cells needed when the n_parallel longest requests run together, the prefix cells are shared
+static uint32_t get_serve_n_ctx(const std::vector<serve_request> & requests, int n_parallel) {
+    std::vector<int> n_cells;
+    int              n_prefix = 0;
+    for (const auto & r : requests) {
+        n_cells.push_back(r.n_prompt - r.n_prefix + r.n_gen);
+        n_prefix = std::max(n_prefix, r.n_prefix);
+    }
+    std::sort(n_cells.begin(), n_cells.end(), std::greater<int>());
+    n_cells.resize(std::min<size_t>(n_cells.size(), n_parallel));
+    return std::accumulate(n_cells.begin(), n_cells.end(), n_prefix);
+}
+
+// decode the longest shared prefix into sequence n_parallel, requests copy the part they use
+static bool test_serve_prefix(llama_context * ctx, const std::vector<serve_request> & requests, int n_parallel,
+                              int n_batch, int n_threads) {
+    llama_set_n_threads(ctx, n_threads, n_threads);
+
+    const llama_model * model   = llama_get_model(ctx);
+    const llama_vocab * vocab   = llama_model_get_vocab(model);
+    const int32_t       n_vocab = llama_vocab_n_tokens(vocab);
+
+    int n_prefix = 0;
+    for (const auto & r : requests) {
+        n_prefix = std::max(n_prefix, r.n_prefix);
+    }
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    for (int i = 0; i < n_prefix; i += n_batch) {
+        common_batch_clear(batch);
+        for (int j = i; j < std::min(n_prefix, i + n_batch); j++) {
+            const llama_token token = j == 0 && llama_vocab_get_add_bos(vocab) ? llama_vocab_bos(vocab) : std::rand() % n_vocab;
+            common_batch_add(batch, token, j, { n_parallel }, false);
+        }
+        int res = llama_decode(ctx, batch);
+        if (res != 0) {
+            fprintf(stderr, "%s: failed to decode prefix batch, res = %d\n", __func__, res);
+            llama_batch_free(batch);
+            return false;
+        }
+    }
+    llama_batch_free(batch);
+
+    llama_synchronize(ctx);
+    return true;
+}
+
+// replay the requests with a continuous batching loop: every decode carries the next token of each generating
+// sequence plus as many pending prompt tokens as fit in n_batch, so long prompts are processed in chunks
+static bool test_serve(llama_context * ctx, const std::vector<serve_request> & requests, int n_parallel, int n_batch,
+                       int n_threads, std::vector<uint64_t> & ttft_ns, std::vector<uint64_t> & itl_ns) {
+    llama_set_n_threads(ctx, n_threads, n_threads);
+
+    const llama_model * model   = llama_get_model(ctx);
+    const llama_vocab * vocab   = llama_model_get_vocab(model);
+    const int32_t       n_vocab = llama_vocab_n_tokens(vocab);
+    llama_memory_t      mem     = llama_get_memory(ctx);
+
+    struct serve_slot {
+        int      i_req  = -1;
+        int      n_past = 0;
+        int      n_gen  = 0;
+        bool     output = false;
+        uint64_t t_last = 0;
+    };
+
+    std::vector<serve_slot> slots(n_parallel);
+    llama_batch             batch = llama_batch_init(n_batch, 0, 1);
+
+    const int n_requests = requests.size();
+    int       i_next     = 0;
+    int       n_done     = 0;
+    bool      ok         = true;
+
+    const uint64_t t_start = get_time_ns();
+
+    while (n_done < n_requests) {
+        uint64_t t_now = get_time_ns() - t_start;
+
+        // admit the requests that have arrived into the free slots
+        for (int i_slot = 0; i_slot < n_parallel && i_next < n_requests; i_slot++) {
+            auto & slot = slots[i_slot];
+            if (slot.i_req >= 0) {
+                continue;
+            }
+            const auto & req = requests[i_next];
+            if (req.t_arrival_ns > t_now) {
+                break;
+            }
+            llama_memory_seq_rm(mem, i_slot, -1, -1);
+            if (req.n_prefix > 0) {
+                llama_memory_seq_cp(mem, n_parallel, i_slot, 0, req.n_prefix);
+            }
+            slot.i_req  = i_next++;
+            slot.n_past = req.n_prefix;
+            slot.n_gen  = 0;
+        }
+
+        common_batch_clear(batch);
+
+        for (auto & slot : slots) {
+            slot.output = false;
+        }
+
+        // one token for every generating sequence
+        for (int i_slot = 0; i_slot < n_parallel && batch.n_tokens < n_batch; i_slot++) {
+            auto & slot = slots[i_slot];
+            if (slot.i_req >= 0 && slot.n_past >= requests[slot.i_req].n_prompt) {
+                common_batch_add(batch, std::rand() % n_vocab, slot.n_past++, { i_slot }, true);
+                slot.output = true;
+            }
+        }
+
+        // fill the rest of the batch with prompt tokens
+        for (int i_slot = 0; i_slot < n_parallel && batch.n_tokens < n_batch; i_slot++) {
+            auto & slot = slots[i_slot];
+            if (slot.i_req < 0 || slot.output) {
+                continue;
+            }
+            const auto & req = requests[slot.i_req];
+            const int    n   = std::min(req.n_prompt - slot.n_past, n_batch - batch.n_tokens);
+            for (int j = 0; j < n; j++) {
+                const bool last = slot.n_past + 1 == req.n_prompt;
+                const llama_token token = slot.n_past == 0 && llama_vocab_get_add_bos(vocab) ? llama_vocab_bos(vocab) : std::rand() % n_vocab;
+                common_batch_add(batch, token, slot.n_past++, { i_slot }, last);
+                slot.output = last;
+            }
+        }
+
+        if (batch.n_tokens == 0) {
+            // idle until the next request arrives
+            std::this_thread::sleep_for(std::chrono::nanoseconds(requests[i_next].t_arrival_ns - t_now));
+            continue;
+        }
+
+        int res = llama_decode(ctx, batch);
+        if (res != 0) {
+            fprintf(stderr, "%s: failed to decode batch, res = %d\n", __func__, res);
+            ok = false;
+            break;
+        }
+        llama_synchronize(ctx);
+
+        t_now = get_time_ns() - t_start;
+
+        for (int i_slot = 0; i_slot < n_parallel; i_slot++) {
+            auto & slot = slots[i_slot];
+            if (!slot.output) {
+                continue;
+            }
+            const auto & req = requests[slot.i_req];
+            if (slot.n_gen == 0) {
+                ttft_ns.push_back(t_now - req.t_arrival_ns);
+            } else {
+                itl_ns.push_back(t_now - slot.t_last);
+            }
+            slot.t_last = t_now;
+            if (++slot.n_gen >= req.n_gen) {
+                llama_memory_seq_rm(mem, i_slot, -1, -1);
+                slot.i_req = -1;
+                n_done++;
+            }
+        }
+    }
+
+    llama_batch_free(batch);
+    return ok;
+}
+
 static void llama_null_log_callback(enum ggml_log_level level, const char * text, void * user_data) {
     (void) level;
     (void) text;
@@ -1876,13 +2381,17 @@ int main(int argc, char ** argv) {
     std::unique_ptr<printer> p     = create_printer(params.output_format);
     std::unique_ptr<printer> p_err = create_printer(params.output_format_stderr);
 
+    const bool serve = !params.n_serve.empty() || !params.serve_requests.empty();
+
     if (p) {
-        p->fout = stdout;
+        p->fout  = stdout;
+        p->serve = serve;
         p->print_header(params);
     }
 
     if (p_err) {
-        p_err->fout = stderr;
+        p_err->fout  = stderr;
+        p_err->serve = serve;
         p_err->print_header(params);
     }
 
@@ -1912,7 +2421,14 @@ int main(int argc, char ** argv) {
             prev_inst = &inst;
         }
 
-        llama_context * ctx = llama_init_from_model(lmodel, inst.to_llama_cparams());
+        llama_context_params       cparams = inst.to_llama_cparams();
+        std::vector<serve_request> serve_requests;
+        if (inst.n_serve > 0) {
+            serve_requests = get_serve_requests(params, inst);
+            cparams.n_ctx  = get_serve_n_ctx(serve_requests, inst.n_parallel);
+        }
+
+        llama_context * ctx = llama_init_from_model(lmodel, cparams);
         if (ctx == NULL) {
             fprintf(stderr, "%s: error: failed to create context with model '%s'\n", __func__, inst.model.c_str());
             llama_model_free(lmodel);
@@ -1920,6 +2436,9 @@ int main(int argc, char ** argv) {
         }
 
         test t(inst, lmodel, ctx);
+        for (const auto & r : serve_requests) {
+            t.n_serve_tokens += r.n_prompt - r.n_prefix + r.n_gen;
+        }
 
         llama_memory_clear(llama_get_memory(ctx), false);
 
@@ -1985,9 +2504,29 @@ int main(int argc, char ** argv) {
                 }
             }
 
+            if (t.n_serve > 0) {
+                // the shared prefix is cached before the clock starts, as a server would have it from earlier requests
+                bool res = test_serve_prefix(ctx, serve_requests, t.n_parallel, t.n_batch, t.n_threads);
+                if (!res) {
+                    fprintf(stderr, "%s: error: failed to run serving prefix\n", __func__);
+                    exit(1);
+                }
+            }
+
             uint64_t t_start = get_time_ns();
 
-            if (t.n_prompt > 0) {
+            if (t.n_serve > 0) {
+                if (params.progress) {
+                    fprintf(stderr, "llama-bench: benchmark %d/%zu: serving run %d/%d\n", params_idx, params_count,
+                            i + 1, params.reps);
+                }
+                bool res = test_serve(ctx, serve_requests, t.n_parallel, t.n_batch, t.n_threads, t.ttft_ns, t.itl_ns);
+                if (!res) {
+                    fprintf(stderr, "%s: error: failed to run serving test\n", __func__);
+                    exit(1);
+                }
+            }
+            if (t.n_serve == 0 && t.n_prompt > 0) {
                 if (params.progress) {
                     fprintf(stderr, "llama-bench: benchmark %d/%zu: prompt run %d/%d\n", params_idx, params_count,
                             i + 1, params.reps);
@@ -1998,7 +2537,7 @@ int main(int argc, char ** argv) {
                     exit(1);
                 }
             }
-            if (t.n_gen > 0) {
+            if (t.n_serve == 0 && t.n_gen > 0) {
                 if (params.progress) {
                     fprintf(stderr, "llama-bench: benchmark %d/%zu: generation run %d/%d\n", params_idx, params_count,
                             i + 1, params.reps);
@@ -27,6 +27,7 @@
 #include <array>
 #include <numeric>
 #include <functional>
+#include <thread>
 
 struct clip_logger_state g_logger_state = {GGML_LOG_LEVEL_CONT, clip_log_callback_default, NULL};
 
@@ -385,12 +386,16 @@ struct clip_ctx {
     int max_nodes = 8192;
     ggml_backend_sched_ptr sched;
 
+    // number of threads used for CPU image preprocessing
+    int n_threads = 1;
+
     // for debugging
     bool debug_graph = false;
     std::vector<ggml_tensor *> debug_print_tensors;
 
     clip_ctx(clip_context_params & ctx_params) {
         debug_graph = std::getenv("MTMD_DEBUG_GRAPH") != nullptr;
+        n_threads   = std::max(1, ctx_params.n_threads);
         backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
         if (!backend_cpu) {
             throw std::runtime_error("failed to initialize CPU backend");
@@ -2843,170 +2848,117 @@ void clip_build_img_from_pixels(const unsigned char * rgb_pixels, int nx, int ny
     memcpy(img->buf.data(), rgb_pixels, img->buf.size());
 }
 
+// run fn(i0, i1) over [0, n), split into contiguous ranges across up to n_threads threads
+static void clip_parallel_for(int n, int n_threads, const std::function<void(int, int)> & fn) {
+    n_threads = std::max(1, std::min(n_threads, n));
+    if (n_threads == 1) {
+        fn(0, n);
+        return;
+    }
+
+    const int chunk = (n + n_threads - 1) / n_threads;
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+    for (int i0 = chunk; i0 < n; i0 += chunk) {
+        workers.emplace_back(fn, i0, std::min(n, i0 + chunk));
+    }
+    fn(0, std::min(n, chunk));
+
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
+// per-channel lookup table for (v / 255 - mean) / std
+// a u8 channel only has 256 distinct values, so this is exact and avoids the division per pixel
+struct clip_norm_lut {
+    float v[3][256];
+
+    clip_norm_lut(const float mean[3], const float std[3]) {
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < 256; ++i) {
+                v[c][i] = (static_cast<float>(i) / 255.0f - mean[c]) / std[c];
+            }
+        }
+    }
+
+    // convert n_px RGB pixels
+    void apply(const uint8_t * src, float * dst, size_t n_px) const {
+        for (size_t i = 0; i < n_px; ++i) {
+            dst[3*i + 0] = v[0][src[3*i + 0]];
+            dst[3*i + 1] = v[1][src[3*i + 1]];
+            dst[3*i + 2] = v[2][src[3*i + 2]];
+        }
+    }
+};
+
 // Normalize image to float32 - careful with pytorch .to(model.device, dtype=torch.float16) - this sometimes reduces precision (32>16>32), sometimes not
-static void normalize_image_u8_to_f32(const clip_image_u8 & src, clip_image_f32 & dst, const float mean[3], const float std[3]) {
+static void normalize_image_u8_to_f32(const clip_image_u8 & src, clip_image_f32 & dst, const clip_norm_lut & lut) {
     dst.nx = src.nx;
     dst.ny = src.ny;
     dst.buf.resize(src.buf.size());
 
-    // TODO @ngxson : seems like this could be done more efficiently on cgraph
-    for (size_t i = 0; i < src.buf.size(); ++i) {
-        int c = i % 3; // rgb
-        dst.buf[i] = (static_cast<float>(src.buf[i]) / 255.0f - mean[c]) / std[c];
+    lut.apply(src.buf.data(), dst.buf.data(), (size_t)src.nx*src.ny);
+}
+
+// normalize a list of images (e.g. llava-uhd slices), the images are distributed across threads
+static void normalize_images_u8_to_f32(const std::vector<clip_image_u8_ptr> & imgs, clip_image_f32_batch & res_imgs, const clip_norm_lut & lut, int n_threads) {
+    const size_t n_prev = res_imgs.entries.size();
+    for (size_t i = 0; i < imgs.size(); ++i) {
+        res_imgs.entries.emplace_back(clip_image_f32_init());
     }
+    clip_parallel_for((int) imgs.size(), n_threads, [&](int i0, int i1) {
+        for (int i = i0; i < i1; ++i) {
+            // clip_image_save_to_bmp(*imgs[i], "slice_" + std::to_string(i) + ".bmp");
+            normalize_image_u8_to_f32(*imgs[i], *res_imgs.entries[n_prev + i], lut);
+        }
+    });
 }
 
 // set of tools to manupulate images
 // in the future, we can have HW acceleration by allowing this struct to access 3rd party lib like imagick or opencv
+//
+// the resize functions are separable: a horizontal pass with precomputed taps produces f32 rows, which are then
+// combined vertically with a contiguous (auto-vectorizable) loop; output rows are distributed across threads
+// each resize function also has a variant that outputs a normalized f32 image directly, to avoid the u8 round-trip
 struct image_manipulation {
     // Bilinear resize function
-    static void bilinear_resize(const clip_image_u8& src, clip_image_u8& dst, int target_width, int target_height) {
-        dst.nx = target_width;
-        dst.ny = target_height;
-        dst.buf.resize(3 * target_width * target_height);
-
-        float x_ratio = static_cast<float>(src.nx - 1) / target_width;
-        float y_ratio = static_cast<float>(src.ny - 1) / target_height;
-
-        for (int y = 0; y < target_height; y++) {
-            for (int x = 0; x < target_width; x++) {
-                float px = x_ratio * x;
-                float py = y_ratio * y;
-                int x_floor = static_cast<int>(px);
-                int y_floor = static_cast<int>(py);
-                float x_lerp = px - x_floor;
-                float y_lerp = py - y_floor;
+    static void bilinear_resize(const clip_image_u8 & src, clip_image_u8 & dst, int target_width, int target_height, int n_threads = 1) {
+        row_writer_u8 writer(dst, target_width, target_height);
+        bilinear_resize_impl(src, writer, 0, 0, target_width, target_height, n_threads);
+    }
 
-                for (int c = 0; c < 3; c++) {
-                    float top = lerp(
-                        static_cast<float>(src.buf[3 * (y_floor * src.nx + x_floor) + c]),
-                        static_cast<float>(src.buf[3 * (y_floor * src.nx + (x_floor + 1)) + c]),
-                        x_lerp
-                    );
-                    float bottom = lerp(
-                        static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + x_floor) + c]),
-                        static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + (x_floor + 1)) + c]),
-                        x_lerp
-                    );
-                    dst.buf[3 * (y * target_width + x) + c] = static_cast<uint8_t>(lerp(top, bottom, y_lerp));
-                }
-            }
-        }
+    static void bilinear_resize(const clip_image_u8 & src, clip_image_f32 & dst, int target_width, int target_height, const clip_norm_lut & lut, int n_threads = 1) {
+        row_writer_f32 writer(dst, target_width, target_height, lut);
+        bilinear_resize_impl(src, writer, 0, 0, target_width, target_height, n_threads);
     }
 
     // Bicubic resize function
     // part of image will be cropped if the aspect ratio is different
-    static bool bicubic_resize(const clip_image_u8 & img, clip_image_u8 & dst, int target_width, int target_height) {
-        const int nx = img.nx;
-        const int ny = img.ny;
-
-        dst.nx = target_width;
-        dst.ny = target_height;
-        dst.buf.resize(3 * target_width * target_height);
-
-        float Cc;
-        float C[5];
-        float d0, d2, d3, a0, a1, a2, a3;
-        int i, j, k, jj;
-        int x, y;
-        float dx, dy;
-        float tx, ty;
-
-        tx = (float)nx / (float)target_width;
-        ty = (float)ny / (float)target_height;
-
-        // Bicubic interpolation; adapted from ViT.cpp, inspired from :
-        //    -> https://github.com/yglukhov/bicubic-interpolation-image-processing/blob/master/libimage.c#L36
-        //    -> https://en.wikipedia.org/wiki/Bicubic_interpolation
-
-        for (i = 0; i < target_height; i++) {
-            for (j = 0; j < target_width; j++) {
-                x = (int)(tx * j);
-                y = (int)(ty * i);
-
-                dx = tx * j - x;
-                dy = ty * i - y;
-
-                for (k = 0; k < 3; k++) {
-                    for (jj = 0; jj <= 3; jj++) {
-                        d0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x - 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                        d2 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                        d3 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 2, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                        a0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-
-                        a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
-                        a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
-                        a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
-
-                        C[jj] = a0 + a1 * dx + a2 * dx * dx + a3 * dx * dx * dx;
-
-                        d0 = C[0] - C[1];
-                        d2 = C[2] - C[1];
-                        d3 = C[3] - C[1];
-                        a0 = C[1];
-                        a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
-                        a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
-                        a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
-                        Cc = a0 + a1 * dy + a2 * dy * dy + a3 * dy * dy * dy;
-
-                        const uint8_t Cc2 = std::min(std::max(std::round(Cc), 0.0f), 255.0f);
-                        dst.buf[(i * target_width + j) * 3 + k] = float(Cc2);
-                    }
-                }
-            }
-        }
+    static bool bicubic_resize(const clip_image_u8 & img, clip_image_u8 & dst, int target_width, int target_height, int n_threads = 1) {
+        row_writer_u8 writer(dst, target_width, target_height);
+        bicubic_resize_impl(img, writer, 0, 0, target_width, target_height, n_threads);
+        return true;
+    }
 
+    static bool bicubic_resize(const clip_image_u8 & img, clip_image_f32 & dst, int target_width, int target_height, const clip_norm_lut & lut, int n_threads = 1) {
+        row_writer_f32 writer(dst, target_width, target_height, lut);
+        bicubic_resize_impl(img, writer, 0, 0, target_width, target_height, n_threads);
         return true;
     }
 
     // llava-1.6 type of resize_and_pad
     // if the ratio is not 1:1, padding with pad_color will be applied
     // pad_color is single channel, default is 0 (black)
-    static void resize_and_pad_image(const clip_image_u8 & image, clip_image_u8 & dst, const clip_image_size & target_resolution, std::array<uint8_t, 3> pad_color = {0, 0, 0}) {
-        int target_width  = target_resolution.width;
-        int target_height = target_resolution.height;
-
-        float scale_w = static_cast<float>(target_width) / image.nx;
-        float scale_h = static_cast<float>(target_height) / image.ny;
-
-        int new_width, new_height;
-
-        if (scale_w < scale_h) {
-            new_width  = target_width;
-            new_height = std::min(static_cast<int>(std::ceil(image.ny * scale_w)), target_height);
-        } else {
-            new_height = target_height;
-            new_width  = std::min(static_cast<int>(std::ceil(image.nx * scale_h)), target_width);
-        }
-
-        clip_image_u8 resized_image;
-        bicubic_resize(image, resized_image, new_width, new_height);
-
-        clip_image_u8 padded_image;
-        padded_image.nx = target_width;
-        padded_image.ny = target_height;
-        padded_image.buf.resize(3 * target_width * target_height);
-
-        // Fill the padded image with the fill color
-        for (size_t i = 0; i < padded_image.buf.size(); i += 3) {
-            padded_image.buf[i]     = pad_color[0];
-            padded_image.buf[i + 1] = pad_color[1];
-            padded_image.buf[i + 2] = pad_color[2];
-        }
-
-        // Calculate padding offsets
-        int pad_x = (target_width  - new_width)  / 2;
-        int pad_y = (target_height - new_height) / 2;
+    static void resize_and_pad_image(const clip_image_u8 & image, clip_image_u8 & dst, const clip_image_size & target_resolution, std::array<uint8_t, 3> pad_color = {0, 0, 0}, int n_threads = 1) {
+        row_writer_u8 writer(dst, target_resolution.width, target_resolution.height);
+        resize_and_pad_impl(image, writer, target_resolution, pad_color, n_threads);
+    }
 
-        // Copy the resized image into the center of the padded buffer
-        for (int y = 0; y < new_height; ++y) {
-            for (int x = 0; x < new_width; ++x) {
-                for (int c = 0; c < 3; ++c) {
-                    padded_image.buf[3 * ((y + pad_y) * target_width + (x + pad_x)) + c] = resized_image.buf[3 * (y * new_width + x) + c];
-                }
-            }
-        }
-        dst = std::move(padded_image);
+    static void resize_and_pad_image(const clip_image_u8 & image, clip_image_f32 & dst, const clip_image_size & target_resolution, const clip_norm_lut & lut, std::array<uint8_t, 3> pad_color = {0, 0, 0}, int n_threads = 1) {
+        row_writer_f32 writer(dst, target_resolution.width, target_resolution.height, lut);
+        resize_and_pad_impl(image, writer, target_resolution, pad_color, n_threads);
     }
 
     static void crop_image(const clip_image_u8 & image, clip_image_u8 & dst, int x, int y, int w, int h) {
@@ -3015,13 +2967,9 @@ struct image_manipulation {
         dst.buf.resize(3 * w * h);
 
         for (int i = 0; i < h; ++i) {
-            for (int j = 0; j < w; ++j) {
-                int src_idx = 3 * ((y + i)*image.nx + (x + j));
-                int dst_idx = 3 * (i*w + j);
-                dst.buf[dst_idx]     = image.buf[src_idx];
-                dst.buf[dst_idx + 1] = image.buf[src_idx + 1];
-                dst.buf[dst_idx + 2] = image.buf[src_idx + 2];
-            }
+            const size_t src_idx = 3 * ((size_t)(y + i)*image.nx + x);
+            const size_t dst_idx = 3 * ((size_t)i*w);
+            memcpy(dst.buf.data() + dst_idx, image.buf.data() + src_idx, 3 * (size_t)w);
         }
     }
 
@@ -3054,6 +3002,227 @@ private:
     static inline float lerp(float s, float e, float t) {
         return s + (e - s) * t;
     }
+
+    // destinations for the resize kernels, which produce rows of u8 RGB pixels
+    struct row_writer_u8 {
+        clip_image_u8 & dst;
+
+        row_writer_u8(clip_image_u8 & dst, int nx, int ny) : dst(dst) {
+            dst.nx = nx;
+            dst.ny = ny;
+            dst.buf.resize(3 * nx * ny);
+        }
+
+        void write(int x, int y, const uint8_t * px, int n_px) {
+            memcpy(dst.buf.data() + 3*((size_t)y*dst.nx + x), px, 3*(size_t)n_px);
+        }
+    };
+
+    struct row_writer_f32 {
+        clip_image_f32 & dst;
+        const clip_norm_lut & lut;
+
+        row_writer_f32(clip_image_f32 & dst, int nx, int ny, const clip_norm_lut & lut) : dst(dst), lut(lut) {
+            dst.nx = nx;
+            dst.ny = ny;
+            dst.buf.resize(3 * nx * ny);
+        }
+
+        void write(int x, int y, const uint8_t * px, int n_px) {
+            lut.apply(px, dst.buf.data() + 3*((size_t)y*dst.nx + x), n_px);
+        }
+    };
+
+    // avoid spawning threads for tiny images
+    static int n_threads_for_rows(int n_rows, int n_threads) {
+        return std::max(1, std::min(n_threads, n_rows / 32));
+    }
+
+    // resize src to (target_width, target_height) and write the result at (off_x, off_y) of dst
+    template <typename writer_t>
+    static void bilinear_resize_impl(const clip_image_u8 & src, writer_t & dst, int off_x, int off_y, int target_width, int target_height, int n_threads) {
+        const float x_ratio = static_cast<float>(src.nx - 1) / target_width;
+        const float y_ratio = static_cast<float>(src.ny - 1) / target_height;
+
+        // horizontal taps, shared by all rows
+        std::vector<int>   x0(target_width);
+        std::vector<int>   x1(target_width);
+        std::vector<float> xl(target_width);
+        for (int x = 0; x < target_width; x++) {
+            const float px = x_ratio * x;
+            x0[x] = static_cast<int>(px);
+            x1[x] = std::min(x0[x] + 1, src.nx - 1);
+            xl[x] = px - x0[x];
+        }
+
+        auto hpass = [&](int sy, float * out) {
+            const uint8_t * row = src.buf.data() + 3*(size_t)sy*src.nx;
+            for (int x = 0; x < target_width; x++) {
+                const uint8_t * p0 = row + 3*x0[x];
+                const uint8_t * p1 = row + 3*x1[x];
+                for (int c = 0; c < 3; c++) {
+                    out[3*x + c] = lerp(static_cast<float>(p0[c]), static_cast<float>(p1[c]), xl[x]);
+                }
+            }
+        };
+
+        clip_parallel_for(target_height, n_threads_for_rows(target_height, n_threads), [&](int y_beg, int y_end) {
+            const int n = 3 * target_width;
+
+            std::vector<float>   top(n);
+            std::vector<float>   bottom(n);
+            std::vector<uint8_t> out(n);
+
+            int y_cached = -2; // source row currently held in top
+            for (int y = y_beg; y < y_end; y++) {
+                const float py = y_ratio * y;
+                const int   y_floor = static_cast<int>(py);
+                const int   y_ceil  = std::min(y_floor + 1, src.ny - 1);
+                const float y_lerp  = py - y_floor;
+
+                if (y_floor == y_cached + 1) {
+                    std::swap(top, bottom);
+                    hpass(y_ceil, bottom.data());
+                } else if (y_floor != y_cached) {
+                    hpass(y_floor, top.data());
+                    hpass(y_ceil,  bottom.data());
+                }
+                y_cached = y_floor;
+
+                const float * t = top.data();
+                const float * b = bottom.data();
+                for (int i = 0; i < n; i++) {
+                    out[i] = static_cast<uint8_t>(lerp(t[i], b[i], y_lerp));
+                }
+                dst.write(off_x, off_y + y, out.data(), target_width);
+            }
+        });
+    }
+
+    // weights of the 4 taps (at offsets -1, 0, 1, 2) of the cubic used by bicubic_resize, at fractional position d
+    // this is the expansion of:
+    //   C = a0 + a1*d + a2*d^2 + a3*d^3
+    //   a1 = -1/3*d0 + d2 - 1/6*d3, a2 = 1/2*d0 + 1/2*d2, a3 = -1/6*d0 - 1/2*d2 + 1/6*d3 (dN = pN - p1)
+    // adapted from ViT.cpp, inspired from :
+    //    -> https://github.com/yglukhov/bicubic-interpolation-image-processing/blob/master/libimage.c#L36
+    //    -> https://en.wikipedia.org/wiki/Bicubic_interpolation
+    static void bicubic_weights(float d, float w[4]) {
+        const float d2 = d * d;
+        const float d3 = d * d2;
+        w[0] = -1.0f/3 * d + 1.0f/2 * d2 - 1.0f/6 * d3;
+        w[2] =           d + 1.0f/2 * d2 - 1.0f/2 * d3;
+        w[3] = -1.0f/6 * d               + 1.0f/6 * d3;
+        w[1] = 1.0f - w[0] - w[2] - w[3];
+    }
+
+    template <typename writer_t>
+    static void bicubic_resize_impl(const clip_image_u8 & img, writer_t & dst, int off_x, int off_y, int target_width, int target_height, int n_threads) {
+        const int nx = img.nx;
+        const int ny = img.ny;
+
+        const float tx = (float)nx / (float)target_width;
+        const float ty = (float)ny / (float)target_height;
+
+        // horizontal taps, shared by all rows
+        std::vector<std::array<int,   4>> xi(target_width);
+        std::vector<std::array<float, 4>> xw(target_width);
+        for (int j = 0; j < target_width; j++) {
+            const int x = (int)(tx * j);
+            for (int k = 0; k < 4; k++) {
+                xi[j][k] = 3 * clip(x - 1 + k, 0, nx - 1);
+            }
+            bicubic_weights(tx * j - x, xw[j].data());
+        }
+
+        clip_parallel_for(target_height, n_threads_for_rows(target_height, n_threads), [&](int i_beg, int i_end) {
+            const int n = 3 * target_width;
+
+            // horizontally interpolated source rows
+            // the 4 rows needed by an output row are consecutive, so a ring indexed by (row % 4) never collides
+            std::vector<float> hrows(4 * n);
+            int hrow_src[4] = { -1, -1, -1, -1 };
+
+            auto hrow = [&](int sy) -> const float * {
+                float * out = hrows.data() + (sy & 3) * n;
+                if (hrow_src[sy & 3] == sy) {
+                    return out;
+                }
+                hrow_src[sy & 3] = sy;
+
+                const uint8_t * row = img.buf.data() + 3*(size_t)sy*nx;
+                for (int j = 0; j < target_width; j++) {
+                    const int   * idx = xi[j].data();
+                    const float * w   = xw[j].data();
+                    for (int c = 0; c < 3; c++) {
+                        out[3*j + c] = w[0] * row[idx[0] + c] + w[1] * row[idx[1] + c]
+                                     + w[2] * row[idx[2] + c] + w[3] * row[idx[3] + c];
+                    }
+                }
+                return out;
+            };
+
+            std::vector<uint8_t> out(n);
+            for (int i = i_beg; i < i_end; i++) {
+                const int y = (int)(ty * i);
+
+                float w[4];
+                bicubic_weights(ty * i - y, w);
+
+                const float * r0 = hrow(clip(y - 1, 0, ny - 1));
+                const float * r1 = hrow(clip(y,     0, ny - 1));
+                const float * r2 = hrow(clip(y + 1, 0, ny - 1));
+                const float * r3 = hrow(clip(y + 2, 0, ny - 1));
+
+                for (int k = 0; k < n; k++) {
+                    const float v = w[0] * r0[k] + w[1] * r1[k] + w[2] * r2[k] + w[3] * r3[k];
+                    out[k] = static_cast<uint8_t>(std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+                }
+                dst.write(off_x, off_y + i, out.data(), target_width);
+            }
+        });
+    }
+
+    template <typename writer_t>
+    static void resize_and_pad_impl(const clip_image_u8 & image, writer_t & dst, const clip_image_size & target_resolution, std::array<uint8_t, 3> pad_color, int n_threads) {
+        int target_width  = target_resolution.width;
+        int target_height = target_resolution.height;
+
+        float scale_w = static_cast<float>(target_width) / image.nx;
+        float scale_h = static_cast<float>(target_height) / image.ny;
+
+        int new_width, new_height;
+
+        if (scale_w < scale_h) {
+            new_width  = target_width;
+            new_height = std::min(static_cast<int>(std::ceil(image.ny * scale_w)), target_height);
+        } else {
+            new_height = target_height;
+            new_width  = std::min(static_cast<int>(std::ceil(image.nx * scale_h)), target_width);
+        }
+
+        // Calculate padding offsets
+        int pad_x = (target_width  - new_width)  / 2;
+        int pad_y = (target_height - new_height) / 2;
+
+        // Fill the borders with the fill color
+        std::vector<uint8_t> pad_row(3 * target_width);
+        for (size_t i = 0; i < pad_row.size(); i += 3) {
+            pad_row[i]     = pad_color[0];
+            pad_row[i + 1] = pad_color[1];
+            pad_row[i + 2] = pad_color[2];
+        }
+        for (int y = 0; y < target_height; ++y) {
+            if (y < pad_y || y >= pad_y + new_height) {
+                dst.write(0, y, pad_row.data(), target_width);
+            } else {
+                dst.write(0, y, pad_row.data(), pad_x);
+                dst.write(pad_x + new_width, y, pad_row.data(), target_width - pad_x - new_width);
+            }
+        }
+
+        // resize directly into the center of the padded image
+        bicubic_resize_impl(image, dst, pad_x, pad_y, new_width, new_height, n_threads);
+    }
 };
 
 /**
@@ -3192,12 +3361,12 @@ struct llava_uhd {
         return res;
     }
 
-    static std::vector<clip_image_u8_ptr> slice_image(const clip_image_u8 * img, const slice_instructions & inst) {
+    static std::vector<clip_image_u8_ptr> slice_image(const clip_image_u8 * img, const slice_instructions & inst, int n_threads = 1) {
         std::vector<clip_image_u8_ptr> output;
 
         // resize to overview size
         clip_image_u8_ptr resized_img(clip_image_u8_init());
-        image_manipulation::bicubic_resize(*img, *resized_img, inst.overview_size.width, inst.overview_size.height);
+        image_manipulation::bicubic_resize(*img, *resized_img, inst.overview_size.width, inst.overview_size.height, n_threads);
         output.push_back(std::move(resized_img));
         if (inst.slices.empty()) {
             // no slices, just return the resized image
@@ -3207,9 +3376,9 @@ struct llava_uhd {
         // resize to refined size
         clip_image_u8_ptr refined_img(clip_image_u8_init());
         if (inst.padding_refined) {
-            image_manipulation::resize_and_pad_image(*img, *refined_img, inst.refined_size);
+            image_manipulation::resize_and_pad_image(*img, *refined_img, inst.refined_size, {0, 0, 0}, n_threads);
         } else {
-            image_manipulation::bilinear_resize(*img, *refined_img, inst.refined_size.width, inst.refined_size.height);
+            image_manipulation::bilinear_resize(*img, *refined_img, inst.refined_size.width, inst.refined_size.height, n_threads);
         }
 
         // create slices
@@ -3362,31 +3531,24 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, str
         pad_to_square = false;
     }
 
+    const int n_threads = ctx->n_threads;
+    const clip_norm_lut lut(params.image_mean, params.image_std);
+
     if (clip_is_minicpmv(ctx)) {
         auto const inst = llava_uhd::get_slice_instructions(ctx, original_size);
-        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst);
-
-        for (size_t i = 0; i < imgs.size(); ++i) {
-            // clip_image_save_to_bmp(*imgs[i], "slice_" + std::to_string(i) + ".bmp");
-            clip_image_f32_ptr res(clip_image_f32_init());
-            normalize_image_u8_to_f32(*imgs[i], *res, params.image_mean, params.image_std);
-            res_imgs->entries.push_back(std::move(res));
-        }
+        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst, n_threads);
+        normalize_images_u8_to_f32(imgs, *res_imgs, lut, n_threads);
 
         res_imgs->grid_x = inst.grid_size.width;
         res_imgs->grid_y = inst.grid_size.height;
         return true;
 
     } else if (ctx->proj_type() == PROJECTOR_TYPE_QWEN2VL || ctx->proj_type() == PROJECTOR_TYPE_QWEN25VL) {
-        clip_image_u8 resized;
         auto patch_size = params.patch_size * 2;
         auto new_size = image_manipulation::calc_size_preserved_ratio(original_size, patch_size, params.image_size);
-        image_manipulation::bicubic_resize(*img, resized, new_size.width, new_size.height);
 
         clip_image_f32_ptr img_f32(clip_image_f32_init());
-        // clip_image_f32_ptr res(clip_image_f32_init());
-        normalize_image_u8_to_f32(resized, *img_f32, params.image_mean, params.image_std);
-        // res_imgs->data[0] = *res;
+        image_manipulation::bicubic_resize(*img, *img_f32, new_size.width, new_size.height, lut, n_threads);
         res_imgs->entries.push_back(std::move(img_f32));
         return true;
     }
@@ -3395,34 +3557,24 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, str
             || ctx->proj_type() == PROJECTOR_TYPE_IDEFICS3
             || ctx->proj_type() == PROJECTOR_TYPE_INTERNVL // TODO @ngxson : support dynamic resolution
     ) {
-        clip_image_u8 resized_image;
         int sz = params.image_size;
-        image_manipulation::resize_and_pad_image(*img, resized_image, {sz, sz});
         clip_image_f32_ptr img_f32(clip_image_f32_init());
-        //clip_image_save_to_bmp(resized_image, "resized.bmp");
-        normalize_image_u8_to_f32(resized_image, *img_f32, params.image_mean, params.image_std);
+        image_manipulation::resize_and_pad_image(*img, *img_f32, {sz, sz}, lut, {0, 0, 0}, n_threads);
         res_imgs->entries.push_back(std::move(img_f32));
         return true;
 
     } else if (ctx->proj_type() == PROJECTOR_TYPE_PIXTRAL) {
-        clip_image_u8 resized_image;
         auto new_size = image_manipulation::calc_size_preserved_ratio(original_size, params.patch_size, params.image_size);
-        image_manipulation::bilinear_resize(*img, resized_image, new_size.width, new_size.height);
         clip_image_f32_ptr img_f32(clip_image_f32_init());
-        normalize_image_u8_to_f32(resized_image, *img_f32, params.image_mean, params.image_std);
+        image_manipulation::bilinear_resize(*img, *img_f32, new_size.width, new_size.height, lut, n_threads);
         res_imgs->entries.push_back(std::move(img_f32));
         return true;
 
     } else if (ctx->proj_type() == PROJECTOR_TYPE_LLAMA4) {
         GGML_ASSERT(!params.image_res_candidates.empty());
         auto const inst = llava_uhd::get_slice_instructions(ctx, original_size);
-        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst);
-
-        for (size_t i = 0; i < imgs.size(); ++i) {
-            clip_image_f32_ptr res(clip_image_f32_init());
-            normalize_image_u8_to_f32(*imgs[i], *res, params.image_mean, params.image_std);
-            res_imgs->entries.push_back(std::move(res));
-        }
+        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst, n_threads);
+        normalize_images_u8_to_f32(imgs, *res_imgs, lut, n_threads);
 
         res_imgs->grid_x = inst.grid_size.width;
         res_imgs->grid_y = inst.grid_size.height;
@@ -3433,38 +3585,24 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, str
     // the logic below is to pad the shorter side to the longer side with a background color: rgb(122, 116, 104)
     // see https://github.com/haotian-liu/LLaVA/blob/e854a2bf85118c504f6f16bf5c3c7c92f8fa8c6b/llava/conversation.py#L113-L156
 
-    clip_image_u8_ptr temp(clip_image_u8_init()); // we will keep the input image data here temporarily
-
     if (pad_to_square) {
         // for llava-1.5, we resize image to a square, and pad the shorter side with a background color
         // see https://github.com/haotian-liu/LLaVA/blob/e854a2bf85118c504f6f16bf5c3c7c92f8fa8c6b/llava/conversation.py#L113-L156
-        const int longer_side = std::max(img->nx, img->ny);
-        temp->nx = longer_side;
-        temp->ny = longer_side;
-        temp->buf.resize(3 * longer_side * longer_side);
 
         // background color in RGB from LLaVA (this is the mean rgb color * 255)
         const std::array<uint8_t, 3> pad_color = {122, 116, 104};
 
         // resize the image to the target_size
-        image_manipulation::resize_and_pad_image(*img, *temp, clip_image_size{params.image_size, params.image_size}, pad_color);
-
         clip_image_f32_ptr res(clip_image_f32_init());
-        normalize_image_u8_to_f32(*temp, *res, params.image_mean, params.image_std);
+        image_manipulation::resize_and_pad_image(*img, *res, clip_image_size{params.image_size, params.image_size}, lut, pad_color, n_threads);
         res_imgs->entries.push_back(std::move(res));
         return true;
 
     } else if (!params.image_res_candidates.empty()) {
         // "spatial_unpad" with "anyres" processing for llava-1.6
         auto const inst = llava_uhd::get_slice_instructions(ctx, original_size);
-        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst);
-
-        for (size_t i = 0; i < imgs.size(); ++i) {
-            // clip_image_save_to_bmp(*imgs[i], "slice_" + std::to_string(i) + ".bmp");
-            clip_image_f32_ptr res(clip_image_f32_init());
-            normalize_image_u8_to_f32(*imgs[i], *res, params.image_mean, params.image_std);
-            res_imgs->entries.push_back(std::move(res));
-        }
+        std::vector<clip_image_u8_ptr> imgs = llava_uhd::slice_image(img, inst, n_threads);
+        normalize_images_u8_to_f32(imgs, *res_imgs, lut, n_threads);
 
         return true;
 
@@ -25,6 +25,7 @@ enum clip_modality {
 struct clip_context_params {
     bool use_gpu;
     enum ggml_log_level verbosity;
+    int n_threads; // used for image preprocessing
 };
 
 struct clip_init_result {
@@ -1,12 +1,14 @@
+#define _USE_MATH_DEFINES // for M_PI
+
 #include "mtmd-audio.h"
 
-#define _USE_MATH_DEFINES // for M_PI
+#include "common/fft.h"
+
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <thread>
 #include <vector>
-#include <fstream>
 #include <algorithm>
 
 // most of the code here is copied from whisper.cpp
@@ -16,32 +18,17 @@
 
 namespace whisper_preprocessor {
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
 namespace {
 struct whisper_global_cache {
-    // In FFT, we frequently use sine and cosine operations with the same values.
-    // We can use precalculated values to speed up the process.
-    float sin_vals[SIN_COS_N_COUNT];
-    float cos_vals[SIN_COS_N_COUNT];
-
     // Hann window (Use cosf to eliminate difference)
     // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
     // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
     float hann_window[WHISPER_N_FFT];
 
     whisper_global_cache() {
-        fill_sin_cos_table();
         fill_hann_window(sizeof(hann_window)/sizeof(hann_window[0]), true, hann_window);
     }
 
-    void fill_sin_cos_table() {
-        for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-            double theta = (2 * M_PI * i) / SIN_COS_N_COUNT;
-            sin_vals[i] = sinf(theta);
-            cos_vals[i] = cosf(theta);
-        }
-    }
-
     void fill_hann_window(int length, bool periodic, float * output) {
         int offset = -1;
         if (periodic) {
@@ -52,236 +39,320 @@ struct whisper_global_cache {
         }
     }
 } global_cache;
-}
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const float* in, int N, float* out) {
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+// FFT of n real samples (n even), computed as a complex FFT of length n/2 over the (even, odd) sample pairs
+struct rfft_plan {
+    int n;
+    fft_plan cfft;
+
+    // exp(-2*pi*i * k / n), for k in [0, n/2]
+    std::vector<float> w_re;
+    std::vector<float> w_im;
+
+    explicit rfft_plan(int n) : n(n), cfft(n/2) {
+        WHISPER_ASSERT(n % 2 == 0);
+        w_re.resize(n/2 + 1);
+        w_im.resize(n/2 + 1);
+        for (int k = 0; k <= n/2; k++) {
+            w_re[k] = cos(-2.0*M_PI*k/n);
+            w_im[k] = sin(-2.0*M_PI*k/n);
+        }
+    }
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+    // power spectrum |X[k]|^2 of the n real samples, for k in [0, n/2]
+    void power_spectrum(const float * in, float * out, fft_work & work) const {
+        const int m = n/2;
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*global_cache.cos_vals[idx]; // cos(t)
-            im -= in[n]*global_cache.sin_vals[idx]; // sin(t)
-        }
+        cfft.run(in, in + 1, 2, work);
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
-    }
-}
+        const float * zr = work.re.data();
+        const float * zi = work.im.data();
+        for (int k = 0; k <= m; k++) {
+            // split Z into the transforms of the even (E) and odd (O) samples
+            const int k0 = k == m ? 0 : k;
+            const int k1 = k == 0 ? 0 : m - k;
+            const float er = 0.5f*(zr[k0] + zr[k1]);
+            const float ei = 0.5f*(zi[k0] - zi[k1]);
+            const float or_ = 0.5f*(zi[k0] + zi[k1]);
+            const float oi  = 0.5f*(zr[k1] - zr[k0]);
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(float* in, int N, float* out) {
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
-    }
+            // X[k] = E[k] + exp(-2*pi*i * k / n) * O[k]
+            const float xr = er + w_re[k]*or_ - w_im[k]*oi;
+            const float xi = ei + w_re[k]*oi  + w_im[k]*or_;
 
-    const int half_N = N / 2;
-    if (N - half_N*2 == 1) {
-        dft(in, N, out);
-        return;
+            out[k] = xr*xr + xi*xi;
+        }
     }
+};
+
+} // namespace
+
+// number of frames processed together by a thread, the mel projection is a GEMM over such a block
+#define WHISPER_MEL_FRAME_BLOCK 16
 
-    float* even = in + N;
-    for (int i = 0; i < half_N; ++i) {
-        even[i]= in[2*i];
+// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
+//
+// the audio is padded with frame_size/2 reflected samples at the beginning and 30 seconds of zeros at the end
+// all frames that only need samples that already arrived are computed by push(), so only the frames overlapping
+// the end of the audio and the normalization (which needs the global max) are left for finish()
+struct whisper_mel_stream::impl {
+    const whisper_filters & filters;
+    const int n_threads;
+
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+    const int stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    const int stage_2_pad = WHISPER_N_FFT / 2;
+
+    rfft_plan fft;
+
+    // range of the non-zero coefficients of each mel filter, the filters are narrow triangles
+    std::vector<int> band_beg;
+    std::vector<int> band_end;
+
+    struct thread_work {
+        fft_work fft;
+        std::vector<float> frame;                     // windowed samples
+        std::vector<float> spec;                      // power spectrum of one frame
+        std::vector<float> spec_block;                // [n_fft][WHISPER_MEL_FRAME_BLOCK]
+        float acc[WHISPER_MEL_FRAME_BLOCK];
+        float mmax;
+    };
+    std::vector<thread_work> work;
+
+    // padded samples, pcm[0] is padded sample pcm_off; samples only needed by completed frames are dropped
+    std::vector<float> pcm;
+    int64_t pcm_off   = 0;
+    int64_t n_samples = 0;     // number of samples received
+    bool    started   = false; // the reflective padding at the beginning is in place
+
+    // log10 mel energies, [n_frames][n_mel]
+    std::vector<float> frames;
+    int64_t n_frames = 0;
+    float   mmax     = -1e20f;
+
+    impl(const whisper_filters & filters, int n_threads) :
+            filters(filters),
+            n_threads(std::max(1, n_threads)),
+            fft(WHISPER_N_FFT) {
+        // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
+        WHISPER_ASSERT(filters.n_fft == 1 + (frame_size / 2));
+
+        band_beg.resize(filters.n_mel, 0);
+        band_end.resize(filters.n_mel, 0);
+        for (int j = 0; j < filters.n_mel; j++) {
+            const float * row = filters.data.data() + j*filters.n_fft;
+            int k0 = 0;
+            int k1 = filters.n_fft;
+            while (k0 < k1 && row[k0]     == 0.0f) k0++;
+            while (k1 > k0 && row[k1 - 1] == 0.0f) k1--;
+            band_beg[j] = k0;
+            band_end[j] = k1;
+        }
+
+        work.resize(this->n_threads);
+        for (auto & w : work) {
+            w.frame.resize(frame_size);
+            w.spec.resize(filters.n_fft);
+            w.spec_block.resize(filters.n_fft * WHISPER_MEL_FRAME_BLOCK);
+        }
     }
-    float* even_fft = out + 2 * N;
-    fft(even, half_N, even_fft);
 
-    float* odd = even;
-    for (int i = 0; i < half_N; ++i) {
-        odd[i] = in[2*i + 1];
+    // add the reflected samples at the beginning, once enough samples are available (or at the end of the audio)
+    void start() {
+        std::vector<float> padded(stage_2_pad + pcm.size());
+        for (int p = 0; p < stage_2_pad; p++) {
+            const size_t i = stage_2_pad - p;
+            padded[p] = i < pcm.size() ? pcm[i] : 0.0f;
+        }
+        std::copy(pcm.begin(), pcm.end(), padded.begin() + stage_2_pad);
+        pcm = std::move(padded);
+        started = true;
     }
-    float* odd_fft = even_fft + N;
-    fft(odd, half_N, odd_fft);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < half_N; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = global_cache.cos_vals[idx]; // cos(t)
-        float im = -global_cache.sin_vals[idx]; // sin(t)
+    // windowed FFT + mel projection of frames [i0, i1), samples past the end of pcm are zeros
+    void compute_block(int64_t i0, int64_t i1, thread_work & w) {
+        const int n_fft = filters.n_fft;
+        const int n_mel = filters.n_mel;
+        const int nf    = (int)(i1 - i0);
+        const float * hann = global_cache.hann_window;
+
+        for (int f = 0; f < nf; f++) {
+            const int64_t offset = (i0 + f)*frame_step - pcm_off;
+            const int     n_avail = (int) std::max<int64_t>(0, std::min<int64_t>(frame_size, (int64_t) pcm.size() - offset));
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+            // apply Hann window
+            for (int j = 0; j < n_avail; j++) {
+                w.frame[j] = hann[j] * pcm[offset + j];
+            }
+            std::fill(w.frame.begin() + n_avail, w.frame.end(), 0.0f);
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+            fft.power_spectrum(w.frame.data(), w.spec.data(), w.fft);
 
-        out[2*(k + half_N) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + half_N) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+            for (int k = 0; k < n_fft; k++) {
+                w.spec_block[k*WHISPER_MEL_FRAME_BLOCK + f] = w.spec[k];
+            }
+        }
+
+        // mel spectrogram: [n_mel][n_fft] x [n_fft][nf], skipping the zero coefficients of each filter
+        for (int j = 0; j < n_mel; j++) {
+            std::fill(w.acc, w.acc + WHISPER_MEL_FRAME_BLOCK, 0.0f);
+            for (int k = band_beg[j]; k < band_end[j]; k++) {
+                const float   c = filters.data[j*n_fft + k];
+                const float * s = w.spec_block.data() + k*WHISPER_MEL_FRAME_BLOCK;
+                for (int f = 0; f < WHISPER_MEL_FRAME_BLOCK; f++) {
+                    w.acc[f] += c * s[f];
+                }
+            }
+            for (int f = 0; f < nf; f++) {
+                const float v = log10f(std::max(w.acc[f], 1e-10f));
+                frames[(i0 + f)*n_mel + j] = v;
+                w.mmax = std::max(w.mmax, v);
+            }
+        }
     }
-}
 
-static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
-                                              int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
-    std::vector<float> fft_in(frame_size * 2, 0.0);
-    std::vector<float> fft_out(frame_size * 2 * 2 * 2);
+    // compute frames [n_frames, i_end), distributing blocks of frames across threads
+    void compute_frames(int64_t i_end) {
+        if (i_end <= n_frames) {
+            return;
+        }
 
-    int n_fft = filters.n_fft;
-    int i = ith;
+        const int64_t i_beg = n_frames;
+        frames.resize(i_end * filters.n_mel);
 
-    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    WHISPER_ASSERT(n_fft == 1 + (frame_size / 2));
+        const int64_t n_blocks = (i_end - i_beg + WHISPER_MEL_FRAME_BLOCK - 1) / WHISPER_MEL_FRAME_BLOCK;
+        const int     nth      = (int) std::min<int64_t>(n_threads, n_blocks);
 
-    // calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
-        const int offset = i * frame_step;
+        auto worker = [&](int ith) {
+            thread_work & w = work[ith];
+            w.mmax = -1e20f;
+            for (int64_t ib = ith; ib < n_blocks; ib += nth) {
+                const int64_t i0 = i_beg + ib*WHISPER_MEL_FRAME_BLOCK;
+                compute_block(i0, std::min<int64_t>(i_end, i0 + WHISPER_MEL_FRAME_BLOCK), w);
+            }
+        };
 
-        // apply Hann window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
+        std::vector<std::thread> workers(nth - 1);
+        for (int iw = 0; iw < nth - 1; ++iw) {
+            workers[iw] = std::thread(worker, iw + 1);
         }
 
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
+        // main thread
+        worker(0);
+
+        for (int iw = 0; iw < nth - 1; ++iw) {
+            workers[iw].join();
         }
 
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
+        for (int ith = 0; ith < nth; ++ith) {
+            mmax = std::max(mmax, work[ith].mmax);
+        }
+        n_frames = i_end;
 
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+        // drop the samples that are not needed anymore
+        const int64_t n_drop = std::min<int64_t>(n_frames*frame_step - pcm_off, pcm.size());
+        if (n_drop > 0) {
+            pcm.erase(pcm.begin(), pcm.begin() + n_drop);
+            pcm_off += n_drop;
         }
+    }
 
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
+    void push(const float * samples, size_t n) {
+        pcm.insert(pcm.end(), samples, samples + n);
+        n_samples += n;
+
+        if (!started) {
+            if (n_samples <= stage_2_pad) {
+                return;
             }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
+            start();
         }
-    }
 
-    // Otherwise fft_out are all zero
-    double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
-        for (int j = 0; j < mel.n_mel; j++) {
-            mel.data[j * mel.n_len + i] = sum;
+        // frames whose window is fully available
+        const int64_t n_padded = stage_2_pad + n_samples;
+        if (n_padded >= frame_size) {
+            compute_frames((n_padded - frame_size)/frame_step + 1);
         }
     }
-}
 
-// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
-static bool log_mel_spectrogram(
-        const float * samples,
-        const int   n_samples,
-        const int   /*sample_rate*/,
-        const int   frame_size,
-        const int   frame_step,
-        const int   n_mel,
-        const int   n_threads,
-        const whisper_filters & filters,
-        const bool   debug,
-        whisper_mel & mel) {
-    //const int64_t t_start_us = ggml_time_us();
-
-    // Hann window
-    WHISPER_ASSERT(frame_size == WHISPER_N_FFT && "Unsupported frame_size");
-    const float * hann = global_cache.hann_window;
-
-    // Calculate the length of padding
-    int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
-    int64_t stage_2_pad = frame_size / 2;
-
-    // Initialize a vector and copy data from C array to it.
-    std::vector<float> samples_padded;
-    samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
-    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
-
-    // pad 30 seconds of zeros at the end of audio (480,000 samples) + reflective pad 200 samples at the end of audio
-    std::fill(samples_padded.begin() + n_samples + stage_2_pad, samples_padded.begin() + n_samples + stage_1_pad + 2 * stage_2_pad, 0);
-
-    // reflective pad 200 samples at the beginning of audio
-    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
-
-    mel.n_mel     = n_mel;
-    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
-    // Calculate number of frames + remove the last frame
-    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
-    // Calculate semi-padded sample length to ensure compatibility
-    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
-    mel.data.resize(mel.n_mel * mel.n_len);
-
-    {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, hann, std::cref(samples_padded),
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
+    bool finish(std::vector<whisper_mel> & output) {
+        if (n_samples == 0) {
+            // empty audio
+            return false;
+        }
+        if (!started) {
+            start();
         }
 
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
+        // Calculate number of frames + remove the last frame
+        const int64_t n_len = (n_samples + stage_1_pad + 2*stage_2_pad - frame_size) / frame_step;
 
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
+        // frames overlapping the audio, the rest of the window is zero
+        const int64_t n_data = std::min(n_len, (stage_2_pad + n_samples + frame_step - 1) / frame_step);
+        compute_frames(n_data);
+
+        // the remaining frames only contain the zero padding
+        const int n_mel = filters.n_mel;
+        const float silence = log10f(1e-10f);
+        frames.resize(n_len * n_mel, silence);
+        if (n_len > n_frames) {
+            mmax = std::max(mmax, silence);
         }
-    }
+        n_frames = n_len;
 
-    // clamping and normalization
-    double mmax = -1e20;
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] > mmax) {
-            mmax = mel.data[i];
+        // clamping and normalization
+        const float vmin = mmax - 8.0f;
+        for (auto & v : frames) {
+            v = (std::max(v, vmin) + 4.0f)/4.0f;
         }
-    }
 
-    mmax -= 8.0;
+        // because the cgraph in clip.cpp only accepts 3000 frames each, we need to split the mel
+        // we always expect the mel to have 3000 silent frames at the end
+        // printf("n_len %d\n", n_len);
+        const int64_t frames_per_chunk = 3000;
+        GGML_ASSERT(n_len > frames_per_chunk);
+        for (int64_t off = 0; off + frames_per_chunk <= n_len; off += frames_per_chunk) {
+            // last uncomplete chunk will always be a padded chunk, safe to ignore
+            whisper_mel out_chunk;
+            out_chunk.n_len     = frames_per_chunk;
+            out_chunk.n_mel     = n_mel;
+            out_chunk.n_len_org = n_mel; // unused
+            out_chunk.data.resize(n_mel * frames_per_chunk);
+
+            for (int64_t t = 0; t < frames_per_chunk; t++) {
+                const float * src = frames.data() + (off + t)*n_mel;
+                for (int j = 0; j < n_mel; j++) {
+                    out_chunk.data[j*frames_per_chunk + t] = src[j];
+                }
+            }
 
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] < mmax) {
-            mel.data[i] = mmax;
+            output.push_back(std::move(out_chunk));
         }
 
-        mel.data[i] = (mel.data[i] + 4.0)/4.0;
+        return true;
     }
+};
 
-    // Dump log_mel_spectrogram
-    if (debug) {
-        std::ofstream outFile("log_mel_spectrogram.json");
-        outFile << "[";
-        for (uint64_t i = 0; i < mel.data.size() - 1; i++) {
-            outFile << mel.data[i] << ", ";
-        }
-        outFile << mel.data[mel.data.size() - 1] << "]";
-        outFile.close();
-    }
+whisper_mel_stream::whisper_mel_stream(const whisper_filters & filters, int n_threads)
+    : pimpl(std::make_unique<impl>(filters, n_threads)) {}
+
+whisper_mel_stream::~whisper_mel_stream() = default;
 
-    return true;
+void whisper_mel_stream::push(const float * samples, size_t n_samples) {
+    pimpl->push(samples, n_samples);
+}
+
+bool whisper_mel_stream::finish(std::vector<whisper_mel> & output) {
+    return pimpl->finish(output);
 }
 
 bool preprocess_audio(
         const float * samples,
         size_t n_samples,
         const whisper_filters & filters,
+        int n_threads,
         std::vector<whisper_mel> & output) {
 
     if (n_samples == 0) {
@@ -289,48 +360,9 @@ bool preprocess_audio(
         return false;
     }
 
-    whisper_mel out_full;
-    bool ok = log_mel_spectrogram(
-                samples,
-                n_samples,
-                COMMON_SAMPLE_RATE,
-                WHISPER_N_FFT,
-                WHISPER_HOP_LENGTH,
-                filters.n_mel,
-                4, // n_threads
-                filters,
-                false, // debug
-                out_full);
-    if (!ok) {
-        return false;
-    }
-
-    // because the cgraph in clip.cpp only accepts 3000 frames each, we need to split the mel
-    // we always expect the mel to have 3000 silent frames at the end
-    // printf("n_len %d\n", out_full.n_len);
-    const size_t frames_per_chunk = 3000;
-    GGML_ASSERT((size_t)out_full.n_len > frames_per_chunk);
-    for (size_t off = 0; off < (size_t)out_full.n_len; off += frames_per_chunk) {
-        int n_len = std::min(frames_per_chunk, (size_t)out_full.n_len - off);
-        if ((size_t)n_len < frames_per_chunk) {
-            break; // last uncomplete chunk will always be a padded chunk, safe to ignore
-        }
-
-        whisper_mel out_chunk;
-        out_chunk.n_len     = n_len;
-        out_chunk.n_mel     = out_full.n_mel;
-        out_chunk.n_len_org = out_full.n_mel; // unused
-        out_chunk.data.reserve(out_chunk.n_mel * out_chunk.n_len);
-
-        for (int i = 0; i < out_full.n_mel; i++) {
-            auto src = out_full.data.begin() + i*out_full.n_len + off;
-            out_chunk.data.insert(out_chunk.data.end(), src, src + frames_per_chunk);
-        }
-
-        output.push_back(std::move(out_chunk));
-    }
-
-    return true;
+    whisper_mel_stream stream(filters, n_threads);
+    stream.push(samples, n_samples);
+    return stream.finish(output);
 }
 
 } // namespace whisper_preprocessor
@@ -3,6 +3,7 @@
 #include "ggml.h"
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -32,10 +33,29 @@ struct whisper_filters {
     std::vector<float> data;
 };
 
+// incremental log-mel spectrogram
+// samples can be pushed as they arrive: the FFT and the mel projection of a frame are computed as soon as its
+// window is complete, only the tail frames and the normalization (which needs the global max) are left to finish()
+struct whisper_mel_stream {
+    whisper_mel_stream(const whisper_filters & filters, int n_threads);
+    ~whisper_mel_stream();
+
+    void push(const float * samples, size_t n_samples);
+
+    // pad the end of the audio and output the normalized mel, split in chunks of 3000 frames
+    // the stream must not be used after this
+    bool finish(std::vector<whisper_mel> & output);
+
+private:
+    struct impl;
+    std::unique_ptr<impl> pimpl;
+};
+
 bool preprocess_audio(
         const float * samples,
         size_t n_samples,
         const whisper_filters & filters,
+        int n_threads,
         std::vector<whisper_mel> & output);
 
 } // namespace whisper_preprocessor
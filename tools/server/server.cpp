@@ -3,6 +3,8 @@
 
 #include "arg.h"
 #include "common.h"
+#include "ggml-cpp.h"
+#include "gguf.h"
 #include "json-schema-to-grammar.h"
 #include "llama.h"
 #include "log.h"
@@ -24,6 +26,8 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <filesystem>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <signal.h>
@@ -31,6 +35,13 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 using json = nlohmann::ordered_json;
 
 constexpr int HTTP_POLLING_SECONDS = 1;
@@ -45,6 +56,7 @@ enum stop_type {
 // state diagram: https://github.com/ggml-org/llama.cpp/pull/9283
 enum slot_state {
     SLOT_STATE_IDLE,
+    SLOT_STATE_WAIT_OTHER, // n > 1: waits for another slot of the request to process the prompt, then continues from a copy of it
     SLOT_STATE_STARTED, // TODO: this state is only used for setting up the initial prompt processing; maybe merge it with launch_slot_with_task in the future
     SLOT_STATE_PROCESSING_PROMPT,
     SLOT_STATE_DONE_PROMPT,
@@ -121,6 +133,9 @@ struct slot_params {
     int64_t t_max_prompt_ms  = -1; // TODO: implement
     int64_t t_max_predict_ms = -1; // if positive, limit the generation phase to this time limit
 
+    int32_t     priority = 0; // tasks with a higher priority get a slot first, and can preempt the slots of lower ones
+    std::string tenant;       // the tenants of the same priority take turns in the queue
+
     std::vector<common_adapter_lora_info> lora;
 
     std::vector<std::string> antiprompt;
@@ -141,6 +156,8 @@ struct slot_params {
     // Embeddings
     int32_t embd_normalize = 2; // (-1=none, 0=max absolute int16, 1=taxicab, 2=Euclidean/L2, >2=p-norm)
 
+    embd_encoding_type embd_encoding = EMBD_ENCODING_FLOAT;
+
     json to_json() const {
         std::vector<std::string> samplers;
         samplers.reserve(sampling.samplers.size());
@@ -208,10 +225,14 @@ struct slot_params {
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
             {"lora",                      lora},
+            {"priority",                  priority},
+            {"tenant",                    tenant},
         };
     }
 };
 
+struct server_slot_preempted;
+
 struct server_task {
     int id    = -1; // to be filled by server_queue
     int index = -1; // used when there are multiple prompts (batch request)
@@ -221,11 +242,22 @@ struct server_task {
     // used by SERVER_TASK_TYPE_CANCEL
     int id_target = -1;
 
+    int64_t t_queued = 0; // set by server_queue, the deferred tasks keep the time of the first post
+
     // used by SERVER_TASK_TYPE_INFERENCE
     slot_params   params;
     server_tokens prompt_tokens;
     int id_selected_slot = -1;
 
+    // set when the task resumes a request that was preempted, instead of starting a new one
+    std::shared_ptr<server_slot_preempted> preempted;
+
+    // set when the task passed the --max-queued-tokens check, it is not checked again when it is deferred again
+    bool admitted = false;
+
+    // n > 1: the other completions of the prompt, launched together with this task in slots that wait for its prompt
+    std::vector<server_task> children;
+
     // used by SERVER_TASK_TYPE_SLOT_SAVE, SERVER_TASK_TYPE_SLOT_RESTORE, SERVER_TASK_TYPE_SLOT_ERASE
     struct slot_action {
         int slot_id;
@@ -271,6 +303,8 @@ struct server_task {
         params.n_discard        = json_value(data, "n_discard",          defaults.n_discard);
       //params.t_max_prompt_ms  = json_value(data, "t_max_prompt_ms",    defaults.t_max_prompt_ms); // TODO: implement
         params.t_max_predict_ms = json_value(data, "t_max_predict_ms",   defaults.t_max_predict_ms);
+        params.priority         = json_value(data, "priority",           defaults.priority);
+        params.tenant           = json_value(data, "tenant",             defaults.tenant);
         params.response_fields  = json_value(data, "response_fields",   std::vector<std::string>());
 
         params.sampling.top_k              = json_value(data, "top_k",              defaults.sampling.top_k);
@@ -555,6 +589,9 @@ struct server_task {
         std::unordered_set<int> ids(tasks.size());
         for (size_t i = 0; i < tasks.size(); i++) {
             ids.insert(tasks[i].id);
+            for (const auto & child : tasks[i].children) {
+                ids.insert(child.id);
+            }
         }
         return ids;
     }
@@ -829,7 +866,7 @@ struct server_task_result_cmpl_final : server_task_result {
 
         json choice {
             {"finish_reason", finish_reason},
-            {"index", 0},
+            {"index", index},
             {"message", msg.to_json_oaicompat<json>()},
         };
 
@@ -879,7 +916,7 @@ struct server_task_result_cmpl_final : server_task_result {
                 {"choices", json::array({
                     json {
                         {"finish_reason", nullptr},
-                        {"index", 0},
+                        {"index", index},
                         {"delta", common_chat_msg_diff_to_json_oaicompat<json>(diff)},
                     },
                 })},
@@ -895,7 +932,7 @@ struct server_task_result_cmpl_final : server_task_result {
             {"choices", json::array({
                 json {
                     {"finish_reason", finish_reason},
-                    {"index", 0},
+                    {"index", index},
                     {"delta", json::object()},
                 },
             })},
@@ -1032,7 +1069,7 @@ struct server_task_result_cmpl_partial : server_task_result {
                 {"choices", json::array({
                     json {
                         {"finish_reason", nullptr},
-                        {"index", 0},
+                        {"index", index},
                         {"delta", delta},
                     },
                 })},
@@ -1073,12 +1110,179 @@ struct server_task_result_cmpl_partial : server_task_result {
     }
 };
 
+// writes the SSE events of the results of a stream
+// the partial results are formatted directly from the fields, without building the json objects, and the parts
+// that are the same for every event of the request (model, id, ...) are escaped once
+// the results that are not covered (probs, timings, tool calls, ...) use to_json()
+struct server_sse_writer {
+    // appends the events of the result to out
+    void write(server_task_result & result, std::string & out) {
+        auto * partial = dynamic_cast<server_task_result_cmpl_partial *>(&result);
+        if (partial != nullptr && write_partial(*partial, out)) {
+            return;
+        }
+
+        json res_json = result.to_json();
+        if (res_json.is_array()) {
+            for (const auto & res : res_json) {
+                out += format_sse("data", res);
+            }
+        } else {
+            out += format_sse("data", res_json);
+        }
+    }
+
+private:
+    // the key of the templates
+    std::string model;
+    std::string cmpl_id;
+    bool        has_tpl = false;
+
+    std::string tpl_cmpl; // end of a text_completion event, after "created"
+    std::string tpl_chat; // end of a chat.completion.chunk event, after "created"
+
+    void update_templates(const server_task_result_cmpl_partial & res) {
+        if (has_tpl && res.oaicompat_model == model && res.oaicompat_cmpl_id == cmpl_id) {
+            return;
+        }
+
+        model   = res.oaicompat_model;
+        cmpl_id = res.oaicompat_cmpl_id;
+        has_tpl = true;
+
+        auto dump = [](const std::string & str) {
+            return json(str).dump(-1, ' ', false, json::error_handler_t::replace);
+        };
+
+        tpl_cmpl = ",\"model\":"              + dump(model)
+                 + ",\"system_fingerprint\":" + dump(build_info)
+                 + ",\"object\":\"text_completion\""
+                 + ",\"id\":"                 + dump(cmpl_id) + "}\n\n";
+
+        tpl_chat = ",\"id\":"                 + dump(cmpl_id)
+                 + ",\"model\":"              + dump(model)
+                 + ",\"system_fingerprint\":" + dump(build_info)
+                 + ",\"object\":\"chat.completion.chunk\"}\n\n";
+    }
+
+    // returns false if the result needs to_json(), out is then unchanged
+    bool write_partial(server_task_result_cmpl_partial & res, std::string & out) {
+        if (!res.prob_output.probs.empty()) {
+            return false;
+        }
+
+        const size_t n_out = out.size();
+
+        bool ok = true;
+        switch (res.oaicompat) {
+            case OAICOMPAT_TYPE_NONE:
+                {
+                    if (res.timings.prompt_n > 0) {
+                        return false;
+                    }
+
+                    out += "data: {\"index\":";
+                    json_append_int(out, res.index);
+                    out += ",\"content\":";
+                    ok = json_append_string(out, res.content);
+                    out += ",\"tokens\":[";
+                    for (size_t i = 0; i < res.tokens.size(); ++i) {
+                        if (i > 0) {
+                            out += ',';
+                        }
+                        json_append_int(out, res.tokens[i]);
+                    }
+                    out += "],\"stop\":false,\"id_slot\":";
+                    json_append_int(out, res.id_slot);
+                    out += ",\"tokens_predicted\":";
+                    json_append_int(out, res.n_decoded);
+                    out += ",\"tokens_evaluated\":";
+                    json_append_int(out, res.n_prompt_tokens);
+                    out += "}\n\n";
+                } break;
+            case OAICOMPAT_TYPE_COMPLETION:
+                {
+                    if (res.verbose || res.timings.prompt_n >= 0) {
+                        return false;
+                    }
+                    update_templates(res);
+
+                    out += "data: {\"choices\":[{\"text\":";
+                    ok = json_append_string(out, res.content);
+                    out += ",\"index\":";
+                    json_append_int(out, res.index);
+                    out += ",\"logprobs\":null,\"finish_reason\":null}],\"created\":";
+                    json_append_int(out, std::time(0));
+                    out += tpl_cmpl;
+                } break;
+            case OAICOMPAT_TYPE_CHAT:
+                {
+                    if (res.timings.prompt_n >= 0) {
+                        return false;
+                    }
+                    for (const auto & diff : res.oaicompat_msg_diffs) {
+                        if (diff.tool_call_index != std::string::npos) {
+                            return false;
+                        }
+                    }
+                    update_templates(res);
+
+                    const std::time_t t = std::time(0);
+
+                    auto add_delta = [&](const common_chat_msg_diff * diff) {
+                        out += "data: {\"choices\":[{\"finish_reason\":null,\"index\":";
+                        json_append_int(out, res.index);
+                        out += ",\"delta\":{";
+                        if (diff == nullptr) {
+                            // initial update, to conform to openai behavior
+                            out += "\"role\":\"assistant\",\"content\":null";
+                        } else {
+                            if (!diff->reasoning_content_delta.empty()) {
+                                out += "\"reasoning_content\":";
+                                ok = ok && json_append_string(out, diff->reasoning_content_delta);
+                            }
+                            if (!diff->content_delta.empty()) {
+                                if (!diff->reasoning_content_delta.empty()) {
+                                    out += ',';
+                                }
+                                out += "\"content\":";
+                                ok = ok && json_append_string(out, diff->content_delta);
+                            }
+                        }
+                        out += "}}],\"created\":";
+                        json_append_int(out, t);
+                        out += tpl_chat;
+                    };
+
+                    if (res.n_decoded == 1) {
+                        add_delta(nullptr);
+                    }
+                    for (const auto & diff : res.oaicompat_msg_diffs) {
+                        add_delta(&diff);
+                    }
+                } break;
+            default:
+                return false;
+        }
+
+        if (!ok) {
+            // invalid UTF-8, replaced by the json serializer
+            out.resize(n_out);
+            return false;
+        }
+
+        return true;
+    }
+};
+
 struct server_task_result_embd : server_task_result {
     int index = 0;
     std::vector<std::vector<float>> embedding;
 
     int32_t n_tokens;
 
+    embd_encoding_type encoding = EMBD_ENCODING_FLOAT;
+
     // OAI-compat fields
     oaicompat_type oaicompat = OAICOMPAT_TYPE_NONE;
 
@@ -1093,16 +1297,20 @@ struct server_task_result_embd : server_task_result {
     }
 
     json to_json_non_oaicompat() {
+        json embd = json::array();
+        for (const auto & row : embedding) {
+            embd.push_back(embd_to_json(row, encoding));
+        }
         return json {
             {"index",     index},
-            {"embedding", embedding},
+            {"embedding", embd},
         };
     }
 
     json to_json_oaicompat() {
         return json {
             {"index",            index},
-            {"embedding",        embedding[0]},
+            {"embedding",        embd_to_json(embedding[0], encoding)},
             {"tokens_evaluated", n_tokens},
         };
     }
@@ -1203,6 +1411,9 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_preempted_total = 0;
+    uint64_t n_rejected_total  = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1227,6 +1438,9 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_preempted_total",               n_preempted_total },
+            { "n_rejected_total",                n_rejected_total },
+
             { "slots",                           slots_data },
         };
     }
@@ -1304,6 +1518,9 @@ struct server_slot {
     // the index relative to completion multi-task request
     size_t index = 0;
 
+    // SLOT_STATE_WAIT_OTHER: the task of the slot that processes the prompt
+    int id_task_parent = -1;
+
     struct slot_params params;
 
     slot_state state = SLOT_STATE_IDLE;
@@ -1356,6 +1573,8 @@ struct server_slot {
     // stats
     size_t n_sent_text        = 0; // number of sent text character
 
+    int64_t t_queued     = 0;
+    int64_t t_last_token = 0; // 0 until the first token is sent
     int64_t t_start_process_prompt;
     int64_t t_start_generation;
 
@@ -1380,6 +1599,8 @@ struct server_slot {
         stopping_word      = "";
         n_past             = 0;
         n_sent_text        = 0;
+        id_task_parent     = -1;
+        t_last_token       = 0;
         task_type          = SERVER_TASK_TYPE_COMPLETION;
         chat_format        = COMMON_CHAT_FORMAT_CONTENT_ONLY;
 
@@ -1394,6 +1615,24 @@ struct server_slot {
         n_draft_accepted = 0;
     }
 
+    // exchange the requests of two slots, each slot keeps its id, its contexts, its speculative decoding state and the
+    // adapters set for its sequence. used to move the request of a preempted slot out, and to resume it in any slot
+    void swap_request(server_slot & other) {
+        std::swap(*this, other);
+
+        std::swap(id,                  other.id);
+        std::swap(batch_spec,          other.batch_spec);
+        std::swap(ctx,                 other.ctx);
+        std::swap(ctx_dft,             other.ctx_dft);
+        std::swap(mctx,                other.mctx);
+        std::swap(spec,                other.spec);
+        std::swap(lora,                other.lora);
+        std::swap(n_ctx,               other.n_ctx);
+        std::swap(n_predict,           other.n_predict);
+        std::swap(t_last_used,         other.t_last_used);
+        std::swap(callback_on_release, other.callback_on_release);
+    }
+
     bool need_embd() const {
         return server_task_type_need_embd(task_type);
     }
@@ -1410,8 +1649,9 @@ struct server_slot {
             (llama_get_memory(ctx) && llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_LAST);
     }
 
+    // the LoRA adapters are set per sequence, so the slots with different adapters are batched together
     bool can_batch_with(server_slot & other_slot) const {
-        return task_type == other_slot.task_type && are_lora_equal(lora, other_slot.lora);
+        return task_type == other_slot.task_type;
     }
 
     bool has_budget(const common_params & global_params) {
@@ -1461,8 +1701,9 @@ struct server_slot {
         result_timings timings;
         timings.prompt_n = n_prompt_tokens_processed;
         timings.prompt_ms = t_prompt_processing;
-        timings.prompt_per_token_ms = t_prompt_processing / n_prompt_tokens_processed;
-        timings.prompt_per_second = 1e3 / t_prompt_processing * n_prompt_tokens_processed;
+        // the slots that continue from the prompt of another slot (n > 1) process no prompt token
+        timings.prompt_per_token_ms = n_prompt_tokens_processed > 0 ? t_prompt_processing / n_prompt_tokens_processed : 0.0;
+        timings.prompt_per_second   = n_prompt_tokens_processed > 0 ? 1e3 / t_prompt_processing * n_prompt_tokens_processed : 0.0;
 
         timings.predicted_n = n_decoded;
         timings.predicted_ms = t_token_generation;
@@ -1570,6 +1811,135 @@ struct server_slot {
     }
 };
 
+// request of a preempted slot, waiting in the deferred queue for a slot to resume it
+struct server_slot_preempted {
+    server_slot          slot;     // holds the request only, the resources stay with the slot that was preempted
+    std::vector<uint8_t> seq_data; // KV data of the sequence, from llama_state_seq_get_data()
+
+    ~server_slot_preempted() {
+        if (slot.smpl != nullptr) {
+            common_sampler_free(slot.smpl);
+        }
+    }
+};
+
+// histogram with fixed buckets, recorded without locks from any thread and exported in the Prometheus format
+struct server_histogram {
+    const char * name;
+    const char * help;
+
+    std::vector<int64_t> bounds; // upper bounds of the buckets, in the recorded unit
+    double scale;                // exported value = recorded value * scale
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts; // one per bucket, the last one is +Inf
+    std::atomic<uint64_t> sum { 0 };
+
+    server_histogram(const char * name, const char * help, std::vector<int64_t> bounds, double scale)
+        : name(name), help(help), bounds(std::move(bounds)), scale(scale),
+          counts(new std::atomic<uint64_t>[this->bounds.size() + 1]) {
+        for (size_t i = 0; i <= this->bounds.size(); ++i) {
+            counts[i] = 0;
+        }
+    }
+
+    // times in us, exported in seconds
+    static server_histogram time(const char * name, const char * help) {
+        return server_histogram(name, help, {
+            100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+            1000000, 2500000, 5000000, 10000000, 30000000, 60000000 }, 1e-6);
+    }
+
+    static server_histogram tokens(const char * name, const char * help) {
+        return server_histogram(name, help, { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192 }, 1.0);
+    }
+
+    void record(int64_t val) {
+        val = std::max<int64_t>(val, 0);
+
+        // a bucket counts the values <= its bound
+        const size_t i = std::lower_bound(bounds.begin(), bounds.end(), val) - bounds.begin();
+
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(val, std::memory_order_relaxed);
+    }
+
+    void to_prometheus(std::ostream & os) const {
+        os << "# HELP llamacpp:" << name << " " << help << "\n"
+           << "# TYPE llamacpp:" << name << " histogram\n";
+
+        // the buckets are cumulative
+        uint64_t n = 0;
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            n += counts[i].load(std::memory_order_relaxed);
+            os << "llamacpp:" << name << "_bucket{le=\"" << bounds[i] * scale << "\"} " << n << "\n";
+        }
+        n += counts[bounds.size()].load(std::memory_order_relaxed);
+
+        os << "llamacpp:" << name << "_bucket{le=\"+Inf\"} " << n << "\n"
+           << "llamacpp:" << name << "_sum "   << sum.load(std::memory_order_relaxed) * scale << "\n"
+           << "llamacpp:" << name << "_count " << n << "\n";
+    }
+};
+
+// Chrome trace of the main loop, enabled with --trace-file
+// the events are only written by the main loop, in the JSON array format, which chrome://tracing and Perfetto
+// also load when the file was not closed
+struct server_trace {
+    FILE * file = nullptr;
+    bool   first = true;
+
+    ~server_trace() {
+        close();
+    }
+
+    bool open(const std::string & fname) {
+        file = fopen(fname.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        fprintf(file, "[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"main loop\"}}");
+        first = false;
+        return true;
+    }
+
+    void close() {
+        if (file != nullptr) {
+            fprintf(file, "\n]\n");
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool enabled() const {
+        return file != nullptr;
+    }
+
+    // name of the lane tid: 0 is the main loop, 1 + id for the slots
+    void set_lane_name(int tid, const std::string & lane) {
+        if (file == nullptr) {
+            return;
+        }
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", tid, lane.c_str());
+        first = false;
+    }
+
+    // phase from t_start to t_end (ggml_time_us()), with an optional integer argument
+    void add(const char * name, int tid, int64_t t_start, int64_t t_end, const char * arg_name = nullptr, int64_t arg = 0) {
+        if (file == nullptr) {
+            return;
+        }
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64,
+                first ? "" : ",\n", name, tid, t_start, std::max<int64_t>(t_end - t_start, 0));
+        if (arg_name != nullptr) {
+            fprintf(file, ",\"args\":{\"%s\":%" PRId64 "}", arg_name, arg);
+        }
+        fprintf(file, "}");
+        first = false;
+    }
+};
+
 struct server_metrics {
     int64_t t_start = 0;
 
@@ -1587,10 +1957,28 @@ struct server_metrics {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_preempted_total = 0;
+    uint64_t n_rejected_total  = 0;
+
+    // distributions, read by /metrics without going through the task queue
+    server_histogram queue_wait   = server_histogram::time  ("queue_wait_seconds",          "Time spent by the tasks in the queue before they get a slot.");
+    server_histogram ttft         = server_histogram::time  ("time_to_first_token_seconds", "Time from the arrival of the task to its first generated token.");
+    server_histogram itl          = server_histogram::time  ("inter_token_latency_seconds", "Time between two generated tokens of a task.");
+    server_histogram batch_size   = server_histogram::tokens("batch_size_tokens",           "Number of tokens per llama_decode() call.");
+    server_histogram t_decode     = server_histogram::time  ("decode_seconds",              "Time of the llama_decode() calls (graph compute).");
+    server_histogram t_sampling   = server_histogram::time  ("sampling_seconds",            "Time spent sampling the slots after each llama_decode() call.");
+    server_histogram t_http_write = server_histogram::time  ("http_write_seconds",          "Time spent by the HTTP layer to format and send the events of a stream.");
+
     void init() {
         t_start = ggml_time_us();
     }
 
+    void to_prometheus(std::ostream & os) const {
+        for (const auto * h : { &queue_wait, &ttft, &itl, &batch_size, &t_decode, &t_sampling, &t_http_write }) {
+            h->to_prometheus(os);
+        }
+    }
+
     void on_prompt_eval(const server_slot & slot) {
         n_prompt_tokens_processed_total += slot.n_prompt_tokens_processed;
         n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
@@ -1633,6 +2021,10 @@ struct server_queue {
     std::mutex mutex_tasks;
     std::condition_variable condition_tasks;
 
+    // turn of the last deferred task of each tenant, see pop_deferred_task()
+    std::unordered_map<std::string, uint64_t> tenant_turn;
+    uint64_t n_turns = 0;
+
     // callback functions
     std::function<void(server_task &&)> callback_new_task;
     std::function<void(void)>           callback_update_slots;
@@ -1646,6 +2038,9 @@ struct server_queue {
             cleanup_pending_task(task.id_target);
         }
         const int task_id = task.id;
+        if (task.t_queued == 0) {
+            task.t_queued = ggml_time_us();
+        }
         QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
         if (front) {
             queue_tasks.push_front(std::move(task));
@@ -1667,6 +2062,9 @@ struct server_queue {
             if (task.type == SERVER_TASK_TYPE_CANCEL) {
                 cleanup_pending_task(task.id_target);
             }
+            if (task.t_queued == 0) {
+                task.t_queued = ggml_time_us();
+            }
             QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
             if (front) {
                 queue_tasks.push_front(std::move(task));
@@ -1704,15 +2102,45 @@ struct server_queue {
     }
 
     // Call when the state of one slot is changed, it will move one task from deferred to main queue
-    void pop_deferred_task() {
+    // the task with the highest priority goes first, then the preempted requests, and the tenants take turns
+    // the tasks with n > 1 that need more than n_slots_free slots are skipped
+    void pop_deferred_task(size_t n_slots_free) {
         std::unique_lock<std::mutex> lock(mutex_tasks);
-        if (!queue_tasks_deferred.empty()) {
-            queue_tasks.emplace_back(std::move(queue_tasks_deferred.front()));
-            queue_tasks_deferred.pop_front();
+        auto best = queue_tasks_deferred.end();
+        for (auto it = queue_tasks_deferred.begin(); it != queue_tasks_deferred.end(); ++it) {
+            if (it->children.size() + 1 > n_slots_free) {
+                continue;
+            }
+            if (best == queue_tasks_deferred.end() || deferred_before(*it, *best)) {
+                best = it;
+            }
+        }
+        if (best != queue_tasks_deferred.end()) {
+            tenant_turn[best->params.tenant] = ++n_turns;
+
+            queue_tasks.emplace_back(std::move(*best));
+            queue_tasks_deferred.erase(best);
         }
         condition_tasks.notify_one();
     }
 
+    // sum of f() over the deferred tasks
+    int64_t sum_deferred(const std::function<int64_t(const server_task &)> & f) {
+        std::unique_lock<std::mutex> lock(mutex_tasks);
+        int64_t res = 0;
+        for (const auto & task : queue_tasks_deferred) {
+            res += f(task);
+        }
+        return res;
+    }
+
+    // remove the pending tasks of a cancelled task, called by the main loop when the task is not in a slot
+    // post() can miss it while it is being deferred by the main loop
+    void cleanup_cancelled_task(int id_target) {
+        std::unique_lock<std::mutex> lock(mutex_tasks);
+        cleanup_pending_task(id_target);
+    }
+
     // end the start_loop routine
     void terminate() {
         std::unique_lock<std::mutex> lock(mutex_tasks);
@@ -1773,10 +2201,25 @@ struct server_queue {
     }
 
 private:
+    // true if a must leave the deferred queue before b, otherwise the order of the queue is kept
+    bool deferred_before(const server_task & a, const server_task & b) const {
+        if (a.params.priority != b.params.priority) {
+            return a.params.priority > b.params.priority;
+        }
+        if ((a.preempted != nullptr) != (b.preempted != nullptr)) {
+            return a.preempted != nullptr;
+        }
+
+        const auto it_a = tenant_turn.find(a.params.tenant);
+        const auto it_b = tenant_turn.find(b.params.tenant);
+
+        return (it_a == tenant_turn.end() ? 0 : it_a->second) < (it_b == tenant_turn.end() ? 0 : it_b->second);
+    }
+
     void cleanup_pending_task(int id_target) {
-        // no need lock because this is called exclusively by post()
+        // no need lock because the callers hold mutex_tasks
         auto rm_func = [id_target](const server_task & task) {
-            return task.id_target == id_target;
+            return task.id == id_target || task.id_target == id_target;
         };
         queue_tasks.erase(
             std::remove_if(queue_tasks.begin(),          queue_tasks.end(),          rm_func),
@@ -1787,107 +2230,166 @@ private:
     }
 };
 
-struct server_response {
-    bool running = true;
+// results of the tasks of one request: sent by the main loop, received by the HTTP thread of the request
+// it is a single-producer single-consumer queue, so a result only wakes up the thread that waits for it
+struct server_result_channel {
+    struct node {
+        server_task_result_ptr result;
+        std::atomic<node *>    next { nullptr };
+    };
+
+    node * head; // consumer side, always points to an already consumed node
+    node * tail; // producer side
+
+    // set while the consumer sleeps, the producer only locks the mutex to wake it up
+    std::atomic<bool> waiting { false };
+
+    std::mutex mutex;
+    std::condition_variable cv;
 
-    // for keeping track of all tasks waiting for the result
-    std::unordered_set<int> waiting_task_ids;
+    // set when the consumer is an event loop instead of a thread, called by the producer for each result
+    std::function<void()> on_ready;
+    std::atomic<bool> has_on_ready { false };
+
+    server_result_channel() {
+        head = tail = new node;
+    }
+
+    ~server_result_channel() {
+        while (head != nullptr) {
+            node * next = head->next.load();
+            delete head;
+            head = next;
+        }
+    }
+
+    server_result_channel(const server_result_channel &) = delete;
+    server_result_channel & operator=(const server_result_channel &) = delete;
+
+    // producer
+    void push(server_task_result_ptr && result) {
+        node * n = new node;
+        n->result = std::move(result);
+
+        tail->next.store(n);
+        tail = n;
+
+        if (has_on_ready.load()) {
+            on_ready();
+        } else if (waiting.load()) {
+            wake();
+        }
+    }
+
+    // consumer, must be called before has_on_ready is read by the producer
+    void set_on_ready(std::function<void()> fn) {
+        on_ready = std::move(fn);
+        has_on_ready = true;
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cv.notify_one();
+    }
+
+    // consumer, returns nullptr if there is no result
+    server_task_result_ptr pop() {
+        node * next = head->next.load();
+        if (next == nullptr) {
+            return nullptr;
+        }
+
+        server_task_result_ptr res = std::move(next->result);
+        delete head;
+        head = next;
+
+        return res;
+    }
+
+    // consumer, blocks until there is a result, returns false on timeout
+    bool wait(const std::atomic<bool> & running, const std::chrono::steady_clock::time_point * t_end) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting = true;
+
+        // checked after setting waiting: either the producer sees it or we see the new result
+        bool ready = true;
+        while (running && head->next.load() == nullptr) {
+            if (t_end == nullptr) {
+                cv.wait(lock);
+            } else if (cv.wait_until(lock, *t_end) == std::cv_status::timeout) {
+                ready = head->next.load() != nullptr;
+                break;
+            }
+        }
+
+        waiting = false;
+
+        return ready;
+    }
+};
+
+using server_result_channel_ptr = std::shared_ptr<server_result_channel>;
+
+struct server_response {
+    std::atomic<bool> running { true };
 
-    // the main result queue (using ptr for polymorphism)
-    std::vector<server_task_result_ptr> queue_results;
+    // channel of each task waiting for the result, the tasks of a request share the same channel
+    std::unordered_map<int, server_result_channel_ptr> channels;
 
-    std::mutex mutex_results;
-    std::condition_variable condition_results;
+    std::mutex mutex_channels;
 
     // add the id_task to the list of tasks waiting for response
     void add_waiting_task_id(int id_task) {
-        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) waiting_task_ids.size());
+        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) channels.size());
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.insert(id_task);
+        auto channel = std::make_shared<server_result_channel>();
+
+        std::unique_lock<std::mutex> lock(mutex_channels);
+        channels[id_task] = channel;
     }
 
     void add_waiting_tasks(const std::vector<server_task> & tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+        auto channel = std::make_shared<server_result_channel>();
+
+        std::unique_lock<std::mutex> lock(mutex_channels);
 
         for (const auto & task : tasks) {
-            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) waiting_task_ids.size());
-            waiting_task_ids.insert(task.id);
+            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) channels.size());
+            channels[task.id] = channel;
+
+            for (const auto & child : task.children) {
+                channels[child.id] = channel;
+            }
         }
     }
 
     // when the request is finished, we can remove task associated with it
+    // the pending results are freed with the channel
     void remove_waiting_task_id(int id_task) {
-        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
+        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) channels.size());
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.erase(id_task);
-        // make sure to clean up all pending results
-        queue_results.erase(
-            std::remove_if(queue_results.begin(), queue_results.end(), [id_task](const server_task_result_ptr & res) {
-                return res->id == id_task;
-            }),
-            queue_results.end());
+        std::unique_lock<std::mutex> lock(mutex_channels);
+        channels.erase(id_task);
     }
 
     void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+        std::unique_lock<std::mutex> lock(mutex_channels);
 
         for (const auto & id_task : id_tasks) {
-            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
-            waiting_task_ids.erase(id_task);
+            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) channels.size());
+            channels.erase(id_task);
         }
     }
 
     // This function blocks the thread until there is a response for one of the id_tasks
     server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-            condition_results.wait(lock, [&]{
-                if (!running) {
-                    SRV_DBG("%s : queue result stop\n", __func__);
-                    std::terminate(); // we cannot return here since the caller is HTTP code
-                }
-                return !queue_results.empty();
-            });
-
-            for (size_t i = 0; i < queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
-            }
-        }
-
-        // should never reach here
+        return recv_impl(id_tasks, -1);
     }
 
     // same as recv(), but have timeout in seconds
     // if timeout is reached, nullptr is returned
     server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-
-            for (int i = 0; i < (int) queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
-            }
-
-            std::cv_status cr_res = condition_results.wait_for(lock, std::chrono::seconds(timeout));
-            if (!running) {
-                SRV_DBG("%s : queue result stop\n", __func__);
-                std::terminate(); // we cannot return here since the caller is HTTP code
-            }
-            if (cr_res == std::cv_status::timeout) {
-                return nullptr;
-            }
-        }
-
-        // should never reach here
+        return recv_impl(id_tasks, timeout);
     }
 
     // single-task version of recv()
@@ -1896,50 +2398,121 @@ struct server_response {
         return recv(id_tasks);
     }
 
+    // non-blocking version of recv(), for the event loop of the HTTP streams
+    // on_ready is called by the main loop each time a result is sent to one of the id_tasks
+    server_result_channel_ptr subscribe(const std::unordered_set<int> & id_tasks, std::function<void()> on_ready) {
+        server_result_channel_ptr channel = get_channel(id_tasks);
+        channel->set_on_ready(std::move(on_ready));
+        return channel;
+    }
+
+    // returns nullptr if there is no result
+    server_task_result_ptr try_recv(const server_result_channel_ptr & channel, const std::unordered_set<int> & id_tasks) {
+        while (server_task_result_ptr res = channel->pop()) {
+            if (id_tasks.find(res->id) != id_tasks.end()) {
+                return res;
+            }
+        }
+
+        return nullptr;
+    }
+
     // Send a new result to a waiting id_task
     void send(server_task_result_ptr && result) {
         SRV_DBG("sending result for task id = %d\n", result->id);
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        for (const auto & id_task : waiting_task_ids) {
-            if (result->id == id_task) {
-                SRV_DBG("task id = %d pushed to result queue\n", result->id);
-
-                queue_results.emplace_back(std::move(result));
-                condition_results.notify_all();
+        server_result_channel_ptr channel;
+        {
+            std::unique_lock<std::mutex> lock(mutex_channels);
+            auto it = channels.find(result->id);
+            if (it == channels.end()) {
                 return;
             }
+            channel = it->second;
         }
+
+        SRV_DBG("task id = %d pushed to result queue\n", result->id);
+
+        // note: results are only sent from the main loop, so there is a single producer per channel
+        channel->push(std::move(result));
     }
 
     // terminate the waiting loop
     void terminate() {
         running = false;
-        condition_results.notify_all();
-    }
-};
-
-struct server_context {
-    common_params params_base;
-
-    // note: keep these alive - they determine the lifetime of the model, context, etc.
-    common_init_result llama_init;
-    common_init_result llama_init_dft;
-
-    llama_model * model = nullptr;
-    llama_context * ctx = nullptr;
 
-    // multimodal
-    mtmd_context * mctx = nullptr;
+        std::unique_lock<std::mutex> lock(mutex_channels);
+        for (auto & it : channels) {
+            it.second->wake();
+        }
+    }
 
-    const llama_vocab * vocab = nullptr;
-    bool vocab_dft_compatible = true;
+private:
+    server_result_channel_ptr get_channel(const std::unordered_set<int> & id_tasks) {
+        std::unique_lock<std::mutex> lock(mutex_channels);
+        for (const auto & id_task : id_tasks) {
+            auto it = channels.find(id_task);
+            if (it != channels.end()) {
+                return it->second;
+            }
+        }
 
-    llama_model * model_dft = nullptr;
+        // none of the tasks is waiting, no result will come
+        return std::make_shared<server_result_channel>();
+    }
 
-    llama_context_params cparams_dft;
+    // timeout in seconds, -1 to wait without timeout
+    server_task_result_ptr recv_impl(const std::unordered_set<int> & id_tasks, int timeout) {
+        server_result_channel_ptr channel = get_channel(id_tasks);
 
-    llama_batch batch {};
+        const auto t_end = std::chrono::steady_clock::now() + std::chrono::seconds(std::max(timeout, 0));
+
+        while (true) {
+            server_task_result_ptr res = channel->pop();
+            if (res == nullptr) {
+                const bool ready = channel->wait(running, timeout < 0 ? nullptr : &t_end);
+                if (!running) {
+                    SRV_DBG("%s : queue result stop\n", __func__);
+                    std::terminate(); // we cannot return here since the caller is HTTP code
+                }
+                if (!ready) {
+                    return nullptr;
+                }
+                continue;
+            }
+
+            if (id_tasks.find(res->id) != id_tasks.end()) {
+                return res;
+            }
+
+            // result of a task that was removed from the waiting list (e.g. cancelled), drop it
+        }
+
+        // should never reach here
+    }
+};
+
+struct server_context {
+    common_params params_base;
+
+    // note: keep these alive - they determine the lifetime of the model, context, etc.
+    common_init_result llama_init;
+    common_init_result llama_init_dft;
+
+    llama_model * model = nullptr;
+    llama_context * ctx = nullptr;
+
+    // multimodal
+    mtmd_context * mctx = nullptr;
+
+    const llama_vocab * vocab = nullptr;
+    bool vocab_dft_compatible = true;
+
+    llama_model * model_dft = nullptr;
+
+    llama_context_params cparams_dft;
+
+    llama_batch batch {};
 
     bool clean_kv_cache = true;
     bool add_bos_token  = true;
@@ -1950,10 +2523,16 @@ struct server_context {
     std::vector<server_slot> slots;
     json default_generation_settings_for_props;
 
+    // the embedding and rerank tasks of an encoder without memory, see update_embd_packed()
+    bool embd_packed = false;
+
+    std::vector<server_task> queue_embd;
+
     server_queue    queue_tasks;
     server_response queue_results;
 
     server_metrics metrics;
+    server_trace   trace;
 
     // Necessary similarity of prompt for slot selection
     float slot_prompt_similarity = 0.0f;
@@ -1998,6 +2577,9 @@ struct server_context {
 
         vocab = llama_model_get_vocab(model);
 
+        // the adapters are set for the sequence of each slot when a task is launched
+        llama_clear_adapter_lora(ctx);
+
         n_ctx = llama_n_ctx(ctx);
 
         add_bos_token = llama_vocab_get_add_bos(vocab);
@@ -2077,6 +2659,12 @@ struct server_context {
             }
         }
 
+        // the per-request LoRA adapters and the multimodal inputs still go through the slots
+        embd_packed = params_base.embedding && llama_get_memory(ctx) == nullptr && mctx == nullptr && params_base.lora_adapters.empty();
+        if (embd_packed) {
+            SRV_INF("embeddings are packed by length, up to %d inputs per batch (--parallel)\n", llama_n_seq_max(ctx));
+        }
+
         if (!llama_memory_can_shift(llama_get_memory(ctx))) {
             if (params_base.ctx_shift) {
                 params_base.ctx_shift = false;
@@ -2132,7 +2720,7 @@ struct server_context {
             slot.params.n_keep = params_base.n_keep;
 
             slot.callback_on_release = [this](int) {
-                queue_tasks.pop_deferred_task();
+                queue_tasks.pop_deferred_task(n_slots_free());
             };
 
             slot.reset();
@@ -2151,6 +2739,17 @@ struct server_context {
 
         metrics.init();
 
+        if (!params_base.trace_file.empty()) {
+            if (trace.open(params_base.trace_file)) {
+                SRV_INF("writing the trace of the main loop to %s\n", params_base.trace_file.c_str());
+                for (const auto & slot : slots) {
+                    trace.set_lane_name(1 + slot.id, "slot " + std::to_string(slot.id));
+                }
+            } else {
+                SRV_ERR("failed to open trace file %s\n", params_base.trace_file.c_str());
+            }
+        }
+
         oai_parser_opt = {
             /* use_jinja             */ params_base.use_jinja,
             /* prefill_assistant     */ params_base.prefill_assistant,
@@ -2173,6 +2772,16 @@ struct server_context {
         return nullptr;
     }
 
+    // number of slots that are not processing a task
+    size_t n_slots_free() const {
+        size_t n = 0;
+        for (const server_slot & slot : slots) {
+            n += !slot.is_processing();
+        }
+
+        return n;
+    }
+
     server_slot * get_available_slot(const server_task & task) {
         server_slot * ret = nullptr;
 
@@ -2243,11 +2852,20 @@ struct server_context {
         slot.task_type     = task.type;
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
+        slot.t_queued      = task.t_queued;
+
+        {
+            const int64_t t_now = ggml_time_us();
+            metrics.queue_wait.record(t_now - task.t_queued);
+            trace.add("queue", 1 + slot.id, task.t_queued, t_now, "id_task", task.id);
+        }
 
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora is changed, we cannot reuse cached tokens
             slot.cache_tokens.clear();
             slot.lora = slot.params.lora;
+
+            common_set_adapter_lora_seq(ctx, slot.id, slot.lora);
         }
 
         if (!slot.prompt_tokens.validate(ctx)) {
@@ -2288,6 +2906,177 @@ struct server_context {
         return true;
     }
 
+    // KV cells a task is projected to use: its prompt and the tokens it can generate, within the context of a slot
+    int64_t n_tokens_projected(const server_task & task) const {
+        const slot_params   & params        = task.preempted ? task.preempted->slot.params        : task.params;
+        const server_tokens & prompt_tokens = task.preempted ? task.preempted->slot.prompt_tokens : task.prompt_tokens;
+
+        const int32_t n_ctx_slot = slots.front().n_ctx;
+
+        int32_t n_predict = server_task_type_need_embd(task.type) ? 0 : params.n_predict;
+        if (n_predict < 0) {
+            n_predict = params_base.n_predict < 0 ? n_ctx_slot : params_base.n_predict;
+        }
+
+        // the completions of a task with n > 1 share the cells of the prompt
+        const int64_t n_children = task.children.size();
+
+        return std::min<int64_t>(prompt_tokens.size() + n_predict, n_ctx_slot) + n_children*std::min<int64_t>(n_predict, n_ctx_slot);
+    }
+
+    // defer a task until a slot is free, or reject it when the tasks that wait with the same or a higher priority
+    // are projected to use more KV cells than --max-queued-tokens, so that the clients can retry elsewhere
+    void defer_task(server_task && task) {
+        const int32_t n_max = params_base.n_queued_tokens_max;
+
+        if (n_max > 0 && task.preempted == nullptr && !task.admitted) {
+            const int32_t priority = task.params.priority;
+
+            const int64_t n_queued = queue_tasks.sum_deferred([&](const server_task & t) {
+                return t.params.priority >= priority ? n_tokens_projected(t) : 0;
+            });
+            const int64_t n_tokens = n_tokens_projected(task);
+
+            if (n_queued > 0 && n_queued + n_tokens > n_max) {
+                SRV_WRN("rejecting task %d, n_tokens = %" PRId64 ", n_queued = %" PRId64 ", max = %d\n", task.id, n_tokens, n_queued, n_max);
+
+                metrics.n_rejected_total++;
+                send_error(task, "The server is busy, too many tokens are queued", ERROR_TYPE_UNAVAILABLE);
+                return;
+            }
+        }
+
+        task.admitted = true;
+
+        queue_tasks.defer(std::move(task));
+    }
+
+    // the slot to preempt for a task that did not find a free slot: a completion with a lower priority than the task,
+    // the lowest first, then the one with the least KV data to save
+    server_slot * get_slot_to_preempt(const server_task & task) {
+        server_slot * ret = nullptr;
+
+        for (server_slot & slot : slots) {
+            if (slot.state != SLOT_STATE_PROCESSING_PROMPT && slot.state != SLOT_STATE_GENERATING) {
+                continue;
+            }
+            if (slot.task_type != SERVER_TASK_TYPE_COMPLETION && slot.task_type != SERVER_TASK_TYPE_INFILL) {
+                continue;
+            }
+            if (slot.params.priority >= task.params.priority) {
+                continue;
+            }
+
+            if (ret == nullptr || slot.params.priority < ret->params.priority ||
+                    (slot.params.priority == ret->params.priority && slot.cache_tokens.size() < ret->cache_tokens.size())) {
+                ret = &slot;
+            }
+        }
+
+        return ret;
+    }
+
+    // save the KV data of the sequence of the slot and move its request out, the slot is then free
+    // the request is deferred with its priority and resumed by resume_slot() in the next free slot
+    bool preempt_slot(server_slot & slot) {
+        auto preempted = std::make_shared<server_slot_preempted>();
+
+        const size_t size = llama_state_seq_get_size(ctx, slot.id);
+
+        preempted->seq_data.resize(size);
+        if (llama_state_seq_get_data(ctx, preempted->seq_data.data(), size, slot.id) != size) {
+            SLT_ERR(slot, "%s", "failed to save the KV data of the sequence\n");
+            return false;
+        }
+
+        llama_memory_seq_rm(llama_get_memory(ctx), slot.id, -1, -1);
+
+        SLT_INF(slot, "preempting task %d, priority = %d, n_past = %d, saved %.3f MiB\n",
+                slot.id_task, slot.params.priority, slot.n_past, size / (1024.0 * 1024.0));
+
+        preempted->slot.id = -1;
+        preempted->slot.swap_request(slot);
+
+        slot.cache_tokens.has_mtmd = mctx != nullptr;
+
+        server_task task(preempted->slot.task_type);
+        task.id              = preempted->slot.id_task;
+        task.index           = preempted->slot.index;
+        task.t_queued        = preempted->slot.t_queued;
+        task.params.priority = preempted->slot.params.priority;
+        task.params.tenant   = preempted->slot.params.tenant;
+        task.preempted       = std::move(preempted);
+
+        metrics.n_preempted_total++;
+        queue_tasks.defer(std::move(task));
+
+        return true;
+    }
+
+    // continue a preempted request in a free slot
+    bool resume_slot(server_slot & slot, server_task && task) {
+        server_slot_preempted & preempted = *task.preempted;
+
+        llama_memory_seq_rm(llama_get_memory(ctx), slot.id, -1, -1);
+        if (llama_state_seq_set_data(ctx, preempted.seq_data.data(), preempted.seq_data.size(), slot.id) == 0) {
+            slot.cache_tokens.clear();
+            send_error(task, "Failed to restore the preempted request", ERROR_TYPE_SERVER);
+            return false;
+        }
+
+        // the slot gets the request, its previous cache is freed with the preempted state
+        slot.swap_request(preempted.slot);
+
+        if (!are_lora_equal(slot.params.lora, slot.lora)) {
+            slot.lora = slot.params.lora;
+
+            common_set_adapter_lora_seq(ctx, slot.id, slot.lora);
+        }
+
+        SLT_INF(slot, "resuming task %d, n_past = %d\n", slot.id_task, slot.n_past);
+
+        return true;
+    }
+
+    // n > 1: the slots that wait for the prompt of the slot continue from a copy of its sequence, and sample their first
+    // token from the same logits. the cells are shared when the sequences are in the same KV stream, and copied otherwise
+    void fork_slot(server_slot & slot) {
+        for (server_slot & child : slots) {
+            if (child.state != SLOT_STATE_WAIT_OTHER || child.id_task_parent != slot.id_task) {
+                continue;
+            }
+
+            llama_memory_seq_rm(llama_get_memory(ctx), child.id, -1, -1);
+            llama_memory_seq_cp(llama_get_memory(ctx), slot.id, child.id, -1, -1);
+
+            child.prompt_tokens   = slot.prompt_tokens.clone();
+            child.cache_tokens    = slot.cache_tokens.clone();
+            child.n_prompt_tokens = slot.n_prompt_tokens;
+            child.n_past          = slot.n_past;
+            child.truncated       = slot.truncated;
+            child.params.n_keep   = slot.params.n_keep;
+
+            child.n_prompt_tokens_processed = 0;
+            child.t_start_process_prompt    = ggml_time_us();
+            child.t_start_generation        = 0;
+
+            common_sampler_reset(child.smpl);
+
+            for (int i = 0; i < child.n_prompt_tokens; ++i) {
+                llama_token id = child.prompt_tokens[i];
+                if (id != LLAMA_TOKEN_NULL) {
+                    common_sampler_accept(child.smpl, id, false);
+                }
+            }
+
+            child.n_decoded = 0;
+            child.i_batch   = slot.i_batch;
+            child.state     = SLOT_STATE_DONE_PROMPT;
+
+            SLT_INF(child, "continuing from the prompt of task %d, n_past = %d\n", slot.id_task, child.n_past);
+        }
+    }
+
     void kv_cache_clear() {
         SRV_DBG("%s", "clearing KV cache\n");
 
@@ -2297,6 +3086,16 @@ struct server_context {
     }
 
     bool process_token(completion_token_output & result, server_slot & slot) {
+        {
+            const int64_t t_now = ggml_time_us();
+            if (slot.t_last_token == 0) {
+                metrics.ttft.record(t_now - slot.t_queued);
+            } else {
+                metrics.itl.record(t_now - slot.t_last_token);
+            }
+            slot.t_last_token = t_now;
+        }
+
         // remember which tokens were sampled - used for repetition penalties during sampling
         const std::string token_str = result.text_to_send;
         slot.sampled = result.tok;
@@ -2558,6 +3357,10 @@ struct server_context {
     }
 
     void send_final_response(server_slot & slot) {
+        if (slot.t_start_generation > 0) {
+            trace.add("generation", 1 + slot.id, slot.t_start_generation, ggml_time_us(), "n_tokens", slot.n_decoded);
+        }
+
         auto res = std::make_unique<server_task_result_cmpl_final>();
         res->id              = slot.id_task;
         res->id_slot         = slot.id;
@@ -2607,38 +3410,44 @@ struct server_context {
     }
 
     void send_embedding(const server_slot & slot, const llama_batch & batch) {
+        send_embedding(slot.id_task, slot.index, slot.n_prompt_tokens, slot.params, slot.id, batch);
+    }
+
+    // the embeddings of the tokens of sequence seq_id in the batch, or of the sequence when there is pooling
+    void send_embedding(int id_task, int index, int32_t n_tokens, const slot_params & params, llama_seq_id seq_id, const llama_batch & batch) {
         auto res = std::make_unique<server_task_result_embd>();
-        res->id        = slot.id_task;
-        res->index     = slot.index;
-        res->n_tokens  = slot.n_prompt_tokens;
-        res->oaicompat = slot.params.oaicompat;
+        res->id        = id_task;
+        res->index     = index;
+        res->n_tokens  = n_tokens;
+        res->encoding  = params.embd_encoding;
+        res->oaicompat = params.oaicompat;
 
         const int n_embd = llama_model_n_embd(model);
 
         std::vector<float> embd_res(n_embd, 0.0f);
 
         for (int i = 0; i < batch.n_tokens; ++i) {
-            if (!batch.logits[i] || batch.seq_id[i][0] != slot.id) {
+            if (!batch.logits[i] || batch.seq_id[i][0] != seq_id) {
                 continue;
             }
 
             const float * embd = nullptr;
-            if (llama_pooling_type(slot.ctx) == LLAMA_POOLING_TYPE_NONE) {
+            if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE) {
                 embd = llama_get_embeddings_ith(ctx, i);
             } else {
                 embd = llama_get_embeddings_seq(ctx, batch.seq_id[i][0]);
             }
 
             if (embd == nullptr) {
-                SLT_ERR(slot, "failed to get embeddings, token = %d, seq_id = %d\n", batch.token[i], batch.seq_id[i][0]);
+                SRV_ERR("failed to get embeddings, id_task = %d, token = %d, seq_id = %d\n", id_task, batch.token[i], batch.seq_id[i][0]);
 
                 res->embedding.push_back(std::vector<float>(n_embd, 0.0f));
                 continue;
             }
 
             // normalize only when there is pooling
-            if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE) {
-                common_embd_normalize(embd, embd_res.data(), n_embd, slot.params.embd_normalize);
+            if (llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE) {
+                common_embd_normalize(embd, embd_res.data(), n_embd, params.embd_normalize);
                 res->embedding.push_back(embd_res);
                 break;
             } else {
@@ -2646,19 +3455,23 @@ struct server_context {
             }
         }
 
-        SLT_DBG(slot, "%s", "sending embeddings\n");
+        SRV_DBG("sending embeddings, id_task = %d\n", id_task);
 
         queue_results.send(std::move(res));
     }
 
     void send_rerank(const server_slot & slot, const llama_batch & batch) {
+        send_rerank(slot.id_task, slot.index, slot.n_prompt_tokens, slot.id, batch);
+    }
+
+    void send_rerank(int id_task, int index, int32_t n_tokens, llama_seq_id seq_id, const llama_batch & batch) {
         auto res = std::make_unique<server_task_result_rerank>();
-        res->id    = slot.id_task;
-        res->index = slot.index;
-        res->n_tokens = slot.n_prompt_tokens;
+        res->id       = id_task;
+        res->index    = index;
+        res->n_tokens = n_tokens;
 
         for (int i = 0; i < batch.n_tokens; ++i) {
-            if (!batch.logits[i] || batch.seq_id[i][0] != slot.id) {
+            if (!batch.logits[i] || batch.seq_id[i][0] != seq_id) {
                 continue;
             }
 
@@ -2668,7 +3481,7 @@ struct server_context {
             }
 
             if (embd == NULL) {
-                SLT_ERR(slot, "failed to get embeddings, token = %d, seq_id = %d\n", batch.token[i], batch.seq_id[i][0]);
+                SRV_ERR("failed to get embeddings, id_task = %d, token = %d, seq_id = %d\n", id_task, batch.token[i], batch.seq_id[i][0]);
 
                 res->score = -1e6;
                 continue;
@@ -2677,11 +3490,104 @@ struct server_context {
             res->score = embd[0];
         }
 
-        SLT_DBG(slot, "sending rerank result, res.score = %f\n", res->score);
+        SRV_DBG("sending rerank result, id_task = %d, res.score = %f\n", id_task, res->score);
 
         queue_results.send(std::move(res));
     }
 
+    // embeddings and reranking with an encoder that has no memory do not need a slot: the inputs of the queued tasks
+    // are packed into ubatches of inputs with a similar length, each input is a sequence of the ubatch
+    void update_embd_packed() {
+        const int32_t n_ubatch  = llama_n_ubatch(ctx);
+        const int32_t n_seq_max = llama_n_seq_max(ctx);
+
+        std::stable_sort(queue_embd.begin(), queue_embd.end(), [](const server_task & a, const server_task & b) {
+            return a.prompt_tokens.size() < b.prompt_tokens.size();
+        });
+
+        // the oldest task goes first, with its neighbours by length as long as they fit
+        size_t i0 = 0;
+        for (size_t i = 1; i < queue_embd.size(); ++i) {
+            if (queue_embd[i].id < queue_embd[i0].id) {
+                i0 = i;
+            }
+        }
+
+        const int32_t n_oldest = queue_embd[i0].prompt_tokens.size();
+
+        size_t  i1       = i0 + 1;
+        int32_t n_tokens = n_oldest;
+        while ((int32_t) (i1 - i0) < n_seq_max) {
+            const int32_t n_left  = i0 > 0                 ? queue_embd[i0 - 1].prompt_tokens.size() : INT32_MAX;
+            const int32_t n_right = i1 < queue_embd.size() ? queue_embd[i1    ].prompt_tokens.size() : INT32_MAX;
+
+            const bool fit_left  = n_left  != INT32_MAX && n_tokens + n_left  <= n_ubatch;
+            const bool fit_right = n_right != INT32_MAX && n_tokens + n_right <= n_ubatch;
+
+            if (fit_left && (!fit_right || n_oldest - n_left <= n_right - n_oldest)) {
+                n_tokens += n_left;
+                i0 -= 1;
+            } else if (fit_right) {
+                n_tokens += n_right;
+                i1 += 1;
+            } else {
+                break;
+            }
+        }
+
+        common_batch_clear(batch);
+
+        const int64_t t_start = ggml_time_us();
+
+        for (size_t i = i0; i < i1; ++i) {
+            const server_task & task = queue_embd[i];
+
+            metrics.queue_wait.record(t_start - task.t_queued);
+
+            for (size_t j = 0; j < task.prompt_tokens.size(); ++j) {
+                common_batch_add(batch, task.prompt_tokens[j], j, { (llama_seq_id) (i - i0) }, true);
+            }
+        }
+
+        llama_set_embeddings(ctx, true);
+
+        const int ret = llama_encode(ctx, batch);
+
+        const int64_t t_end = ggml_time_us();
+
+        metrics.n_decode_total++;
+        metrics.n_prompt_tokens_processed_total += batch.n_tokens;
+        metrics.n_prompt_tokens_processed       += batch.n_tokens;
+        metrics.t_prompt_processing_total       += (t_end - t_start) / 1000;
+        metrics.t_prompt_processing             += (t_end - t_start) / 1000;
+        metrics.batch_size.record(batch.n_tokens);
+        metrics.t_decode.record(t_end - t_start);
+        trace.add("encode", 0, t_start, t_end, "n_tokens", batch.n_tokens);
+
+        SRV_DBG("encoded %d inputs, n_tokens = %d, ret = %d\n", (int) (i1 - i0), batch.n_tokens, ret);
+
+        for (size_t i = i0; i < i1; ++i) {
+            const server_task & task = queue_embd[i];
+            const llama_seq_id seq_id = i - i0;
+
+            if (ret != 0) {
+                send_error(task, "Compute error.", ERROR_TYPE_SERVER);
+            } else if (task.type == SERVER_TASK_TYPE_RERANK) {
+                send_rerank(task.id, task.index, task.prompt_tokens.size(), seq_id, batch);
+            } else {
+                send_embedding(task.id, task.index, task.prompt_tokens.size(), task.params, seq_id, batch);
+            }
+        }
+
+        queue_embd.erase(queue_embd.begin() + i0, queue_embd.begin() + i1);
+
+        if (!queue_embd.empty()) {
+            server_task task(SERVER_TASK_TYPE_NEXT_RESPONSE);
+            task.id = queue_tasks.get_new_id();
+            queue_tasks.post(std::move(task));
+        }
+    }
+
     //
     // Functions to create new task(s) and receive result(s)
     //
@@ -2781,6 +3687,43 @@ struct server_context {
         }
     }
 
+    // non-blocking version of receive_cmpl_results_stream(), used by the event loop of the HTTP streams
+    // returns false when the stream is finished: all the tasks are stopped, or an error occurred
+    bool poll_cmpl_results_stream(
+            const std::unordered_set<int> & id_tasks,
+            const server_result_channel_ptr & channel,
+            size_t & n_finished,
+            const std::function<bool(server_task_result_ptr&)> & result_handler,
+            const std::function<void(json)> & error_handler) {
+        while (true) {
+            server_task_result_ptr result = queue_results.try_recv(channel, id_tasks);
+            if (result == nullptr) {
+                return true;
+            }
+
+            if (result->is_error()) {
+                error_handler(result->to_json());
+                cancel_tasks(id_tasks);
+                return false;
+            }
+
+            GGML_ASSERT(
+                dynamic_cast<server_task_result_cmpl_partial*>(result.get()) != nullptr
+                || dynamic_cast<server_task_result_cmpl_final*>(result.get()) != nullptr
+            );
+            if (!result_handler(result)) {
+                cancel_tasks(id_tasks);
+                return false;
+            }
+
+            if (result->is_stop()) {
+                if (++n_finished == id_tasks.size()) {
+                    return false;
+                }
+            }
+        }
+    }
+
     //
     // Functions to process the task
     //
@@ -2792,38 +3735,108 @@ struct server_context {
             case SERVER_TASK_TYPE_EMBEDDING:
             case SERVER_TASK_TYPE_RERANK:
                 {
+                    if (embd_packed && server_task_type_need_embd(task.type)) {
+                        if ((int32_t) task.prompt_tokens.size() > (int32_t) llama_n_ubatch(ctx)) {
+                            send_error(task, "input is too large to process. increase the physical batch size", ERROR_TYPE_SERVER);
+                            break;
+                        }
+                        queue_embd.push_back(std::move(task));
+                        break;
+                    }
+
                     const int id_slot = task.id_selected_slot;
 
                     server_slot * slot = id_slot != -1 ? get_slot_by_id(id_slot) : get_available_slot(task);
 
+                    if (slot == nullptr && task.children.empty()) {
+                        // a task with a higher priority takes the slot of a lower one
+                        server_slot * slot_preempt = get_slot_to_preempt(task);
+                        if (slot_preempt != nullptr && preempt_slot(*slot_preempt)) {
+                            slot = slot_preempt;
+                        }
+                    }
+
                     if (slot == nullptr) {
                         // if no slot is available, we defer this task for processing later
                         SRV_DBG("no slot is available, defer task, id_task = %d\n", task.id);
-                        queue_tasks.defer(std::move(task));
+                        defer_task(std::move(task));
                         break;
                     }
 
                     if (slot->is_processing()) {
                         // if requested slot is unavailable, we defer this task for processing later
                         SRV_DBG("requested slot is unavailable, defer task, id_task = %d\n", task.id);
-                        queue_tasks.defer(std::move(task));
+                        defer_task(std::move(task));
+                        break;
+                    }
+
+                    if (task.preempted) {
+                        if (!resume_slot(*slot, std::move(task))) {
+                            SRV_ERR("failed to resume task, id_task = %d\n", task.id);
+                            queue_tasks.pop_deferred_task(n_slots_free());
+                        }
+                        break;
+                    }
+
+                    // n > 1: all the completions of the prompt start together, in free slots
+                    std::vector<server_slot *> slots_children;
+                    for (server_slot & other : slots) {
+                        if (slots_children.size() < task.children.size() && &other != slot && !other.is_processing()) {
+                            slots_children.push_back(&other);
+                        }
+                    }
+
+                    if (slots_children.size() < task.children.size()) {
+                        SRV_DBG("not enough free slots for n = %zu, defer task, id_task = %d\n", task.children.size() + 1, task.id);
+                        defer_task(std::move(task));
+                        // the free slots go to a deferred task that fits in them
+                        queue_tasks.pop_deferred_task(n_slots_free());
                         break;
                     }
 
+                    const int id_task = task.id;
+
+                    std::vector<server_task> children = std::move(task.children);
+
                     if (!launch_slot_with_task(*slot, std::move(task))) {
                         SRV_ERR("failed to launch slot with task, id_task = %d\n", task.id);
+                        queue_tasks.pop_deferred_task(n_slots_free());
                         break;
                     }
+
+                    // the other slots continue from a copy of the prompt of the first one, see fork_slot()
+                    for (size_t i = 0; i < children.size(); ++i) {
+                        server_slot & child = *slots_children[i];
+
+                        if (!launch_slot_with_task(child, std::move(children[i]))) {
+                            SRV_ERR("failed to launch slot with task, id_task = %d\n", children[i].id);
+                            queue_tasks.pop_deferred_task(n_slots_free());
+                            continue;
+                        }
+
+                        child.state          = SLOT_STATE_WAIT_OTHER;
+                        child.id_task_parent = id_task;
+                    }
                 } break;
             case SERVER_TASK_TYPE_CANCEL:
                 {
                     // release slot linked with the task id
+                    bool found = false;
                     for (auto & slot : slots) {
                         if (slot.id_task == task.id_target) {
                             slot.release();
+                            found = true;
                             break;
                         }
                     }
+                    if (!found) {
+                        // the task is not started yet
+                        queue_tasks.cleanup_cancelled_task(task.id_target);
+
+                        queue_embd.erase(std::remove_if(queue_embd.begin(), queue_embd.end(), [&](const server_task & t) {
+                            return t.id == task.id_target;
+                        }), queue_embd.end());
+                    }
                 } break;
             case SERVER_TASK_TYPE_NEXT_RESPONSE:
                 {
@@ -2870,6 +3883,9 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    res->n_preempted_total       = metrics.n_preempted_total;
+                    res->n_rejected_total        = metrics.n_rejected_total;
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -3002,6 +4018,12 @@ struct server_context {
     }
 
     void update_slots() {
+        const int64_t t_update_start = ggml_time_us();
+
+        if (!queue_embd.empty()) {
+            update_embd_packed();
+        }
+
         // check if all slots are idle
         {
             bool all_idle = true;
@@ -3031,13 +4053,33 @@ struct server_context {
             queue_tasks.post(std::move(task));
         }
 
-        // apply context-shift if needed
-        // TODO: simplify and improve
+        // n > 1: the slots that wait for a prompt that is no longer processed (the slot was preempted, or stopped with an
+        // error) process it themselves
         for (server_slot & slot : slots) {
-            if (slot.is_processing() && slot.n_past + 1 >= slot.n_ctx) {
-                if (!params_base.ctx_shift) {
-                    // this check is redundant (for good)
-                    // we should never get here, because generation should already stopped in process_token()
+            if (slot.state != SLOT_STATE_WAIT_OTHER) {
+                continue;
+            }
+
+            const bool has_parent = std::any_of(slots.begin(), slots.end(), [&](const server_slot & other) {
+                return other.id_task == slot.id_task_parent && (
+                        other.state == SLOT_STATE_STARTED ||
+                        other.state == SLOT_STATE_PROCESSING_PROMPT ||
+                        other.state == SLOT_STATE_DONE_PROMPT);
+            });
+
+            if (!has_parent) {
+                SLT_WRN(slot, "task %d stopped before the end of the prompt, processing it in this slot\n", slot.id_task_parent);
+                slot.state = SLOT_STATE_STARTED;
+            }
+        }
+
+        // apply context-shift if needed
+        // TODO: simplify and improve
+        for (server_slot & slot : slots) {
+            if (slot.is_processing() && slot.n_past + 1 >= slot.n_ctx) {
+                if (!params_base.ctx_shift) {
+                    // this check is redundant (for good)
+                    // we should never get here, because generation should already stopped in process_token()
                     slot.release();
                     send_error(slot, "context shift is disabled", ERROR_TYPE_SERVER);
                     continue;
@@ -3423,12 +4465,11 @@ struct server_context {
         SRV_DBG("decoding batch, n_tokens = %d\n", batch.n_tokens);
 
         if (slot_batched) {
-            // apply lora, only need to do it once per batch
-            common_set_adapter_lora(ctx, slot_batched->lora);
-
             llama_set_embeddings(ctx, slot_batched->need_embd());
         }
 
+        trace.add("batch", 0, t_update_start, ggml_time_us(), "n_tokens", batch.n_tokens);
+
         int32_t i_next = 0;
 
         // process the created batch of tokens
@@ -3445,9 +4486,16 @@ struct server_context {
                 batch.logits   + i,
             };
 
+            const int64_t t_decode_start = ggml_time_us();
+
             const int ret = llama_decode(ctx, batch_view);
 
+            const int64_t t_decode_end = ggml_time_us();
+
             metrics.on_decoded(slots);
+            metrics.batch_size.record(n_tokens);
+            metrics.t_decode.record(t_decode_end - t_decode_start);
+            trace.add("decode", 0, t_decode_start, t_decode_end, "n_tokens", n_tokens);
 
             if (ret != 0) {
                 {
@@ -3492,6 +4540,15 @@ struct server_context {
             // on successful decode, restore the original batch size
             n_batch = llama_n_batch(ctx);
 
+            int64_t t_sampling = 0;
+            int     n_sampled  = 0;
+
+            for (auto & slot : slots) {
+                if (slot.state == SLOT_STATE_DONE_PROMPT && slot.i_batch >= (int) i && slot.i_batch < (int) (i + n_tokens)) {
+                    fork_slot(slot);
+                }
+            }
+
             for (auto & slot : slots) {
                 if (slot.i_batch < (int) i || slot.i_batch >= (int) (i + n_tokens)) {
                     continue; // continue loop of slots
@@ -3521,6 +4578,8 @@ struct server_context {
 
                 const int tok_idx = slot.i_batch - i;
 
+                const int64_t t_sample_start = ggml_time_us();
+
                 llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
 
                 slot.i_batch = -1;
@@ -3531,10 +4590,14 @@ struct server_context {
 
                 const int64_t t_current = ggml_time_us();
 
+                t_sampling += t_current - t_sample_start;
+                n_sampled++;
+
                 if (slot.n_decoded == 1) {
                     slot.t_start_generation = t_current;
                     slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
                     metrics.on_prompt_eval(slot);
+                    trace.add("prompt", 1 + slot.id, slot.t_start_process_prompt, t_current, "n_tokens", slot.n_prompt_tokens_processed);
                 }
 
                 slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
@@ -3558,6 +4621,11 @@ struct server_context {
                 }
             }
 
+            if (n_sampled > 0) {
+                metrics.t_sampling.record(t_sampling);
+                trace.add("sample", 0, t_decode_end, ggml_time_us(), "n_slots", n_sampled);
+            }
+
             // do speculative decoding
             for (auto & slot : slots) {
                 if (!slot.is_processing() || !slot.can_speculate()) {
@@ -3622,8 +4690,16 @@ struct server_context {
 
                 SLT_DBG(slot, "decoding speculative batch, size = %d\n", slot.batch_spec.n_tokens);
 
+                const int64_t t_spec_start = ggml_time_us();
+
                 llama_decode(ctx, slot.batch_spec);
 
+                const int64_t t_spec_end = ggml_time_us();
+
+                metrics.batch_size.record(slot.batch_spec.n_tokens);
+                metrics.t_decode.record(t_spec_end - t_spec_start);
+                trace.add("decode_spec", 0, t_spec_start, t_spec_end, "n_tokens", slot.batch_spec.n_tokens);
+
                 // the accepted tokens from the speculation
                 const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, draft);
 
@@ -3704,6 +4780,712 @@ inline void signal_handler(int signal) {
     shutdown_handler(signal);
 }
 
+//
+// HTTP streams
+//
+// The HTTP thread of a streaming completion parses the request, writes the response headers and hands the socket
+// over to the event loop of server_http_streams, which writes the SSE events as the results arrive. A stream then
+// costs a socket and a buffer instead of a thread of the HTTP pool, so many idle or slow clients do not block the
+// other requests. Only plain HTTP on Linux is handed over; with SSL the stream is written by the HTTP thread.
+//
+// Like the writes of httplib, a stream is closed when the client does not read anything for --timeout-write
+// seconds. The results are not produced while more than max_out bytes are waiting to be sent, they stay in the
+// channel of the stream.
+//
+
+#ifdef __linux__
+
+struct server_http_streams {
+    // appends the next events to out, returns false when the stream is finished
+    using produce_t = std::function<bool(std::string & out)>;
+
+    // called once when the stream is closed, finished is false if the client disconnected before the end
+    using close_t = std::function<void(bool finished)>;
+
+    // socket of the request processed by the current HTTP thread, set by server_http
+    static thread_local socket_t cur_sock;
+    static thread_local bool     cur_handed_over;
+
+    explicit server_http_streams(int timeout_write) : t_timeout_us(int64_t(timeout_write) * 1000000) {
+        fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+        fd_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd_epoll < 0 || fd_event < 0) {
+            SRV_WRN("%s: failed to create the event loop, the streams are written by the HTTP threads\n", __func__);
+            return;
+        }
+
+        epoll_event ev = {};
+        ev.events   = EPOLLIN;
+        ev.data.u64 = 0; // the ids of the streams start at 1
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_event, &ev);
+
+        running = true;
+        thread  = std::thread([this]() { loop(); });
+    }
+
+    ~server_http_streams() {
+        stop();
+
+        if (fd_epoll >= 0) {
+            close(fd_epoll);
+        }
+        if (fd_event >= 0) {
+            close(fd_event);
+        }
+    }
+
+    // closes all the streams
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        signal();
+
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    // true if the response of the current HTTP thread can be handed over
+    bool can_hand_over() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running && cur_sock != INVALID_SOCKET && !cur_handed_over;
+    }
+
+    // the id must be known before the stream is handed over, to subscribe to the results
+    int new_id() {
+        return next_id.fetch_add(1);
+    }
+
+    // there are new results for the stream id, can be called from any thread
+    void notify(int id) {
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            was_empty = ready.empty() && pending.empty();
+            ready.push_back(id);
+        }
+        if (was_empty) {
+            signal();
+        }
+    }
+
+    // takes the socket of the current HTTP thread, the headers of the chunked response are already written
+    void hand_over(int id, produce_t && produce, close_t && on_close) {
+        auto s = std::make_unique<stream>();
+        s->id       = id;
+        s->sock     = cur_sock;
+        s->produce  = std::move(produce);
+        s->on_close = std::move(on_close);
+
+        cur_handed_over = true;
+
+        bool was_empty = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (running) {
+                was_empty = ready.empty() && pending.empty();
+                pending.push_back(std::move(s));
+            }
+        }
+        if (s) {
+            // stopped in the meantime
+            drop(*s);
+            return;
+        }
+        if (was_empty) {
+            signal();
+        }
+    }
+
+private:
+    struct stream {
+        int      id;
+        socket_t sock;
+
+        produce_t produce;
+        close_t   on_close;
+
+        std::string out; // chunks not sent yet
+        size_t      n_sent   = 0;
+        bool        finished = false; // the last chunk is in out
+        bool        held     = false; // results were not produced because out was full
+        uint32_t    events   = 0;
+        int64_t     t_send   = 0;     // last time out was empty or something was sent
+    };
+
+    // pending bytes of a stream above which its results are not produced
+    static constexpr size_t max_out = 1024*1024;
+
+    const int64_t t_timeout_us;
+
+    int fd_epoll = -1;
+    int fd_event = -1;
+
+    std::thread thread;
+    std::atomic<int> next_id { 1 };
+
+    std::mutex mutex;
+    bool running = false;
+    std::vector<std::unique_ptr<stream>> pending; // new streams
+    std::vector<int> ready;                       // streams with new results
+
+    // only used by the thread of the loop
+    std::unordered_map<int, std::unique_ptr<stream>> streams;
+    std::string payload;
+
+    void signal() {
+        if (fd_event >= 0) {
+            const uint64_t one = 1;
+            GGML_UNUSED(write(fd_event, &one, sizeof(one)));
+        }
+    }
+
+    void loop() {
+        std::vector<std::unique_ptr<stream>> new_streams;
+        std::vector<int> new_ready;
+        std::vector<int> resumed; // held streams that can take more results
+
+        epoll_event evs[64];
+
+        int64_t t_check = ggml_time_us();
+
+        while (true) {
+            // wake up every second to check the write timeouts
+            const int n = epoll_wait(fd_epoll, evs, 64, streams.empty() ? -1 : 1000);
+            if (n < 0 && errno != EINTR) {
+                SRV_ERR("%s: epoll_wait failed: %s\n", __func__, strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                if (evs[i].data.u64 == 0) {
+                    uint64_t val;
+                    GGML_UNUSED(read(fd_event, &val, sizeof(val)));
+                    continue;
+                }
+
+                auto it = streams.find((int) evs[i].data.u64);
+                if (it == streams.end()) {
+                    continue;
+                }
+
+                if (evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                    close_stream(it, false);
+                } else if (evs[i].events & EPOLLOUT) {
+                    const stream & s = *it->second;
+                    if (flush(it) && s.held && s.out.size() - s.n_sent <= max_out) {
+                        resumed.push_back(s.id);
+                    }
+                }
+            }
+
+            const int64_t t_now = ggml_time_us();
+            if (t_now - t_check >= 1000000) {
+                t_check = t_now;
+                for (auto it = streams.begin(); it != streams.end();) {
+                    const stream & s = *it->second;
+                    if (!s.out.empty() && t_now - s.t_send > t_timeout_us) {
+                        SRV_WRN("%s: closing stream %d, the client did not read for %d s\n", __func__, s.id, int(t_timeout_us / 1000000));
+                        close_stream(it++, false);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!running) {
+                    break;
+                }
+                new_streams.swap(pending);
+                new_ready.swap(ready);
+            }
+            new_ready.insert(new_ready.end(), resumed.begin(), resumed.end());
+            resumed.clear();
+
+            for (auto & s : new_streams) {
+                const int id = s->id;
+
+                const int flags = fcntl(s->sock, F_GETFL, 0);
+                fcntl(s->sock, F_SETFL, flags | O_NONBLOCK);
+
+                epoll_event ev = {};
+                ev.events   = s->events = EPOLLRDHUP;
+                ev.data.u64 = id;
+                if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, s->sock, &ev) != 0) {
+                    SRV_ERR("%s: epoll_ctl failed: %s\n", __func__, strerror(errno));
+                    drop(*s);
+                    continue;
+                }
+
+                streams.emplace(id, std::move(s));
+
+                // the results received before the stream was handed over
+                new_ready.push_back(id);
+            }
+            new_streams.clear();
+
+            for (int id : new_ready) {
+                auto it = streams.find(id);
+                if (it == streams.end() || it->second->finished) {
+                    continue;
+                }
+
+                stream & s = *it->second;
+
+                // the results wait in the channel until the client reads the previous ones
+                s.held = s.out.size() - s.n_sent > max_out;
+                if (s.held) {
+                    continue;
+                }
+
+                if (s.out.empty()) {
+                    s.t_send = ggml_time_us();
+                }
+
+                payload.clear();
+                s.finished = !s.produce(payload);
+
+                if (!payload.empty()) {
+                    char hdr[32];
+                    snprintf(hdr, sizeof(hdr), "%zx\r\n", payload.size());
+                    s.out += hdr;
+                    s.out += payload;
+                    s.out += "\r\n";
+                }
+                if (s.finished) {
+                    s.out += "0\r\n\r\n";
+                }
+
+                flush(it);
+            }
+            new_ready.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+            new_streams.swap(pending);
+        }
+        for (auto & s : new_streams) {
+            drop(*s);
+        }
+        while (!streams.empty()) {
+            close_stream(streams.begin(), false);
+        }
+    }
+
+    // closes a stream that is not in the loop
+    static void drop(stream & s) {
+        httplib::detail::shutdown_socket(s.sock);
+        httplib::detail::close_socket(s.sock);
+        s.on_close(false);
+    }
+
+    using stream_it = std::unordered_map<int, std::unique_ptr<stream>>::iterator;
+
+    // returns false if the stream was closed
+    bool flush(stream_it it) {
+        stream & s = *it->second;
+
+        while (s.n_sent < s.out.size()) {
+            const ssize_t n = send(s.sock, s.out.data() + s.n_sent, s.out.size() - s.n_sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                s.n_sent += n;
+                s.t_send  = ggml_time_us();
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                close_stream(it, false);
+                return false;
+            }
+        }
+
+        if (s.n_sent == s.out.size()) {
+            s.out.clear();
+            s.n_sent = 0;
+
+            if (s.finished) {
+                close_stream(it, true);
+                return false;
+            }
+        }
+
+        // wait for the socket to be writable only while there is something to send
+        const uint32_t events = s.out.empty() ? EPOLLRDHUP : EPOLLRDHUP | EPOLLOUT;
+        if (events != s.events) {
+            epoll_event ev = {};
+            ev.events   = s.events = events;
+            ev.data.u64 = s.id;
+            epoll_ctl(fd_epoll, EPOLL_CTL_MOD, s.sock, &ev);
+        }
+
+        return true;
+    }
+
+    void close_stream(stream_it it, bool finished) {
+        stream & s = *it->second;
+
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, s.sock, nullptr);
+        if (finished) {
+            httplib::detail::shutdown_socket(s.sock);
+            httplib::detail::close_socket(s.sock);
+            s.on_close(true);
+        } else {
+            drop(s);
+        }
+
+        streams.erase(it);
+    }
+};
+
+thread_local socket_t server_http_streams::cur_sock        = INVALID_SOCKET;
+thread_local bool     server_http_streams::cur_handed_over = false;
+
+// same as httplib::Server, except that the socket is not closed when the response was handed over to server_http_streams
+struct server_http : httplib::Server {
+private:
+    bool process_and_close_socket(socket_t sock) override {
+        std::string remote_addr;
+        int remote_port = 0;
+        httplib::detail::get_remote_ip_and_port(sock, remote_addr, remote_port);
+
+        std::string local_addr;
+        int local_port = 0;
+        httplib::detail::get_local_ip_and_port(sock, local_addr, local_port);
+
+        server_http_streams::cur_sock        = sock;
+        server_http_streams::cur_handed_over = false;
+
+        auto ret = httplib::detail::process_server_socket(
+            svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
+            read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
+            write_timeout_usec_,
+            [&](httplib::Stream & strm, bool close_connection, bool & connection_closed) {
+                return process_request(strm, remote_addr, remote_port, local_addr,
+                                       local_port, close_connection, connection_closed,
+                                       nullptr);
+            });
+
+        const bool handed_over = server_http_streams::cur_handed_over;
+
+        server_http_streams::cur_sock        = INVALID_SOCKET;
+        server_http_streams::cur_handed_over = false;
+
+        if (!handed_over) {
+            httplib::detail::shutdown_socket(sock);
+            httplib::detail::close_socket(sock);
+        }
+
+        return ret;
+    }
+};
+
+#else
+
+// the streams are written by the HTTP threads
+struct server_http_streams {
+    using produce_t = std::function<bool(std::string & out)>;
+    using close_t   = std::function<void(bool finished)>;
+
+    explicit server_http_streams(int) {}
+
+    void stop() {}
+    bool can_hand_over() { return false; }
+    int  new_id() { return 0; }
+    void notify(int) {}
+    void hand_over(int, produce_t &&, close_t &&) { GGML_ABORT("not supported"); }
+};
+
+using server_http = httplib::Server;
+
+#endif
+
+using server_context_ptr = std::shared_ptr<server_context>;
+
+// the models of --models-dir, loaded by the first request that uses them
+// each loaded model has its own server_context (slots, KV cache) and its own main loop thread
+// the requests hold a reference to the context of their model, the models without references are unloaded in LRU order
+// when the loaded models exceed the budget
+struct server_models {
+    struct model_entry {
+        std::string path;
+        size_t      size = 0; // size of the file (the weights are memory mapped) + estimated size of the KV cache
+
+        server_context_ptr ctx; // nullptr if not loaded
+        std::thread        loop;
+
+        bool    loading     = false;
+        int64_t t_last_used = 0;
+    };
+
+    common_params params_base;
+    size_t        budget  = 0; // in bytes, 0 = unlimited
+    bool          stopped = false;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    // the list of models does not change after init(), only the entries do
+    std::map<std::string, model_entry> entries;
+
+    void init(const common_params & params) {
+        params_base = params;
+        budget      = (size_t) params.models_budget*1024*1024;
+
+        if (params.models_dir.empty()) {
+            return;
+        }
+
+        std::error_code ec;
+        for (const auto & file : std::filesystem::directory_iterator(params.models_dir, ec)) {
+            if (!file.is_regular_file() || file.path().extension() != ".gguf") {
+                continue;
+            }
+
+            const size_t size_kv = estimate_kv_size(file.path().string(), params);
+
+            model_entry & entry = entries[file.path().stem().string()];
+            entry.path = file.path().string();
+            entry.size = file.file_size() + size_kv;
+
+            SRV_INF("model '%s': %.2f MiB weights + %.2f MiB KV cache\n", file.path().stem().string().c_str(),
+                    file.file_size()/1024.0/1024.0, size_kv/1024.0/1024.0);
+        }
+        if (ec) {
+            SRV_ERR("failed to list the models of '%s': %s\n", params.models_dir.c_str(), ec.message().c_str());
+        }
+
+        SRV_INF("%zu models found in '%s'\n", entries.size(), params.models_dir.c_str());
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    bool has(const std::string & name) const {
+        return entries.find(name) != entries.end();
+    }
+
+    // returns the context of the model, loads it if needed
+    // nullptr if the model could not be loaded
+    server_context_ptr acquire(const std::string & name) {
+        model_entry & entry = entries.at(name);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !entry.loading; });
+
+        entry.t_last_used = ggml_time_us();
+        if (entry.ctx || stopped) {
+            return entry.ctx;
+        }
+
+        entry.loading = true;
+        lock.unlock();
+
+        // free the memory before loading the new model
+        unload_lru();
+
+        std::thread loop;
+        server_context_ptr ctx = load(name, entry.path, loop);
+
+        lock.lock();
+        entry.loading = false;
+        if (stopped && ctx) {
+            unload(name, ctx, loop);
+            ctx.reset();
+        }
+        entry.ctx  = ctx;
+        entry.loop = std::move(loop);
+        cv.notify_all();
+
+        return ctx;
+    }
+
+    // name and model_meta() of the models, null if not loaded
+    std::vector<std::pair<std::string, json>> list() {
+        std::vector<std::pair<std::string, json>> res;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto & [name, entry] : entries) {
+            res.emplace_back(name, entry.ctx ? entry.ctx->model_meta() : json(nullptr));
+        }
+
+        return res;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        for (auto & [name, entry] : entries) {
+            if (entry.ctx) {
+                unload(name, entry.ctx, entry.loop);
+                entry.ctx.reset();
+            }
+        }
+    }
+
+private:
+    // n_ctx x n_layer x (n_embd_k + n_embd_v) of the KV heads, in the cache types of params, read from the metadata
+    // of the file; recurrent states and SWA caches are not accounted for, 0 if the metadata is missing
+    static size_t estimate_kv_size(const std::string & path, const common_params & params) {
+        gguf_init_params gparams = {
+            /*.no_alloc = */ true,
+            /*.ctx      = */ NULL,
+        };
+        gguf_context_ptr ctx(gguf_init_from_file(path.c_str(), gparams));
+        if (!ctx) {
+            return 0;
+        }
+
+        const int64_t arch_id = gguf_find_key(ctx.get(), "general.architecture");
+        if (arch_id < 0 || gguf_get_kv_type(ctx.get(), arch_id) != GGUF_TYPE_STRING) {
+            return 0;
+        }
+        const std::string arch = gguf_get_val_str(ctx.get(), arch_id);
+
+        // per-layer arrays use their largest value
+        const auto get_u32 = [&](const char * key, uint32_t def) -> uint32_t {
+            const int64_t id = gguf_find_key(ctx.get(), (arch + "." + key).c_str());
+            if (id < 0) {
+                return def;
+            }
+            switch (gguf_get_kv_type(ctx.get(), id)) {
+                case GGUF_TYPE_UINT32: return gguf_get_val_u32(ctx.get(), id);
+                case GGUF_TYPE_INT32:  return std::max(0, gguf_get_val_i32(ctx.get(), id));
+                case GGUF_TYPE_ARRAY:
+                    {
+                        const gguf_type type = gguf_get_arr_type(ctx.get(), id);
+                        if (type != GGUF_TYPE_UINT32 && type != GGUF_TYPE_INT32) {
+                            return def;
+                        }
+                        const uint32_t * data = (const uint32_t *) gguf_get_arr_data(ctx.get(), id);
+                        uint32_t res = 0;
+                        for (size_t i = 0; i < gguf_get_arr_n(ctx.get(), id); i++) {
+                            res = std::max(res, data[i]);
+                        }
+                        return res;
+                    }
+                default: return def;
+            }
+        };
+
+        const uint32_t n_layer = get_u32("block_count", 0);
+        const uint32_t n_embd  = get_u32("embedding_length", 0);
+        const uint32_t n_head  = get_u32("attention.head_count", 0);
+        if (n_head == 0) {
+            return 0;
+        }
+        const uint32_t n_head_kv = get_u32("attention.head_count_kv", n_head);
+        const uint32_t n_embd_k  = get_u32("attention.key_length",   n_embd/n_head)*n_head_kv;
+        const uint32_t n_embd_v  = get_u32("attention.value_length", n_embd/n_head)*n_head_kv;
+        const uint32_t n_ctx     = params.n_ctx > 0 ? (uint32_t) params.n_ctx : get_u32("context_length", 0);
+
+        const size_t row_k = ggml_type_size(params.cache_type_k)*n_embd_k/ggml_blck_size(params.cache_type_k);
+        const size_t row_v = ggml_type_size(params.cache_type_v)*n_embd_v/ggml_blck_size(params.cache_type_v);
+
+        return (size_t) n_ctx*n_layer*(row_k + row_v);
+    }
+
+    server_context_ptr load(const std::string & name, const std::string & path, std::thread & loop) {
+        common_params params = params_base;
+
+        // the adapters, draft model and projector given on the command line belong to the default model
+        params.model         = common_params_model();
+        params.model.path    = path;
+        params.model_alias   = name;
+        params.lora_adapters.clear();
+        params.speculative.model = common_params_model();
+        params.mmproj            = common_params_model();
+        if (!params.trace_file.empty()) {
+            params.trace_file += "." + name;
+        }
+
+        const int64_t t_start = ggml_time_us();
+
+        auto ctx = std::make_shared<server_context>();
+        if (!ctx->load_model(params)) {
+            return nullptr;
+        }
+
+        ctx->init();
+        ctx->slot_prompt_similarity = params.slot_prompt_similarity;
+
+        server_context * p = ctx.get();
+
+        p->queue_tasks.on_new_task([p](server_task && task) {
+            p->process_single_task(std::move(task));
+        });
+
+        p->queue_tasks.on_update_slots([p]() {
+            p->update_slots();
+        });
+
+        loop = std::thread([p]() {
+            p->queue_tasks.start_loop();
+        });
+
+        SRV_INF("loaded model '%s' in %.2f s\n", name.c_str(), (ggml_time_us() - t_start)/1e6);
+
+        return ctx;
+    }
+
+    void unload(const std::string & name, const server_context_ptr & ctx, std::thread & loop) {
+        ctx->queue_results.terminate();
+        ctx->queue_tasks.terminate();
+        loop.join();
+
+        SRV_INF("unloaded model '%s'\n", name.c_str());
+    }
+
+    // unload the least recently used models until the loaded and loading models fit in the budget
+    // the models that are used by a request are not unloaded, so the budget can be exceeded
+    void unload_lru() {
+        if (budget == 0) {
+            return;
+        }
+
+        std::vector<std::tuple<std::string, server_context_ptr, std::thread>> unloaded;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            size_t size_used = 0;
+            for (const auto & [name, entry] : entries) {
+                if (entry.ctx || entry.loading) {
+                    size_used += entry.size;
+                }
+            }
+
+            while (size_used > budget) {
+                std::string lru;
+                for (const auto & [name, entry] : entries) {
+                    // no other reference can be created while the mutex is held
+                    if (entry.ctx && entry.ctx.use_count() == 1 && (lru.empty() || entry.t_last_used < entries.at(lru).t_last_used)) {
+                        lru = name;
+                    }
+                }
+                if (lru.empty()) {
+                    break;
+                }
+
+                model_entry & entry = entries.at(lru);
+                size_used -= entry.size;
+                unloaded.emplace_back(lru, std::move(entry.ctx), std::move(entry.loop));
+                entry.ctx.reset();
+            }
+        }
+
+        for (auto & [name, ctx, loop] : unloaded) {
+            unload(name, ctx, loop);
+        }
+    }
+};
+
 int main(int argc, char ** argv) {
     // own arguments required by this example
     common_params params;
@@ -3734,18 +5516,27 @@ int main(int argc, char ** argv) {
         );
     } else {
         LOG_INF("Running without SSL\n");
-        svr.reset(new httplib::Server());
+        svr.reset(new server_http());
     }
 #else
     if (params.ssl_file_key != "" && params.ssl_file_cert != "") {
         LOG_ERR("Server is built without SSL support\n");
         return 1;
     }
-    svr.reset(new httplib::Server());
+    svr.reset(new server_http());
 #endif
 
     std::atomic<server_state> state{SERVER_STATE_LOADING_MODEL};
 
+    // event loop of the SSE streams
+    server_http_streams streams(params.timeout_write);
+
+    // models of --models-dir, the model given with -m is not part of them and stays loaded
+    server_models models;
+    models.init(params);
+
+    server_context_ptr ctx_default(&ctx_server, [](server_context *) {});
+
     svr->set_default_headers({{"Server", "llama.cpp"}});
     svr->set_logger(log_server_request);
 
@@ -3780,7 +5571,7 @@ int main(int argc, char ** argv) {
     });
 
     svr->set_error_handler([&res_error](const httplib::Request &, httplib::Response & res) {
-        if (res.status == 404) {
+        if (res.status == 404 && res.body.empty()) {
             res_error(res, format_error_response("File Not Found", ERROR_TYPE_NOT_FOUND));
         }
         // for other error codes, we skip processing here because it's already done by res_error()
@@ -3888,6 +5679,35 @@ int main(int argc, char ** argv) {
     // Route handlers (or controllers)
     //
 
+    // the model selected by the "model" field of the body or by the "model" query parameter
+    // returns nullptr after setting the error response if the model is unknown or cannot be loaded
+    const auto get_model = [&params, &models, &ctx_default, &res_error](const httplib::Request & req, httplib::Response & res, const json & body) -> server_context_ptr {
+        if (models.empty()) {
+            return ctx_default;
+        }
+
+        std::string name = req.get_param_value("model");
+        if (body.is_object() && body.contains("model") && body.at("model").is_string()) {
+            name = body.at("model").get<std::string>();
+        }
+
+        if (name.empty() || name == params.model_alias || name == params.model.path) {
+            return ctx_default;
+        }
+
+        if (!models.has(name)) {
+            res_error(res, format_error_response(string_format("model '%s' not found", name.c_str()), ERROR_TYPE_NOT_FOUND));
+            return nullptr;
+        }
+
+        server_context_ptr ctx = models.acquire(name);
+        if (!ctx) {
+            res_error(res, format_error_response(string_format("failed to load model '%s'", name.c_str()), ERROR_TYPE_SERVER));
+        }
+
+        return ctx;
+    };
+
     const auto handle_health = [&](const httplib::Request &, httplib::Response & res) {
         // error and loading states are handled by middleware
         json health = {{"status", "ok"}};
@@ -3987,6 +5807,14 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "requests_preempted_total"},
+                    {"help",  "Number of requests preempted by a request with a higher priority."},
+                    {"value",  res_metrics->n_preempted_total}
+            }, {
+                    {"name",  "requests_rejected_total"},
+                    {"help",  "Number of requests rejected because the queue was over --max-queued-tokens."},
+                    {"value",  res_metrics->n_rejected_total}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -4024,6 +5852,9 @@ int main(int argc, char ** argv) {
             }
         }
 
+        // the histograms are read directly, they are updated without locks
+        ctx_server.metrics.to_prometheus(prometheus);
+
         res.set_header("Process-Start-Time-Unix", std::to_string(res_metrics->t_start));
 
         res.set_content(prometheus.str(), "text/plain; version=0.0.4");
@@ -4214,7 +6045,8 @@ int main(int argc, char ** argv) {
 
     // handle completion-like requests (completion, chat, infill)
     // we can optionally provide a custom format for partial results and final results
-    const auto handle_completions_impl = [&ctx_server, &res_error, &res_ok](
+    const auto handle_completions_impl = [&streams, &res_error, &res_ok](
+            const server_context_ptr & model,
             server_task_type type,
             json & data,
             const std::vector<raw_buffer> & files,
@@ -4223,8 +6055,14 @@ int main(int argc, char ** argv) {
             oaicompat_type oaicompat) -> void {
         GGML_ASSERT(type == SERVER_TASK_TYPE_COMPLETION || type == SERVER_TASK_TYPE_INFILL);
 
+        server_context & ctx_server = *model;
+
         auto completion_id = gen_chatcmplid();
         std::unordered_set<int> task_ids;
+
+        // number of completions of each prompt
+        const int n_cmpl = json_value(data, "n", 1);
+
         try {
             std::vector<server_task> tasks;
 
@@ -4284,12 +6122,17 @@ int main(int argc, char ** argv) {
                 }
             }
 
+            // n > 1: the other completions of a prompt are children of its task, they continue from its prompt
+            if (n_cmpl < 1 || n_cmpl > ctx_server.params_base.n_parallel) {
+                throw std::runtime_error("n must be between 1 and the number of slots (" + std::to_string(ctx_server.params_base.n_parallel) + ")");
+            }
+
             tasks.reserve(inputs.size());
             for (size_t i = 0; i < inputs.size(); i++) {
                 server_task task = server_task(type);
 
                 task.id    = ctx_server.queue_tasks.get_new_id();
-                task.index = i;
+                task.index = i*n_cmpl;
 
                 task.prompt_tokens    = std::move(inputs[i]);
                 task.params           = server_task::params_from_json_cmpl(
@@ -4303,6 +6146,22 @@ int main(int argc, char ** argv) {
                 task.params.oaicompat_cmpl_id         = completion_id;
                 // oaicompat_model is already populated by params_from_json_cmpl
 
+                for (int j = 1; j < n_cmpl; j++) {
+                    server_task child = server_task(type);
+
+                    child.id            = ctx_server.queue_tasks.get_new_id();
+                    child.index         = task.index + j;
+                    child.prompt_tokens = task.prompt_tokens.clone();
+                    child.params        = task.params;
+
+                    // a fixed seed gives different, reproducible completions
+                    if (child.params.sampling.seed != LLAMA_DEFAULT_SEED) {
+                        child.params.sampling.seed += j;
+                    }
+
+                    task.children.push_back(std::move(child));
+                }
+
                 tasks.push_back(std::move(task));
             }
 
@@ -4321,6 +6180,13 @@ int main(int argc, char ** argv) {
                 if (results.size() == 1) {
                     // single result
                     res_ok(res, results[0]->to_json());
+                } else if (n_cmpl > 1 && oaicompat != OAICOMPAT_TYPE_NONE) {
+                    // n > 1: one response with the choices of all the results
+                    std::vector<json> responses;
+                    for (auto & res : results) {
+                        responses.push_back(res->to_json());
+                    }
+                    res_ok(res, format_oaicompat_choices(responses, n_cmpl));
                 } else {
                     // multiple results (multitask)
                     json arr = json::array();
@@ -4335,20 +6201,81 @@ int main(int argc, char ** argv) {
 
             ctx_server.queue_results.remove_waiting_task_ids(task_ids);
         } else {
-            const auto chunked_content_provider = [task_ids, &ctx_server, oaicompat](size_t, httplib::DataSink & sink) {
-                ctx_server.receive_cmpl_results_stream(task_ids, [&](server_task_result_ptr & result) -> bool {
-                    json res_json = result->to_json();
-                    if (res_json.is_array()) {
-                        for (const auto & res : res_json) {
-                            if (!server_sent_event(sink, "data", res)) {
-                                // sending failed (HTTP connection closed), cancel the generation
-                                return false;
-                            }
+            struct stream_state {
+                bool started     = false; // the provider was called
+                bool handed_over = false; // the stream is written by the event loop, which then removes the tasks
+            };
+            auto stream = std::make_shared<stream_state>();
+
+            // the lambdas hold a reference to the model, so that it is not unloaded before the end of the stream
+            const auto chunked_content_provider = [task_ids, model, &streams, oaicompat, stream](size_t, httplib::DataSink & sink) {
+                server_context & ctx_server = *model;
+
+                stream->started = true;
+
+                if (streams.can_hand_over()) {
+                    const int id = streams.new_id();
+
+                    auto channel = ctx_server.queue_results.subscribe(task_ids, [&streams, id]() {
+                        streams.notify(id);
+                    });
+
+                    // all the results received since the last call are sent in one chunk
+                    auto produce = [task_ids, model, oaicompat, channel, n_finished = size_t(0), writer = server_sse_writer()](std::string & out) mutable {
+                        server_context & ctx_server = *model;
+
+                        const int64_t t_start = ggml_time_us();
+
+                        const bool more = ctx_server.poll_cmpl_results_stream(task_ids, channel, n_finished, [&](server_task_result_ptr & result) -> bool {
+                            writer.write(*result, out);
+                            return true;
+                        }, [&](const json & error_data) {
+                            out += format_sse("error", error_data);
+                        });
+                        if (!more && oaicompat != OAICOMPAT_TYPE_NONE) {
+                            out += "data: [DONE]\n\n";
                         }
-                        return true;
-                    } else {
-                        return server_sent_event(sink, "data", res_json);
-                    }
+
+                        // the write of the events by the event loop is not blocking, only the formatting is measured
+                        ctx_server.metrics.t_http_write.record(ggml_time_us() - t_start);
+
+                        return more;
+                    };
+
+                    auto on_close = [task_ids, model](bool finished) {
+                        server_context & ctx_server = *model;
+
+                        if (!finished) {
+                            // the client disconnected, cancel the generation
+                            ctx_server.cancel_tasks(task_ids);
+                        }
+                        ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+                    };
+
+                    streams.hand_over(id, std::move(produce), std::move(on_close));
+                    stream->handed_over = true;
+
+                    // stops httplib, the socket is not closed
+                    return false;
+                }
+
+                server_sse_writer writer;
+                std::string buf;
+
+                ctx_server.receive_cmpl_results_stream(task_ids, [&](server_task_result_ptr & result) -> bool {
+                    const int64_t t_start = ggml_time_us();
+
+                    buf.clear();
+                    writer.write(*result, buf);
+
+                    LOG_DBG("data stream, to_send: %s", buf.c_str());
+
+                    // sending failed (HTTP connection closed), cancel the generation
+                    const bool ok = buf.empty() || sink.write(buf.data(), buf.size());
+
+                    ctx_server.metrics.t_http_write.record(ggml_time_us() - t_start);
+
+                    return ok;
                 }, [&](const json & error_data) {
                     server_sent_event(sink, "error", error_data);
                 }, [&sink]() {
@@ -4363,7 +6290,17 @@ int main(int argc, char ** argv) {
                 return false;
             };
 
-            auto on_complete = [task_ids, &ctx_server] (bool) {
+            auto on_complete = [task_ids, model, stream] (bool) {
+                if (stream->handed_over) {
+                    return;
+                }
+
+                server_context & ctx_server = *model;
+
+                if (!stream->started) {
+                    // the client disconnected before the first event
+                    ctx_server.cancel_tasks(task_ids);
+                }
                 ctx_server.queue_results.remove_waiting_task_ids(task_ids);
             };
 
@@ -4371,10 +6308,15 @@ int main(int argc, char ** argv) {
         }
     };
 
-    const auto handle_completions = [&handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_completions = [&get_model, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
         json data = json::parse(req.body);
+        const auto model = get_model(req, res, data);
+        if (!model) {
+            return;
+        }
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            model,
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4383,10 +6325,16 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_NONE);
     };
 
-    const auto handle_completions_oai = [&handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
-        json data = oaicompat_completion_params_parse(json::parse(req.body));
+    const auto handle_completions_oai = [&get_model, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        json data = oaicompat_completion_params_parse(body);
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            model,
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4395,7 +6343,15 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_COMPLETION);
     };
 
-    const auto handle_infill = [&ctx_server, &res_error, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_infill = [&get_model, &res_error, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+        json data = json::parse(req.body);
+
+        const auto model = get_model(req, res, data);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
+
         // check model compatibility
         std::string err;
         if (llama_vocab_fim_pre(ctx_server.vocab) == LLAMA_TOKEN_NULL) {
@@ -4412,8 +6368,6 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        json data = json::parse(req.body);
-
         // validate input
         if (data.contains("prompt") && !data.at("prompt").is_string()) {
             // prompt is optional
@@ -4466,6 +6420,7 @@ int main(int argc, char ** argv) {
 
         std::vector<raw_buffer> files; // dummy
         handle_completions_impl(
+            model,
             SERVER_TASK_TYPE_INFILL,
             data,
             files,
@@ -4474,10 +6429,16 @@ int main(int argc, char ** argv) {
             OAICOMPAT_TYPE_NONE); // infill is not OAI compatible
     };
 
-    const auto handle_chat_completions = [&ctx_server, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_chat_completions = [&get_model, &handle_completions_impl](const httplib::Request & req, httplib::Response & res) {
         LOG_DBG("request: %s\n", req.body.c_str());
 
         auto body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
+
         std::vector<raw_buffer> files;
         json data = oaicompat_chat_params_parse(
             body,
@@ -4485,6 +6446,7 @@ int main(int argc, char ** argv) {
             files);
 
         handle_completions_impl(
+            model,
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
@@ -4494,8 +6456,14 @@ int main(int argc, char ** argv) {
     };
 
     // same with handle_chat_completions, but without inference part
-    const auto handle_apply_template = [&ctx_server, &res_ok](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_apply_template = [&get_model, &res_ok](const httplib::Request & req, httplib::Response & res) {
         auto body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
+
         std::vector<raw_buffer> files; // dummy, unused
         json data = oaicompat_chat_params_parse(
             body,
@@ -4504,53 +6472,71 @@ int main(int argc, char ** argv) {
         res_ok(res, {{ "prompt", std::move(data.at("prompt")) }});
     };
 
-    const auto handle_models = [&params, &ctx_server, &state, &res_ok](const httplib::Request &, httplib::Response & res) {
+    const auto handle_models = [&params, &ctx_server, &models, &state, &res_ok](const httplib::Request &, httplib::Response & res) {
         server_state current_state = state.load();
         json model_meta = nullptr;
         if (current_state == SERVER_STATE_READY) {
             model_meta = ctx_server.model_meta();
         }
 
-        json models = {
-            {"models", {
-                {
-                    {"name", params.model_alias.empty() ? params.model.path : params.model_alias},
-                    {"model", params.model_alias.empty() ? params.model.path : params.model_alias},
-                    {"modified_at", ""},
-                    {"size", ""},
-                    {"digest", ""}, // dummy value, llama.cpp does not support managing model file's hash
-                    {"type", "model"},
-                    {"description", ""},
-                    {"tags", {""}},
-                    {"capabilities", {"completion"}},
-                    {"parameters", ""},
-                    {"details", {
-                        {"parent_model", ""},
-                        {"format", "gguf"},
-                        {"family", ""},
-                        {"families", {""}},
-                        {"parameter_size", ""},
-                        {"quantization_level", ""}
-                    }}
-                }
-            }},
-            {"object", "list"},
-            {"data", {
-                {
-                    {"id",       params.model_alias.empty() ? params.model.path : params.model_alias},
-                    {"object",   "model"},
-                    {"created",  std::time(0)},
-                    {"owned_by", "llamacpp"},
-                    {"meta",     model_meta},
-                },
-            }}
+        const auto format_model = [](const std::string & name) {
+            return json {
+                {"name", name},
+                {"model", name},
+                {"modified_at", ""},
+                {"size", ""},
+                {"digest", ""}, // dummy value, llama.cpp does not support managing model file's hash
+                {"type", "model"},
+                {"description", ""},
+                {"tags", {""}},
+                {"capabilities", {"completion"}},
+                {"parameters", ""},
+                {"details", {
+                    {"parent_model", ""},
+                    {"format", "gguf"},
+                    {"family", ""},
+                    {"families", {""}},
+                    {"parameter_size", ""},
+                    {"quantization_level", ""}
+                }}
+            };
         };
 
-        res_ok(res, models);
+        const auto format_model_oai = [](const std::string & name, const json & meta) {
+            return json {
+                {"id",       name},
+                {"object",   "model"},
+                {"created",  std::time(0)},
+                {"owned_by", "llamacpp"},
+                {"meta",     meta},
+            };
+        };
+
+        const std::string name = params.model_alias.empty() ? params.model.path : params.model_alias;
+
+        json models_list = json::array({ format_model(name) });
+        json data        = json::array({ format_model_oai(name, model_meta) });
+
+        // the models of --models-dir, meta is null if the model is not loaded
+        for (const auto & [name_dir, meta] : models.list()) {
+            models_list.push_back(format_model(name_dir));
+            data.push_back(format_model_oai(name_dir, meta));
+        }
+
+        res_ok(res, {
+            {"models", models_list},
+            {"object", "list"},
+            {"data",   data},
+        });
     };
 
-    const auto handle_tokenize = [&ctx_server, &res_ok](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_tokenize = [&get_model, &res_ok](const httplib::Request & req, httplib::Response & res) {
         const json body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
 
         json tokens_response = json::array();
         if (body.count("content") != 0) {
@@ -4590,8 +6576,13 @@ int main(int argc, char ** argv) {
         res_ok(res, data);
     };
 
-    const auto handle_detokenize = [&ctx_server, &res_ok](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_detokenize = [&get_model, &res_ok](const httplib::Request & req, httplib::Response & res) {
         const json body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
 
         std::string content;
         if (body.count("tokens") != 0) {
@@ -4603,7 +6594,14 @@ int main(int argc, char ** argv) {
         res_ok(res, data);
     };
 
-    const auto handle_embeddings_impl = [&ctx_server, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res, oaicompat_type oaicompat) {
+    const auto handle_embeddings_impl = [&get_model, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res, oaicompat_type oaicompat) {
+        const json body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
+
         if (!ctx_server.params_base.embedding) {
             res_error(res, format_error_response("This server does not support embeddings. Start it with `--embeddings`", ERROR_TYPE_NOT_SUPPORTED));
             return;
@@ -4614,8 +6612,6 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        const json body = json::parse(req.body);
-
         // for the shape of input/content, see tokenize_input_prompts()
         json prompt;
         if (body.count("input") != 0) {
@@ -4628,13 +6624,15 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        bool use_base64 = false;
+        embd_encoding_type encoding = EMBD_ENCODING_FLOAT;
         if (body.count("encoding_format") != 0) {
             const std::string& format = body.at("encoding_format");
             if (format == "base64") {
-                use_base64 = true;
+                encoding = EMBD_ENCODING_BASE64;
+            } else if (format == "base64_f16") {
+                encoding = EMBD_ENCODING_BASE64_F16;
             } else if (format != "float") {
-                res_error(res, format_error_response("The format to return the embeddings in. Can be either float or base64", ERROR_TYPE_INVALID_REQUEST));
+                res_error(res, format_error_response("The format to return the embeddings in. Can be either float, base64 or base64_f16", ERROR_TYPE_INVALID_REQUEST));
                 return;
             }
         }
@@ -4672,6 +6670,7 @@ int main(int argc, char ** argv) {
                 // OAI-compat
                 task.params.oaicompat = oaicompat;
                 task.params.embd_normalize = embd_normalize;
+                task.params.embd_encoding  = encoding;
 
                 tasks.push_back(std::move(task));
             }
@@ -4700,7 +6699,7 @@ int main(int argc, char ** argv) {
 
         // write JSON response
         json root = oaicompat == OAICOMPAT_TYPE_EMBEDDING
-            ? format_embeddings_response_oaicompat(body, responses, use_base64)
+            ? format_embeddings_response_oaicompat(body, responses, encoding)
             : json(responses);
         res_ok(res, root);
     };
@@ -4713,14 +6712,19 @@ int main(int argc, char ** argv) {
         handle_embeddings_impl(req, res, OAICOMPAT_TYPE_EMBEDDING);
     };
 
-    const auto handle_rerank = [&ctx_server, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
+    const auto handle_rerank = [&get_model, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+        const auto model = get_model(req, res, body);
+        if (!model) {
+            return;
+        }
+        server_context & ctx_server = *model;
+
         if (!ctx_server.params_base.embedding || ctx_server.params_base.pooling_type != LLAMA_POOLING_TYPE_RANK) {
             res_error(res, format_error_response("This server does not support reranking. Start it with `--reranking`", ERROR_TYPE_NOT_SUPPORTED));
             return;
         }
 
-        const json body = json::parse(req.body);
-
         // TODO: implement
         //int top_n = 1;
         //if (body.count("top_n") != 1) {
@@ -4922,9 +6926,11 @@ int main(int argc, char ** argv) {
     svr->new_task_queue = [&params] { return new httplib::ThreadPool(params.n_threads_http); };
 
     // clean up function, to be called before exit
-    auto clean_up = [&svr, &ctx_server]() {
+    auto clean_up = [&svr, &streams, &models, &ctx_server]() {
         SRV_INF("%s: cleaning up before exit...\n", __func__);
         svr->stop();
+        streams.stop();
+        models.stop();
         ctx_server.queue_results.terminate();
         llama_backend_free();
     };
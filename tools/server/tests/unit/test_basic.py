@@ -94,3 +94,75 @@ def test_no_webui():
     server.start()
     res = requests.get(url)
     assert res.status_code == 404
+
+
+HISTOGRAMS = [
+    "queue_wait_seconds",
+    "time_to_first_token_seconds",
+    "inter_token_latency_seconds",
+    "batch_size_tokens",
+    "decode_seconds",
+    "sampling_seconds",
+    "http_write_seconds",
+]
+
+
+def get_histograms() -> dict[str, dict]:
+    url = f"http://{server.server_host}:{server.server_port}/metrics"
+    res = requests.get(url)
+    assert res.status_code == 200
+    histograms = {}
+    for line in res.text.splitlines():
+        m = re.match(r'^llamacpp:(\w+)_bucket\{le="([^"]+)"\} (\S+)$', line)
+        if m:
+            h = histograms.setdefault(m.group(1), {"buckets": []})
+            h["buckets"].append((float(m.group(2)), float(m.group(3))))
+            continue
+        m = re.match(r'^llamacpp:(\w+)_(sum|count) (\S+)$', line)
+        if m and m.group(1) in histograms:
+            histograms[m.group(1)][m.group(2)] = float(m.group(3))
+    return histograms
+
+
+def test_server_metrics_histograms():
+    global server
+    server.server_metrics = True
+    server.start()
+
+    prev = None
+    for _ in range(2):
+        # a stream, so that the HTTP write time is recorded as well
+        for _ in server.make_stream_request("POST", "/completion", data={
+            "n_predict": 16,
+            "prompt": "Hello",
+            "ignore_eos": True,
+            "stream": True,
+        }):
+            pass
+
+        histograms = get_histograms()
+        for name in HISTOGRAMS:
+            assert name in histograms, f"missing histogram {name}"
+            h = histograms[name]
+            assert "sum" in h and "count" in h
+
+            # the bounds are increasing, the last one is +Inf, the buckets are cumulative
+            bounds = [le for le, _ in h["buckets"]]
+            counts = [n for _, n in h["buckets"]]
+            assert bounds == sorted(bounds)
+            assert bounds[-1] == float("inf")
+            assert counts == sorted(counts)
+            assert counts[-1] == h["count"]
+            assert h["count"] > 0
+            assert h["sum"] >= 0
+
+            # the histograms are never reset between two scrapes
+            if prev is not None:
+                assert h["count"] > prev[name]["count"]
+                assert h["sum"] >= prev[name]["sum"]
+                assert all(n >= n_prev for (_, n), (_, n_prev) in zip(h["buckets"], prev[name]["buckets"]))
+        prev = histograms
+
+    # 16 tokens per request, one inter-token latency for each token after the first
+    assert prev["time_to_first_token_seconds"]["count"] == 2
+    assert prev["inter_token_latency_seconds"]["count"] == 2*15
@@ -1,5 +1,10 @@
+import json
+import os
 import pytest
 import requests
+import socket
+import sys
+import threading
 import time
 from openai import OpenAI
 from utils import *
@@ -180,6 +185,142 @@ def test_different_result_different_seed(n_slots: int):
             assert res.body["content"] != last_res.body["content"]
         last_res = res
 
+@pytest.mark.parametrize("n_slots,n_cmpl", [(2, 2), (4, 3)])
+def test_completion_n_choices(n_slots: int, n_cmpl: int):
+    global server
+    server.n_slots = n_slots
+    server.start()
+    res = server.make_request("POST", "/v1/completions", data={
+        "prompt": "I believe the meaning of life is",
+        "max_tokens": 8,
+        "temperature": 0.0,
+    })
+    assert res.status_code == 200
+    content = res.body["choices"][0]["text"]
+    res = server.make_request("POST", "/v1/completions", data={
+        "prompt": "I believe the meaning of life is",
+        "max_tokens": 8,
+        "temperature": 0.0,
+        "n": n_cmpl,
+    })
+    assert res.status_code == 200
+    assert [choice["index"] for choice in res.body["choices"]] == list(range(n_cmpl))
+    for choice in res.body["choices"]:
+        assert choice["text"] == content
+    assert res.body["usage"]["completion_tokens"] == 8 * n_cmpl
+    # at most one completion per slot
+    res = server.make_request("POST", "/v1/completions", data={
+        "prompt": "I believe the meaning of life is",
+        "n": n_slots + 1,
+    })
+    assert res.status_code == 400
+
+
+def test_completion_n_choices_with_seed():
+    global server
+    server.n_slots = 4
+    server.start()
+    def get_choices(seed: int) -> list[str]:
+        res = server.make_request("POST", "/v1/completions", data={
+            "prompt": "I believe the meaning of life is",
+            "max_tokens": 16,
+            "temperature": 1.0,
+            "seed": seed,
+            "n": 3,
+        })
+        assert res.status_code == 200
+        assert [choice["index"] for choice in res.body["choices"]] == [0, 1, 2]
+        return [choice["text"] for choice in res.body["choices"]]
+    choices = get_choices(42)
+    # each completion is sampled with its own seed
+    assert len(set(choices)) == 3
+    assert get_choices(42) == choices
+    assert get_choices(43) != choices
+
+
+@pytest.mark.parametrize("path", ["/v1/completions", "/v1/chat/completions"])
+def test_completion_n_choices_stream(path: str):
+    global server
+    server.n_slots = 4
+    server.start()
+    data = {
+        "max_tokens": 8,
+        "temperature": 0.0,
+        "n": 3,
+        "stream": True,
+    }
+    if path == "/v1/chat/completions":
+        data["messages"] = [{"role": "user", "content": "I believe the meaning of life is"}]
+    else:
+        data["prompt"] = "I believe the meaning of life is"
+    res = server.make_stream_request("POST", path, data=data)
+    content = {}
+    finish_reason = {}
+    for data in res:
+        for choice in data["choices"]:
+            index = choice["index"]
+            if "delta" in choice:
+                text = choice["delta"].get("content")
+            else:
+                text = choice["text"]
+            content[index] = content.get(index, "") + (text or "")
+            if choice["finish_reason"] is not None:
+                finish_reason[index] = choice["finish_reason"]
+    assert sorted(content.keys()) == [0, 1, 2]
+    assert sorted(finish_reason.keys()) == [0, 1, 2]
+    # all the completions are the same at temperature 0
+    assert len(content[0]) > 0
+    assert content[0] == content[1] == content[2]
+
+
+def test_completion_n_choices_deferred():
+    global server
+    server.n_ctx = 8192
+    server.n_slots = 2
+    server.start()
+    url = f"http://{server.server_host}:{server.server_port}/completion"
+    # streams that keep the slots busy until they are closed
+    blockers = []
+    for _ in range(2):
+        res = requests.post(url, json={
+            "prompt": "I believe the meaning of life is",
+            "n_predict": -1,
+            "ignore_eos": True,
+            "stream": True,
+        }, stream=True)
+        assert res.status_code == 200
+        next(res.iter_lines())
+        blockers.append(res)
+
+    finished = []
+    def run(name: str, n_cmpl: int):
+        res = server.make_request("POST", "/v1/completions", data={
+            "prompt": "I believe the meaning of life is",
+            "max_tokens": 8,
+            "n": n_cmpl,
+        })
+        assert res.status_code == 200
+        finished.append(name)
+
+    # the task with n = 2 is deferred first
+    threads = [
+        threading.Thread(target=run, args=("n2", 2)),
+        threading.Thread(target=run, args=("n1", 1)),
+    ]
+    for t in threads:
+        t.start()
+        time.sleep(0.2)
+
+    # a single free slot goes to the task that fits in it
+    blockers[0].close()
+    threads[1].join(timeout=10)
+    assert finished == ["n1"]
+
+    blockers[1].close()
+    threads[0].join()
+    assert finished == ["n1", "n2"]
+
+
 # TODO figure why it don't work with temperature = 1
 # @pytest.mark.parametrize("temperature", [0.0, 1.0])
 @pytest.mark.parametrize("n_batch", [16, 32])
@@ -495,3 +636,150 @@ def test_cancel_request():
     time.sleep(1) # wait for HTTP_POLLING_SECONDS
     res = server.make_request("GET", "/slots")
     assert res.body[0]["is_processing"] == False
+
+
+def test_cancel_stream_request():
+    global server
+    server.n_ctx = 4096
+    server.n_predict = -1
+    server.n_slots = 1
+    server.server_slots = True
+    server.start()
+    # read the first events of a stream that would take a long time, then disconnect
+    url = f"http://{server.server_host}:{server.server_port}/completion"
+    with requests.post(url, json={
+        "prompt": "I believe the meaning of life is",
+        "stream": True,
+    }, stream=True) as response:
+        assert response.status_code == 200
+        n_events = 0
+        for line in response.iter_lines():
+            if line.startswith(b"data: "):
+                n_events += 1
+                if n_events == 4:
+                    break
+    # the slot is released as soon as the disconnect is detected
+    for _ in range(20):
+        res = server.make_request("GET", "/slots")
+        if not res.body[0]["is_processing"]:
+            break
+        time.sleep(0.1)
+    assert res.body[0]["is_processing"] == False
+    # and it can be used again
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 8,
+    })
+    assert res.status_code == 200
+    assert res.body["tokens_predicted"] == 8
+
+
+def test_cancel_deferred_stream_request():
+    global server
+    server.n_ctx = 4096
+    server.n_predict = -1
+    server.n_slots = 1
+    server.server_slots = True
+    server.start()
+    url = f"http://{server.server_host}:{server.server_port}/completion"
+    # the first stream takes the only slot
+    first = requests.post(url, json={
+        "prompt": "I believe the meaning of life is",
+        "stream": True,
+    }, stream=True)
+    assert first.status_code == 200
+    next(first.iter_lines())
+    # the second one waits for it, and its client disconnects before the first event
+    second = requests.post(url, json={
+        "prompt": "Once upon a time",
+        "stream": True,
+    }, stream=True)
+    assert second.status_code == 200
+    second.close()
+    time.sleep(0.5)
+    first.close()
+    # the waiting task was removed from the queue: the slot becomes idle and stays idle
+    for _ in range(20):
+        res = server.make_request("GET", "/slots")
+        if not res.body[0]["is_processing"]:
+            break
+        time.sleep(0.1)
+    assert res.body[0]["is_processing"] == False
+    time.sleep(1)
+    res = server.make_request("GET", "/slots")
+    assert res.body[0]["is_processing"] == False
+
+
+@pytest.mark.skipif(sys.platform != "linux", reason="the streams are handed over to the event loop on Linux only")
+def test_unread_streams_do_not_block_http_threads():
+    global server
+    server.n_ctx = 4096
+    server.n_predict = -1
+    server.n_slots = 1
+    server.server_slots = True
+    server.start()
+    url = f"http://{server.server_host}:{server.server_port}/completion"
+    # more streams than HTTP threads, none of them is read
+    n_streams = (os.cpu_count() or 1) + 8
+    streams = [requests.post(url, json={
+        "prompt": "I believe the meaning of life is",
+        "stream": True,
+    }, stream=True) for _ in range(n_streams)]
+    assert all(s.status_code == 200 for s in streams)
+    # the HTTP threads are free to answer other requests
+    res = server.make_request("GET", "/health", timeout=5)
+    assert res.status_code == 200
+    # disconnecting cancels the running task and the waiting ones
+    for s in streams:
+        s.close()
+    for _ in range(50):
+        res = server.make_request("GET", "/slots")
+        if not res.body[0]["is_processing"]:
+            break
+        time.sleep(0.1)
+    assert res.body[0]["is_processing"] == False
+    time.sleep(1)
+    res = server.make_request("GET", "/slots")
+    assert res.body[0]["is_processing"] == False
+
+
+@pytest.mark.skipif(sys.platform != "linux", reason="the streams are handed over to the event loop on Linux only")
+def test_unread_stream_times_out():
+    global server
+    server.n_ctx = 32768
+    server.n_slots = 1
+    server.server_slots = True
+    server.timeout = 3
+    server.start()
+    body = json.dumps({
+        "prompt": "I believe the meaning of life is",
+        "n_predict": -1,
+        "ignore_eos": True,
+        "n_probs": 50, # large events fill the socket buffers quickly
+        "stream": True,
+    })
+    # the client keeps the connection open and never reads
+    sock = socket.socket()
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    sock.connect((server.server_host, server.server_port))
+    sock.sendall((
+        "POST /completion HTTP/1.1\r\n"
+        f"Host: {server.server_host}\r\n"
+        "Content-Type: application/json\r\n"
+        f"Content-Length: {len(body)}\r\n\r\n"
+        f"{body}"
+    ).encode())
+    time.sleep(1)
+    res = server.make_request("GET", "/slots")
+    assert res.body[0]["is_processing"] == True
+    # the stream is closed after the write timeout and its task is cancelled
+    for _ in range(300):
+        res = server.make_request("GET", "/slots")
+        if not res.body[0]["is_processing"]:
+            break
+        time.sleep(0.1)
+    assert res.body[0]["is_processing"] == False
+    sock.settimeout(10)
+    while sock.recv(1 << 20):
+        pass
+    sock.close()
@@ -188,6 +188,34 @@ def test_same_prompt_give_same_result():
             assert abs(x - y) < EPSILON
 
 
+@pytest.mark.parametrize("with_fa", [False, True])
+def test_embedding_multiple_different_lengths(with_fa: bool):
+    server = ServerPreset.bert_bge_small_with_fa() if with_fa else ServerPreset.bert_bge_small()
+    server.pooling = 'mean'
+    server.n_slots = 4
+    server.start()
+    # inputs of close lengths are encoded in one batch, with the attention computed per input over
+    # a block padded to the longest one (n_pad > 0): each of them must give its own embedding
+    inputs = [
+        "a "*20,
+        "b "*18,
+        "c "*17,
+        "d "*15,
+    ]
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": inputs,
+    })
+    assert res.status_code == 200
+    assert len(res.body['data']) == len(inputs)
+    for d in res.body['data']:
+        res_single = server.make_request("POST", "/v1/embeddings", data={
+            "input": inputs[d['index']],
+        })
+        assert res_single.status_code == 200
+        for x, y in zip(d['embedding'], res_single.body['data'][0]['embedding']):
+            assert abs(x - y) < EPSILON
+
+
 @pytest.mark.parametrize(
     "content,n_tokens",
     [
@@ -255,3 +283,28 @@ def test_embedding_openai_library_base64():
     # make sure the decoded data is the same as the original
     for x, y in zip(floats, vec0):
         assert abs(x - y) < EPSILON
+
+
+def test_embedding_base64_f16():
+    server.start()
+    test_input = "Test base64 f16 embedding output"
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input
+    })
+    assert res.status_code == 200
+    vec0 = res.body["data"][0]["embedding"]
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "encoding_format": "base64_f16"
+    })
+    assert res.status_code == 200
+    embedding_data = res.body["data"][0]
+    assert embedding_data["encoding_format"] == "base64_f16"
+
+    decoded = base64.b64decode(embedding_data["embedding"])
+    halfs = struct.unpack(f'{len(decoded) // 2}e', decoded)  # 2 bytes per half
+    assert len(halfs) == len(vec0)
+    for x, y in zip(halfs, vec0):
+        assert abs(x - y) < EPSILON
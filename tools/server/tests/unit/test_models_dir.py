@@ -0,0 +1,118 @@
+import os
+import shutil
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+MODEL_FILE_URL = "https://huggingface.co/ggml-org/models/resolve/main/tinyllamas/stories260K.gguf"
+MODELS_DIR = "./tmp/models-dir"
+
+
+@pytest.fixture(scope="module", autouse=True)
+def create_models_dir():
+    os.makedirs(MODELS_DIR, exist_ok=True)
+    model_file = download_file(MODEL_FILE_URL)
+    for name in ["model-a", "model-b"]:
+        shutil.copy(model_file, f"{MODELS_DIR}/{name}.gguf")
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.models_dir = MODELS_DIR
+
+
+def get_loaded_models() -> set[str]:
+    res = server.make_request("GET", "/v1/models")
+    assert res.status_code == 200
+    return {model["id"] for model in res.body["data"] if model["meta"] is not None}
+
+
+def test_models_dir_list():
+    global server
+    server.start()
+    res = server.make_request("GET", "/v1/models")
+    assert res.status_code == 200
+    ids = [model["id"] for model in res.body["data"]]
+    assert ids[0] == server.model_alias
+    assert "model-a" in ids
+    assert "model-b" in ids
+    # the models of --models-dir are loaded on demand
+    assert get_loaded_models() == {server.model_alias}
+
+
+@pytest.mark.parametrize("model", ["model-a", "model-b"])
+def test_models_dir_routing(model: str):
+    global server
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "model": model,
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 8,
+    })
+    assert res.status_code == 200
+    assert res.body["model"] == model
+    assert res.body["tokens_predicted"] == 8
+    assert model in get_loaded_models()
+
+
+def test_models_dir_same_output_as_default():
+    global server
+    server.temperature = 0.0
+    server.start()
+    contents = []
+    for model in [None, "model-a"]:
+        data = {
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 8,
+        }
+        if model is not None:
+            data["model"] = model
+        res = server.make_request("POST", "/completion", data=data)
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+    # same weights, same output
+    assert contents[0] == contents[1]
+
+
+def test_models_dir_unknown_model():
+    global server
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "model": "does-not-exist",
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 8,
+    })
+    assert res.status_code == 404
+
+
+def test_models_dir_eviction():
+    global server
+    # room for one model only, the least recently used one is unloaded before loading the next one
+    server.models_budget = 1
+    server.start()
+    for model, loaded in [("model-a", {"model-a"}), ("model-b", {"model-b"}), ("model-a", {"model-a"})]:
+        res = server.make_request("POST", "/completion", data={
+            "model": model,
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 8,
+        })
+        assert res.status_code == 200
+        assert res.body["model"] == model
+        # the -m model is never unloaded
+        assert get_loaded_models() == {server.model_alias} | loaded
+
+
+def test_models_dir_no_eviction_without_budget():
+    global server
+    server.start()
+    for model in ["model-a", "model-b"]:
+        res = server.make_request("POST", "/completion", data={
+            "model": model,
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 8,
+        })
+        assert res.status_code == 200
+    assert get_loaded_models() == {server.model_alias, "model-a", "model-b"}
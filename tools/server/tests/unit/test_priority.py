@@ -0,0 +1,152 @@
+import pytest
+import requests
+import threading
+import time
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+PROMPT = "I believe the meaning of life is"
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_ctx = 4096
+    server.n_slots = 1
+    server.temperature = 0.0
+    server.server_metrics = True
+
+
+def start_blocking_stream(priority: int) -> requests.Response:
+    # a stream that keeps the only slot busy until the context is full, or until it is closed
+    url = f"http://{server.server_host}:{server.server_port}/completion"
+    res = requests.post(url, json={
+        "prompt": PROMPT,
+        "n_predict": -1,
+        "ignore_eos": True,
+        "priority": priority,
+        "stream": True,
+    }, stream=True)
+    assert res.status_code == 200
+    next(res.iter_lines())
+    return res
+
+
+def get_metric(name: str) -> float:
+    url = f"http://{server.server_host}:{server.server_port}/metrics"
+    res = requests.get(url)
+    assert res.status_code == 200
+    for line in res.text.splitlines():
+        if line.startswith(f"llamacpp:{name} "):
+            return float(line.split(" ")[1])
+    raise AssertionError(f"metric {name} not found")
+
+
+def test_priority_order():
+    global server
+    server.start()
+    # nothing can preempt the blocking stream, the other requests wait for it
+    blocker = start_blocking_stream(priority=2)
+
+    finished = []
+    def run(name: str, priority: int):
+        res = server.make_request("POST", "/completion", data={
+            "prompt": PROMPT,
+            "n_predict": 8,
+            "priority": priority,
+        })
+        assert res.status_code == 200
+        finished.append(name)
+
+    # the low priority request arrives first
+    threads = [
+        threading.Thread(target=run, args=("low", 0)),
+        threading.Thread(target=run, args=("high", 1)),
+    ]
+    for t in threads:
+        t.start()
+        time.sleep(0.2)
+
+    blocker.close()
+    for t in threads:
+        t.join()
+
+    assert finished == ["high", "low"]
+    assert get_metric("requests_preempted_total") == 0
+
+
+def test_preempt_restore_same_output():
+    global server
+    server.start()
+    # long enough to be still running when the second request arrives
+    data = {
+        "prompt": PROMPT,
+        "n_predict": 512,
+        "ignore_eos": True,
+        "priority": 0,
+    }
+
+    # reference, without preemption
+    res = server.make_request("POST", "/completion", data=data)
+    assert res.status_code == 200
+    content_ref = res.body["content"]
+
+    # the same request, preempted after its first tokens by a request with a higher priority
+    content = ""
+    n_events = 0
+    for chunk in server.make_stream_request("POST", "/completion", data={**data, "stream": True}):
+        content += chunk["content"]
+        n_events += 1
+        if n_events == 2:
+            res = server.make_request("POST", "/completion", data={
+                "prompt": "Once upon a time",
+                "n_predict": 8,
+                "priority": 1,
+            })
+            assert res.status_code == 200
+            assert res.body["tokens_predicted"] == 8
+
+    assert get_metric("requests_preempted_total") == 1
+    # the KV cache of the request was saved and restored, the output is unchanged
+    assert content == content_ref
+
+
+def test_max_queued_tokens():
+    global server
+    server.n_queued_tokens_max = 100
+    server.start()
+    blocker = start_blocking_stream(priority=0)
+
+    # the first waiting request is always accepted
+    results = {}
+    def run():
+        results["first"] = server.make_request("POST", "/completion", data={
+            "prompt": PROMPT,
+            "n_predict": 64,
+        })
+    t = threading.Thread(target=run)
+    t.start()
+    time.sleep(0.3)
+
+    # the second one would exceed the budget of the queue
+    res = server.make_request("POST", "/completion", data={
+        "prompt": PROMPT,
+        "n_predict": 64,
+    })
+    assert res.status_code == 503
+    assert res.body["error"]["type"] == "unavailable_error"
+    assert get_metric("requests_rejected_total") == 1
+
+    blocker.close()
+    t.join()
+    assert results["first"].status_code == 200
+    assert results["first"].body["tokens_predicted"] == 64
+
+    # the queue is empty again
+    res = server.make_request("POST", "/completion", data={
+        "prompt": PROMPT,
+        "n_predict": 64,
+    })
+    assert res.status_code == 200
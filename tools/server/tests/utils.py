@@ -90,6 +90,10 @@ class ServerProcess:
     chat_template_file: str | None = None
     server_path: str | None = None
     mmproj_url: str | None = None
+    models_dir: str | None = None
+    models_budget: int | None = None
+    n_queued_tokens_max: int | None = None
+    timeout: int | None = None
 
     # session variables
     process: subprocess.Popen | None = None
@@ -200,6 +204,14 @@ class ServerProcess:
             server_args.extend(["--chat-template-file", self.chat_template_file])
         if self.mmproj_url:
             server_args.extend(["--mmproj-url", self.mmproj_url])
+        if self.models_dir:
+            server_args.extend(["--models-dir", self.models_dir])
+        if self.models_budget is not None:
+            server_args.extend(["--models-budget", self.models_budget])
+        if self.n_queued_tokens_max is not None:
+            server_args.extend(["--max-queued-tokens", self.n_queued_tokens_max])
+        if self.timeout is not None:
+            server_args.extend(["--timeout", self.timeout])
 
         args = [str(arg) for arg in [server_path, *server_args]]
         print(f"tests: starting server with: {' '.join(args)}")
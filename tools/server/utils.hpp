@@ -517,11 +517,104 @@ static std::string tokens_to_output_formatted_string(const llama_context * ctx,
     return out;
 }
 
-static bool server_sent_event(httplib::DataSink & sink, const char * event, const json & data) {
-    const std::string str =
+// length of the UTF-8 sequence at p, 0 if it is not valid (same rules as the json parser: no overlong, no surrogates)
+static size_t utf8_seq_len(const unsigned char * p, const unsigned char * end) {
+    const size_t n = end - p;
+    const unsigned char c = p[0];
+    auto cont = [&](size_t i, unsigned char lo = 0x80, unsigned char hi = 0xBF) {
+        return i < n && p[i] >= lo && p[i] <= hi;
+    };
+
+    if (c <= 0x7F) {
+        return 1;
+    }
+    if (c >= 0xC2 && c <= 0xDF) {
+        return cont(1) ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        const unsigned char lo = c == 0xE0 ? 0xA0 : 0x80;
+        const unsigned char hi = c == 0xED ? 0x9F : 0xBF;
+        return cont(1, lo, hi) && cont(2) ? 3 : 0;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        const unsigned char lo = c == 0xF0 ? 0x90 : 0x80;
+        const unsigned char hi = c == 0xF4 ? 0x8F : 0xBF;
+        return cont(1, lo, hi) && cont(2) && cont(3) ? 4 : 0;
+    }
+    return 0;
+}
+
+// appends str as a JSON string literal, the output is the same as json(str).dump()
+// returns false if str is not valid UTF-8, out is then unchanged
+static bool json_append_string(std::string & out, const std::string & str) {
+    static const char * hex = "0123456789abcdef";
+
+    const size_t n_out = out.size();
+
+    const unsigned char * p   = (const unsigned char *) str.data();
+    const unsigned char * end = p + str.size();
+
+    out.push_back('"');
+    while (p < end) {
+        // copy the runs of characters that do not need to be escaped at once
+        const unsigned char * q = p;
+        while (q < end && *q >= 0x20 && *q < 0x80 && *q != '"' && *q != '\\') {
+            q++;
+        }
+        out.append((const char *) p, q - p);
+        p = q;
+        if (p == end) {
+            break;
+        }
+
+        const unsigned char c = *p;
+        if (c >= 0x80) {
+            const size_t len = utf8_seq_len(p, end);
+            if (len == 0) {
+                out.resize(n_out);
+                return false;
+            }
+            out.append((const char *) p, len);
+            p += len;
+            continue;
+        }
+
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b";  break;
+            case '\f': out += "\\f";  break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                {
+                    const char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                    out.append(esc, sizeof(esc));
+                } break;
+        }
+        p++;
+    }
+    out.push_back('"');
+
+    return true;
+}
+
+static void json_append_int(std::string & out, int64_t val) {
+    char buf[24];
+    const int n = snprintf(buf, sizeof(buf), "%" PRId64, val);
+    out.append(buf, n);
+}
+
+static std::string format_sse(const char * event, const json & data) {
+    return
         std::string(event) + ": " +
         data.dump(-1, ' ', false, json::error_handler_t::replace) +
         "\n\n"; // required by RFC 8895 - A message is terminated by a blank line (two line terminators in a row).
+}
+
+static bool server_sent_event(httplib::DataSink & sink, const char * event, const json & data) {
+    const std::string str = format_sse(event, data);
 
     LOG_DBG("data stream, to_send: %s", str.c_str());
 
@@ -549,8 +642,8 @@ static json oaicompat_completion_params_parse(const json & body) {
 
     // Handle "n" field
     int n_choices = json_value(body, "n", 1);
-    if (n_choices != 1) {
-        throw std::runtime_error("Only one completion choice is allowed");
+    if (n_choices < 1) {
+        throw std::runtime_error("n must be at least 1");
     }
 
     // Handle "echo" field
@@ -823,8 +916,8 @@ static json oaicompat_chat_params_parse(
 
     // Handle "n" field
     int n_choices = json_value(body, "n", 1);
-    if (n_choices != 1) {
-        throw std::runtime_error("Only one completion choice is allowed");
+    if (n_choices < 1) {
+        throw std::runtime_error("n must be at least 1");
     }
 
     // Handle "logprobs" field
@@ -851,29 +944,83 @@ static json oaicompat_chat_params_parse(
     return llama_params;
 }
 
-static json format_embeddings_response_oaicompat(const json & request, const json & embeddings, bool use_base64 = false) {
+enum embd_encoding_type {
+    EMBD_ENCODING_FLOAT,
+    EMBD_ENCODING_BASE64,     // little-endian f32
+    EMBD_ENCODING_BASE64_F16, // little-endian f16, half the size
+};
+
+static const char * embd_encoding_name(embd_encoding_type encoding) {
+    switch (encoding) {
+        case EMBD_ENCODING_BASE64:     return "base64";
+        case EMBD_ENCODING_BASE64_F16: return "base64_f16";
+        default:                       return "float";
+    }
+}
+
+// n > 1: the completions of each prompt are separate results, merged into one response with all the choices
+// the prompt tokens are counted once per prompt
+static json format_oaicompat_choices(const std::vector<json> & responses, int n_cmpl) {
+    json choices = json::array();
+    int32_t n_prompt_tokens     = 0;
+    int32_t n_completion_tokens = 0;
+
+    for (size_t i = 0; i < responses.size(); ++i) {
+        for (const auto & choice : responses[i].at("choices")) {
+            choices.push_back(choice);
+        }
+
+        const json & usage = responses[i].at("usage");
+        if (i % n_cmpl == 0) {
+            n_prompt_tokens += json_value(usage, "prompt_tokens", 0);
+        }
+        n_completion_tokens += json_value(usage, "completion_tokens", 0);
+    }
+
+    json res = responses.front();
+    res["choices"] = choices;
+    res["usage"]   = json {
+        {"completion_tokens", n_completion_tokens},
+        {"prompt_tokens",     n_prompt_tokens},
+        {"total_tokens",      n_completion_tokens + n_prompt_tokens}
+    };
+
+    return res;
+}
+
+// the embedding as a json array of floats or as a base64 string
+static json embd_to_json(const std::vector<float> & embd, embd_encoding_type encoding) {
+    switch (encoding) {
+        case EMBD_ENCODING_BASE64:
+            {
+                return base64::encode(reinterpret_cast<const char *>(embd.data()), embd.size() * sizeof(float));
+            }
+        case EMBD_ENCODING_BASE64_F16:
+            {
+                std::vector<ggml_fp16_t> embd_f16(embd.size());
+                ggml_fp32_to_fp16_row(embd.data(), embd_f16.data(), embd.size());
+                return base64::encode(reinterpret_cast<const char *>(embd_f16.data()), embd_f16.size() * sizeof(ggml_fp16_t));
+            }
+        default:
+            {
+                return embd;
+            }
+    }
+}
+
+// the embeddings are already encoded by the results
+static json format_embeddings_response_oaicompat(const json & request, const json & embeddings, embd_encoding_type encoding = EMBD_ENCODING_FLOAT) {
     json data = json::array();
     int32_t n_tokens = 0;
     int i = 0;
     for (const auto & elem : embeddings) {
-        json embedding_obj;
-
-        if (use_base64) {
-            const auto& vec = json_value(elem, "embedding", json::array()).get<std::vector<float>>();
-            const char* data_ptr = reinterpret_cast<const char*>(vec.data());
-            size_t data_size = vec.size() * sizeof(float);
-            embedding_obj = {
-                {"embedding", base64::encode(data_ptr, data_size)},
-                {"index", i++},
-                {"object", "embedding"},
-                {"encoding_format", "base64"}
-            };
-        } else {
-            embedding_obj = {
-                {"embedding", json_value(elem, "embedding", json::array())},
-                {"index", i++},
-                {"object", "embedding"}
-            };
+        json embedding_obj = {
+            {"embedding", json_value(elem, "embedding", json::array())},
+            {"index", i++},
+            {"object", "embedding"}
+        };
+        if (encoding != EMBD_ENCODING_FLOAT) {
+            embedding_obj["encoding_format"] = embd_encoding_name(encoding);
         }
         data.push_back(embedding_obj);
 
@@ -1116,6 +1263,17 @@ public:
     server_tokens(server_tokens&&) = default;
     server_tokens& operator=(server_tokens&&) = default;
 
+    // explicit copy, with copies of the media chunks
+    server_tokens clone() const {
+        server_tokens res;
+        res.has_mtmd = has_mtmd;
+        res.tokens   = tokens;
+        for (const auto & it : map_pos_to_media) {
+            res.map_pos_to_media[it.first] = mtmd::input_chunk_ptr(mtmd_input_chunk_copy(it.second.get()));
+        }
+        return res;
+    }
+
     // Allow accessing elements using [] operator
     llama_token operator[](size_t index) { return tokens[index]; }
     const llama_token& operator[](size_t index) const { return tokens[index]; }
@@ -2,6 +2,7 @@
 
 #include "arg.h"
 #include "common.h"
+#include "fft.h"
 #include "sampling.h"
 #include "log.h"
 #include "llama.h"
@@ -14,6 +15,7 @@
 #include <cstdio>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <thread>
@@ -89,28 +91,62 @@ struct wav_header {
     uint32_t data_size;
 };
 
-static bool save_wav16(const std::string & fname, const std::vector<float> & data, int sample_rate) {
-    std::ofstream file(fname, std::ios::binary);
-    if (!file) {
-        LOG_ERR("%s: Failed to open file '%s' for writing.\n", __func__, fname.c_str());
-        return false;
+// writes 16-bit mono PCM incrementally, the sizes in the header are patched when the file is closed
+struct wav_writer {
+    std::ofstream file;
+    wav_header    header;
+    uint32_t      n_samples = 0;
+
+    bool open(const std::string & fname, int sample_rate) {
+        file.open(fname, std::ios::binary);
+        if (!file) {
+            LOG_ERR("%s: Failed to open file '%s' for writing.\n", __func__, fname.c_str());
+            return false;
+        }
+
+        header.sample_rate = sample_rate;
+        header.byte_rate = header.sample_rate * header.num_channels * (header.bits_per_sample / 8);
+        header.block_align = header.num_channels * (header.bits_per_sample / 8);
+        header.data_size = 0;
+        header.chunk_size = 36;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        return file.good();
     }
 
-    wav_header header;
-    header.sample_rate = sample_rate;
-    header.byte_rate = header.sample_rate * header.num_channels * (header.bits_per_sample / 8);
-    header.block_align = header.num_channels * (header.bits_per_sample / 8);
-    header.data_size = data.size() * (header.bits_per_sample / 8);
-    header.chunk_size = 36 + header.data_size;
+    void write(const float * data, size_t n) {
+        std::vector<int16_t> pcm(n);
+        for (size_t i = 0; i < n; ++i) {
+            pcm[i] = static_cast<int16_t>(std::clamp(data[i] * 32767.0, -32768.0, 32767.0));
+        }
+        file.write(reinterpret_cast<const char*>(pcm.data()), n * sizeof(int16_t));
+        file.flush();
 
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        n_samples += n;
+    }
+
+    bool close() {
+        header.data_size = n_samples * (header.bits_per_sample / 8);
+        header.chunk_size = 36 + header.data_size;
 
-    for (const auto & sample : data) {
-        int16_t pcm_sample = static_cast<int16_t>(std::clamp(sample * 32767.0, -32768.0, 32767.0));
-        file.write(reinterpret_cast<const char*>(&pcm_sample), sizeof(pcm_sample));
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+
+        return !file.fail();
     }
+};
 
-    return file.good();
+static bool save_wav16(const std::string & fname, const std::vector<float> & data, int sample_rate) {
+    wav_writer wav;
+    if (!wav.open(fname, sample_rate)) {
+        return false;
+    }
+
+    wav.write(data.data(), data.size());
+
+    return wav.close();
 }
 
 static void fill_hann_window(int length, bool periodic, float * output) {
@@ -123,45 +159,74 @@ static void fill_hann_window(int length, bool periodic, float * output) {
     }
 }
 
-// very poor-man fft
-static void twiddle(float * real, float * imag, int k, int N) {
-    float angle = 2 * M_PI * k / N;
-    *real = cos(angle);
-    *imag = sin(angle);
-}
-
-static void irfft(int n, const float * inp_cplx, float * out_real) {
-    int N = n / 2 + 1;
+// scratch space of the inverse FFTs, one per thread
+struct fft_buffers {
+    std::vector<float> in_re;
+    std::vector<float> in_im;
+    fft_work fft;
+};
 
-    std::vector<float> real_input(N);
-    std::vector<float> imag_input(N);
-    for (int i = 0; i < N; ++i) {
-        real_input[i] = inp_cplx[2 * i];
-        imag_input[i] = inp_cplx[2 * i + 1];
+// inverse real FFT of size n, computed with a complex FFT of size n/2
+//
+// it reproduces the result of the original direct implementation:
+//   out[k] = Re(sum_{m=0}^{n/2} inp[m] * exp(2*pi*i * k*m / n)) / (n/2 + 1)
+// which is the inverse of the hermitian spectrum H[0] = Re(inp[0]), H[n/2] = Re(inp[n/2]), H[m] = inp[m]/2
+struct irfft_plan {
+    int n;
+    fft_plan half;
+
+    std::vector<float> w_re; // exp(2*pi*i * m / n), m in [0, n/2)
+    std::vector<float> w_im;
+
+    explicit irfft_plan(int n) : n(n), half(n/2) {
+        w_re.resize(n/2);
+        w_im.resize(n/2);
+        for (int m = 0; m < n/2; ++m) {
+            w_re[m] = cos(2.0*M_PI*m/n);
+            w_im[m] = sin(2.0*M_PI*m/n);
+        }
     }
 
-    std::vector<float> real_output(n);
-    std::vector<float> imag_output(n);
+    // inp_cplx holds n/2 + 1 interleaved (re, im) bins
+    void run(const float * inp_cplx, float * out_real, fft_buffers & buf) const {
+        const int M = n/2;
 
-    for (int k = 0; k < n; ++k) {
-        real_output[k] = 0.0f;
-        imag_output[k] = 0.0f;
-        for (int m = 0; m < N; ++m) {
-            float twiddle_real;
-            float twiddle_imag;
+        buf.in_re.resize(M);
+        buf.in_im.resize(M);
 
-            twiddle(&twiddle_real, &twiddle_imag, k * m, n);
+        auto h_re = [&](int m) { return (m == 0 || m == M) ? inp_cplx[2*m] : 0.5f*inp_cplx[2*m]; };
+        auto h_im = [&](int m) { return (m == 0 || m == M) ? 0.0f          : 0.5f*inp_cplx[2*m + 1]; };
 
-            real_output[k] += real_input[m] * twiddle_real - imag_input[m] * twiddle_imag;
-            imag_output[k] += real_input[m] * twiddle_imag + imag_input[m] * twiddle_real;
+        // Z[m] = E[m] + i*O[m], with E/O the spectra of the even/odd output samples
+        // the FFT input is conj(Z), so that the forward transform computes the inverse
+        for (int m = 0; m < M; ++m) {
+            const float ar = h_re(m),     ai =  h_im(m);
+            const float br = h_re(M - m), bi = -h_im(M - m);
+
+            const float er = 0.5f*(ar + br);
+            const float ei = 0.5f*(ai + bi);
+            const float dr = 0.5f*(ar - br);
+            const float di = 0.5f*(ai - bi);
+
+            const float or_ = dr*w_re[m] - di*w_im[m];
+            const float oi  = dr*w_im[m] + di*w_re[m];
+
+            buf.in_re[m] =   er - oi;
+            buf.in_im[m] = -(ei + or_);
         }
-    }
 
-    for (int i = 0; i < n; ++i) {
-        out_real[i] = real_output[i] / N;
+        half.run(buf.in_re.data(), buf.in_im.data(), 1, buf.fft);
+
+        const float scale = 2.0f/(M + 1);
+        for (int j = 0; j < M; ++j) {
+            out_real[2*j + 0] =  buf.fft.re[j]*scale;
+            out_real[2*j + 1] = -buf.fft.im[j]*scale;
+        }
     }
-}
+};
 
+//
+// incremental inverse STFT of the vocoder output, equivalent to:
 //
 //  y = torch.nn.functional.fold(
 //       data, output_size=(1, output_size), kernel_size=(1, self.win_length), stride=(1, self.hop_length),
@@ -173,111 +238,217 @@ static void irfft(int n, const float * inp_cplx, float * out_real) {
 // hop_length =  320
 // pad =  480
 //
-static void fold(const std::vector<float> & data, int64_t n_out, int64_t n_win, int64_t n_hop, int64_t n_pad, std::vector<float> & output) {
-    int64_t output_height = n_out;
-    int64_t kernel_w = n_win;
-    int64_t stride_w = n_hop;
-    int64_t width    = n_out;
-
-    output.resize(width, 0.0f);
-
-    int64_t col_idx = 0;
-    for (int64_t w_col = 0; w_col < width; ++w_col) {
-        int64_t start = w_col * stride_w - n_pad;
-        int64_t end   = start + kernel_w;
-
-        for (int64_t w_im = start; w_im < end; ++w_im) {
-            if (w_im >= 0 && w_im < output_height && col_idx < (int64_t) data.size()) {
-                output[w_im] += data[col_idx];
+// frames are added in order, each one is windowed and overlap-added together with the squared window (the envelope),
+// and samples are released as soon as no later frame overlaps them
+//
+struct istft_stream {
+    static constexpr int n_fft = 1280;
+    static constexpr int n_hop = 320;
+    static constexpr int n_win = 1280;
+    static constexpr int n_pad = (n_win - n_hop)/2;
+
+    irfft_plan irfft;
+
+    std::vector<float> hann;
+
+    // overlap-add accumulators, index 0 is the padded output sample ola_off
+    std::vector<float> ola;
+    std::vector<float> env;
+    int64_t ola_off  = 0;
+    int64_t n_frames = 0;
+
+    istft_stream() : irfft(n_fft), hann(n_fft) {
+        fill_hann_window(hann.size(), true, hann.data());
+    }
+
+    // add n frames of vocoder output: n_embd/2 log-magnitudes followed by n_embd/2 phases per frame
+    void add(const float * embd, int n, int n_embd, int n_thread) {
+        std::vector<float> res(n*n_fft);
+
+        n_thread = std::max(1, std::min(n_thread, n));
+
+        std::vector<std::thread> workers(n_thread);
+        for (int i = 0; i < n_thread; ++i) {
+            workers[i] = std::thread([&, i]() {
+                fft_buffers buf;
+                std::vector<float> spec(n_embd);
+                for (int l = i; l < n; l += n_thread) {
+                    const float * e = embd + l*n_embd;
+                    for (int k = 0; k < n_embd/2; ++k) {
+                        float mag = e[k];
+                        float phi = e[k + n_embd/2];
+
+                        mag = exp(mag);
+
+                        if (mag > 1e2) {
+                            mag = 1e2;
+                        }
+                        spec[2*k + 0] = mag*cosf(phi);
+                        spec[2*k + 1] = mag*sinf(phi);
+                    }
+
+                    float * out = res.data() + l*n_fft;
+                    irfft.run(spec.data(), out, buf);
+                    for (int j = 0; j < n_fft; ++j) {
+                        out[j] *= hann[j];
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < n_thread; ++i) {
+            workers[i].join();
+        }
+
+        const size_t n_ola = (n_frames + n - 1)*n_hop + n_win - ola_off;
+        ola.resize(n_ola, 0.0f);
+        env.resize(n_ola, 0.0f);
+
+        for (int l = 0; l < n; ++l) {
+            const int64_t start = (n_frames + l)*n_hop - ola_off;
+            for (int j = 0; j < n_win; ++j) {
+                ola[start + j] += res[l*n_fft + j];
+                env[start + j] += hann[j]*hann[j];
             }
-            col_idx++;
         }
+
+        n_frames += n;
     }
 
-    output.resize(n_out - 2 * n_pad);
-}
+    // append the completed samples to out, on the last call all the remaining ones
+    void flush(std::vector<float> & out, bool last) {
+        if (n_frames == 0) {
+            return;
+        }
+
+        const int64_t end = last ? (n_frames - 1)*n_hop + n_win - n_pad : n_frames*n_hop;
+        if (end <= ola_off) {
+            return;
+        }
+
+        for (int64_t i = std::max<int64_t>(ola_off, n_pad); i < end; ++i) {
+            out.push_back(ola[i - ola_off] / env[i - ola_off]);
+        }
+
+        ola.erase(ola.begin(), ola.begin() + (end - ola_off));
+        env.erase(env.begin(), env.begin() + (end - ola_off));
+        ola_off = end;
+    }
+};
 
-// TODO: not optimized at all
 static std::vector<float> embd_to_audio(
         const float * embd,
         const int n_codes,
         const int n_embd,
         const int n_thread) {
-    const int n_fft = 1280;
-    const int n_hop = 320;
-    const int n_win = 1280;
-    const int n_pad = (n_win - n_hop)/2;
-    const int n_out = (n_codes - 1)*n_hop + n_win;
+    istft_stream istft;
+    istft.add(embd, n_codes, n_embd, n_thread);
 
-    std::vector<float> hann(n_fft);
+    std::vector<float> audio;
+    istft.flush(audio, true);
 
-    fill_hann_window(hann.size(), true, hann.data());
+    return audio;
+}
 
-    int n_spec = n_embd*n_codes;
+// streaming synthesis: the vocoder runs on windows of n_chunk codes while the codes are still being generated and
+// the audio of each window is appended to the output file as soon as the inverse STFT completes it
+// the vocoder is not causal, so each window is decoded with n_ctx extra codes of context on both sides
+struct tts_stream {
+    static constexpr int n_ctx = 16;
 
-    std::vector<float> E (n_spec);
-    std::vector<float> S (n_spec);
-    std::vector<float> ST(n_spec);
+    llama_context * ctx_cts;
 
-    for (int l = 0; l < n_codes; ++l) {
-        for (int k = 0; k < n_embd; ++k) {
-            E[k*n_codes + l] = embd[l*n_embd + k];
-        }
-    }
+    const int n_chunk;
+    const int n_embd;
+    const int n_thread;
+    const int n_sr;
 
-    for (int k = 0; k < n_embd/2; ++k) {
-        for (int l = 0; l < n_codes; ++l) {
-            float mag = E[(k           )*n_codes + l];
-            float phi = E[(k + n_embd/2)*n_codes + l];
+    istft_stream istft;
+    wav_writer   wav;
+    llama_batch  batch;
 
-            mag = exp(mag);
+    std::vector<llama_token> codes; // audio codes, relative to the first audio token
+    int     n_done    = 0;          // codes already decoded
+    int64_t n_written = 0;          // samples already written
 
-            if (mag > 1e2) {
-                mag = 1e2;
-            }
-            S[2*(k*n_codes + l) + 0] = mag*cosf(phi);
-            S[2*(k*n_codes + l) + 1] = mag*sinf(phi);
+    const int64_t t_start_us;
+
+    tts_stream(llama_context * ctx_cts, int n_chunk, int n_embd, int n_thread, int n_sr) :
+        ctx_cts(ctx_cts), n_chunk(n_chunk), n_embd(n_embd), n_thread(n_thread), n_sr(n_sr),
+        batch(llama_batch_init(n_chunk + 2*n_ctx, 0, 1)),
+        t_start_us(ggml_time_us()) {}
+
+    ~tts_stream() {
+        llama_batch_free(batch);
+    }
+
+    // add a generated token, everything that is not an audio code is ignored
+    bool add(llama_token token) {
+        if (token < 151672 || token > 155772) {
+            return true;
         }
+        codes.push_back(token - 151672);
+
+        if ((int) codes.size() >= n_done + n_chunk + n_ctx) {
+            return decode(n_done + n_chunk, false);
+        }
+
+        return true;
     }
 
-    for (int l = 0; l < n_codes; ++l) {
-        for (int k = 0; k < n_embd/2; ++k) {
-            ST[l*n_embd + 2*k + 0] = S[2*(k*n_codes + l) + 0];
-            ST[l*n_embd + 2*k + 1] = S[2*(k*n_codes + l) + 1];
+    bool finish() {
+        if (!decode(codes.size(), true)) {
+            return false;
         }
+
+        LOG_INF("%s: audio length: %.3f s\n", __func__, (float) n_written / n_sr);
+
+        return wav.close();
     }
 
-    std::vector<float> res  (n_codes*n_fft);
-    std::vector<float> hann2(n_codes*n_fft);
-
-    std::vector<std::thread> workers(n_thread);
-    for (int i = 0; i < n_thread; ++i) {
-        workers[i] = std::thread([&, i]() {
-            for (int l = i; l < n_codes; l += n_thread) {
-                irfft(n_fft, ST.data() + l*n_embd, res.data() + l*n_fft);
-                for (int j = 0; j < n_fft; ++j) {
-                    res  [l*n_fft + j] *= hann[j];
-                    hann2[l*n_fft + j]  = hann[j] * hann[j];
-                }
+private:
+    // decode codes [n_done, i_end) and write the completed audio
+    bool decode(int i_end, bool last) {
+        if (i_end > n_done) {
+            const int w0 = std::max(0, n_done - n_ctx);
+            const int w1 = std::min((int) codes.size(), i_end + n_ctx);
+
+            common_batch_clear(batch);
+            for (int i = w0; i < w1; ++i) {
+                common_batch_add(batch, codes[i], i - w0, { 0 }, true);
             }
-        });
-    }
-    for (int i = 0; i < n_thread; ++i) {
-        workers[i].join();
-    }
 
-    std::vector<float> audio;
-    std::vector<float> env;
+            if (llama_encode(ctx_cts, batch) != 0) {
+                LOG_ERR("%s: llama_encode() failed\n", __func__);
+                return false;
+            }
 
-    fold(res,   n_out, n_win, n_hop, n_pad, audio);
-    fold(hann2, n_out, n_win, n_hop, n_pad, env); // TODO: can be done once
+            llama_synchronize(ctx_cts);
 
-    for (size_t i = 0; i < audio.size(); ++i) {
-        audio[i] /= env[i];
-    }
+            const float * embd = llama_get_embeddings(ctx_cts);
 
-    return audio;
-}
+            istft.add(embd + (n_done - w0)*n_embd, i_end - n_done, n_embd, n_thread);
+            n_done = i_end;
+        }
+
+        std::vector<float> audio;
+        istft.flush(audio, last);
+
+        // zero out first 0.25 seconds
+        for (size_t i = 0; i < audio.size() && n_written + (int64_t) i < n_sr/4; ++i) {
+            audio[i] = 0.0f;
+        }
+
+        if (!audio.empty()) {
+            if (n_written == 0) {
+                LOG_INF("%s: time to first audio: %.3f ms\n", __func__, (ggml_time_us() - t_start_us) / 1000.0f);
+            }
+            wav.write(audio.data(), audio.size());
+            n_written += audio.size();
+        }
+
+        return true;
+    }
+};
 
 static const std::map<int, std::string> ones = {
     {0, "zero"}, {1, "one"}, {2, "two"}, {3, "three"}, {4, "four"},
@@ -555,6 +726,12 @@ int main(int argc, char ** argv) {
     const int n_parallel = params.n_parallel;
     const int n_predict  = params.n_predict;
 
+    bool stream = params.vocoder.stream_chunk > 0;
+    if (stream && n_parallel > 1) {
+        LOG_WRN("%s: audio streaming is not supported with n_parallel > 1, disabling\n", __func__);
+        stream = false;
+    }
+
     common_init();
 
     // init LLM
@@ -609,6 +786,16 @@ int main(int argc, char ** argv) {
 
     const auto t_main_start = ggml_time_us();
 
+    const int n_sr = 24000; // sampling rate
+
+    std::unique_ptr<tts_stream> streamer;
+    if (stream) {
+        streamer = std::make_unique<tts_stream>(ctx_cts, params.vocoder.stream_chunk, llama_model_n_embd(model_cts), params.cpuparams.n_threads, n_sr);
+        if (!streamer->wav.open(params.out_file, n_sr)) {
+            return ENOENT;
+        }
+    }
+
     std::vector<llama_token> codes;
     std::vector<llama_token> guide_tokens;
 
@@ -896,6 +1083,10 @@ lovely<|t_0.56|><|code_start|><|634|><|596|><|1766|><|1556|><|1306|><|1285|><|14
 
                 codes.push_back(new_token_id);
 
+                if (streamer && !streamer->add(new_token_id)) {
+                    return 1;
+                }
+
                 const auto * cands = common_sampler_get_candidates(smpl[i]);
 
                 // is it an end of generation? -> mark the stream as finished
@@ -1000,6 +1191,25 @@ lovely<|t_0.56|><|code_start|><|634|><|596|><|1766|><|1556|><|1306|><|1285|><|14
         LOG_INF("%s: codes size: %d\n", __func__, (int) codes.size());
     }
 
+    if (streamer) {
+        const auto t_voc_start = ggml_time_us();
+
+        if (!streamer->finish()) {
+            LOG_ERR("%s: failed to write audio to file '%s'\n", __func__, params.out_file.c_str());
+            return ENOENT;
+        }
+
+        LOG_INF("%s: time for last chunk:   %.3f ms\n", __func__, (ggml_time_us() - t_voc_start) / 1000.0f);
+        LOG_INF("%s: total time:            %.3f ms\n", __func__, (ggml_time_us() - t_main_start) / 1000.0f);
+        LOG_INF("%s: audio written to file '%s'\n", __func__, params.out_file.c_str());
+
+        streamer.reset();
+
+        llama_backend_free();
+
+        return 0;
+    }
+
     // remove all non-audio tokens (i.e. < 151672 || > 155772)
     codes.erase(std::remove_if(codes.begin(), codes.end(), [](llama_token t) { return t < 151672 || t > 155772; }), codes.end());
 
@@ -1070,8 +1280,6 @@ lovely<|t_0.56|><|code_start|><|634|><|596|><|1766|><|1556|><|1306|><|1285|><|14
     }
 #endif
 
-    const int n_sr = 24000; // sampling rate
-
     // zero out first 0.25 seconds
     for (int i = 0; i < 24000/4; ++i) {
         audio[i] = 0.0f;